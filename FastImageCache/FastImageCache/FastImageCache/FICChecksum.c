@@ -0,0 +1,184 @@
+//
+//  FICChecksum.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICChecksum.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// The hardware functions are compiled for the CRC instructions whatever the compiler targets, and only called once the CPU is known to have them
+#if (defined(__aarch64__) || defined(__arm64__)) && (defined(__clang__) || defined(__GNUC__))
+#include <arm_acle.h>
+#define FIC_CHECKSUM_ARM_CRC32 1
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || defined(__GNUC__))
+#include <nmmintrin.h>
+#define FIC_CHECKSUM_SSE42 1
+#endif
+
+#pragma mark Internal Definitions
+
+typedef uint32_t (*FICChecksumFunction)(uint32_t crc, const uint8_t *byte, size_t length);
+
+// The Castagnoli polynomial, bit-reversed
+#define FICChecksumPolynomial 0x82f63b78u
+
+// Table k holds the checksum of each byte followed by k zero bytes, so 8 bytes can be folded in with 8 independent lookups
+static uint32_t FICChecksumTables[8][256];
+static pthread_once_t FICChecksumTablesOnce = PTHREAD_ONCE_INIT;
+
+static FICChecksumFunction FICChecksumSelectedFunction;
+static pthread_once_t FICChecksumSelectedFunctionOnce = PTHREAD_ONCE_INIT;
+
+static void _FICChecksumFillTables(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (FICChecksumPolynomial & (0u - (crc & 1)));
+        }
+        FICChecksumTables[0][byte] = crc;
+    }
+
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t crc = FICChecksumTables[k - 1][byte];
+            FICChecksumTables[k][byte] = (crc >> 8) ^ FICChecksumTables[0][crc & 0xff];
+        }
+    }
+}
+
+#pragma mark - Computing Checksums with Tables
+
+static uint32_t _FICChecksumCRC32CTable(uint32_t crc, const uint8_t *byte, size_t length) {
+    pthread_once(&FICChecksumTablesOnce, _FICChecksumFillTables);
+
+    // Words are read in little-endian order, which is what the tables expect on every platform the library runs on
+    for (; length >= 8; length -= 8, byte += 8) {
+        uint32_t low, high;
+        memcpy(&low, byte, sizeof(low));
+        memcpy(&high, byte + 4, sizeof(high));
+        low ^= crc;
+        crc = FICChecksumTables[7][low & 0xff] ^ FICChecksumTables[6][(low >> 8) & 0xff] ^ FICChecksumTables[5][(low >> 16) & 0xff] ^ FICChecksumTables[4][low >> 24] ^
+              FICChecksumTables[3][high & 0xff] ^ FICChecksumTables[2][(high >> 8) & 0xff] ^ FICChecksumTables[1][(high >> 16) & 0xff] ^ FICChecksumTables[0][high >> 24];
+    }
+    for (; length > 0; length--, byte++) {
+        crc = (crc >> 8) ^ FICChecksumTables[0][(crc ^ *byte) & 0xff];
+    }
+
+    return crc;
+}
+
+#pragma mark - Computing Checksums with CRC Instructions
+
+#if FIC_CHECKSUM_ARM_CRC32
+
+__attribute__((target("crc")))
+static uint32_t _FICChecksumCRC32CHardware(uint32_t crc, const uint8_t *byte, size_t length) {
+    for (; length >= 8; length -= 8, byte += 8) {
+        uint64_t word;
+        memcpy(&word, byte, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; length > 0; length--, byte++) {
+        crc = __crc32cb(crc, *byte);
+    }
+
+    return crc;
+}
+
+// The A7 and other early ARMv8 CPUs don't have the CRC32 instructions, which only became required in ARMv8.1
+static bool _FICChecksumHardwareIsAvailable(void) {
+#if defined(__ARM_FEATURE_CRC32)
+    return true;
+#elif defined(__APPLE__)
+    int hasCRC32 = 0;
+    size_t length = sizeof(hasCRC32);
+    return sysctlbyname("hw.optional.armv8_crc32", &hasCRC32, &length, NULL, 0) == 0 && hasCRC32 != 0;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+#elif FIC_CHECKSUM_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t _FICChecksumCRC32CHardware(uint32_t crc, const uint8_t *byte, size_t length) {
+#if defined(__x86_64__)
+    for (; length >= 8; length -= 8, byte += 8) {
+        uint64_t word;
+        memcpy(&word, byte, sizeof(word));
+        crc = (uint32_t)_mm_crc32_u64(crc, word);
+    }
+#endif
+    for (; length >= 4; length -= 4, byte += 4) {
+        uint32_t word;
+        memcpy(&word, byte, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; length > 0; length--, byte++) {
+        crc = _mm_crc32_u8(crc, *byte);
+    }
+
+    return crc;
+}
+
+static bool _FICChecksumHardwareIsAvailable(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+static bool _FICChecksumHardwareIsAvailable(void) {
+    return false;
+}
+
+#endif
+
+#pragma mark - Choosing an Implementation
+
+static FICChecksumFunction _FICChecksumFunction(FICChecksumImplementation implementation) {
+#if FIC_CHECKSUM_ARM_CRC32 || FIC_CHECKSUM_SSE42
+    if (implementation == FICChecksumImplementationHardware) {
+        return _FICChecksumHardwareIsAvailable() ? _FICChecksumCRC32CHardware : NULL;
+    }
+#endif
+
+    return implementation == FICChecksumImplementationTable ? _FICChecksumCRC32CTable : NULL;
+}
+
+static void _FICChecksumSelectFunction(void) {
+    FICChecksumFunction function = _FICChecksumFunction(FICChecksumImplementationHardware);
+    FICChecksumSelectedFunction = function != NULL ? function : _FICChecksumCRC32CTable;
+}
+
+bool FICChecksumImplementationIsAvailable(FICChecksumImplementation implementation) {
+    return _FICChecksumFunction(implementation) != NULL;
+}
+
+uint32_t FICChecksumCRC32CWithImplementation(FICChecksumImplementation implementation, uint32_t crc, const void *bytes, size_t length) {
+    FICChecksumFunction function = _FICChecksumFunction(implementation);
+    if (function == NULL) {
+        function = _FICChecksumCRC32CTable;
+    }
+
+    return ~function(~crc, bytes, length);
+}
+
+uint32_t FICChecksumCRC32C(uint32_t crc, const void *bytes, size_t length) {
+    // The CPU is checked once, since checking it on Apple platforms is a system call
+    pthread_once(&FICChecksumSelectedFunctionOnce, _FICChecksumSelectFunction);
+
+    return ~FICChecksumSelectedFunction(~crc, bytes, length);
+}
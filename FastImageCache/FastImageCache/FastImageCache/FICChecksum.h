@@ -0,0 +1,56 @@
+//
+//  FICChecksum.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICChecksum_h
+#define FICChecksum_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Computes the CRC-32C (Castagnoli) checksum of data, used to detect image data that was torn or damaged on disk.
+
+ @param crc The checksum of the data that comes before this data, or 0 to start a new checksum. Checksumming data in pieces gives the same result as checksumming it all at once.
+
+ @return The checksum of all of the data so far.
+
+ @discussion The checksum is computed 8 bytes at a time with the CRC32 instructions of ARMv8 or SSE 4.2 when the CPU has them, and with 8 lookup tables otherwise. The CPU is
+ checked the first time a checksum is computed, so builds that target CPUs without the instructions still use them where they're available.
+ */
+uint32_t FICChecksumCRC32C(uint32_t crc, const void *bytes, size_t length);
+
+/**
+ The ways a checksum can be computed.
+ */
+typedef enum {
+    FICChecksumImplementationTable = 0,     // 8 lookup tables, available everywhere
+    FICChecksumImplementationHardware,      // The CRC32 instructions of ARMv8 or SSE 4.2
+} FICChecksumImplementation;
+
+/**
+ Returns whether checksums can be computed with an implementation on this CPU.
+ */
+bool FICChecksumImplementationIsAvailable(FICChecksumImplementation implementation);
+
+/**
+ Computes a checksum like `<FICChecksumCRC32C>`, but with a given implementation, so implementations can be compared with each other.
+
+ @discussion Falls back to the lookup tables if the implementation isn't available.
+ */
+uint32_t FICChecksumCRC32CWithImplementation(FICChecksumImplementation implementation, uint32_t crc, const void *bytes, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,440 @@
+//
+//  FICColdStore.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICColdStore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+// Values are stored in host byte order. Cold stores live in the caches directory of the device that wrote them.
+static const uint8_t FICColdStoreMagic[4] = { 'F', 'I', 'C', 'C' };
+static const uint8_t FICColdStoreRecordMagic[4] = { 'F', 'I', 'C', 'R' };
+static const uint32_t FICColdStoreVersion = 1;
+
+#define FICColdStoreHeaderLength 32
+#define FICColdStoreRecordHeaderLength 64
+
+// Records start on 16-byte boundaries, which is also the step used to search for the next record past damaged data
+#define FICColdStoreRecordAlignment 16
+
+#define FICColdStoreMinimumRecordCapacity 64
+
+static uint32_t _FICColdStoreChecksum(uint32_t hash, const void *bytes, size_t length) {
+    // 32-bit FNV-1a
+    const uint8_t *byte = bytes;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= byte[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define FICColdStoreChecksumSeed 2166136261u
+
+static inline size_t _FICColdStoreRecordLength(size_t payloadLength) {
+    size_t length = FICColdStoreRecordHeaderLength + payloadLength;
+    return (length + FICColdStoreRecordAlignment - 1) & ~(size_t)(FICColdStoreRecordAlignment - 1);
+}
+
+static void _FICColdStoreEncodeHeader(const FICColdStore *store, uint8_t *bytes) {
+    memset(bytes, 0, FICColdStoreHeaderLength);
+    memcpy(bytes, FICColdStoreMagic, sizeof(FICColdStoreMagic));
+    memcpy(bytes + 4, &FICColdStoreVersion, sizeof(uint32_t));
+    memcpy(bytes + 8, &store->imageLength, sizeof(uint32_t));
+    memcpy(bytes + 12, &store->formatChecksum, sizeof(uint32_t));
+
+    uint32_t checksum = _FICColdStoreChecksum(FICColdStoreChecksumSeed, bytes, FICColdStoreHeaderLength - sizeof(uint32_t));
+    memcpy(bytes + FICColdStoreHeaderLength - sizeof(uint32_t), &checksum, sizeof(uint32_t));
+}
+
+static void _FICColdStoreEncodeRecordHeader(const FICColdStoreRecord *record, uint8_t *bytes) {
+    memset(bytes, 0, FICColdStoreRecordHeaderLength);
+    memcpy(bytes, FICColdStoreRecordMagic, sizeof(FICColdStoreRecordMagic));
+    memcpy(bytes + 4, &record->payloadLength, sizeof(uint32_t));
+    memcpy(bytes + 8, &record->sequence, sizeof(uint64_t));
+    memcpy(bytes + 16, record->entityUUIDBytes, 16);
+    memcpy(bytes + 32, record->sourceImageUUIDBytes, 16);
+    memcpy(bytes + 48, &record->payloadChecksum, sizeof(uint32_t));
+
+    uint32_t checksum = _FICColdStoreChecksum(FICColdStoreChecksumSeed, bytes, FICColdStoreRecordHeaderLength - sizeof(uint32_t));
+    memcpy(bytes + FICColdStoreRecordHeaderLength - sizeof(uint32_t), &checksum, sizeof(uint32_t));
+}
+
+static bool _FICColdStoreDecodeRecordHeader(const uint8_t *bytes, FICColdStoreRecord *record) {
+    if (memcmp(bytes, FICColdStoreRecordMagic, sizeof(FICColdStoreRecordMagic)) != 0) {
+        return false;
+    }
+
+    uint32_t checksum;
+    memcpy(&checksum, bytes + FICColdStoreRecordHeaderLength - sizeof(uint32_t), sizeof(uint32_t));
+    if (checksum != _FICColdStoreChecksum(FICColdStoreChecksumSeed, bytes, FICColdStoreRecordHeaderLength - sizeof(uint32_t))) {
+        return false;
+    }
+
+    memcpy(&record->payloadLength, bytes + 4, sizeof(uint32_t));
+    memcpy(&record->sequence, bytes + 8, sizeof(uint64_t));
+    memcpy(record->entityUUIDBytes, bytes + 16, 16);
+    memcpy(record->sourceImageUUIDBytes, bytes + 32, 16);
+    memcpy(&record->payloadChecksum, bytes + 48, sizeof(uint32_t));
+    record->length = (uint32_t)_FICColdStoreRecordLength(record->payloadLength);
+    record->live = false;
+
+    return true;
+}
+
+static bool _FICColdStoreWriteFully(int fileDescriptor, const void *bytes, size_t length, off_t offset) {
+    const uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t written = pwrite(fileDescriptor, cursor, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        cursor += written;
+        offset += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static bool _FICColdStoreReadFully(int fileDescriptor, void *bytes, size_t length, off_t offset) {
+    uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t bytesRead = pread(fileDescriptor, cursor, length, offset);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        cursor += bytesRead;
+        offset += bytesRead;
+        length -= (size_t)bytesRead;
+    }
+    return true;
+}
+
+// Overwrites a record's magic, so the record is skipped the next time the log is scanned
+static void _FICColdStoreInvalidateRecord(FICColdStore *store, const FICColdStoreRecord *record) {
+    static const uint8_t invalidMagic[4] = { 0, 0, 0, 0 };
+    _FICColdStoreWriteFully(store->fileDescriptor, invalidMagic, sizeof(invalidMagic), (off_t)record->offset);
+}
+
+static void _FICColdStoreRebuildIndex(FICColdStore *store) {
+    FICEntryIndexRemoveAll(&store->index);
+    for (size_t i = store->firstRecord; i < store->recordEnd; i++) {
+        FICColdStoreRecord *record = &store->records[i];
+        if (record->live && FICEntryIndexSet(&store->index, record->entityUUIDBytes, record->sourceImageUUIDBytes, (uint32_t)i) == false) {
+            record->live = false;
+        }
+    }
+}
+
+static bool _FICColdStoreEnsureRecordCapacity(FICColdStore *store) {
+    if (store->recordEnd < store->recordCapacity) {
+        return true;
+    }
+
+    size_t count = store->recordEnd - store->firstRecord;
+    if (store->firstRecord > 0 && count <= store->recordCapacity / 2) {
+        // Most of the array is records that have already been dropped, so the rest move down instead of the array growing. The index refers to records by position, so it has to be rebuilt.
+        memmove(store->records, store->records + store->firstRecord, count * sizeof(FICColdStoreRecord));
+    } else {
+        size_t newRecordCapacity = store->recordCapacity > 0 ? store->recordCapacity * 2 : FICColdStoreMinimumRecordCapacity;
+        FICColdStoreRecord *records = realloc(store->records, newRecordCapacity * sizeof(FICColdStoreRecord));
+        if (records == NULL) {
+            return false;
+        }
+        store->records = records;
+        store->recordCapacity = newRecordCapacity;
+
+        if (store->firstRecord == 0) {
+            return true;
+        }
+        memmove(store->records, store->records + store->firstRecord, count * sizeof(FICColdStoreRecord));
+    }
+
+    store->firstRecord = 0;
+    store->recordEnd = count;
+    _FICColdStoreRebuildIndex(store);
+
+    return true;
+}
+
+static void _FICColdStoreDropFirstRecord(FICColdStore *store) {
+    FICColdStoreRecord *record = &store->records[store->firstRecord];
+    if (record->live) {
+        // The record that replaces it doesn't necessarily cover its header, since the padding after a record is never written
+        _FICColdStoreInvalidateRecord(store, record);
+        FICEntryIndexRemove(&store->index, record->entityUUIDBytes);
+    }
+    store->firstRecord++;
+}
+
+static void _FICColdStoreRemoveRecordAtPosition(FICColdStore *store, size_t position) {
+    FICColdStoreRecord *record = &store->records[position];
+    _FICColdStoreInvalidateRecord(store, record);
+    record->live = false;
+    FICEntryIndexRemove(&store->index, record->entityUUIDBytes);
+}
+
+static void _FICColdStoreResetRecords(FICColdStore *store) {
+    store->firstRecord = 0;
+    store->recordEnd = 0;
+    store->head = FICColdStoreHeaderLength;
+    store->nextSequence = 1;
+    FICEntryIndexRemoveAll(&store->index);
+}
+
+static bool _FICColdStoreStartNewLog(FICColdStore *store) {
+    _FICColdStoreResetRecords(store);
+
+    uint8_t header[FICColdStoreHeaderLength];
+    _FICColdStoreEncodeHeader(store, header);
+
+    return ftruncate(store->fileDescriptor, 0) == 0 && _FICColdStoreWriteFully(store->fileDescriptor, header, sizeof(header), 0);
+}
+
+static int _FICColdStoreCompareRecordSequences(const void *first, const void *second) {
+    uint64_t firstSequence = ((const FICColdStoreRecord *)first)->sequence;
+    uint64_t secondSequence = ((const FICColdStoreRecord *)second)->sequence;
+    return firstSequence < secondSequence ? -1 : (firstSequence > secondSequence ? 1 : 0);
+}
+
+static bool _FICColdStoreScan(FICColdStore *store, const uint8_t *bytes, size_t length) {
+    size_t offset = FICColdStoreHeaderLength;
+    while (offset + FICColdStoreRecordHeaderLength <= length) {
+        FICColdStoreRecord record;
+        // The padding after the last record in the file is never written, so only its header and data have to fit
+        if (_FICColdStoreDecodeRecordHeader(bytes + offset, &record) == false || record.payloadLength > length - offset - FICColdStoreRecordHeaderLength) {
+            offset += FICColdStoreRecordAlignment;
+            continue;
+        }
+
+        if (_FICColdStoreEnsureRecordCapacity(store) == false) {
+            return false;
+        }
+        record.offset = offset;
+        store->records[store->recordEnd++] = record;
+        offset += record.length;
+    }
+
+    // Records were appended in sequence order, wrapping around the file, so sorting by sequence puts them back in the order they were written: oldest first
+    qsort(store->records, store->recordEnd, sizeof(FICColdStoreRecord), _FICColdStoreCompareRecordSequences);
+
+    for (size_t i = 0; i < store->recordEnd; i++) {
+        FICColdStoreRecord *record = &store->records[i];
+
+        // An entity should only have one valid record on disk, unless a crash struck between writing a new record and invalidating the previous one
+        const FICEntryIndexEntry *entry = FICEntryIndexFind(&store->index, record->entityUUIDBytes);
+        if (entry != NULL) {
+            _FICColdStoreRemoveRecordAtPosition(store, entry->slot);
+        }
+
+        record->live = FICEntryIndexSet(&store->index, record->entityUUIDBytes, record->sourceImageUUIDBytes, (uint32_t)i);
+    }
+
+    if (store->recordEnd > 0) {
+        const FICColdStoreRecord *newestRecord = &store->records[store->recordEnd - 1];
+        store->head = (size_t)newestRecord->offset + newestRecord->length;
+        store->nextSequence = newestRecord->sequence + 1;
+    }
+
+    return true;
+}
+
+#pragma mark - Store Lifecycle
+
+void FICColdStoreInit(FICColdStore *store, const char *path, size_t capacity, uint32_t imageLength, uint32_t formatChecksum) {
+    memset(store, 0, sizeof(FICColdStore));
+    store->fileDescriptor = -1;
+    store->path = strdup(path);
+    store->capacity = capacity;
+    store->imageLength = imageLength;
+    store->formatChecksum = formatChecksum;
+    FICEntryIndexInit(&store->index);
+    _FICColdStoreResetRecords(store);
+}
+
+void FICColdStoreDestroy(FICColdStore *store) {
+    if (store->fileDescriptor >= 0) {
+        close(store->fileDescriptor);
+        store->fileDescriptor = -1;
+    }
+    free(store->path);
+    free(store->records);
+    FICEntryIndexDestroy(&store->index);
+    memset(store, 0, sizeof(FICColdStore));
+    store->fileDescriptor = -1;
+}
+
+bool FICColdStoreOpen(FICColdStore *store) {
+    if (store->fileDescriptor >= 0) {
+        close(store->fileDescriptor);
+    }
+    _FICColdStoreResetRecords(store);
+
+    store->fileDescriptor = open(store->path, O_RDWR | O_CREAT, 0666);
+    if (store->fileDescriptor < 0) {
+        return false;
+    }
+
+    struct stat fileStatus;
+    if (fstat(store->fileDescriptor, &fileStatus) != 0) {
+        close(store->fileDescriptor);
+        store->fileDescriptor = -1;
+        return false;
+    }
+
+    size_t length = (size_t)fileStatus.st_size;
+    bool isValid = false;
+    if (length >= FICColdStoreHeaderLength && length <= store->capacity) {
+        uint8_t *bytes = mmap(NULL, length, PROT_READ, MAP_SHARED, store->fileDescriptor, 0);
+        if (bytes != MAP_FAILED) {
+            uint8_t expectedHeader[FICColdStoreHeaderLength];
+            _FICColdStoreEncodeHeader(store, expectedHeader);
+            isValid = memcmp(bytes, expectedHeader, FICColdStoreHeaderLength) == 0 && _FICColdStoreScan(store, bytes, length);
+            munmap(bytes, length);
+        }
+    }
+
+    if (isValid == false && _FICColdStoreStartNewLog(store) == false) {
+        close(store->fileDescriptor);
+        store->fileDescriptor = -1;
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t FICColdStoreFormatChecksum(const void *bytes, size_t length) {
+    return _FICColdStoreChecksum(FICColdStoreChecksumSeed, bytes, length);
+}
+
+#pragma mark - Reading Records
+
+size_t FICColdStoreCount(const FICColdStore *store) {
+    return store->index.count;
+}
+
+size_t FICColdStorePayloadLength(const FICColdStore *store, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&store->index, entityUUIDBytes);
+    if (entry == NULL || memcmp(entry->sourceImageUUIDBytes, sourceImageUUIDBytes, 16) != 0) {
+        return 0;
+    }
+
+    return store->records[entry->slot].payloadLength;
+}
+
+bool FICColdStoreRead(FICColdStore *store, const uint8_t entityUUIDBytes[16], void *buffer, size_t length) {
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&store->index, entityUUIDBytes);
+    if (entry == NULL || store->fileDescriptor < 0) {
+        return false;
+    }
+
+    size_t position = entry->slot;
+    const FICColdStoreRecord *record = &store->records[position];
+    if (length != record->payloadLength) {
+        return false;
+    }
+
+    bool success = _FICColdStoreReadFully(store->fileDescriptor, buffer, length, (off_t)(record->offset + FICColdStoreRecordHeaderLength))
+        && _FICColdStoreChecksum(FICColdStoreChecksumSeed, buffer, length) == record->payloadChecksum;
+    if (success == false) {
+        _FICColdStoreRemoveRecordAtPosition(store, position);
+    }
+
+    return success;
+}
+
+#pragma mark - Modifying the Store
+
+bool FICColdStoreAppend(FICColdStore *store, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], const void *payload, size_t payloadLength) {
+    size_t length = _FICColdStoreRecordLength(payloadLength);
+    if (store->fileDescriptor < 0 || store->capacity < FICColdStoreHeaderLength || length > store->capacity - FICColdStoreHeaderLength || payloadLength > UINT32_MAX) {
+        return false;
+    }
+
+    FICColdStoreRemove(store, entityUUIDBytes);
+
+    if (store->head + length > store->capacity) {
+        // Wrap around. The records past the head are the oldest ones, so they are dropped and cut off the end of the file.
+        while (store->firstRecord < store->recordEnd && store->records[store->firstRecord].offset >= store->head) {
+            _FICColdStoreDropFirstRecord(store);
+        }
+        ftruncate(store->fileDescriptor, (off_t)store->head);
+        store->head = FICColdStoreHeaderLength;
+    }
+
+    // Drop the oldest records that the new one overwrites
+    while (store->firstRecord < store->recordEnd) {
+        const FICColdStoreRecord *oldestRecord = &store->records[store->firstRecord];
+        if (oldestRecord->offset < store->head || oldestRecord->offset >= store->head + length) {
+            break;
+        }
+        _FICColdStoreDropFirstRecord(store);
+    }
+
+    if (_FICColdStoreEnsureRecordCapacity(store) == false) {
+        return false;
+    }
+
+    FICColdStoreRecord record;
+    record.offset = store->head;
+    record.sequence = store->nextSequence;
+    record.length = (uint32_t)length;
+    record.payloadLength = (uint32_t)payloadLength;
+    record.payloadChecksum = _FICColdStoreChecksum(FICColdStoreChecksumSeed, payload, payloadLength);
+    memcpy(record.entityUUIDBytes, entityUUIDBytes, 16);
+    memcpy(record.sourceImageUUIDBytes, sourceImageUUIDBytes, 16);
+    record.live = true;
+
+    // The data goes first, so a header is never on disk in front of data that hasn't been written
+    uint8_t header[FICColdStoreRecordHeaderLength];
+    _FICColdStoreEncodeRecordHeader(&record, header);
+    if (_FICColdStoreWriteFully(store->fileDescriptor, payload, payloadLength, (off_t)(record.offset + FICColdStoreRecordHeaderLength)) == false
+        || _FICColdStoreWriteFully(store->fileDescriptor, header, sizeof(header), (off_t)record.offset) == false) {
+        return false;
+    }
+
+    size_t position = store->recordEnd;
+    if (FICEntryIndexSet(&store->index, entityUUIDBytes, sourceImageUUIDBytes, (uint32_t)position) == false) {
+        _FICColdStoreInvalidateRecord(store, &record);
+        record.live = false;
+    }
+
+    store->records[store->recordEnd++] = record;
+    store->head += length;
+    store->nextSequence++;
+
+    return record.live;
+}
+
+void FICColdStoreRemove(FICColdStore *store, const uint8_t entityUUIDBytes[16]) {
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&store->index, entityUUIDBytes);
+    if (entry != NULL) {
+        _FICColdStoreRemoveRecordAtPosition(store, entry->slot);
+    }
+}
+
+void FICColdStoreRemoveAll(FICColdStore *store) {
+    if (store->fileDescriptor >= 0) {
+        _FICColdStoreStartNewLog(store);
+    } else {
+        _FICColdStoreResetRecords(store);
+    }
+}
@@ -0,0 +1,136 @@
+//
+//  FICColdStore.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICColdStore_h
+#define FICColdStore_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FICEntryIndex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ A record in a cold store log, oldest first. Records that were superseded or removed stay in the log, no longer live, until the space they occupy is reused.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t sequence;
+    uint32_t length;
+    uint32_t payloadLength;
+    uint32_t payloadChecksum;
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    bool live;
+} FICColdStoreRecord;
+
+/**
+ `FICColdStore` keeps the compressed image data of entries evicted from an image table in a circular, variable-length log.
+
+ @discussion The log file starts with a header that identifies the image format it was written for, followed by records of any length. Records are appended at the head of the log.
+ Once the head reaches the capacity of the store, it wraps around to the start of the file and new records overwrite the oldest ones, so the file never grows past its capacity and
+ the oldest entries are the first to go.
+
+ Every record carries a checksum of its header and of its data. When the store is opened, the log is scanned for valid record headers and rebuilt in memory, so records that were
+ torn by a crash are skipped. Damaged data is only detected when it is read, at which point the record is dropped. When an entity's record is superseded or removed, its header
+ is overwritten on disk, so it can't come back the next time the store is opened.
+
+ The store doesn't synchronize its file to disk. It only holds data that can be drawn again, so losing recent records in a crash is harmless.
+
+ A store is not thread-safe; callers are expected to serialize access.
+ */
+typedef struct {
+    int fileDescriptor;
+    char *path;
+    size_t capacity;
+    uint32_t imageLength;
+    uint32_t formatChecksum;
+    size_t head;
+    uint64_t nextSequence;
+    FICColdStoreRecord *records;
+    size_t recordCapacity;
+    size_t firstRecord;
+    size_t recordEnd;
+    FICEntryIndex index;
+} FICColdStore;
+
+/**
+ Initializes a closed store for the file at `path`.
+
+ @param capacity The maximum length of the log file, in bytes.
+
+ @param imageLength The length of the uncompressed image data of each entry.
+
+ @param formatChecksum A checksum of the image format the entries are drawn in. A log written for a different image length or format checksum is discarded when opened.
+ */
+void FICColdStoreInit(FICColdStore *store, const char *path, size_t capacity, uint32_t imageLength, uint32_t formatChecksum);
+
+/**
+ Closes the log file and frees the memory owned by the store.
+ */
+void FICColdStoreDestroy(FICColdStore *store);
+
+/**
+ Opens the log file and rebuilds the store from the records in it, starting a new log if the file is missing, damaged or written for a different image format.
+
+ @return `false` if the log file could not be opened or created.
+ */
+bool FICColdStoreOpen(FICColdStore *store);
+
+/**
+ Returns a checksum of serialized image format data, for use as a store's format checksum.
+ */
+uint32_t FICColdStoreFormatChecksum(const void *bytes, size_t length);
+
+/**
+ Returns the number of entities with a record in the store.
+ */
+size_t FICColdStoreCount(const FICColdStore *store);
+
+/**
+ Returns the length of the compressed data stored for an entity, or 0 if the store has no record of the entity drawn from the source image.
+ */
+size_t FICColdStorePayloadLength(const FICColdStore *store, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]);
+
+/**
+ Reads the compressed data stored for an entity.
+
+ @param length The length of `buffer`, which must be the length returned by `FICColdStorePayloadLength`.
+
+ @return `false` if the store has no record of the entity, or if the data could not be read or is damaged, in which case the record is removed.
+ */
+bool FICColdStoreRead(FICColdStore *store, const uint8_t entityUUIDBytes[16], void *buffer, size_t length);
+
+/**
+ Appends a record of compressed data for an entity drawn from a source image, replacing any record the entity already had.
+
+ @discussion The oldest records are dropped to make room for the new one.
+
+ @return `false` if the record is larger than the store or could not be written.
+ */
+bool FICColdStoreAppend(FICColdStore *store, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], const void *payload, size_t payloadLength);
+
+/**
+ Removes the record of an entity.
+ */
+void FICColdStoreRemove(FICColdStore *store, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Removes every record and truncates the log file.
+ */
+void FICColdStoreRemoveAll(FICColdStore *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
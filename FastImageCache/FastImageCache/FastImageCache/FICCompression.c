@@ -0,0 +1,234 @@
+//
+//  FICCompression.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICCompression.h"
+
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICCompressionMinimumMatchLength 4
+#define FICCompressionMaximumOffset 65535
+#define FICCompressionHashLog 12
+
+// The block format requires the last 5 bytes to be literals, and the last match to start at least 12 bytes before the end
+#define FICCompressionLastLiteralsLength 5
+#define FICCompressionMatchSearchLimit 12
+
+// Incompressible data is skipped over faster the longer it has gone without a match
+#define FICCompressionSkipTrigger 6
+
+static inline uint32_t _FICCompressionRead32(const uint8_t *bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(uint32_t));
+    return value;
+}
+
+static inline uint32_t _FICCompressionHash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - FICCompressionHashLog);
+}
+
+// Returns how many bytes match, up to limit - bytes
+static inline size_t _FICCompressionMatchLength(const uint8_t *bytes, const uint8_t *reference, const uint8_t *limit) {
+    const uint8_t *start = bytes;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (bytes + sizeof(uint64_t) <= limit) {
+        uint64_t word, referenceWord;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        memcpy(&referenceWord, reference, sizeof(uint64_t));
+        uint64_t difference = word ^ referenceWord;
+        if (difference != 0) {
+            return (size_t)(bytes - start) + (size_t)__builtin_ctzll(difference) / 8;
+        }
+        bytes += sizeof(uint64_t);
+        reference += sizeof(uint64_t);
+    }
+#endif
+    while (bytes < limit && *bytes == *reference) {
+        bytes++;
+        reference++;
+    }
+    return (size_t)(bytes - start);
+}
+
+// Writes the extra bytes of a literal or match length that didn't fit in its token
+static inline uint8_t * _FICCompressionWriteLength(uint8_t *output, size_t length) {
+    while (length >= 255) {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = (uint8_t)length;
+    return output;
+}
+
+static uint8_t * _FICCompressionWriteSequence(uint8_t *output, const uint8_t *outputEnd, const uint8_t *literals, size_t literalLength, size_t offset, size_t matchLength) {
+    // Worst case for the token, both lengths, the literals and the offset
+    size_t maximumLength = 1 + (literalLength / 255 + 1) + literalLength + 2 + (matchLength / 255 + 1);
+    if (maximumLength > (size_t)(outputEnd - output)) {
+        return NULL;
+    }
+
+    uint8_t *token = output++;
+    *token = (uint8_t)(literalLength >= 15 ? 15 << 4 : literalLength << 4);
+    if (literalLength >= 15) {
+        output = _FICCompressionWriteLength(output, literalLength - 15);
+    }
+
+    memcpy(output, literals, literalLength);
+    output += literalLength;
+
+    if (offset > 0) {
+        *output++ = (uint8_t)offset;
+        *output++ = (uint8_t)(offset >> 8);
+
+        size_t encodedMatchLength = matchLength - FICCompressionMinimumMatchLength;
+        *token |= (uint8_t)(encodedMatchLength >= 15 ? 15 : encodedMatchLength);
+        if (encodedMatchLength >= 15) {
+            output = _FICCompressionWriteLength(output, encodedMatchLength - 15);
+        }
+    }
+
+    return output;
+}
+
+#pragma mark - Compressing Data
+
+size_t FICCompressionBound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+size_t FICCompress(const void *source, size_t sourceLength, void *destination, size_t destinationCapacity) {
+    const uint8_t *input = source;
+    const uint8_t *inputEnd = input + sourceLength;
+    uint8_t *output = destination;
+    const uint8_t *outputEnd = output + destinationCapacity;
+    const uint8_t *anchor = input;
+
+    if (sourceLength > FICCompressionMatchSearchLimit) {
+        // Positions are stored relative to the start of the input. Empty buckets point at the start, which is always rejected as a match for itself.
+        uint32_t hashTable[1 << FICCompressionHashLog];
+        memset(hashTable, 0, sizeof(hashTable));
+
+        const uint8_t *matchLimit = inputEnd - FICCompressionLastLiteralsLength;
+        const uint8_t *searchLimit = inputEnd - FICCompressionMatchSearchLimit;
+        const uint8_t *position = input;
+
+        while (position < searchLimit) {
+            uint32_t sequence = _FICCompressionRead32(position);
+            uint32_t hash = _FICCompressionHash(sequence);
+            const uint8_t *candidate = input + hashTable[hash];
+            hashTable[hash] = (uint32_t)(position - input);
+
+            if (candidate >= position || position - candidate > FICCompressionMaximumOffset || _FICCompressionRead32(candidate) != sequence) {
+                position += 1 + ((size_t)(position - anchor) >> FICCompressionSkipTrigger);
+                continue;
+            }
+
+            // Matches are extended backwards over literals that happen to match too
+            while (position > anchor && candidate > input && position[-1] == candidate[-1]) {
+                position--;
+                candidate--;
+            }
+
+            size_t matchLength = FICCompressionMinimumMatchLength + _FICCompressionMatchLength(position + FICCompressionMinimumMatchLength, candidate + FICCompressionMinimumMatchLength, matchLimit);
+            output = _FICCompressionWriteSequence(output, outputEnd, anchor, (size_t)(position - anchor), (size_t)(position - candidate), matchLength);
+            if (output == NULL) {
+                return 0;
+            }
+
+            position += matchLength;
+            anchor = position;
+
+            // The position just before the next search gets a hash table entry too, which finds repeats of the end of the match
+            if (position < searchLimit) {
+                hashTable[_FICCompressionHash(_FICCompressionRead32(position - 2))] = (uint32_t)(position - 2 - input);
+            }
+        }
+    }
+
+    output = _FICCompressionWriteSequence(output, outputEnd, anchor, (size_t)(inputEnd - anchor), 0, 0);
+    if (output == NULL) {
+        return 0;
+    }
+
+    return (size_t)(output - (uint8_t *)destination);
+}
+
+#pragma mark - Decompressing Data
+
+// Reads the extra bytes of a literal or match length. Returns false if they run past the end of the input.
+static inline bool _FICDecompressionReadLength(const uint8_t **input, const uint8_t *inputEnd, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*input >= inputEnd) {
+            return false;
+        }
+        byte = *(*input)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool FICDecompress(const void *source, size_t sourceLength, void *destination, size_t destinationLength) {
+    const uint8_t *input = source;
+    const uint8_t *inputEnd = input + sourceLength;
+    uint8_t *output = destination;
+    uint8_t *outputEnd = output + destinationLength;
+
+    while (input < inputEnd) {
+        uint8_t token = *input++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && _FICDecompressionReadLength(&input, inputEnd, &literalLength) == false) {
+            return false;
+        }
+        if (literalLength > (size_t)(inputEnd - input) || literalLength > (size_t)(outputEnd - output)) {
+            return false;
+        }
+
+        memcpy(output, input, literalLength);
+        input += literalLength;
+        output += literalLength;
+
+        // The last sequence has no match
+        if (input == inputEnd) {
+            break;
+        }
+
+        if (inputEnd - input < 2) {
+            return false;
+        }
+        size_t offset = (size_t)input[0] | ((size_t)input[1] << 8);
+        input += 2;
+        if (offset == 0 || offset > (size_t)(output - (uint8_t *)destination)) {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && _FICDecompressionReadLength(&input, inputEnd, &matchLength) == false) {
+            return false;
+        }
+        matchLength += FICCompressionMinimumMatchLength;
+        if (matchLength > (size_t)(outputEnd - output)) {
+            return false;
+        }
+
+        const uint8_t *match = output - offset;
+        if (offset >= matchLength) {
+            memcpy(output, match, matchLength);
+            output += matchLength;
+        } else {
+            // The match overlaps the bytes it produces, which repeats its first offset bytes
+            for (size_t i = 0; i < matchLength; i++) {
+                *output++ = match[i];
+            }
+        }
+    }
+
+    return output == outputEnd;
+}
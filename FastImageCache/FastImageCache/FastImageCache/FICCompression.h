@@ -0,0 +1,56 @@
+//
+//  FICCompression.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICCompression_h
+#define FICCompression_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Fast lossless compression of image data, used for entries kept in cold storage.
+
+ @discussion Data is compressed into the LZ4 block format: runs of literal bytes alternating with back-references of at least 4 bytes into the previous 64 KB. Matches are found
+ greedily through a single 4,096-entry hash table kept on the stack, so compression never allocates and runs in a single pass. Decompression is a sequence of bounds-checked
+ copies, so damaged data is rejected instead of being read or written out of bounds.
+
+ Pixel data with flat areas, such as transparent corners or solid backgrounds, compresses well. Photographic data usually shrinks far less.
+ */
+
+/**
+ Returns the largest possible compressed length of `length` bytes of data, for sizing compression buffers.
+ */
+size_t FICCompressionBound(size_t length);
+
+/**
+ Compresses data.
+
+ @return The compressed length, or 0 if the compressed data doesn't fit in `destinationCapacity` bytes. A destination of `FICCompressionBound(sourceLength)` bytes is always big
+ enough.
+ */
+size_t FICCompress(const void *source, size_t sourceLength, void *destination, size_t destinationCapacity);
+
+/**
+ Decompresses data.
+
+ @param destinationLength The exact length of the decompressed data.
+
+ @return `false` if the compressed data is damaged or doesn't decompress to exactly `destinationLength` bytes.
+ */
+bool FICDecompress(const void *source, size_t sourceLength, void *destination, size_t destinationLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,258 @@
+//
+//  FICEntryIndex.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICEntryIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICEntryIndexMinimumBucketCount 64
+
+static inline size_t _FICEntryIndexHash(const uint8_t entityUUIDBytes[16]) {
+    // UUIDs are mostly random already, but sequential or hand-made ones aren't, so both halves are mixed into every bit of the result
+    uint64_t high, low;
+    memcpy(&high, entityUUIDBytes, sizeof(uint64_t));
+    memcpy(&low, entityUUIDBytes + 8, sizeof(uint64_t));
+
+    uint64_t hash = (high ^ ((low << 32) | (low >> 32))) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 32;
+
+    return (size_t)hash;
+}
+
+static inline bool _FICEntryIndexBucketIsEmpty(const FICEntryIndexEntry *bucket) {
+    return bucket->slot == FICEntryIndexNoSlot;
+}
+
+static size_t _FICEntryIndexFindBucket(const FICEntryIndex *index, const uint8_t entityUUIDBytes[16], bool *found) {
+    size_t mask = index->bucketCount - 1;
+    size_t bucketIndex = _FICEntryIndexHash(entityUUIDBytes) & mask;
+
+    // The load factor is capped, so there is always an empty bucket to stop at
+    while (_FICEntryIndexBucketIsEmpty(&index->buckets[bucketIndex]) == false) {
+        if (memcmp(index->buckets[bucketIndex].entityUUIDBytes, entityUUIDBytes, 16) == 0) {
+            *found = true;
+            return bucketIndex;
+        }
+        bucketIndex = (bucketIndex + 1) & mask;
+    }
+
+    *found = false;
+    return bucketIndex;
+}
+
+static void _FICEntryIndexMarkAllBucketsEmpty(FICEntryIndexEntry *buckets, size_t bucketCount) {
+    for (size_t i = 0; i < bucketCount; i++) {
+        buckets[i].slot = FICEntryIndexNoSlot;
+    }
+}
+
+// Growing borrowed storage can't reallocate it, so it's copied into memory the index owns first
+static bool _FICEntryIndexOwnStorage(FICEntryIndex *index) {
+    if (index->borrowsStorage == false) {
+        return true;
+    }
+
+    FICEntryIndexEntry *buckets = malloc(index->bucketCount * sizeof(FICEntryIndexEntry));
+    uint8_t (*entityUUIDBytesBySlot)[16] = malloc(index->slotCapacity * 16);
+    if (buckets == NULL || entityUUIDBytesBySlot == NULL) {
+        free(buckets);
+        free(entityUUIDBytesBySlot);
+        return false;
+    }
+
+    memcpy(buckets, index->buckets, index->bucketCount * sizeof(FICEntryIndexEntry));
+    memcpy(entityUUIDBytesBySlot, index->entityUUIDBytesBySlot, index->slotCapacity * 16);
+    index->buckets = buckets;
+    index->entityUUIDBytesBySlot = entityUUIDBytesBySlot;
+    index->borrowsStorage = false;
+
+    return true;
+}
+
+static bool _FICEntryIndexEnsureBucketCapacity(FICEntryIndex *index, size_t count) {
+    // Keep the load factor at or below 3/4
+    if (index->bucketCount > 0 && count * 4 <= index->bucketCount * 3) {
+        return true;
+    }
+
+    size_t newBucketCount = index->bucketCount > 0 ? index->bucketCount : FICEntryIndexMinimumBucketCount;
+    while (count * 4 > newBucketCount * 3) {
+        newBucketCount *= 2;
+    }
+
+    if (_FICEntryIndexOwnStorage(index) == false) {
+        return false;
+    }
+
+    FICEntryIndexEntry *newBuckets = malloc(newBucketCount * sizeof(FICEntryIndexEntry));
+    if (newBuckets == NULL) {
+        return false;
+    }
+    _FICEntryIndexMarkAllBucketsEmpty(newBuckets, newBucketCount);
+
+    size_t mask = newBucketCount - 1;
+    for (size_t i = 0; i < index->bucketCount; i++) {
+        const FICEntryIndexEntry *entry = &index->buckets[i];
+        if (_FICEntryIndexBucketIsEmpty(entry) == false) {
+            size_t bucketIndex = _FICEntryIndexHash(entry->entityUUIDBytes) & mask;
+            while (_FICEntryIndexBucketIsEmpty(&newBuckets[bucketIndex]) == false) {
+                bucketIndex = (bucketIndex + 1) & mask;
+            }
+            newBuckets[bucketIndex] = *entry;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = newBuckets;
+    index->bucketCount = newBucketCount;
+
+    return true;
+}
+
+static bool _FICEntryIndexEnsureSlotCapacity(FICEntryIndex *index, size_t slotCount) {
+    if (slotCount <= index->slotCapacity) {
+        return true;
+    }
+
+    size_t newSlotCapacity = index->slotCapacity > 0 ? index->slotCapacity : 256;
+    while (newSlotCapacity < slotCount) {
+        newSlotCapacity *= 2;
+    }
+
+    if (_FICEntryIndexOwnStorage(index) == false) {
+        return false;
+    }
+
+    uint8_t (*entityUUIDBytesBySlot)[16] = realloc(index->entityUUIDBytesBySlot, newSlotCapacity * 16);
+    if (entityUUIDBytesBySlot == NULL) {
+        return false;
+    }
+
+    index->entityUUIDBytesBySlot = entityUUIDBytesBySlot;
+    index->slotCapacity = newSlotCapacity;
+
+    return true;
+}
+
+#pragma mark - Index Lifecycle
+
+void FICEntryIndexInit(FICEntryIndex *index) {
+    memset(index, 0, sizeof(FICEntryIndex));
+}
+
+void FICEntryIndexDestroy(FICEntryIndex *index) {
+    if (index->borrowsStorage == false) {
+        free(index->buckets);
+        free(index->entityUUIDBytesBySlot);
+    }
+    memset(index, 0, sizeof(FICEntryIndex));
+}
+
+#pragma mark - Finding Entries
+
+const FICEntryIndexEntry * FICEntryIndexFind(const FICEntryIndex *index, const uint8_t entityUUIDBytes[16]) {
+    if (index->count == 0) {
+        return NULL;
+    }
+
+    bool found;
+    size_t bucketIndex = _FICEntryIndexFindBucket(index, entityUUIDBytes, &found);
+
+    return found ? &index->buckets[bucketIndex] : NULL;
+}
+
+const FICEntryIndexEntry * FICEntryIndexFindSlot(const FICEntryIndex *index, uint32_t slot) {
+    if (slot >= index->slotCapacity) {
+        return NULL;
+    }
+
+    // The slot table is never cleared, so the entity it names has to still be in the slot to count
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(index, index->entityUUIDBytesBySlot[slot]);
+
+    return entry != NULL && entry->slot == slot ? entry : NULL;
+}
+
+const FICEntryIndexEntry * FICEntryIndexNextEntry(const FICEntryIndex *index, size_t *position) {
+    while (*position < index->bucketCount) {
+        const FICEntryIndexEntry *entry = &index->buckets[(*position)++];
+        if (_FICEntryIndexBucketIsEmpty(entry) == false) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+#pragma mark - Modifying the Index
+
+bool FICEntryIndexSet(FICEntryIndex *index, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], uint32_t slot) {
+    if (slot == FICEntryIndexNoSlot || _FICEntryIndexEnsureSlotCapacity(index, (size_t)slot + 1) == false) {
+        return false;
+    }
+
+    if (_FICEntryIndexEnsureBucketCapacity(index, index->count + 1) == false) {
+        return false;
+    }
+
+    bool found;
+    size_t bucketIndex = _FICEntryIndexFindBucket(index, entityUUIDBytes, &found);
+    FICEntryIndexEntry *entry = &index->buckets[bucketIndex];
+    if (found == false) {
+        memcpy(entry->entityUUIDBytes, entityUUIDBytes, 16);
+        index->count++;
+    }
+
+    memcpy(entry->sourceImageUUIDBytes, sourceImageUUIDBytes, 16);
+    entry->slot = slot;
+    memcpy(index->entityUUIDBytesBySlot[slot], entityUUIDBytes, 16);
+
+    return true;
+}
+
+bool FICEntryIndexRemove(FICEntryIndex *index, const uint8_t entityUUIDBytes[16]) {
+    if (index->count == 0) {
+        return false;
+    }
+
+    bool found;
+    size_t emptyIndex = _FICEntryIndexFindBucket(index, entityUUIDBytes, &found);
+    if (found == false) {
+        return false;
+    }
+
+    // Shift back every later entry in the probe run that would otherwise become unreachable
+    size_t mask = index->bucketCount - 1;
+    size_t bucketIndex = emptyIndex;
+    while (true) {
+        bucketIndex = (bucketIndex + 1) & mask;
+        FICEntryIndexEntry *entry = &index->buckets[bucketIndex];
+        if (_FICEntryIndexBucketIsEmpty(entry)) {
+            break;
+        }
+
+        size_t homeIndex = _FICEntryIndexHash(entry->entityUUIDBytes) & mask;
+        bool homeIsBetween = emptyIndex <= bucketIndex ? (emptyIndex < homeIndex && homeIndex <= bucketIndex) : (emptyIndex < homeIndex || homeIndex <= bucketIndex);
+        if (homeIsBetween == false) {
+            index->buckets[emptyIndex] = *entry;
+            emptyIndex = bucketIndex;
+        }
+    }
+
+    index->buckets[emptyIndex].slot = FICEntryIndexNoSlot;
+    index->count--;
+
+    return true;
+}
+
+void FICEntryIndexRemoveAll(FICEntryIndex *index) {
+    _FICEntryIndexMarkAllBucketsEmpty(index->buckets, index->bucketCount);
+    index->count = 0;
+}
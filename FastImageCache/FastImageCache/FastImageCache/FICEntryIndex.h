@@ -0,0 +1,109 @@
+//
+//  FICEntryIndex.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICEntryIndex_h
+#define FICEntryIndex_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FICEntryIndexNoSlot UINT32_MAX
+
+/**
+ An entry in an image table index. Buckets whose `slot` is `FICEntryIndexNoSlot` are empty.
+ */
+typedef struct {
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    uint32_t slot;
+} FICEntryIndexEntry;
+
+/**
+ `FICEntryIndex` maps raw 128-bit entity UUIDs to the image table slot that holds their image data and the source image UUID it was drawn from.
+
+ @discussion Entries are stored inline in a single open-addressing hash table with linear probing. Removals shift later entries back instead of leaving tombstones, so lookups never
+ degrade as entries churn. Neither lookups nor removals allocate memory.
+
+ The index also remembers which entity UUID was last stored in each slot, so the entry occupying a slot can be found without a second hash table.
+
+ Pointers to entries returned by the index are only valid until the index is next modified.
+
+ An index can also work in place on storage it doesn't own, such as a metadata snapshot mapped from disk. See `<FICMetadataSnapshotAdopt>`. Borrowed storage is modified in place,
+ copied into memory owned by the index the first time the index has to grow, and never freed by the index.
+
+ The index is not thread-safe; callers are expected to hold the image table lock.
+ */
+typedef struct {
+    FICEntryIndexEntry *buckets;
+    size_t bucketCount;
+    size_t count;
+    uint8_t (*entityUUIDBytesBySlot)[16];
+    size_t slotCapacity;
+    bool borrowsStorage;
+} FICEntryIndex;
+
+/**
+ Initializes an empty index.
+ */
+void FICEntryIndexInit(FICEntryIndex *index);
+
+/**
+ Frees the memory owned by the index.
+ */
+void FICEntryIndexDestroy(FICEntryIndex *index);
+
+/**
+ Returns the entry for an entity UUID, or `NULL` if there is none.
+ */
+const FICEntryIndexEntry * FICEntryIndexFind(const FICEntryIndex *index, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Returns the entry that occupies a slot, or `NULL` if the slot is empty.
+ */
+const FICEntryIndexEntry * FICEntryIndexFindSlot(const FICEntryIndex *index, uint32_t slot);
+
+/**
+ Adds an entry for an entity UUID, or updates its slot and source image UUID if it already has one.
+
+ @discussion The caller is responsible for removing any other entity that occupied `slot`.
+
+ @return `false` if memory for the index could not be allocated.
+ */
+bool FICEntryIndexSet(FICEntryIndex *index, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], uint32_t slot);
+
+/**
+ Removes the entry for an entity UUID.
+
+ @return `false` if the index had no entry for the entity UUID.
+ */
+bool FICEntryIndexRemove(FICEntryIndex *index, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Removes every entry.
+ */
+void FICEntryIndexRemoveAll(FICEntryIndex *index);
+
+/**
+ Iterates over the entries in an unspecified order.
+
+ @param position The iteration state. Set it to 0 before the first call.
+
+ @return The next entry, or `NULL` once every entry has been returned.
+ */
+const FICEntryIndexEntry * FICEntryIndexNextEntry(const FICEntryIndex *index, size_t *position);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+//
+//  FICEvictionPolicy.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICEvictionPolicy.h"
+
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICEvictionPolicyWindowPercentage 1
+#define FICEvictionPolicyProtectedPercentage 80
+
+static unsigned _FICEvictionPolicyFrequencyOfSlot(const FICEvictionPolicy *policy, const FICEntryIndex *index, uint32_t slot) {
+    if (slot >= index->slotCapacity) {
+        return 0;
+    }
+
+    return FICFrequencySketchFrequency(&policy->sketch, index->entityUUIDBytesBySlot[slot]);
+}
+
+// Each access adds at most one entry to a segment, so moving one entry out is enough to bring it back within its share
+static void _FICEvictionPolicyMoveOverflow(FICEvictionPolicy *policy, FICEvictionPolicySegment segment, size_t capacity) {
+    if (policy->list.segments[segment].trackedCount > capacity) {
+        uint32_t slot = FICRecencyListLeastRecentSlotInSegment(&policy->list, segment);
+        if (slot != FICRecencyListNone) {
+            FICRecencyListTouchInSegment(&policy->list, slot, FICEvictionPolicySegmentProbation);
+        }
+    }
+}
+
+#pragma mark - Policy Lifecycle
+
+void FICEvictionPolicyInit(FICEvictionPolicy *policy) {
+    memset(policy, 0, sizeof(FICEvictionPolicy));
+    policy->kind = FICEvictionPolicyKindLRU;
+    FICRecencyListInit(&policy->list);
+    FICFrequencySketchInit(&policy->sketch);
+}
+
+void FICEvictionPolicyDestroy(FICEvictionPolicy *policy) {
+    FICRecencyListDestroy(&policy->list);
+    FICFrequencySketchDestroy(&policy->sketch);
+    FICEvictionPolicyInit(policy);
+}
+
+bool FICEvictionPolicyConfigure(FICEvictionPolicy *policy, FICEvictionPolicyKind kind, size_t maximumCount) {
+    policy->kind = kind;
+
+    if (kind == FICEvictionPolicyKindLRU) {
+        FICRecencyListMergeSegments(&policy->list);
+        FICFrequencySketchDestroy(&policy->sketch);
+        policy->windowCapacity = 0;
+        policy->protectedCapacity = 0;
+        return true;
+    }
+
+    size_t windowCapacity = maximumCount * FICEvictionPolicyWindowPercentage / 100;
+    policy->windowCapacity = windowCapacity > 0 ? windowCapacity : 1;
+    policy->protectedCapacity = maximumCount > policy->windowCapacity ? (maximumCount - policy->windowCapacity) * FICEvictionPolicyProtectedPercentage / 100 : 0;
+
+    return FICFrequencySketchSetCapacity(&policy->sketch, maximumCount);
+}
+
+#pragma mark - Tracking Entries
+
+bool FICEvictionPolicyTouch(FICEvictionPolicy *policy, uint32_t slot, const uint8_t entityUUIDBytes[16]) {
+    if (policy->kind == FICEvictionPolicyKindLRU) {
+        return FICRecencyListTouch(&policy->list, slot);
+    }
+
+    FICFrequencySketchIncrement(&policy->sketch, entityUUIDBytes);
+
+    if (FICRecencyListContains(&policy->list, slot) == false) {
+        if (FICRecencyListTouchInSegment(&policy->list, slot, FICEvictionPolicySegmentWindow) == false) {
+            return false;
+        }
+
+        // Entries leaving the window while the table still has room go straight into probation
+        _FICEvictionPolicyMoveOverflow(policy, FICEvictionPolicySegmentWindow, policy->windowCapacity);
+    } else if (FICRecencyListSegmentOfSlot(&policy->list, slot) == FICEvictionPolicySegmentProbation) {
+        FICRecencyListTouchInSegment(&policy->list, slot, FICEvictionPolicySegmentProtected);
+        _FICEvictionPolicyMoveOverflow(policy, FICEvictionPolicySegmentProtected, policy->protectedCapacity);
+    } else {
+        FICRecencyListTouch(&policy->list, slot);
+    }
+
+    return true;
+}
+
+// Returns the victim, and the window entry that has to be admitted into probation for it to be evicted instead of the window entry, if any
+static uint32_t _FICEvictionPolicyFindVictim(const FICEvictionPolicy *policy, const FICEntryIndex *index, uint32_t *admittedSlot) {
+    *admittedSlot = FICRecencyListNone;
+
+    if (policy->kind == FICEvictionPolicyKindLRU) {
+        return FICRecencyListLeastRecentSlot(&policy->list);
+    }
+
+    uint32_t victim = FICRecencyListLeastRecentSlotInSegment(&policy->list, FICEvictionPolicySegmentProbation);
+    if (victim == FICRecencyListNone) {
+        victim = FICRecencyListLeastRecentSlotInSegment(&policy->list, FICEvictionPolicySegmentProtected);
+    }
+
+    uint32_t candidate = FICRecencyListLeastRecentSlotInSegment(&policy->list, FICEvictionPolicySegmentWindow);
+    if (candidate == FICRecencyListNone || victim == FICRecencyListNone) {
+        return victim != FICRecencyListNone ? victim : candidate;
+    }
+
+    // A window with room left has no entry waiting to be admitted
+    if (policy->list.segments[FICEvictionPolicySegmentWindow].trackedCount < policy->windowCapacity) {
+        return victim;
+    }
+
+    // Ties go to the entry already in the table, so a burst of entries that are only seen once can't push out anything that has been seen as often
+    if (_FICEvictionPolicyFrequencyOfSlot(policy, index, candidate) > _FICEvictionPolicyFrequencyOfSlot(policy, index, victim)) {
+        *admittedSlot = candidate;
+        return victim;
+    }
+
+    return candidate;
+}
+
+uint32_t FICEvictionPolicyChooseVictim(FICEvictionPolicy *policy, const FICEntryIndex *index) {
+    uint32_t admittedSlot;
+    uint32_t victim = _FICEvictionPolicyFindVictim(policy, index, &admittedSlot);
+    if (admittedSlot != FICRecencyListNone) {
+        FICRecencyListTouchInSegment(&policy->list, admittedSlot, FICEvictionPolicySegmentProbation);
+    }
+
+    return victim;
+}
+
+uint32_t FICEvictionPolicyPeekVictim(const FICEvictionPolicy *policy, const FICEntryIndex *index) {
+    uint32_t admittedSlot;
+    return _FICEvictionPolicyFindVictim(policy, index, &admittedSlot);
+}
+
+void FICEvictionPolicyRemove(FICEvictionPolicy *policy, uint32_t slot) {
+    FICRecencyListRemove(&policy->list, slot);
+}
+
+void FICEvictionPolicyRemoveAll(FICEvictionPolicy *policy) {
+    FICRecencyListRemoveAll(&policy->list);
+    FICFrequencySketchRemoveAll(&policy->sketch);
+}
@@ -0,0 +1,116 @@
+//
+//  FICEvictionPolicy.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICEvictionPolicy_h
+#define FICEvictionPolicy_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FICEntryIndex.h"
+#include "FICFrequencySketch.h"
+#include "FICRecencyList.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FICEvictionPolicyKindLRU = 0,
+    FICEvictionPolicyKindTinyLFU,
+} FICEvictionPolicyKind;
+
+/**
+ The segments of the recency list of an `<FICEvictionPolicy>`.
+ */
+typedef enum {
+    FICEvictionPolicySegmentProbation = 0,
+    FICEvictionPolicySegmentProtected,
+    FICEvictionPolicySegmentWindow,
+} FICEvictionPolicySegment;
+
+/**
+ `FICEvictionPolicy` decides which entry of an image table is evicted to make room for a new one.
+
+ @discussion The LRU policy evicts the least recently accessed entry that isn't in use, keeping every entry in the first segment of its recency list.
+
+ The TinyLFU policy keeps entries that are accessed often even when a burst of entries that are only accessed once comes through, such as when a long list is scrolled past. New
+ entries go into a small window, about 1% of the table, ordered by recency. The rest of the table is split into probation and protected segments: an entry in probation that is
+ accessed again is promoted to protected, and protected entries that overflow its share of the table are demoted back to the front of probation. When an entry has to be evicted
+ and the window is full, the least recently accessed window entry is only admitted into probation, at the expense of the least recently accessed probation entry, if a
+ `<FICFrequencySketch>` estimates that it has been accessed more often. Otherwise, the window entry itself is evicted.
+
+ In-use entries are pinned off the recency list, so no policy ever picks them.
+
+ The policy is not thread-safe; image tables guard it with a lock of its own so that recording cache hits doesn't hold up the rest of the table.
+ */
+typedef struct {
+    FICEvictionPolicyKind kind;
+    FICRecencyList list;
+    FICFrequencySketch sketch;
+    size_t windowCapacity;
+    size_t protectedCapacity;
+} FICEvictionPolicy;
+
+/**
+ Initializes an empty LRU policy for a table with no entries.
+ */
+void FICEvictionPolicyInit(FICEvictionPolicy *policy);
+
+/**
+ Frees the memory owned by the policy.
+ */
+void FICEvictionPolicyDestroy(FICEvictionPolicy *policy);
+
+/**
+ Sets the kind of the policy and the number of entries of its image table, keeping the entries it's tracking.
+
+ @discussion Policies are configured once their state has been loaded, so a table whose policy changed since its state was saved keeps as much of it as it can. Entries tracked by an
+ LRU policy become probation entries of a TinyLFU policy, and every entry of a TinyLFU policy becomes an entry of an LRU policy.
+
+ @return `false` if memory for the frequency sketch could not be allocated. The policy still works, but treats every entry as if it had never been accessed before.
+ */
+bool FICEvictionPolicyConfigure(FICEvictionPolicy *policy, FICEvictionPolicyKind kind, size_t maximumCount);
+
+/**
+ Records an access to the entry in a slot, tracking the slot if it isn't already.
+
+ @return `false` if memory for the recency list could not be allocated.
+ */
+bool FICEvictionPolicyTouch(FICEvictionPolicy *policy, uint32_t slot, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Picks the entry to evict next, or returns `FICRecencyListNone` if every tracked entry is in use.
+
+ @param index The entry index of the image table, which the TinyLFU policy uses to find the entities whose frequencies it compares.
+
+ @discussion The slot stays tracked until it's removed, but the TinyLFU policy may move another entry into probation while choosing it.
+ */
+uint32_t FICEvictionPolicyChooseVictim(FICEvictionPolicy *policy, const FICEntryIndex *index);
+
+/**
+ Returns the entry `<FICEvictionPolicyChooseVictim>` would pick, without changing the policy.
+ */
+uint32_t FICEvictionPolicyPeekVictim(const FICEvictionPolicy *policy, const FICEntryIndex *index);
+
+/**
+ Stops tracking a slot. The frequency of its entity is kept, so it's remembered if the entity is added again.
+ */
+void FICEvictionPolicyRemove(FICEvictionPolicy *policy, uint32_t slot);
+
+/**
+ Stops tracking every slot, drops all pins and forgets every frequency.
+ */
+void FICEvictionPolicyRemoveAll(FICEvictionPolicy *policy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+//
+//  FICFrequencySketch.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICFrequencySketch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICFrequencySketchCountersPerEntity 4
+#define FICFrequencySketchCountersPerWord 16
+#define FICFrequencySketchMaximumCount 15
+#define FICFrequencySketchSampleSizeMultiplier 10
+
+static const uint64_t FICFrequencySketchSeeds[FICFrequencySketchCountersPerEntity] = {
+    0xC3A5C85C97CB3127ull, 0xB492B66FBE98F273ull, 0x9AE16A3B2F90404Full, 0xCBF29CE484222325ull,
+};
+
+static inline uint64_t _FICFrequencySketchHash(const uint8_t entityUUIDBytes[16]) {
+    uint64_t high, low;
+    memcpy(&high, entityUUIDBytes, sizeof(uint64_t));
+    memcpy(&low, entityUUIDBytes + 8, sizeof(uint64_t));
+
+    uint64_t hash = (high ^ ((low << 32) | (low >> 32))) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 32);
+}
+
+// Picks the word and the counter within it for one of an entity's counters. The low bits pick the counter, and the rest pick the word.
+static inline void _FICFrequencySketchGetCounter(const FICFrequencySketch *sketch, uint64_t hash, unsigned i, size_t *wordIndex, unsigned *shift) {
+    uint64_t counterHash = (hash + FICFrequencySketchSeeds[i]) * FICFrequencySketchSeeds[i];
+    counterHash ^= counterHash >> 29;
+
+    *wordIndex = (size_t)(counterHash >> 4) & (sketch->wordCount - 1);
+    *shift = (unsigned)(counterHash & (FICFrequencySketchCountersPerWord - 1)) * 4;
+}
+
+// Halving every counter at once is a shift of each word, with the bit shifted in from the next counter masked off
+static void _FICFrequencySketchAge(FICFrequencySketch *sketch) {
+    for (size_t i = 0; i < sketch->wordCount; i++) {
+        sketch->words[i] = (sketch->words[i] >> 1) & 0x7777777777777777ull;
+    }
+
+    sketch->additionCount /= 2;
+}
+
+#pragma mark - Sketch Lifecycle
+
+void FICFrequencySketchInit(FICFrequencySketch *sketch) {
+    memset(sketch, 0, sizeof(FICFrequencySketch));
+}
+
+void FICFrequencySketchDestroy(FICFrequencySketch *sketch) {
+    if (sketch->borrowsStorage == false) {
+        free(sketch->words);
+    }
+    FICFrequencySketchInit(sketch);
+}
+
+size_t FICFrequencySketchWordCountForCapacity(size_t capacity) {
+    // One word per entry gives each entry sixteen counters to share with others, which keeps collisions rare enough
+    size_t wordCount = 1;
+    while (wordCount < capacity && wordCount < ((size_t)1 << 24)) {
+        wordCount *= 2;
+    }
+
+    return wordCount;
+}
+
+bool FICFrequencySketchSetCapacity(FICFrequencySketch *sketch, size_t capacity) {
+    size_t wordCount = FICFrequencySketchWordCountForCapacity(capacity);
+    size_t sampleSize = (capacity > 0 ? capacity : 1) * FICFrequencySketchSampleSizeMultiplier;
+
+    if (wordCount != sketch->wordCount) {
+        FICFrequencySketchDestroy(sketch);
+
+        uint64_t *words = calloc(wordCount, sizeof(uint64_t));
+        if (words == NULL) {
+            return false;
+        }
+
+        sketch->words = words;
+        sketch->wordCount = wordCount;
+    }
+
+    sketch->sampleSize = sampleSize;
+    if (sketch->additionCount >= sketch->sampleSize) {
+        _FICFrequencySketchAge(sketch);
+    }
+
+    return true;
+}
+
+#pragma mark - Counting Accesses
+
+void FICFrequencySketchIncrement(FICFrequencySketch *sketch, const uint8_t entityUUIDBytes[16]) {
+    if (sketch->wordCount == 0) {
+        return;
+    }
+
+    uint64_t hash = _FICFrequencySketchHash(entityUUIDBytes);
+    bool incremented = false;
+    for (unsigned i = 0; i < FICFrequencySketchCountersPerEntity; i++) {
+        size_t wordIndex;
+        unsigned shift;
+        _FICFrequencySketchGetCounter(sketch, hash, i, &wordIndex, &shift);
+
+        if (((sketch->words[wordIndex] >> shift) & 0xF) < FICFrequencySketchMaximumCount) {
+            sketch->words[wordIndex] += (uint64_t)1 << shift;
+            incremented = true;
+        }
+    }
+
+    if (incremented && ++sketch->additionCount >= sketch->sampleSize) {
+        _FICFrequencySketchAge(sketch);
+    }
+}
+
+unsigned FICFrequencySketchFrequency(const FICFrequencySketch *sketch, const uint8_t entityUUIDBytes[16]) {
+    if (sketch->wordCount == 0) {
+        return 0;
+    }
+
+    uint64_t hash = _FICFrequencySketchHash(entityUUIDBytes);
+    unsigned frequency = FICFrequencySketchMaximumCount;
+    for (unsigned i = 0; i < FICFrequencySketchCountersPerEntity; i++) {
+        size_t wordIndex;
+        unsigned shift;
+        _FICFrequencySketchGetCounter(sketch, hash, i, &wordIndex, &shift);
+
+        unsigned count = (unsigned)((sketch->words[wordIndex] >> shift) & 0xF);
+        if (count < frequency) {
+            frequency = count;
+        }
+    }
+
+    return frequency;
+}
+
+void FICFrequencySketchRemoveAll(FICFrequencySketch *sketch) {
+    if (sketch->wordCount > 0) {
+        memset(sketch->words, 0, sketch->wordCount * sizeof(uint64_t));
+    }
+    sketch->additionCount = 0;
+}
@@ -0,0 +1,84 @@
+//
+//  FICFrequencySketch.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICFrequencySketch_h
+#define FICFrequencySketch_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ `FICFrequencySketch` estimates how often each entity of an image table has been accessed recently, in a fixed amount of memory.
+
+ @discussion The sketch is a count-min sketch of 4-bit counters packed sixteen to a 64-bit word. Each entity is counted in four counters picked by hashing its UUID, and its estimated
+ frequency is the lowest of the four, which can only overestimate it. Counters stop at 15.
+
+ Once the sketch has counted ten times as many accesses as the image table holds entries, every counter is halved, so entities that were popular a while ago don't stay popular forever.
+
+ A sketch with no counters counts nothing and estimates every frequency as 0. Like `<FICRecencyList>`, a sketch can work in place on borrowed storage, which it modifies in place but
+ never frees.
+
+ The sketch is not thread-safe; image tables guard it with the same lock as their recency list.
+ */
+typedef struct {
+    uint64_t *words;
+    size_t wordCount;
+    size_t additionCount;
+    size_t sampleSize;
+    bool borrowsStorage;
+} FICFrequencySketch;
+
+/**
+ Initializes a sketch with no counters.
+ */
+void FICFrequencySketchInit(FICFrequencySketch *sketch);
+
+/**
+ Frees the memory owned by the sketch.
+ */
+void FICFrequencySketchDestroy(FICFrequencySketch *sketch);
+
+/**
+ Returns the number of words a sketch sized for `capacity` entries has.
+ */
+size_t FICFrequencySketchWordCountForCapacity(size_t capacity);
+
+/**
+ Sizes the sketch for an image table holding up to `capacity` entries.
+
+ @discussion Counts are kept if the sketch already has the right number of counters. Otherwise, every counter starts over at 0.
+
+ @return `false` if memory for the counters could not be allocated, in which case the sketch is left with no counters.
+ */
+bool FICFrequencySketchSetCapacity(FICFrequencySketch *sketch, size_t capacity);
+
+/**
+ Counts an access to an entity.
+ */
+void FICFrequencySketchIncrement(FICFrequencySketch *sketch, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Returns the estimated number of recent accesses to an entity, from 0 to 15.
+ */
+unsigned FICFrequencySketchFrequency(const FICFrequencySketch *sketch, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Sets every counter back to 0.
+ */
+void FICFrequencySketchRemoveAll(FICFrequencySketch *sketch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
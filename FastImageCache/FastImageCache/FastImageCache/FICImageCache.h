@@ -9,12 +9,71 @@
 #import "FICImports.h"
 #import "FICImageFormat.h"
 #import "FICEntity.h"
+#import "FICStatistics.h"
 
 @protocol FICEntity;
 @protocol FICImageCacheDelegate;
 
 typedef void (^FICImageCacheCompletionBlock)(id <FICEntity> _Nullable entity, NSString * _Nonnull formatName, UIImage * _Nullable image);
 typedef void (^FICImageRequestCompletionBlock)(UIImage * _Nullable sourceImage);
+typedef void (^FICImageCacheBatchCompletionBlock)(NSArray <id <FICEntity>> * _Nonnull entities, NSString * _Nonnull formatName, NSArray <UIImage *> * _Nonnull images);
+
+typedef NS_ENUM(NSUInteger, FICImageCachePriority) {
+    FICImageCachePriorityLow,
+    FICImageCachePriorityNormal,
+    FICImageCachePriorityHigh,
+};
+
+typedef NS_ENUM(NSUInteger, FICImageCacheRequestOrder) {
+    FICImageCacheRequestOrderFirstInFirstOut,
+    FICImageCacheRequestOrderLastInFirstOut,
+};
+
+/**
+ How image retrievals for an image format were served.
+ 
+ - `hotHitCount`: The image was already in the image table.
+ - `coldHitCount`: The image was restored from the image format's cold storage.
+ - `scaledHitCount`: The image was downscaled from a larger format in the same family.
+ - `missCount`: The image had to be created from its source image.
+ */
+typedef struct {
+    NSUInteger hotHitCount;
+    NSUInteger coldHitCount;
+    NSUInteger scaledHitCount;
+    NSUInteger missCount;
+} FICImageCacheRetrievalStatistics;
+
+/**
+ What an image table has done since it was opened.
+ 
+ - `hitCount`: Images that were retrieved from the image table.
+ - `missCount`: Images that were asked for but weren't in the image table.
+ - `storedEntryCount`: Entries that were stored, whether drawn, converted, downscaled, or restored from cold storage.
+ - `evictedEntryCount`: Entries that were evicted, either to make room for other entries or to stay within a disk budget.
+ - `chunkMappingCount`: Times the image table mapped file data into memory.
+ - `chunkUnmappingCount`: Times the image table's mapped file data was unmapped again.
+ - `writtenLength`: Bytes written to disk for the image table, counting entries, evicted entries moved to cold storage, journal records, and metadata checkpoints.
+ - `lockCount`: Times the image table lock was taken.
+ - `lockWaitDurations`: How long taking the image table lock waited for other threads, counting only the times it had to wait.
+ - `flushDurations`: How long writing entries to disk took, one duration per `msync`.
+ - `journalWriteDurations`: How long appending records to the metadata journal took, one duration per batch of records.
+ - `checkpointDurations`: How long saving the image table's metadata took, from copying it to writing the checkpoint.
+ */
+typedef struct {
+    NSUInteger hitCount;
+    NSUInteger missCount;
+    NSUInteger storedEntryCount;
+    NSUInteger evictedEntryCount;
+    NSUInteger chunkMappingCount;
+    NSUInteger chunkUnmappingCount;
+    unsigned long long writtenLength;
+    NSUInteger lockCount;
+    FICStatisticsHistogram lockWaitDurations;
+    FICStatisticsHistogram flushDurations;
+    FICStatisticsHistogram journalWriteDurations;
+    FICStatisticsHistogram checkpointDurations;
+} FICImageTableStatistics;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -46,6 +105,104 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, weak) id <FICImageCacheDelegate> delegate;
 
+///-----------------------------------
+/// @name Configuring Image Processing
+///-----------------------------------
+
+/**
+ The maximum number of source images the image cache draws into its image tables at the same time.
+ 
+ @discussion Images are processed on a pool of background threads. Work for the same entity and image format is always done in the order it was requested, but different
+ entities and formats are processed in parallel, up to this limit. Defaults to 1, which processes images one at a time, the way earlier versions always did. Setting it to
+ the number of active processor cores, `[[NSProcessInfo processInfo] activeProcessorCount]`, processes a burst of new images several times faster.
+ 
+ @note With a limit above 1, drawing blocks run on several threads at once, so they must synchronize access to any mutable state they share.
+ */
+@property (nonatomic, assign) NSUInteger maximumConcurrentProcessingCount;
+
+///----------------------------------------
+/// @name Configuring Source Image Requests
+///----------------------------------------
+
+/**
+ The maximum number of source images the image cache asks its delegate for at the same time.
+ 
+ @discussion Once this many <[FICImageCacheDelegate imageCache:wantsSourceImageForEntity:withFormatName:completionBlock:]> requests are outstanding, further requests wait
+ until an earlier one completes or is canceled. Requests for entities that share a source image URL are always coalesced into a single delegate request. Defaults to 8.
+ */
+@property (nonatomic, assign) NSUInteger maximumConcurrentSourceImageRequestCount;
+
+/**
+ The order in which equally urgent source image requests are passed on to the delegate.
+ 
+ @discussion Defaults to `FICImageCacheRequestOrderFirstInFirstOut`. `FICImageCacheRequestOrderLastInFirstOut` favors the most recently requested images, which are usually
+ the ones on screen while the user is scrolling quickly. Requests with a higher priority or an earlier deadline always go first.
+ */
+@property (nonatomic, assign) FICImageCacheRequestOrder sourceImageRequestOrder;
+
+/**
+ The number of source images the image cache has asked its delegate for.
+ */
+@property (nonatomic, assign, readonly) NSUInteger sourceImageRequestCount;
+
+/**
+ The number of image retrievals that were folded into a source image request that was already outstanding, rather than asking the delegate again.
+ */
+@property (nonatomic, assign, readonly) NSUInteger coalescedSourceImageRequestCount;
+
+///--------------------------------------
+/// @name Configuring Image Table Mappings
+///--------------------------------------
+
+/**
+ The maximum number of bytes of image table file data that stay mapped into memory after the last image using them goes away.
+ 
+ @discussion Image table files are mapped in chunks of about 2 MB. Keeping recently used chunks mapped means that scrolling back over images that were just shown doesn't map
+ and unmap the same file data again. The budget is shared by all of the image cache's image tables and is spent on the most recently used chunks first. Defaults to 32 MB.
+ Set it to 0 to unmap image table data as soon as no image uses it.
+ */
+@property (nonatomic, assign) size_t maximumMappedLength;
+
+///--------------------------
+/// @name Limiting Disk Usage
+///--------------------------
+
+/**
+ The maximum number of bytes of entry data that all of the image cache's image tables store on disk together.
+ 
+ @discussion Each image table already evicts entries once it holds its format's `<[FICImageFormat maximumCount]>` entries. With a disk length set, entries are also evicted when the
+ image tables hold more than this many bytes of entries between them, from whichever table has the entry that is the cheapest to lose: the least recently used one, weighed by its
+ format's `<[FICImageFormat recreationCost]>` and its length. Mapped memory is limited separately by `<maximumMappedLength>`. Cold storage files don't count toward the limit.
+ 
+ Evicted entries leave free space in image table files until they're compacted; see `<compactionRate>`. Defaults to 0, which doesn't limit disk usage beyond each format's maximum count.
+ */
+@property (nonatomic, assign) size_t maximumDiskLength;
+
+///-----------------------------
+/// @name Scrubbing Image Tables
+///-----------------------------
+
+/**
+ The number of bytes of image data per second that the image cache checks against their checksums in the background.
+ 
+ @discussion Scrubbing works through the image cache's image tables one after another, a little at a time, and discards images whose data was damaged on disk after it was
+ written. See `<[FICImageTable scrubEntriesUpToLength:]>`. Defaults to 1 MB per second. Set it to 0 to stop scrubbing.
+ */
+@property (nonatomic, assign) size_t scrubbingRate;
+
+///------------------------------
+/// @name Compacting Image Tables
+///------------------------------
+
+/**
+ The number of bytes of entry data per second that the image cache moves or releases in the background to shrink its image table files.
+ 
+ @discussion Image table files don't shrink when entries are deleted or evicted. Compaction works through the image cache's image tables one after another, moving entries toward the
+ start of each file so the end of it can be truncated. See `<[FICImageTable compactEntriesUpToLength:]>`. Moving entries writes to the disk, so compaction is off by default.
+ Set it to a rate such as 1 MB per second after purging content or lowering the maximum count of image formats.
+ */
+@property (nonatomic, assign) size_t compactionRate;
+
 ///---------------------------------------
 /// @name Creating Image Cache instances
 ///---------------------------------------
@@ -85,7 +242,10 @@ NS_ASSUME_NONNULL_BEGIN
  
  @return A generic, shared dispatch queue of type `dispatch_queue_t`.
  
- @note All instances of `FICImageCache` make use a single, shared dispatch queue to do their work.
+ @note All instances of `FICImageCache` make use a single, shared dispatch queue to do their work. Drawing and storing new images is done separately, by each image cache's
+ processing threads.
+ 
+ @see maximumConcurrentProcessingCount
  */
 + (dispatch_queue_t)dispatchQueue;
 
@@ -197,6 +357,79 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (BOOL)asynchronouslyRetrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName completionBlock:(nullable FICImageCacheCompletionBlock)completionBlock;
 
+/**
+ Asynchronously retrieves an image from the image cache, with a given urgency.
+ 
+ @param entity The entity that uniquely identifies the source image.
+ 
+ @param formatName The format name that uniquely identifies which image table to look in for the cached image. Must not be nil.
+ 
+ @param priority How urgently the image is needed. Use `FICImageCachePriorityHigh` for images that are on screen and `FICImageCachePriorityLow` for images that may be shown
+ soon, such as those of rows just past the edge of the screen.
+ 
+ @param deadline When the image is needed by, or `nil` if there's no particular time. Among requests with the same priority, those with the earliest deadline are served first.
+ 
+ @param completionBlock The completion block that is called when the requested image is available or if an error occurs. See
+ `<asynchronouslyRetrieveImageForEntity:withFormatName:completionBlock:>` for more information.
+ 
+ @return `YES` if the requested image already exists in the image case, `NO` if the image needs to be provided to the image cache by its delegate.
+ 
+ @discussion If the image has to be provided by the delegate, both the request for its source image and the processing of that source image wait behind any more urgent work,
+ so images on screen aren't held up by a backlog of speculative requests. `<asynchronouslyRetrieveImageForEntity:withFormatName:completionBlock:>` uses
+ `FICImageCachePriorityNormal` and no deadline.
+ 
+ @see setPriority:forImageRetrievalForEntity:withFormatName:
+ */
+- (BOOL)asynchronouslyRetrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(nullable NSDate *)deadline completionBlock:(nullable FICImageCacheCompletionBlock)completionBlock;
+
+/**
+ Asynchronously retrieves the images of several entities at once.
+ 
+ @param entities The entities that uniquely identify the source images.
+ 
+ @param formatName The format name that uniquely identifies which image table to look in for the cached images. Must not be nil.
+ 
+ @param batchCompletionBlock The completion block that is called once on the main thread with every image that was already in the image cache.
+ 
+ The batch completion block's type is defined as follows:
+ 
+     typedef void (^FICImageCacheBatchCompletionBlock)(NSArray <id <FICEntity>> *entities, NSString *formatName, NSArray <UIImage *> *images)
+ 
+ `entities` holds the entities whose images were found, in the order they were requested, and `images` holds their images in the same order. The block is called even if no
+ images were found.
+ 
+ @param completionBlock The completion block that is called on the main thread for each entity whose image wasn't in the image cache, as soon as its image is available or if
+ an error occurs. See `<asynchronouslyRetrieveImageForEntity:withFormatName:completionBlock:>` for more information.
+ 
+ @discussion All of the entities are looked up in a single pass over the image table on the image cache's dispatch queue, and all of the images that were found are delivered
+ in a single callback. For a screenful of images, this costs far less than retrieving each image separately. Source images for the missing entities are requested together,
+ right after the batch completion block is called: they all join the queue of source image requests before any of them is passed on to the delegate. This method uses
+ `FICImageCachePriorityNormal` and no deadline.
+ */
+- (void)asynchronouslyRetrieveImagesForEntities:(NSArray <id <FICEntity>> *)entities withFormatName:(NSString *)formatName batchCompletionBlock:(nullable FICImageCacheBatchCompletionBlock)batchCompletionBlock completionBlock:(nullable FICImageCacheCompletionBlock)completionBlock;
+
+/**
+ Asynchronously retrieves the images of several entities at once, with a given urgency.
+ 
+ @param entities The entities that uniquely identify the source images.
+ 
+ @param formatName The format name that uniquely identifies which image table to look in for the cached images. Must not be nil.
+ 
+ @param priority How urgently the images are needed. See `<asynchronouslyRetrieveImageForEntity:withFormatName:priority:deadline:completionBlock:>` for more information.
+ 
+ @param deadline When the images are needed by, or `nil` if there's no particular time.
+ 
+ @param batchCompletionBlock The completion block that is called once on the main thread with every image that was already in the image cache.
+ 
+ @param completionBlock The completion block that is called on the main thread for each entity whose image wasn't in the image cache.
+ 
+ @discussion See `<asynchronouslyRetrieveImagesForEntities:withFormatName:batchCompletionBlock:completionBlock:>` for more information. The priority and deadline apply to
+ everything done for the missing entities: restoring or downscaling their images, requesting their source images, and processing them.
+ 
+ @see setPriority:forImageRetrievalForEntity:withFormatName:
+ */
+- (void)asynchronouslyRetrieveImagesForEntities:(NSArray <id <FICEntity>> *)entities withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(nullable NSDate *)deadline batchCompletionBlock:(nullable FICImageCacheBatchCompletionBlock)batchCompletionBlock completionBlock:(nullable FICImageCacheCompletionBlock)completionBlock;
+
 /**
  Deletes an image from the image cache.
  
@@ -219,9 +452,31 @@ NS_ASSUME_NONNULL_BEGIN
  
  @discussion After this method is called, the completion block of the <[FICImageCacheDelegate imageCache:wantsSourceImageForEntity:withFormatName:completionBlock:]> delegate
  method for the corresponding entity, if called, does nothing.
+ 
+ If nothing else is waiting on the same source image, its request is dropped right away. A request that hasn't been passed on to the delegate yet is simply removed from the
+ queue, and one that has frees its slot for the next waiting request.
  */
 - (void)cancelImageRetrievalForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName;
     
+///----------------------------------
+/// @name Prioritizing Image Requests
+///----------------------------------
+
+/**
+ Changes how urgently an outstanding image retrieval is needed.
+ 
+ @param priority The new priority of the image retrieval.
+ 
+ @param entity The entity that uniquely identifies the source image.
+ 
+ @param formatName The format name that uniquely identifies which image table to look in for the cached image.
+ 
+ @discussion Call this as cells scroll on and off screen to move their images ahead of or behind other work. It affects the source image request, if it hasn't been passed on
+ to the delegate yet, and the entity's image in that format if it's still waiting to be processed. Images of the entity in other formats keep their priorities, unless they're
+ processed along with it. It does nothing if the image isn't being retrieved.
+ */
+- (void)setPriority:(FICImageCachePriority)priority forImageRetrievalForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName;
+
 ///-----------------------------------
 /// @name Checking for Image Existence
 ///-----------------------------------
@@ -237,6 +492,85 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (BOOL)imageExistsForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName;
 
+///-------------------------------
+/// @name Prefetching Image Data
+///-------------------------------
+
+/**
+ Starts reading the image data of entities that are about to be shown, so their images are already in memory when they're retrieved.
+ 
+ @param entities The entities whose images are expected to be retrieved soon, most urgent first. Typically, these are the rows a scroll view will come to rest on after a fling.
+ 
+ @param formatName The format name that uniquely identifies which image table to prefetch from. Must not be nil.
+ 
+ @discussion Prefetching happens in the background, in batches. Each call replaces the previous list for the same format, and whatever hasn't been prefetched from the previous
+ list yet is skipped. Pass an empty array to stop prefetching for a format.
+ 
+ Entities whose images aren't in the image cache are ignored. Prefetching never asks the delegate for source images.
+ */
+- (void)prefetchImagesForEntities:(NSArray <id <FICEntity>> *)entities withFormatName:(NSString *)formatName;
+
+///-------------------------------------
+/// @name Measuring Image Cache Activity
+///-------------------------------------
+
+/**
+ Returns how the image retrievals for an image format have been served since the image cache was created.
+ 
+ @param formatName The format name that uniquely identifies the image table.
+ 
+ @return Counts of retrievals served by the image table, by its cold storage, by downscaling larger images, and from source images. Each entity counts once per retrieval, whether it was retrieved on its own
+ or in a batch.
+ 
+ @discussion Comparing cold hits to misses shows whether a format's cold storage is large enough, and comparing hot hits to cold hits shows whether its `<[FICImageFormat maximumCount]>`
+ is.
+ */
+- (FICImageCacheRetrievalStatistics)retrievalStatisticsForFormatName:(NSString *)formatName;
+
+/**
+ Returns what the image table for an image format has done since it was opened.
+ 
+ @param formatName The format name that uniquely identifies the image table.
+ 
+ @return The image table's counters and duration histograms, or all zeros if there's no image table with that format name.
+ 
+ @discussion Image tables count everything in counters that are spread across threads and never take a lock, so this is cheap enough to call from any thread, as often as a monitoring timer
+ likes. Use `FICStatisticsHistogramPercentile()` to read percentiles from the histograms.
+ */
+- (FICImageTableStatistics)imageTableStatisticsForFormatName:(NSString *)formatName;
+
+/**
+ Returns what all of the image cache's image tables have done since they were opened, added together.
+ 
+ @return The sums of the image tables' counters, and their duration histograms merged.
+ */
+- (FICImageTableStatistics)imageTableStatistics;
+
+///-----------------------------
+/// @name Tracing Image Requests
+///-----------------------------
+
+/**
+ Whether or not the image cache records how long each stage of retrieving and storing images takes.
+
+ @discussion Defaults to `NO`. While tracing, the image cache records a span, tagged with its entity and format, for every lookup, wait on `<dispatchQueue>` or for a processing job
+ to start, source image fetch, restore from cold storage, downscale, conversion, drawing block, flush to disk, wait for the main queue, and run of completion blocks. Only the
+ 8192 most recent spans are kept. Turning tracing on discards the spans recorded before, so each session starts with an empty trace.
+
+ Tracing costs a few atomic operations per span. While it's off, checking whether it's on is all that's left.
+ */
+@property (nonatomic, assign, getter=isTracingEnabled) BOOL tracingEnabled;
+
+/**
+ Returns the spans recorded while tracing, as a JSON document in the Chrome trace event format.
+
+ @return The document, or `nil` if there wasn't enough memory to create it.
+
+ @discussion Write the document to a file and open it in chrome://tracing or Perfetto to see, thread by thread, where each image's time went. Spans nest on the thread that
+ recorded them, so a flush shows up inside the store that caused it. Tracing doesn't have to be turned off first.
+ */
+- (nullable NSData *)chromeTraceData;
+
 ///--------------------------------
 /// @name Resetting the Image Cache
 ///--------------------------------
@@ -244,6 +578,9 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  Resets the image cache by deleting all image tables and their contents.
  
+ @discussion The reset is ordered with the images being processed. Images already waiting to be drawn are stored before the image tables are reset, and images requested afterwards
+ are only drawn once it's done.
+ 
  @note Resetting an image cache does not reset its image formats.
  */
 - (void)reset;
@@ -10,21 +10,228 @@
 #import "FICEntity.h"
 #import "FICImageTable.h"
 #import "FICImageFormat.h"
+#import "FICImageTableChunkCache.h"
+#import "FICImageTableDiskBudget.h"
+#import "FICImageCacheTrace.h"
 
 #pragma mark Internal Definitions
 
-static void _FICAddCompletionBlockForEntity(NSString *formatName, NSMutableDictionary *entityRequestsDictionary, id <FICEntity> entity, FICImageCacheCompletionBlock completionBlock);
+static const NSUInteger FICImageCacheDefaultMaximumConcurrentSourceImageRequestCount = 8;
 
-static NSString *const FICImageCacheFormatKey = @"FICImageCacheFormatKey";
-static NSString *const FICImageCacheCompletionBlocksKey = @"FICImageCacheCompletionBlocksKey";
-static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
+// Deadlines are kept as times since the reference date. Work without a deadline sorts after all work with one in the same priority class.
+static const NSTimeInterval FICImageCacheNoDeadline = DBL_MAX;
+
+// Other processing keys are a format name and an entity UUID joined by a slash, so this one never collides with them
+static NSString *const FICImageCacheBarrierProcessingKey = @"FICImageCacheBarrier";
+
+// Prefetch lists are worked through this many entities at a time, so a newer list can take over quickly
+static const NSUInteger FICImageCachePrefetchBatchSize = 32;
+
+// Image tables are scrubbed in steps this far apart, each checking as much image data as the scrubbing rate allows for in the meantime
+static const size_t FICImageCacheDefaultScrubbingRate = 1024 * 1024;
+static const NSTimeInterval FICImageCacheScrubbingInterval = 0.5;
+
+// Image tables are compacted the same way, in steps that each move or release as much entry data as the compaction rate allows for
+static const NSTimeInterval FICImageCacheCompactionInterval = 1.0;
+
+typedef NS_ENUM(NSUInteger, FICImageCacheRetrievalResult) {
+    FICImageCacheRetrievalResultHotHit,
+    FICImageCacheRetrievalResultColdHit,
+    FICImageCacheRetrievalResultScaledHit,
+    FICImageCacheRetrievalResultMiss,
+    FICImageCacheRetrievalResultCount,
+};
+
+#pragma mark - Processing Jobs
+
+// Drawing and storing an image for one entity in one format. Jobs with the same processing key are run one at a time, in the order they were added.
+@interface FICImageCacheProcessingJob : NSObject
+
+@property (nonatomic, copy) NSString *processingKey;
+@property (nonatomic, copy) NSString *entityUUID;
+@property (nonatomic, copy) NSString *formatName;
+@property (nonatomic, copy) NSArray *formatNames;                                   // Every format the job stores an image in, starting with formatName
+@property (nonatomic, assign) uint64_t traceStartTime;                              // When the job was added, if the image cache is tracing
+@property (nonatomic, assign) FICImageCachePriority priority;
+@property (nonatomic, assign) NSTimeInterval deadline;
+@property (nonatomic, copy) dispatch_block_t block;
+@property (nonatomic, assign, getter = isBarrier) BOOL barrier;                    // Runs alone, after every job added before it and before every job added after it
+
+@end
+
+@implementation FICImageCacheProcessingJob
+
+@end
+
+static BOOL _FICWorkIsMoreUrgent(FICImageCachePriority priority, NSTimeInterval deadline, FICImageCachePriority otherPriority, NSTimeInterval otherDeadline) {
+    return priority > otherPriority || (priority == otherPriority && deadline < otherDeadline);
+}
+
+static long _FICDispatchQueuePriorityForPriority(FICImageCachePriority priority) {
+    switch (priority) {
+        case FICImageCachePriorityLow:
+            return DISPATCH_QUEUE_PRIORITY_LOW;
+        case FICImageCachePriorityHigh:
+            return DISPATCH_QUEUE_PRIORITY_HIGH;
+        default:
+            return DISPATCH_QUEUE_PRIORITY_DEFAULT;
+    }
+}
+
+#pragma mark - Source Image Requests
+
+typedef NS_ENUM(NSUInteger, FICImageCacheRequestState) {
+    FICImageCacheRequestStatePending,           // Waiting for a free source image request slot
+    FICImageCacheRequestStateFetching,          // The delegate has been asked for the source image
+    FICImageCacheRequestStateFinished,          // The source image was delivered, or the request was canceled
+};
+
+// Everything waiting on one entity's source image
+@interface FICImageCacheEntityRequest : NSObject
+
+@property (nonatomic, strong) id <FICEntity> entity;
+@property (nonatomic, copy) NSString *formatName;                                   // The first format requested for the entity
+@property (nonatomic, assign) FICImageCachePriority priority;
+@property (nonatomic, assign) NSTimeInterval deadline;
+@property (nonatomic, strong, readonly) NSMutableDictionary *completionBlocks;      // Key: format name, value: array of completion blocks
+
+@end
+
+@implementation FICImageCacheEntityRequest
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _completionBlocks = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+@end
+
+// A single source image fetch, shared by every entity whose source image has the same URL. Guarded by synchronizing on the image cache's request table.
+@interface FICImageCacheRequest : NSObject
+
+@property (nonatomic, strong) NSURL *sourceImageURL;
+@property (nonatomic, copy) NSString *entityUUID;                                   // The entity the request was started for
+@property (nonatomic, assign) FICImageCacheRequestState state;
+@property (nonatomic, assign) uint64_t traceStartTime;                              // When the source image was first asked for, if the image cache is tracing
+@property (nonatomic, strong, readonly) NSMutableDictionary *entityRequests;        // Key: entity UUID, value: FICImageCacheEntityRequest
+
+- (void)addCompletionBlock:(FICImageCacheCompletionBlock)completionBlock forEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline;
+
+// The most urgent priority and deadline of any entity waiting on the request
+- (FICImageCachePriority)priority;
+- (NSTimeInterval)deadline;
+
+// The entity request to ask the delegate about, preferring the entity the request was started for
+- (FICImageCacheEntityRequest *)primaryEntityRequest;
+
+@end
+
+@implementation FICImageCacheRequest
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _entityRequests = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)addCompletionBlock:(FICImageCacheCompletionBlock)completionBlock forEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline {
+    NSString *entityUUID = [entity fic_UUID];
+    FICImageCacheEntityRequest *entityRequest = [_entityRequests objectForKey:entityUUID];
+    
+    if (entityRequest == nil) {
+        // This is the first time we're dealing with this particular entity for this URL request.
+        entityRequest = [[FICImageCacheEntityRequest alloc] init];
+        [entityRequest setEntity:entity];
+        [entityRequest setFormatName:formatName];
+        [entityRequest setPriority:priority];
+        [entityRequest setDeadline:deadline];
+        [_entityRequests setObject:entityRequest forKey:entityUUID];
+    } else {
+        // Asking again never makes an entity less urgent. Lowering its priority is done explicitly.
+        [entityRequest setPriority:MAX([entityRequest priority], priority)];
+        [entityRequest setDeadline:MIN([entityRequest deadline], deadline)];
+    }
+    
+    if (completionBlock != nil) {
+        NSMutableArray *completionBlocks = [[entityRequest completionBlocks] objectForKey:formatName];
+        if (completionBlocks == nil) {
+            completionBlocks = [NSMutableArray array];
+            [[entityRequest completionBlocks] setObject:completionBlocks forKey:formatName];
+        }
+        
+        [completionBlocks addObject:[completionBlock copy]];
+    }
+}
+
+- (FICImageCachePriority)priority {
+    FICImageCachePriority priority = FICImageCachePriorityLow;
+    for (FICImageCacheEntityRequest *entityRequest in [_entityRequests objectEnumerator]) {
+        priority = MAX(priority, [entityRequest priority]);
+    }
+    return priority;
+}
+
+- (NSTimeInterval)deadline {
+    NSTimeInterval deadline = FICImageCacheNoDeadline;
+    for (FICImageCacheEntityRequest *entityRequest in [_entityRequests objectEnumerator]) {
+        deadline = MIN(deadline, [entityRequest deadline]);
+    }
+    return deadline;
+}
+
+- (FICImageCacheEntityRequest *)primaryEntityRequest {
+    FICImageCacheEntityRequest *entityRequest = [_entityRequests objectForKey:_entityUUID];
+    if (entityRequest == nil) {
+        entityRequest = [[_entityRequests allValues] firstObject];
+    }
+    return entityRequest;
+}
+
+@end
 
 #pragma mark - Class Extension
 
 @interface FICImageCache () {
     NSMutableDictionary *_formats;
     NSMutableDictionary *_imageTables;
-    NSMutableDictionary *_requests;
+    NSMutableDictionary *_primaryImageTables;                   // Key: format name, value: image table the format's image data is converted from
+    NSMutableDictionary *_largerImageTables;                    // Key: format name, value: image tables the format's missing images can be downscaled from, smallest first
+    
+    // Source image requests, guarded by synchronizing on _requests
+    NSMutableDictionary *_requests;                             // Key: source image URL, value: FICImageCacheRequest
+    NSMutableArray *_pendingRequests;
+    NSUInteger _fetchingRequestCount;
+    NSUInteger _maximumConcurrentSourceImageRequestCount;
+    FICImageCacheRequestOrder _sourceImageRequestOrder;
+    NSUInteger _sourceImageRequestCount;
+    NSUInteger _coalescedSourceImageRequestCount;
+    
+    FICImageTableChunkCache *_chunkCache;
+    FICImageTableDiskBudget *_diskBudget;
+    FICImageCacheTrace *_trace;
+    NSMutableDictionary *_prefetchGenerations;                  // Key: format name, value: number of the latest prefetch list. Guarded by synchronizing on itself.
+    NSMutableDictionary *_retrievalStatisticsIndexes;           // Key: format name, value: index of the format's first counter in _retrievalStatistics. Only changed by setFormats:.
+    FICStatistics _retrievalStatistics;                         // FICImageCacheRetrievalResultCount counters per format, counted without a lock
+    
+    // Scrubbing, guarded by synchronizing on self
+    size_t _scrubbingRate;
+    dispatch_source_t _scrubbingTimer;
+    NSUInteger _scrubbingTableIndex;                            // Only used on the scrubbing queue
+    
+    // Compaction, guarded by synchronizing on self
+    size_t _compactionRate;
+    dispatch_source_t _compactionTimer;
+    NSUInteger _compactionTableIndex;                           // Only used on the compaction queue
+    
+    // Image processing, guarded by synchronizing on _pendingProcessingJobs
+    NSMutableArray *_pendingProcessingJobs;
+    NSMutableSet *_runningProcessingKeys;
+    NSUInteger _maximumConcurrentProcessingCount;
     
     BOOL _delegateImplementsWantsSourceImageForEntityWithFormatNameCompletionBlock;
     BOOL _delegateImplementsShouldProcessAllFormatsInFamilyForEntity;
@@ -53,6 +260,100 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
     }
 }
 
+- (NSUInteger)maximumConcurrentProcessingCount {
+    @synchronized (_pendingProcessingJobs) {
+        return _maximumConcurrentProcessingCount;
+    }
+}
+
+- (void)setMaximumConcurrentProcessingCount:(NSUInteger)maximumConcurrentProcessingCount {
+    @synchronized (_pendingProcessingJobs) {
+        _maximumConcurrentProcessingCount = MAX(maximumConcurrentProcessingCount, 1);
+    }
+    
+    [self _startProcessingJobs];
+}
+
+- (NSUInteger)maximumConcurrentSourceImageRequestCount {
+    @synchronized (_requests) {
+        return _maximumConcurrentSourceImageRequestCount;
+    }
+}
+
+- (void)setMaximumConcurrentSourceImageRequestCount:(NSUInteger)maximumConcurrentSourceImageRequestCount {
+    @synchronized (_requests) {
+        _maximumConcurrentSourceImageRequestCount = MAX(maximumConcurrentSourceImageRequestCount, 1);
+    }
+    
+    [self _startSourceImageRequests];
+}
+
+- (FICImageCacheRequestOrder)sourceImageRequestOrder {
+    @synchronized (_requests) {
+        return _sourceImageRequestOrder;
+    }
+}
+
+- (void)setSourceImageRequestOrder:(FICImageCacheRequestOrder)sourceImageRequestOrder {
+    @synchronized (_requests) {
+        _sourceImageRequestOrder = sourceImageRequestOrder;
+    }
+}
+
+- (NSUInteger)sourceImageRequestCount {
+    @synchronized (_requests) {
+        return _sourceImageRequestCount;
+    }
+}
+
+- (NSUInteger)coalescedSourceImageRequestCount {
+    @synchronized (_requests) {
+        return _coalescedSourceImageRequestCount;
+    }
+}
+
+- (size_t)maximumMappedLength {
+    return [_chunkCache maximumLength];
+}
+
+- (void)setMaximumMappedLength:(size_t)maximumMappedLength {
+    [_chunkCache setMaximumLength:maximumMappedLength];
+}
+
+- (size_t)maximumDiskLength {
+    return [_diskBudget maximumLength];
+}
+
+- (void)setMaximumDiskLength:(size_t)maximumDiskLength {
+    [_diskBudget setMaximumLength:maximumDiskLength];
+}
+
+- (size_t)scrubbingRate {
+    @synchronized (self) {
+        return _scrubbingRate;
+    }
+}
+
+- (void)setScrubbingRate:(size_t)scrubbingRate {
+    @synchronized (self) {
+        _scrubbingRate = scrubbingRate;
+        [self _updateScrubbingTimer];
+    }
+}
+
+- (size_t)compactionRate {
+    @synchronized (self) {
+        return _compactionRate;
+    }
+}
+
+- (void)setCompactionRate:(size_t)compactionRate {
+    @synchronized (self) {
+        _compactionRate = compactionRate;
+        [self _updateCompactionTimer];
+    }
+}
+
 #pragma mark - Object Lifecycle
 
 + (instancetype)sharedImageCache {
@@ -83,12 +384,38 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
     if (self) {
         _formats = [[NSMutableDictionary alloc] init];
         _imageTables = [[NSMutableDictionary alloc] init];
+        _primaryImageTables = [[NSMutableDictionary alloc] init];
+        _largerImageTables = [[NSMutableDictionary alloc] init];
         _requests = [[NSMutableDictionary alloc] init];
+        _pendingRequests = [[NSMutableArray alloc] init];
+        _maximumConcurrentSourceImageRequestCount = FICImageCacheDefaultMaximumConcurrentSourceImageRequestCount;
+        _chunkCache = [[FICImageTableChunkCache alloc] init];
+        _diskBudget = [[FICImageTableDiskBudget alloc] init];
+        _trace = [[FICImageCacheTrace alloc] init];
+        _prefetchGenerations = [[NSMutableDictionary alloc] init];
+        _retrievalStatisticsIndexes = [[NSMutableDictionary alloc] init];
+        _scrubbingRate = FICImageCacheDefaultScrubbingRate;
         _nameSpace = nameSpace;
+        
+        _pendingProcessingJobs = [[NSMutableArray alloc] init];
+        _runningProcessingKeys = [[NSMutableSet alloc] init];
+        // Drawing blocks used to run one at a time, and clients may depend on it, so running them in parallel is opt-in
+        _maximumConcurrentProcessingCount = 1;
     }
     return self;
 }
 
+- (void)dealloc {
+    if (_scrubbingTimer != nil) {
+        dispatch_source_cancel(_scrubbingTimer);
+    }
+    if (_compactionTimer != nil) {
+        dispatch_source_cancel(_compactionTimer);
+    }
+    
+    FICStatisticsDestroy(&_retrievalStatistics);
+}
+
 #pragma mark - Working with Formats
 
 - (void)setFormats:(NSArray *)formats {
@@ -96,6 +423,7 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
         [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s FICImageCache has already been configured with its image formats.", __PRETTY_FUNCTION__]];
     } else {
         NSMutableSet *imageTableFiles = [NSMutableSet set];
+        FICStatisticsInit(&_retrievalStatistics, [formats count] * FICImageCacheRetrievalResultCount, 0);
         FICImageFormatDevices currentDevice = [[UIDevice currentDevice] userInterfaceIdiom] == UIUserInterfaceIdiomPad ? FICImageFormatDevicePad : FICImageFormatDevicePhone;
         for (FICImageFormat *imageFormat in formats) {
             NSString *formatName = [imageFormat name];
@@ -103,14 +431,63 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
             if (devices & currentDevice) {
                 // Only initialize an image table for this format if it is needed on the current device.
                 FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:self];
+                [imageTable setChunkCache:_chunkCache];
+                [imageTable setDiskBudget:_diskBudget];
+                [imageTable setTrace:_trace];
                 [_imageTables setObject:imageTable forKey:formatName];
                 [_formats setObject:imageFormat forKey:formatName];
+                [_retrievalStatisticsIndexes setObject:@([_retrievalStatisticsIndexes count] * FICImageCacheRetrievalResultCount) forKey:formatName];
                 
                 [imageTableFiles addObject:[[imageTable tableFilePath] lastPathComponent]];
                 [imageTableFiles addObject:[[imageTable metadataFilePath] lastPathComponent]];
+                if ([imageFormat coldStorageMaximumLength] > 0) {
+                    [imageTableFiles addObject:[[imageTable coldStorageFilePath] lastPathComponent]];
+                }
             }
         }
         
+        // Formats converted from a primary format are drawn as usual if the primary format isn't suitable
+        for (FICImageFormat *imageFormat in [_formats allValues]) {
+            NSString *primaryFormatName = [imageFormat primaryFormatName];
+            if (primaryFormatName != nil) {
+                FICImageTable *imageTable = [_imageTables objectForKey:[imageFormat name]];
+                FICImageTable *primaryImageTable = [_imageTables objectForKey:primaryFormatName];
+                if ([imageTable canConvertEntriesFromImageTable:primaryImageTable]) {
+                    [_primaryImageTables setObject:primaryImageTable forKey:[imageFormat name]];
+                } else {
+                    [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s image format %@ can't be converted from primary image format %@. Its images will be drawn instead.", __PRETTY_FUNCTION__, [imageFormat name], primaryFormatName]];
+                }
+            }
+        }
+        
+        // Formats that downscale missing images from their family try the smallest larger format first
+        for (FICImageFormat *imageFormat in [_formats allValues]) {
+            if ([imageFormat downscalesFromFamily] && [imageFormat family] != nil) {
+                FICImageTable *imageTable = [_imageTables objectForKey:[imageFormat name]];
+                NSMutableArray *largerImageTables = [NSMutableArray array];
+                for (FICImageTable *otherImageTable in [_imageTables allValues]) {
+                    if ([[[otherImageTable imageFormat] family] isEqualToString:[imageFormat family]] && [imageTable canScaleEntriesFromImageTable:otherImageTable]) {
+                        [largerImageTables addObject:otherImageTable];
+                    }
+                }
+                
+                [largerImageTables sortUsingComparator:^NSComparisonResult(FICImageTable *imageTable1, FICImageTable *imageTable2) {
+                    CGFloat area1 = [[imageTable1 imageFormat] pixelSize].width * [[imageTable1 imageFormat] pixelSize].height;
+                    CGFloat area2 = [[imageTable2 imageFormat] pixelSize].width * [[imageTable2 imageFormat] pixelSize].height;
+                    return area1 < area2 ? NSOrderedAscending : (area1 > area2 ? NSOrderedDescending : NSOrderedSame);
+                }];
+                
+                if ([largerImageTables count] > 0) {
+                    [_largerImageTables setObject:largerImageTables forKey:[imageFormat name]];
+                }
+            }
+        }
+        
+        @synchronized (self) {
+            [self _updateScrubbingTimer];
+            [self _updateCompactionTimer];
+        }
+        
         // Remove any extraneous files in the image tables directory
         NSFileManager *fileManager = [NSFileManager defaultManager];
         NSString *directoryPath = [FICImageTable directoryPath];
@@ -150,14 +527,19 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
 #pragma mark - Retrieving Images
 
 - (BOOL)retrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName completionBlock:(FICImageCacheCompletionBlock)completionBlock {
-    return [self _retrieveImageForEntity:entity withFormatName:formatName loadSynchronously:YES completionBlock:completionBlock];
+    return [self _retrieveImageForEntity:entity withFormatName:formatName loadSynchronously:YES priority:FICImageCachePriorityNormal deadline:FICImageCacheNoDeadline completionBlock:completionBlock];
 }
 
 - (BOOL)asynchronouslyRetrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName completionBlock:(FICImageCacheCompletionBlock)completionBlock {
-    return [self _retrieveImageForEntity:entity withFormatName:formatName loadSynchronously:NO completionBlock:completionBlock];
+    return [self _retrieveImageForEntity:entity withFormatName:formatName loadSynchronously:NO priority:FICImageCachePriorityNormal deadline:FICImageCacheNoDeadline completionBlock:completionBlock];
 }
 
-- (BOOL)_retrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName loadSynchronously:(BOOL)loadSynchronously completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+- (BOOL)asynchronouslyRetrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSDate *)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    NSTimeInterval deadlineTime = deadline != nil ? [deadline timeIntervalSinceReferenceDate] : FICImageCacheNoDeadline;
+    return [self _retrieveImageForEntity:entity withFormatName:formatName loadSynchronously:NO priority:priority deadline:deadlineTime completionBlock:completionBlock];
+}
+
+- (BOOL)_retrieveImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName loadSynchronously:(BOOL)loadSynchronously priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
     NSParameterAssert(formatName);
 	
     BOOL imageExists = NO;
@@ -166,142 +548,415 @@ static NSString *const FICImageCacheEntityKey = @"FICImageCacheEntityKey";
     NSString *entityUUID = [entity fic_UUID];
     NSString *sourceImageUUID = [entity fic_sourceImageUUID];
     
+    FICImageCacheTrace *trace = _trace;
+    
     if (loadSynchronously == NO && [imageTable entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]) {
         imageExists = YES;
+        [self _recordRetrievalResult:FICImageCacheRetrievalResultHotHit count:1 formatName:formatName];
         
+        uint64_t queueWaitStartTime = [trace spanStartTime];
         dispatch_async([FICImageCache dispatchQueue], ^{
+            [trace recordSpanForStage:FICTraceStageQueueWait startTime:queueWaitStartTime entityUUID:entityUUID formatName:formatName];
+            
+            uint64_t lookupStartTime = [trace spanStartTime];
             UIImage *image = [imageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:YES];
+            [trace recordSpanForStage:FICTraceStageLookup startTime:lookupStartTime entityUUID:entityUUID formatName:formatName];
             
             if (completionBlock != nil) {
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    completionBlock(entity, formatName, image);
-                });
+                [self _callCompletionBlocks:@[completionBlock] forEntity:entity entityUUID:entityUUID formatName:formatName image:image];
             }
         });
     } else {
+        uint64_t lookupStartTime = [trace spanStartTime];
         UIImage *image = [imageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:NO];
+        [trace recordSpanForStage:FICTraceStageLookup startTime:lookupStartTime entityUUID:entityUUID formatName:formatName];
         imageExists = image != nil;
         
         dispatch_block_t completionBlockCallingBlock = ^{
             if (completionBlock != nil) {
                 if (loadSynchronously) {
+                    uint64_t completionStartTime = [trace spanStartTime];
                     completionBlock(entity, formatName, image);
+                    [trace recordSpanForStage:FICTraceStageCompletion startTime:completionStartTime entityUUID:entityUUID formatName:formatName];
                 } else {
-                    dispatch_async(dispatch_get_main_queue(), ^{
-                        completionBlock(entity, formatName, image);
-                    });
+                    [self _callCompletionBlocks:@[completionBlock] forEntity:entity entityUUID:entityUUID formatName:formatName image:image];
                 }
             }
         };
         
         if (image == nil) {
-            // No image for this UUID exists in the image table. We'll need to ask the delegate to retrieve the source asset.
-            NSURL *sourceImageURL = [entity fic_sourceImageURLWithFormatName:formatName];
+            // No image for this UUID exists in the image table. It's restored from cold storage or downscaled from a larger format if it can be, and otherwise we'll need to ask the
+            // delegate to retrieve the source asset.
+            if ([self _retrieveMissingImageForEntity:entity withFormatName:formatName priority:priority deadline:deadline completionBlock:completionBlock] == NO) {
+                completionBlockCallingBlock();
+            }
+        } else {
+            [self _recordRetrievalResult:FICImageCacheRetrievalResultHotHit count:1 formatName:formatName];
+            completionBlockCallingBlock();
+        }
+    }
+    
+    return imageExists;
+}
+
+- (void)asynchronouslyRetrieveImagesForEntities:(NSArray *)entities withFormatName:(NSString *)formatName batchCompletionBlock:(FICImageCacheBatchCompletionBlock)batchCompletionBlock completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    [self asynchronouslyRetrieveImagesForEntities:entities withFormatName:formatName priority:FICImageCachePriorityNormal deadline:nil batchCompletionBlock:batchCompletionBlock completionBlock:completionBlock];
+}
+
+- (void)asynchronouslyRetrieveImagesForEntities:(NSArray *)entities withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSDate *)deadline batchCompletionBlock:(FICImageCacheBatchCompletionBlock)batchCompletionBlock completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    NSParameterAssert(formatName);
+    NSTimeInterval deadlineTime = deadline != nil ? [deadline timeIntervalSinceReferenceDate] : FICImageCacheNoDeadline;
+    
+    FICImageTable *imageTable = [_imageTables objectForKey:formatName];
+    if (imageTable == nil) {
+        [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s Couldn't find image table with format name %@", __PRETTY_FUNCTION__, formatName]];
+        
+        // The completion blocks are still called, so callers waiting on them aren't left hanging
+        NSArray *missingEntities = [entities copy];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (batchCompletionBlock != nil) {
+                batchCompletionBlock(@[], formatName, @[]);
+            }
+            
+            if (completionBlock != nil) {
+                for (id <FICEntity> entity in missingEntities) {
+                    completionBlock(entity, formatName, nil);
+                }
+            }
+        });
+        
+        return;
+    }
+    
+    // Entities are asked for their UUIDs on the calling thread, since they may not be thread-safe
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:[entities count]];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:[entities count]];
+    for (id <FICEntity> entity in entities) {
+        [entityUUIDs addObject:[entity fic_UUID] ?: @""];
+        [sourceImageUUIDs addObject:[entity fic_sourceImageUUID] ?: @""];
+    }
+    
+    FICImageCacheTrace *trace = _trace;
+    uint64_t queueWaitStartTime = [trace spanStartTime];
+    dispatch_async([FICImageCache dispatchQueue], ^{
+        [trace recordSpanForStage:FICTraceStageQueueWait startTime:queueWaitStartTime entityUUID:nil formatName:formatName];
+        
+        // Every entity is looked up in one pass over the image table
+        uint64_t lookupStartTime = [trace spanStartTime];
+        NSArray *images = [imageTable newImagesForEntityUUIDs:entityUUIDs sourceImageUUIDs:sourceImageUUIDs preheatData:YES];
+        [trace recordSpanForStage:FICTraceStageLookup startTime:lookupStartTime entityUUID:nil formatName:formatName];
+        
+        NSMutableArray *foundEntities = [NSMutableArray arrayWithCapacity:[entities count]];
+        NSMutableArray *foundImages = [NSMutableArray arrayWithCapacity:[entities count]];
+        NSMutableArray *missingEntities = [NSMutableArray array];
+        [entities enumerateObjectsUsingBlock:^(id <FICEntity> entity, NSUInteger index, BOOL *stop) {
+            UIImage *image = index < [images count] ? [images objectAtIndex:index] : nil;
+            if ([image isKindOfClass:[UIImage class]]) {
+                [foundEntities addObject:entity];
+                [foundImages addObject:image];
+            } else {
+                [missingEntities addObject:entity];
+            }
+        }];
+        
+        [self _recordRetrievalResult:FICImageCacheRetrievalResultHotHit count:[foundEntities count] formatName:formatName];
+        
+        uint64_t mainQueueWaitStartTime = [trace spanStartTime];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [trace recordSpanForStage:FICTraceStageMainQueueWait startTime:mainQueueWaitStartTime entityUUID:nil formatName:formatName];
+            
+            if (batchCompletionBlock != nil) {
+                uint64_t completionStartTime = [trace spanStartTime];
+                batchCompletionBlock(foundEntities, formatName, foundImages);
+                [trace recordSpanForStage:FICTraceStageCompletion startTime:completionStartTime entityUUID:nil formatName:formatName];
+            }
             
-            if (sourceImageURL != nil) {
-                // We check to see if this image is already being fetched.
-                BOOL needsToFetch = NO;
-                @synchronized (_requests) {
-                    NSMutableDictionary *requestDictionary = [_requests objectForKey:sourceImageURL];
-                    if (requestDictionary == nil) {
-                        // If we're here, then we aren't currently fetching this image.
-                        requestDictionary = [NSMutableDictionary dictionary];
-                        [_requests setObject:requestDictionary forKey:sourceImageURL];
-                        needsToFetch = YES;
+            // Images that can't be restored or downscaled have their source images requested together
+            NSMutableArray *sourceImageEntities = [NSMutableArray array];
+            for (id <FICEntity> entity in missingEntities) {
+                if ([self _restoreOrDownscaleMissingImageForEntity:entity withFormatName:formatName priority:priority deadline:deadlineTime completionBlock:completionBlock] == NO) {
+                    [sourceImageEntities addObject:entity];
+                }
+            }
+            
+            if ([sourceImageEntities count] > 0) {
+                [self _recordRetrievalResult:FICImageCacheRetrievalResultMiss count:[sourceImageEntities count] formatName:formatName];
+                
+                NSArray *unrequestedEntities = [self _requestSourceImagesForEntities:sourceImageEntities withFormatName:formatName priority:priority deadline:deadlineTime completionBlock:completionBlock];
+                for (id <FICEntity> entity in unrequestedEntities) {
+                    if (completionBlock != nil) {
+                        completionBlock(entity, formatName, nil);
                     }
-                    
-                    _FICAddCompletionBlockForEntity(formatName, requestDictionary, entity, completionBlock);
                 }
+            }
+        });
+    });
+}
 
-                if (needsToFetch) {
-                    @autoreleasepool {
-                        UIImage *image;
-                        if ([entity respondsToSelector:@selector(fic_imageForFormat:)]){
-                            FICImageFormat *format = [self formatWithName:formatName];
-                            image = [entity fic_imageForFormat:format];
-                        }
-                        
-                        if (image){
-                            [self _imageDidLoad:image forURL:sourceImageURL];
-                        } else if (_delegateImplementsWantsSourceImageForEntityWithFormatNameCompletionBlock){
-                            [_delegate imageCache:self wantsSourceImageForEntity:entity withFormatName:formatName completionBlock:^(UIImage *sourceImage) {
-                                [self _imageDidLoad:sourceImage forURL:sourceImageURL];
-                            }];
-                        }
-                    }
+// Returns NO if the entity has no image data in cold storage, no larger image to downscale, and no source image to request
+- (BOOL)_retrieveMissingImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    if ([self _restoreOrDownscaleMissingImageForEntity:entity withFormatName:formatName priority:priority deadline:deadline completionBlock:completionBlock]) {
+        return YES;
+    }
+    
+    [self _recordRetrievalResult:FICImageCacheRetrievalResultMiss count:1 formatName:formatName];
+    
+    return [self _requestSourceImageForEntity:entity withFormatName:formatName priority:priority deadline:deadline completionBlock:completionBlock];
+}
+
+// Returns NO, without requesting the source image, if the entity has no image data in cold storage and no larger image to downscale
+- (BOOL)_restoreOrDownscaleMissingImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    FICImageTable *imageTable = [_imageTables objectForKey:formatName];
+    NSString *entityUUID = [entity fic_UUID];
+    NSString *sourceImageUUID = [entity fic_sourceImageUUID];
+    
+    // Image data in cold storage is exactly what was drawn, so it's preferred over downscaling a larger image
+    BOOL coldEntryExists = [imageTable coldEntryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID];
+    FICImageTable *largerImageTable = nil;
+    if (coldEntryExists == NO) {
+        for (FICImageTable *otherImageTable in [_largerImageTables objectForKey:formatName]) {
+            if ([otherImageTable entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]) {
+                largerImageTable = otherImageTable;
+                break;
+            }
+        }
+    }
+    
+    if (coldEntryExists == NO && largerImageTable == nil) {
+        return NO;
+    }
+    
+    // Restoring or downscaling an entry uses the same processing key as drawing it, so they never run at the same time
+    NSString *processingKey = [NSString stringWithFormat:@"%@/%@", formatName, entityUUID];
+    FICImageCacheTrace *trace = _trace;
+    [self _addProcessingJobWithKey:processingKey formatNames:@[formatName] entityUUID:entityUUID priority:priority deadline:deadline block:^{
+        FICImageCacheRetrievalResult result = FICImageCacheRetrievalResultMiss;
+        if (coldEntryExists) {
+            uint64_t restoreStartTime = [trace spanStartTime];
+            if ([imageTable restoreEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]) {
+                result = FICImageCacheRetrievalResultColdHit;
+            }
+            [trace recordSpanForStage:FICTraceStageRestore startTime:restoreStartTime entityUUID:entityUUID formatName:formatName];
+        } else if (largerImageTable != nil) {
+            uint64_t scaleStartTime = [trace spanStartTime];
+            if ([imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID scalingEntryFromImageTable:largerImageTable]) {
+                result = FICImageCacheRetrievalResultScaledHit;
+            }
+            [trace recordSpanForStage:FICTraceStageScale startTime:scaleStartTime entityUUID:entityUUID formatName:formatName];
+        }
+        
+        UIImage *image = nil;
+        if (result != FICImageCacheRetrievalResultMiss) {
+            uint64_t lookupStartTime = [trace spanStartTime];
+            image = [imageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:NO];
+            [trace recordSpanForStage:FICTraceStageLookup startTime:lookupStartTime entityUUID:entityUUID formatName:formatName];
+        }
+        
+        uint64_t mainQueueWaitStartTime = [trace spanStartTime];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [trace recordSpanForStage:FICTraceStageMainQueueWait startTime:mainQueueWaitStartTime entityUUID:entityUUID formatName:formatName];
+            
+            if (image != nil) {
+                [self _recordRetrievalResult:result count:1 formatName:formatName];
+                
+                if (completionBlock != nil) {
+                    uint64_t completionStartTime = [trace spanStartTime];
+                    completionBlock(entity, formatName, image);
+                    [trace recordSpanForStage:FICTraceStageCompletion startTime:completionStartTime entityUUID:entityUUID formatName:formatName];
                 }
             } else {
-                NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s entity %@ returned a nil source image URL for image format %@.", __PRETTY_FUNCTION__, entity, formatName];
-                [self _logMessage:message];
+                // The image data couldn't be restored or downscaled, so the image has to be created from its source image after all
+                [self _recordRetrievalResult:FICImageCacheRetrievalResultMiss count:1 formatName:formatName];
                 
-                completionBlockCallingBlock();
+                if ([self _requestSourceImageForEntity:entity withFormatName:formatName priority:priority deadline:deadline completionBlock:completionBlock] == NO && completionBlock != nil) {
+                    completionBlock(entity, formatName, nil);
+                }
             }
+        });
+    }];
+    
+    return YES;
+}
+
+// Returns NO if the entity has no source image to request
+- (BOOL)_requestSourceImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    return [[self _requestSourceImagesForEntities:@[entity] withFormatName:formatName priority:priority deadline:deadline completionBlock:completionBlock] count] == 0;
+}
+
+// Requests the source images of several entities at once. Requests that go to the delegate join the queue together before any of them is started, so the most urgent of them
+// go first. Returns the entities whose source images couldn't be requested.
+- (NSArray *)_requestSourceImagesForEntities:(NSArray *)entities withFormatName:(NSString *)formatName priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline completionBlock:(FICImageCacheCompletionBlock)completionBlock {
+    NSMutableArray *unrequestedEntities = [NSMutableArray array];
+    NSMutableArray *requestedEntities = [NSMutableArray arrayWithCapacity:[entities count]];
+    NSMutableArray *sourceImageURLs = [NSMutableArray arrayWithCapacity:[entities count]];
+    for (id <FICEntity> entity in entities) {
+        NSURL *sourceImageURL = [entity fic_sourceImageURLWithFormatName:formatName];
+        
+        if (sourceImageURL == nil) {
+            NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s entity %@ returned a nil source image URL for image format %@.", __PRETTY_FUNCTION__, entity, formatName];
+            [self _logMessage:message];
+            [unrequestedEntities addObject:entity];
         } else {
-            completionBlockCallingBlock();
+            [requestedEntities addObject:entity];
+            [sourceImageURLs addObject:sourceImageURL];
         }
     }
     
-    return imageExists;
-}
-
-- (void)_imageDidLoad:(UIImage *)image forURL:(NSURL *)URL {
-    NSDictionary *requestDictionary;
+    // We check to see if these images are already being fetched.
+    NSMutableArray *requestsToFetch = [NSMutableArray array];
+    NSMutableArray *entitiesToFetch = [NSMutableArray array];
     @synchronized (_requests) {
-        requestDictionary = [_requests objectForKey:URL];
-        [_requests removeObjectForKey:URL];
-        // Now safe to use requestsDictionary outside the lock, because we've taken ownership from _requests
-    }
-
-    if (requestDictionary != nil) {
-        for (NSMutableDictionary *entityDictionary in [requestDictionary allValues]) {
-            id <FICEntity> entity = [entityDictionary objectForKey:FICImageCacheEntityKey];
-            NSString *formatName = [entityDictionary objectForKey:FICImageCacheFormatKey];
-            NSDictionary *completionBlocksDictionary = [entityDictionary objectForKey:FICImageCacheCompletionBlocksKey];
-            if (image != nil){
-                [self _processImage:image forEntity:entity completionBlocksDictionary:completionBlocksDictionary];
+        for (NSUInteger index = 0; index < [requestedEntities count]; index++) {
+            id <FICEntity> entity = [requestedEntities objectAtIndex:index];
+            NSURL *sourceImageURL = [sourceImageURLs objectAtIndex:index];
+            FICImageCacheRequest *request = [_requests objectForKey:sourceImageURL];
+            if (request == nil) {
+                // If we're here, then we aren't currently fetching this image.
+                request = [[FICImageCacheRequest alloc] init];
+                [request setSourceImageURL:sourceImageURL];
+                [request setEntityUUID:[entity fic_UUID]];
+                [request setTraceStartTime:[_trace spanStartTime]];
+                [_requests setObject:request forKey:sourceImageURL];
+                [requestsToFetch addObject:request];
+                [entitiesToFetch addObject:entity];
             } else {
-                NSArray *completionBlocks = [completionBlocksDictionary objectForKey:formatName];
-                if (completionBlocks != nil) {
-                    dispatch_async(dispatch_get_main_queue(), ^{
-                        for (FICImageCacheCompletionBlock completionBlock in completionBlocks) {
-                            completionBlock(entity, formatName, nil);
-                        }
-                    });
+                _coalescedSourceImageRequestCount++;
+            }
+            
+            [request addCompletionBlock:completionBlock forEntity:entity withFormatName:formatName priority:priority deadline:deadline];
+        }
+    }
+    
+    NSMutableArray *delegateRequests = [NSMutableArray array];
+    for (NSUInteger index = 0; index < [requestsToFetch count]; index++) {
+        @autoreleasepool {
+            FICImageCacheRequest *request = [requestsToFetch objectAtIndex:index];
+            id <FICEntity> entity = [entitiesToFetch objectAtIndex:index];
+            UIImage *image;
+            if ([entity respondsToSelector:@selector(fic_imageForFormat:)]){
+                FICImageFormat *format = [self formatWithName:formatName];
+                image = [entity fic_imageForFormat:format];
+            }
+            
+            if (image){
+                [self _sourceImage:image didLoadForRequest:request];
+            } else if (_delegateImplementsWantsSourceImageForEntityWithFormatNameCompletionBlock){
+                [delegateRequests addObject:request];
+            }
+        }
+    }
+    
+    if ([delegateRequests count] > 0) {
+        // Delegate fetches wait their turn, so that a burst of misses doesn't start hundreds of source image loads at once
+        @synchronized (_requests) {
+            for (FICImageCacheRequest *request in delegateRequests) {
+                if ([request state] == FICImageCacheRequestStatePending) {
+                    [_pendingRequests addObject:request];
                 }
             }
         }
+        
+        [self _startSourceImageRequests];
     }
+    
+    return unrequestedEntities;
 }
 
-static void _FICAddCompletionBlockForEntity(NSString *formatName, NSMutableDictionary *entityRequestsDictionary, id <FICEntity> entity, FICImageCacheCompletionBlock completionBlock) {
-    NSString *entityUUID = [entity fic_UUID];
-    NSMutableDictionary *requestDictionary = [entityRequestsDictionary objectForKey:entityUUID];
-    NSMutableDictionary *completionBlocks = nil;
+- (void)_startSourceImageRequests {
+    NSMutableArray *requestsToStart = [NSMutableArray array];
+    NSMutableArray *entityRequestsToStart = [NSMutableArray array];
     
-    if (requestDictionary == nil) {
-        // This is the first time we're dealing with this particular entity for this URL request.
-        requestDictionary = [NSMutableDictionary dictionaryWithObjectsAndKeys:entity, FICImageCacheEntityKey, nil];
-        [entityRequestsDictionary setObject:requestDictionary forKey:entityUUID];
-        [requestDictionary setObject:formatName forKey:FICImageCacheFormatKey];
-        
-        // Dictionary where keys are imageFormats, and each value is an array of the completion blocks for the requests for this
-        // URL at the specified format.
-        completionBlocks = [NSMutableDictionary dictionary];
-        [requestDictionary setObject:completionBlocks forKey:FICImageCacheCompletionBlocksKey];
-    } else {
-        // We already have a request dictionary for this entity, so we just need to append a completion block.
-        completionBlocks = [requestDictionary objectForKey:FICImageCacheCompletionBlocksKey];
+    @synchronized (_requests) {
+        while (_fetchingRequestCount < _maximumConcurrentSourceImageRequestCount && [_pendingRequests count] > 0) {
+            NSUInteger requestIndex = [self _indexOfNextPendingRequest];
+            FICImageCacheRequest *request = [_pendingRequests objectAtIndex:requestIndex];
+            [_pendingRequests removeObjectAtIndex:requestIndex];
+            
+            [request setState:FICImageCacheRequestStateFetching];
+            _fetchingRequestCount++;
+            _sourceImageRequestCount++;
+            
+            [requestsToStart addObject:request];
+            [entityRequestsToStart addObject:[request primaryEntityRequest]];
+        }
     }
     
-    if (completionBlock != nil) {
-        NSMutableArray *blocksArray = [completionBlocks objectForKey:formatName];
-        if (blocksArray == nil) {
-            blocksArray = [NSMutableArray array];
-            [completionBlocks setObject:blocksArray forKey:formatName];
+    [requestsToStart enumerateObjectsUsingBlock:^(FICImageCacheRequest *request, NSUInteger index, BOOL *stop) {
+        FICImageCacheEntityRequest *entityRequest = [entityRequestsToStart objectAtIndex:index];
+        [_delegate imageCache:self wantsSourceImageForEntity:[entityRequest entity] withFormatName:[entityRequest formatName] completionBlock:^(UIImage *sourceImage) {
+            [self _sourceImage:sourceImage didLoadForRequest:request];
+        }];
+    }];
+}
+
+// The most urgent request goes first. Requests that are equally urgent go in the configured order. The caller must synchronize on _requests.
+- (NSUInteger)_indexOfNextPendingRequest {
+    BOOL lastInFirstOut = _sourceImageRequestOrder == FICImageCacheRequestOrderLastInFirstOut;
+    NSUInteger nextRequestIndex = 0;
+    FICImageCachePriority nextPriority = [[_pendingRequests firstObject] priority];
+    NSTimeInterval nextDeadline = [[_pendingRequests firstObject] deadline];
+    
+    for (NSUInteger requestIndex = 1; requestIndex < [_pendingRequests count]; requestIndex++) {
+        FICImageCacheRequest *request = [_pendingRequests objectAtIndex:requestIndex];
+        FICImageCachePriority priority = [request priority];
+        NSTimeInterval deadline = [request deadline];
+        
+        BOOL isNext = _FICWorkIsMoreUrgent(priority, deadline, nextPriority, nextDeadline);
+        if (isNext == NO && lastInFirstOut) {
+            isNext = _FICWorkIsMoreUrgent(nextPriority, nextDeadline, priority, deadline) == NO;
         }
         
-        FICImageCacheCompletionBlock completionBlockCopy = [completionBlock copy];
-        [blocksArray addObject:completionBlockCopy];
+        if (isNext) {
+            nextRequestIndex = requestIndex;
+            nextPriority = priority;
+            nextDeadline = deadline;
+        }
+    }
+    
+    return nextRequestIndex;
+}
+
+- (void)_sourceImage:(UIImage *)image didLoadForRequest:(FICImageCacheRequest *)request {
+    NSArray *entityRequests = nil;
+    BOOL requestWasFetching = NO;
+    @synchronized (_requests) {
+        // Canceled requests have already given up their slot, and anything waiting on them is gone
+        if ([request state] == FICImageCacheRequestStateFinished) {
+            return;
+        }
+        
+        requestWasFetching = [request state] == FICImageCacheRequestStateFetching;
+        if (requestWasFetching) {
+            _fetchingRequestCount--;
+        }
+        
+        [request setState:FICImageCacheRequestStateFinished];
+        if ([_requests objectForKey:[request sourceImageURL]] == request) {
+            [_requests removeObjectForKey:[request sourceImageURL]];
+        }
+        
+        // Now safe to use the entity requests outside the lock, because we've taken ownership from _requests
+        entityRequests = [[request entityRequests] allValues];
+    }
+
+    for (FICImageCacheEntityRequest *entityRequest in entityRequests) {
+        id <FICEntity> entity = [entityRequest entity];
+        NSString *formatName = [entityRequest formatName];
+        NSDictionary *completionBlocksDictionary = [entityRequest completionBlocks];
+        [_trace recordSpanForStage:FICTraceStageSourceImageFetch startTime:[request traceStartTime] entityUUID:[entity fic_UUID] formatName:formatName];
+        
+        if (image != nil){
+            [self _processImage:image forEntity:entity completionBlocksDictionary:completionBlocksDictionary priority:[entityRequest priority] deadline:[entityRequest deadline]];
+        } else {
+            NSArray *completionBlocks = [completionBlocksDictionary objectForKey:formatName];
+            if (completionBlocks != nil) {
+                [self _callCompletionBlocks:completionBlocks forEntity:entity entityUUID:[entity fic_UUID] formatName:formatName image:nil];
+            }
+        }
+    }
+    
+    if (requestWasFetching) {
+        [self _startSourceImageRequests];
     }
 }
 
@@ -320,53 +975,207 @@ static void _FICAddCompletionBlockForEntity(NSString *formatName, NSMutableDicti
         if (imageTable) {
             [imageTable deleteEntryForEntityUUID:entityUUID];
         
-            [self _processImage:image forEntity:entity completionBlocksDictionary:completionBlocksDictionary];
+            [self _processImage:image forEntity:entity completionBlocksDictionary:completionBlocksDictionary priority:FICImageCachePriorityNormal deadline:FICImageCacheNoDeadline];
         } else {
             [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s Couldn't find image table with format name %@", __PRETTY_FUNCTION__, formatName]];
         }
     }
 }
 
-- (void)_processImage:(UIImage *)image forEntity:(id <FICEntity>)entity completionBlocksDictionary:(NSDictionary *)completionBlocksDictionary {
-    for (NSString *formatToProcess in [self formatsToProcessForCompletionBlocks:completionBlocksDictionary
-                                                                         entity:entity]) {
+- (void)_processImage:(UIImage *)image forEntity:(id <FICEntity>)entity completionBlocksDictionary:(NSDictionary *)completionBlocksDictionary priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline {
+    NSSet *formatsToProcess = [self formatsToProcessForCompletionBlocks:completionBlocksDictionary entity:entity];
+    
+    // Formats converted from a primary format that is being processed too are processed right after it, as part of the same job, so the primary format's image data is ready for them
+    NSMutableDictionary *derivedImageTables = [NSMutableDictionary dictionary];     // Key: primary format name, value: image tables converted from it
+    NSMutableArray *imageTablesToProcess = [NSMutableArray array];
+    for (NSString *formatToProcess in formatsToProcess) {
         FICImageTable *imageTable = [_imageTables objectForKey:formatToProcess];
-        NSArray *completionBlocks = [completionBlocksDictionary objectForKey:formatToProcess];
-        [self _processImage:image forEntity:entity imageTable:imageTable completionBlocks:completionBlocks];
-    }
-}
-
-- (void)_processImage:(UIImage *)image forEntity:(id <FICEntity>)entity imageTable:(FICImageTable *)imageTable completionBlocks:(NSArray *)completionBlocks {
-    if (imageTable != nil) {
-        if ([entity fic_UUID] == nil) {
-            [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s entity %@ is missing its UUID.", __PRETTY_FUNCTION__, entity]];
-            return;
+        if (imageTable == nil) {
+            continue;
         }
         
-        if ([entity fic_sourceImageUUID] == nil) {
-            [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s entity %@ is missing its source image UUID.", __PRETTY_FUNCTION__, entity]];
-            return;
+        NSString *primaryFormatName = [[[_primaryImageTables objectForKey:formatToProcess] imageFormat] name];
+        if (primaryFormatName != nil && [formatsToProcess containsObject:primaryFormatName]) {
+            NSMutableArray *imageTables = [derivedImageTables objectForKey:primaryFormatName];
+            if (imageTables == nil) {
+                imageTables = [NSMutableArray array];
+                [derivedImageTables setObject:imageTables forKey:primaryFormatName];
+            }
+            
+            [imageTables addObject:imageTable];
+        } else {
+            [imageTablesToProcess addObject:imageTable];
         }
-        
-        NSString *entityUUID = [entity fic_UUID];
-        NSString *sourceImageUUID = [entity fic_sourceImageUUID];
-        FICImageFormat *imageFormat = [imageTable imageFormat];
-        NSString *imageFormatName = [imageFormat name];
-        FICEntityImageDrawingBlock imageDrawingBlock = [entity fic_drawingBlockForImage:image withFormatName:imageFormatName];
-        
-        dispatch_async([FICImageCache dispatchQueue], ^{
-            [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:imageDrawingBlock];
+    }
+    
+    for (FICImageTable *imageTable in imageTablesToProcess) {
+        NSArray *imageTables = [@[imageTable] arrayByAddingObjectsFromArray:[derivedImageTables objectForKey:[[imageTable imageFormat] name]]];
+        [self _processImage:image forEntity:entity imageTables:imageTables completionBlocksDictionary:completionBlocksDictionary priority:priority deadline:deadline];
+    }
+}
 
+// Processes the image for the first image table, then for the rest of them in order
+- (void)_processImage:(UIImage *)image forEntity:(id <FICEntity>)entity imageTables:(NSArray *)imageTables completionBlocksDictionary:(NSDictionary *)completionBlocksDictionary priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline {
+    if ([entity fic_UUID] == nil) {
+        [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s entity %@ is missing its UUID.", __PRETTY_FUNCTION__, entity]];
+        return;
+    }
+    
+    if ([entity fic_sourceImageUUID] == nil) {
+        [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s entity %@ is missing its source image UUID.", __PRETTY_FUNCTION__, entity]];
+        return;
+    }
+    
+    NSString *entityUUID = [entity fic_UUID];
+    NSString *sourceImageUUID = [entity fic_sourceImageUUID];
+    
+    NSMutableArray *formatNames = [NSMutableArray arrayWithCapacity:[imageTables count]];
+    NSMutableArray *imageDrawingBlocks = [NSMutableArray arrayWithCapacity:[imageTables count]];
+    NSMutableArray *primaryImageTables = [NSMutableArray arrayWithCapacity:[imageTables count]];
+    for (FICImageTable *imageTable in imageTables) {
+        NSString *imageFormatName = [[imageTable imageFormat] name];
+        [formatNames addObject:imageFormatName];
+        FICEntityImageDrawingBlock imageDrawingBlock = [entity fic_drawingBlockForImage:image withFormatName:imageFormatName];
+        FICImageTable *primaryImageTable = [_primaryImageTables objectForKey:imageFormatName];
+        [imageDrawingBlocks addObject:imageDrawingBlock != nil ? [imageDrawingBlock copy] : [NSNull null]];
+        [primaryImageTables addObject:primaryImageTable != nil ? primaryImageTable : [NSNull null]];
+    }
+    
+    NSString *firstFormatName = [[[imageTables firstObject] imageFormat] name];
+    NSString *processingKey = [NSString stringWithFormat:@"%@/%@", firstFormatName, entityUUID];
+    FICImageCacheTrace *trace = _trace;
+    [self _addProcessingJobWithKey:processingKey formatNames:formatNames entityUUID:entityUUID priority:priority deadline:deadline block:^{
+        [imageTables enumerateObjectsUsingBlock:^(FICImageTable *imageTable, NSUInteger index, BOOL *stop) {
+            NSString *formatName = [[imageTable imageFormat] name];
+            
+            // Image data is only drawn if it can't be converted from the primary format
+            FICImageTable *primaryImageTable = [primaryImageTables objectAtIndex:index];
+            BOOL entryWasConverted = NO;
+            if (primaryImageTable != (id)[NSNull null]) {
+                uint64_t convertStartTime = [trace spanStartTime];
+                entryWasConverted = [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID convertingEntryFromImageTable:primaryImageTable];
+                [trace recordSpanForStage:FICTraceStageConvert startTime:convertStartTime entityUUID:entityUUID formatName:formatName];
+            }
+            
+            FICEntityImageDrawingBlock imageDrawingBlock = [imageDrawingBlocks objectAtIndex:index];
+            if (entryWasConverted == NO && imageDrawingBlock != (id)[NSNull null]) {
+                if ([trace isEnabled]) {
+                    // The drawing block is traced on its own, so the time the image table spends around it shows up as the rest of the store
+                    FICEntityImageDrawingBlock untracedDrawingBlock = imageDrawingBlock;
+                    imageDrawingBlock = ^(CGContextRef context, CGSize contextSize) {
+                        uint64_t drawStartTime = [trace spanStartTime];
+                        untracedDrawingBlock(context, contextSize);
+                        [trace recordSpanForStage:FICTraceStageDraw startTime:drawStartTime entityUUID:entityUUID formatName:formatName];
+                    };
+                }
+                
+                [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:imageDrawingBlock];
+            }
+            
+            uint64_t lookupStartTime = [trace spanStartTime];
             UIImage *resultImage = [imageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:NO];
+            [trace recordSpanForStage:FICTraceStageLookup startTime:lookupStartTime entityUUID:entityUUID formatName:formatName];
             
+            NSArray *completionBlocks = [completionBlocksDictionary objectForKey:formatName];
             if (completionBlocks != nil) {
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    NSString *formatName = [[imageTable imageFormat] name];
-                    for (FICImageCacheCompletionBlock completionBlock in completionBlocks) {
-                        completionBlock(entity, formatName, resultImage);
+                [self _callCompletionBlocks:completionBlocks forEntity:entity entityUUID:entityUUID formatName:formatName image:resultImage];
+            }
+        }];
+    }];
+}
+
+// Calls completion blocks on the main queue, tracing the wait for the main queue and the calls themselves
+- (void)_callCompletionBlocks:(NSArray *)completionBlocks forEntity:(id <FICEntity>)entity entityUUID:(NSString *)entityUUID formatName:(NSString *)formatName image:(UIImage *)image {
+    FICImageCacheTrace *trace = _trace;
+    uint64_t mainQueueWaitStartTime = [trace spanStartTime];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [trace recordSpanForStage:FICTraceStageMainQueueWait startTime:mainQueueWaitStartTime entityUUID:entityUUID formatName:formatName];
+        
+        uint64_t completionStartTime = [trace spanStartTime];
+        for (FICImageCacheCompletionBlock completionBlock in completionBlocks) {
+            completionBlock(entity, formatName, image);
+        }
+        [trace recordSpanForStage:FICTraceStageCompletion startTime:completionStartTime entityUUID:entityUUID formatName:formatName];
+    });
+}
+
+- (void)_addProcessingJobWithKey:(NSString *)processingKey formatNames:(NSArray *)formatNames entityUUID:(NSString *)entityUUID priority:(FICImageCachePriority)priority deadline:(NSTimeInterval)deadline block:(dispatch_block_t)block {
+    FICImageCacheProcessingJob *job = [[FICImageCacheProcessingJob alloc] init];
+    [job setProcessingKey:processingKey];
+    [job setEntityUUID:entityUUID];
+    [job setFormatName:[formatNames firstObject]];
+    [job setFormatNames:formatNames];
+    [job setTraceStartTime:[_trace spanStartTime]];
+    [job setPriority:priority];
+    [job setDeadline:deadline];
+    [job setBlock:block];
+    
+    @synchronized (_pendingProcessingJobs) {
+        [_pendingProcessingJobs addObject:job];
+    }
+    
+    [self _startProcessingJobs];
+}
+
+- (void)_startProcessingJobs {
+    NSMutableArray *jobsToStart = [NSMutableArray array];
+    
+    @synchronized (_pendingProcessingJobs) {
+        while ([_runningProcessingKeys count] < _maximumConcurrentProcessingCount && [_runningProcessingKeys containsObject:FICImageCacheBarrierProcessingKey] == NO) {
+            // The most urgent job goes first, and equally urgent jobs go in the order they were added. Only the oldest job for each processing key can run, and
+            // not while another job with that key is running, so work for the same entity and format stays in order without holding up anything else.
+            NSMutableSet *blockedProcessingKeys = [NSMutableSet setWithSet:_runningProcessingKeys];
+            NSUInteger nextJobIndex = NSNotFound;
+            FICImageCacheProcessingJob *nextJob = nil;
+            
+            for (NSUInteger jobIndex = 0; jobIndex < [_pendingProcessingJobs count]; jobIndex++) {
+                FICImageCacheProcessingJob *job = [_pendingProcessingJobs objectAtIndex:jobIndex];
+                if ([job isBarrier]) {
+                    // Nothing added after a barrier can start before it, and the barrier waits until nothing added before it is left
+                    if (jobIndex == 0 && [_runningProcessingKeys count] == 0) {
+                        nextJobIndex = jobIndex;
+                        nextJob = job;
                     }
-                });
+                    
+                    break;
+                }
+                
+                if ([blockedProcessingKeys containsObject:[job processingKey]]) {
+                    continue;
+                }
+                
+                [blockedProcessingKeys addObject:[job processingKey]];
+                if (nextJob == nil || _FICWorkIsMoreUrgent([job priority], [job deadline], [nextJob priority], [nextJob deadline])) {
+                    nextJobIndex = jobIndex;
+                    nextJob = job;
+                }
+            }
+            
+            if (nextJob == nil) {
+                break;
+            }
+            
+            [_runningProcessingKeys addObject:[nextJob processingKey]];
+            [_pendingProcessingJobs removeObjectAtIndex:nextJobIndex];
+            [jobsToStart addObject:nextJob];
+        }
+    }
+    
+    for (FICImageCacheProcessingJob *job in jobsToStart) {
+        dispatch_async(dispatch_get_global_queue(_FICDispatchQueuePriorityForPriority([job priority]), 0), ^{
+            if ([job isBarrier] == NO) {
+                [_trace recordSpanForStage:FICTraceStageQueueWait startTime:[job traceStartTime] entityUUID:[job entityUUID] formatName:[job formatName]];
+            }
+            
+            @autoreleasepool {
+                [job block]();
             }
+            
+            @synchronized (_pendingProcessingJobs) {
+                [_runningProcessingKeys removeObject:[job processingKey]];
+            }
+            
+            [self _startProcessingJobs];
         });
     }
 }
@@ -423,6 +1232,63 @@ static void _FICAddCompletionBlockForEntity(NSString *formatName, NSMutableDicti
     return formatsToProcess;
 }
 
+#pragma mark - Prefetching Image Data
+
++ (dispatch_queue_t)_prefetchQueue {
+    static dispatch_queue_t __prefetchQueue = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __prefetchQueue = dispatch_queue_create("com.path.FastImageCache.PrefetchQueue", NULL);
+        dispatch_set_target_queue(__prefetchQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+    });
+    return __prefetchQueue;
+}
+
+- (void)prefetchImagesForEntities:(NSArray *)entities withFormatName:(NSString *)formatName {
+    NSParameterAssert(formatName);
+    
+    FICImageTable *imageTable = [_imageTables objectForKey:formatName];
+    if (imageTable == nil) {
+        [self _logMessage:[NSString stringWithFormat:@"*** FIC Error: %s Couldn't find image table with format name %@", __PRETTY_FUNCTION__, formatName]];
+        return;
+    }
+    
+    // Entities are asked for their UUIDs on the calling thread, since they may not be thread-safe
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:[entities count]];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:[entities count]];
+    for (id <FICEntity> entity in entities) {
+        NSString *entityUUID = [entity fic_UUID];
+        NSString *sourceImageUUID = [entity fic_sourceImageUUID];
+        if (entityUUID != nil && sourceImageUUID != nil) {
+            [entityUUIDs addObject:entityUUID];
+            [sourceImageUUIDs addObject:sourceImageUUID];
+        }
+    }
+    
+    NSUInteger generation = 0;
+    @synchronized (_prefetchGenerations) {
+        generation = [[_prefetchGenerations objectForKey:formatName] unsignedIntegerValue] + 1;
+        [_prefetchGenerations setObject:@(generation) forKey:formatName];
+    }
+    
+    for (NSUInteger location = 0; location < [entityUUIDs count]; location += FICImageCachePrefetchBatchSize) {
+        NSRange range = NSMakeRange(location, MIN(FICImageCachePrefetchBatchSize, [entityUUIDs count] - location));
+        NSArray *batchEntityUUIDs = [entityUUIDs subarrayWithRange:range];
+        NSArray *batchSourceImageUUIDs = [sourceImageUUIDs subarrayWithRange:range];
+        
+        dispatch_async([FICImageCache _prefetchQueue], ^{
+            BOOL listWasReplaced = NO;
+            @synchronized (_prefetchGenerations) {
+                listWasReplaced = [[_prefetchGenerations objectForKey:formatName] unsignedIntegerValue] != generation;
+            }
+            
+            if (listWasReplaced == NO) {
+                [imageTable prefetchEntriesForEntityUUIDs:batchEntityUUIDs sourceImageUUIDs:batchSourceImageUUIDs];
+            }
+        });
+    }
+}
+
 #pragma mark - Checking for Image Existence
 
 - (BOOL)imageExistsForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName {
@@ -449,38 +1315,273 @@ static void _FICAddCompletionBlockForEntity(NSString *formatName, NSMutableDicti
 
     BOOL cancelImageLoadingForEntity = NO;
     @synchronized (_requests) {
-        NSMutableDictionary *requestDictionary = [_requests objectForKey:sourceImageURL];
-        if (requestDictionary) {
-            NSMutableDictionary *entityRequestsDictionary = [requestDictionary objectForKey:entityUUID];
-            if (entityRequestsDictionary) {
-                NSMutableDictionary *completionBlocksDictionary = [entityRequestsDictionary objectForKey:FICImageCacheCompletionBlocksKey];
-                [completionBlocksDictionary removeObjectForKey:formatName];
-
-                if ([completionBlocksDictionary count] == 0) {
-                    [requestDictionary removeObjectForKey:entityUUID];
-                }
+        FICImageCacheRequest *request = [_requests objectForKey:sourceImageURL];
+        FICImageCacheEntityRequest *entityRequest = [[request entityRequests] objectForKey:entityUUID];
+        if (entityRequest != nil) {
+            [[entityRequest completionBlocks] removeObjectForKey:formatName];
 
-                if ([requestDictionary count] == 0) {
-                    [_requests removeObjectForKey:sourceImageURL];
+            if ([[entityRequest completionBlocks] count] == 0) {
+                [[request entityRequests] removeObjectForKey:entityUUID];
+            }
+
+            if ([[request entityRequests] count] == 0) {
+                // Nobody is waiting on the source image anymore, so the request gives up its place in line or its slot right away
+                if ([request state] == FICImageCacheRequestStateFetching) {
+                    _fetchingRequestCount--;
                     cancelImageLoadingForEntity = YES;
+                } else {
+                    [_pendingRequests removeObjectIdenticalTo:request];
                 }
+                
+                [request setState:FICImageCacheRequestStateFinished];
+                [_requests removeObjectForKey:sourceImageURL];
             }
         }
     }
 
-    if (cancelImageLoadingForEntity && _delegateImplementsCancelImageLoadingForEntityWithFormatName) {
-        [_delegate imageCache:self cancelImageLoadingForEntity:entity withFormatName:formatName];
+    if (cancelImageLoadingForEntity) {
+        if (_delegateImplementsCancelImageLoadingForEntityWithFormatName) {
+            [_delegate imageCache:self cancelImageLoadingForEntity:entity withFormatName:formatName];
+        }
+        
+        [self _startSourceImageRequests];
     }
 }
 
-- (void)reset {
+#pragma mark - Prioritizing Image Requests
+
+- (void)setPriority:(FICImageCachePriority)priority forImageRetrievalForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName {
+    NSURL *sourceImageURL = [entity fic_sourceImageURLWithFormatName:formatName];
+    NSString *entityUUID = [entity fic_UUID];
+    
+    // A request that hasn't been passed on to the delegate yet moves up or down the queue
+    if (sourceImageURL != nil) {
+        @synchronized (_requests) {
+            FICImageCacheRequest *request = [_requests objectForKey:sourceImageURL];
+            [[[request entityRequests] objectForKey:entityUUID] setPriority:priority];
+        }
+    }
+    
+    // So does any image of the entity in the format that's still waiting to be drawn. Images of other formats keep their own priorities, unless they're drawn along with it.
+    if (entityUUID != nil && formatName != nil) {
+        @synchronized (_pendingProcessingJobs) {
+            for (FICImageCacheProcessingJob *job in _pendingProcessingJobs) {
+                if ([[job entityUUID] isEqualToString:entityUUID] && [[job formatNames] containsObject:formatName]) {
+                    [job setPriority:priority];
+                }
+            }
+        }
+    }
+}
+
+#pragma mark - Measuring Image Cache Activity
+
+- (FICImageCacheRetrievalStatistics)retrievalStatisticsForFormatName:(NSString *)formatName {
+    FICImageCacheRetrievalStatistics statistics = { 0 };
+    
+    NSNumber *firstCounter = formatName != nil ? [_retrievalStatisticsIndexes objectForKey:formatName] : nil;
+    if (firstCounter != nil) {
+        size_t counter = [firstCounter unsignedIntegerValue];
+        statistics.hotHitCount = (NSUInteger)FICStatisticsCounterValue(&_retrievalStatistics, counter + FICImageCacheRetrievalResultHotHit);
+        statistics.coldHitCount = (NSUInteger)FICStatisticsCounterValue(&_retrievalStatistics, counter + FICImageCacheRetrievalResultColdHit);
+        statistics.scaledHitCount = (NSUInteger)FICStatisticsCounterValue(&_retrievalStatistics, counter + FICImageCacheRetrievalResultScaledHit);
+        statistics.missCount = (NSUInteger)FICStatisticsCounterValue(&_retrievalStatistics, counter + FICImageCacheRetrievalResultMiss);
+    }
+    
+    return statistics;
+}
+
+- (void)_recordRetrievalResult:(FICImageCacheRetrievalResult)result count:(NSUInteger)count formatName:(NSString *)formatName {
+    NSNumber *firstCounter = formatName != nil ? [_retrievalStatisticsIndexes objectForKey:formatName] : nil;
+    if (count > 0 && firstCounter != nil) {
+        FICStatisticsAdd(&_retrievalStatistics, [firstCounter unsignedIntegerValue] + result, count);
+    }
+}
+
+- (FICImageTableStatistics)imageTableStatisticsForFormatName:(NSString *)formatName {
+    FICImageTableStatistics statistics = { 0 };
+    
+    FICImageTable *imageTable = formatName != nil ? [_imageTables objectForKey:formatName] : nil;
+    if (imageTable != nil) {
+        statistics = [imageTable statistics];
+    }
+    
+    return statistics;
+}
+
+- (FICImageTableStatistics)imageTableStatistics {
+    FICImageTableStatistics statistics = { 0 };
+    
     for (FICImageTable *imageTable in [_imageTables allValues]) {
-        dispatch_async([[self class] dispatchQueue], ^{
-            [imageTable reset];
+        FICImageTableStatistics tableStatistics = [imageTable statistics];
+        statistics.hitCount += tableStatistics.hitCount;
+        statistics.missCount += tableStatistics.missCount;
+        statistics.storedEntryCount += tableStatistics.storedEntryCount;
+        statistics.evictedEntryCount += tableStatistics.evictedEntryCount;
+        statistics.chunkMappingCount += tableStatistics.chunkMappingCount;
+        statistics.chunkUnmappingCount += tableStatistics.chunkUnmappingCount;
+        statistics.writtenLength += tableStatistics.writtenLength;
+        statistics.lockCount += tableStatistics.lockCount;
+        FICStatisticsHistogramMerge(&statistics.lockWaitDurations, &tableStatistics.lockWaitDurations);
+        FICStatisticsHistogramMerge(&statistics.flushDurations, &tableStatistics.flushDurations);
+        FICStatisticsHistogramMerge(&statistics.journalWriteDurations, &tableStatistics.journalWriteDurations);
+        FICStatisticsHistogramMerge(&statistics.checkpointDurations, &tableStatistics.checkpointDurations);
+    }
+    
+    return statistics;
+}
+
+#pragma mark - Tracing Image Requests
+
+- (BOOL)isTracingEnabled {
+    return [_trace isEnabled];
+}
+
+- (void)setTracingEnabled:(BOOL)tracingEnabled {
+    [_trace setEnabled:tracingEnabled];
+}
+
+- (NSData *)chromeTraceData {
+    return [_trace chromeTraceData];
+}
+
+#pragma mark - Scrubbing Image Tables
+
++ (dispatch_queue_t)_scrubbingQueue {
+    static dispatch_queue_t __scrubbingQueue = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __scrubbingQueue = dispatch_queue_create("com.path.FastImageCache.ScrubbingQueue", NULL);
+        dispatch_set_target_queue(__scrubbingQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return __scrubbingQueue;
+}
+
+// The caller must synchronize on self
+- (void)_updateScrubbingTimer {
+    BOOL needsScrubbing = _scrubbingRate > 0 && [_imageTables count] > 0;
+    if (needsScrubbing && _scrubbingTimer == nil) {
+        uint64_t interval = (uint64_t)(FICImageCacheScrubbingInterval * NSEC_PER_SEC);
+        _scrubbingTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, [FICImageCache _scrubbingQueue]);
+        
+        // Scrubbing isn't urgent, so the system is given plenty of leeway to coalesce it with other wakeups
+        dispatch_source_set_timer(_scrubbingTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 2);
+        
+        __weak FICImageCache *weakSelf = self;
+        dispatch_source_set_event_handler(_scrubbingTimer, ^{
+            [weakSelf _scrubImageTables];
         });
+        dispatch_resume(_scrubbingTimer);
+    } else if (needsScrubbing == NO && _scrubbingTimer != nil) {
+        dispatch_source_cancel(_scrubbingTimer);
+        _scrubbingTimer = nil;
     }
 }
 
+// Called on the scrubbing queue
+- (void)_scrubImageTables {
+    size_t length = 0;
+    @synchronized (self) {
+        length = (size_t)(_scrubbingRate * FICImageCacheScrubbingInterval);
+    }
+    
+    // Image tables are only added when the formats are set, before scrubbing starts
+    NSArray *imageTables = [[_imageTables allValues] sortedArrayUsingComparator:^NSComparisonResult(FICImageTable *imageTable1, FICImageTable *imageTable2) {
+        return [[[imageTable1 imageFormat] name] compare:[[imageTable2 imageFormat] name]];
+    }];
+    
+    // An image table that reaches its end passes the rest of the step's budget on to the next one. Each image table is scrubbed at most once per step.
+    for (NSUInteger i = 0; i < [imageTables count] && length > 0; i++) {
+        FICImageTable *imageTable = [imageTables objectAtIndex:_scrubbingTableIndex % [imageTables count]];
+        size_t scrubbedLength = [imageTable scrubEntriesUpToLength:length];
+        if (scrubbedLength >= length) {
+            break;
+        }
+        
+        length -= scrubbedLength;
+        _scrubbingTableIndex++;
+    }
+}
+
+#pragma mark - Compacting Image Tables
+
++ (dispatch_queue_t)_compactionQueue {
+    static dispatch_queue_t __compactionQueue = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __compactionQueue = dispatch_queue_create("com.path.FastImageCache.CompactionQueue", NULL);
+        dispatch_set_target_queue(__compactionQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return __compactionQueue;
+}
+
+// The caller must synchronize on self
+- (void)_updateCompactionTimer {
+    BOOL needsCompaction = _compactionRate > 0 && [_imageTables count] > 0;
+    if (needsCompaction && _compactionTimer == nil) {
+        uint64_t interval = (uint64_t)(FICImageCacheCompactionInterval * NSEC_PER_SEC);
+        _compactionTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, [FICImageCache _compactionQueue]);
+        dispatch_source_set_timer(_compactionTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 2);
+        
+        __weak FICImageCache *weakSelf = self;
+        dispatch_source_set_event_handler(_compactionTimer, ^{
+            [weakSelf _compactImageTables];
+        });
+        dispatch_resume(_compactionTimer);
+    } else if (needsCompaction == NO && _compactionTimer != nil) {
+        dispatch_source_cancel(_compactionTimer);
+        _compactionTimer = nil;
+    }
+}
+
+// Called on the compaction queue
+- (void)_compactImageTables {
+    size_t length = 0;
+    @synchronized (self) {
+        length = (size_t)(_compactionRate * FICImageCacheCompactionInterval);
+    }
+    
+    NSArray *imageTables = [[_imageTables allValues] sortedArrayUsingComparator:^NSComparisonResult(FICImageTable *imageTable1, FICImageTable *imageTable2) {
+        return [[[imageTable1 imageFormat] name] compare:[[imageTable2 imageFormat] name]];
+    }];
+    
+    // An image table with nothing left to compact passes the rest of the step's budget on to the next one, like scrubbing does
+    for (NSUInteger i = 0; i < [imageTables count] && length > 0; i++) {
+        FICImageTable *imageTable = [imageTables objectAtIndex:_compactionTableIndex % [imageTables count]];
+        size_t compactedLength = [imageTable compactEntriesUpToLength:length];
+        if (compactedLength >= length) {
+            break;
+        }
+        
+        length -= compactedLength;
+        _compactionTableIndex++;
+    }
+}
+
+#pragma mark - Resetting the Image Cache
+
+- (void)reset {
+    // Images are stored by processing jobs, so the image tables are reset by one too. Images queued before the reset can't be stored after it, and images queued after it
+    // can't be stored before it and then deleted.
+    NSArray *imageTables = [_imageTables allValues];
+    FICImageCacheProcessingJob *job = [[FICImageCacheProcessingJob alloc] init];
+    [job setProcessingKey:FICImageCacheBarrierProcessingKey];
+    [job setPriority:FICImageCachePriorityNormal];
+    [job setDeadline:FICImageCacheNoDeadline];
+    [job setBarrier:YES];
+    [job setBlock:^{
+        for (FICImageTable *imageTable in imageTables) {
+            [imageTable reset];
+        }
+    }];
+    
+    @synchronized (_pendingProcessingJobs) {
+        [_pendingProcessingJobs addObject:job];
+    }
+    
+    [self _startProcessingJobs];
+}
+
 #pragma mark - Logging Errors
 
 - (void)_logMessage:(NSString *)message {
@@ -0,0 +1,96 @@
+//
+//  FICImageCacheTrace.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImports.h"
+#import "FICTrace.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ `FICImageCacheTrace` records how long each stage of retrieving and storing images takes, so the spans of a scroll session can be loaded into a trace viewer.
+
+ @discussion An image cache and its image tables share one trace. Spans are only recorded while the trace is enabled, and only the most recent `<maximumSpanCount>` are kept,
+ in a `<FICTrace>` ring buffer that is only allocated once the trace is first enabled. While the trace is disabled, recording a span costs a single atomic load.
+
+ Traces are thread-safe.
+ */
+@interface FICImageCacheTrace : NSObject
+
+///---------------------------------------
+/// @name Configuring an Image Cache Trace
+///---------------------------------------
+
+/**
+ The number of recent spans the trace keeps, a power of two.
+ */
+@property (nonatomic, assign, readonly) NSUInteger maximumSpanCount;
+
+/**
+ Whether or not spans are being recorded.
+
+ @discussion Defaults to `NO`. Enabling the trace discards the spans recorded before, so each session starts with an empty trace. Disabling it keeps them, so they can still be
+ exported.
+ */
+@property (nonatomic, assign, getter=isEnabled) BOOL enabled;
+
+/**
+ Initializes a trace that keeps the 8192 most recent spans.
+ */
+- (instancetype)init;
+
+/**
+ Initializes a trace.
+
+ @param maximumSpanCount The number of recent spans to keep. It's rounded up to a power of two.
+ */
+- (instancetype)initWithMaximumSpanCount:(NSUInteger)maximumSpanCount NS_DESIGNATED_INITIALIZER;
+
+///----------------------
+/// @name Recording Spans
+///----------------------
+
+/**
+ Returns the start time of a span that begins now, or 0 if the trace is disabled.
+ */
+- (uint64_t)spanStartTime;
+
+/**
+ Records a span that ends now.
+
+ @param stage The stage the span measured.
+
+ @param startTime The time returned by `<spanStartTime>` when the span began. Spans that began while the trace was disabled aren't recorded.
+
+ @param entityUUID The UUID of the entity the span belongs to, or `nil` if it belongs to several.
+
+ @param formatName The name of the format the span belongs to, or `nil`.
+ */
+- (void)recordSpanForStage:(FICTraceStage)stage startTime:(uint64_t)startTime entityUUID:(nullable NSString *)entityUUID formatName:(nullable NSString *)formatName;
+
+/**
+ Records a span that ends now, for an entity whose UUID has already been parsed.
+ */
+- (void)recordSpanForStage:(FICTraceStage)stage startTime:(uint64_t)startTime entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes formatName:(nullable NSString *)formatName;
+
+///----------------------
+/// @name Exporting Spans
+///----------------------
+
+/**
+ Returns the recorded spans as a JSON document in the Chrome trace event format.
+
+ @return The document, or `nil` if there wasn't enough memory to create it. Each span is a complete event on the thread that recorded it, named after its stage and carrying its
+ entity and format as arguments.
+
+ @discussion The document can be opened in chrome://tracing or Perfetto. Spans are only read, so exporting a trace that is still enabled is fine.
+ */
+- (nullable NSData *)chromeTraceData;
+
+@end
+
+NS_ASSUME_NONNULL_END
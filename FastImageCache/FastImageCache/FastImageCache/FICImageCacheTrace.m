@@ -0,0 +1,101 @@
+//
+//  FICImageCacheTrace.m
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImageCacheTrace.h"
+#import "FICStatistics.h"
+#import "FICUtilities.h"
+
+#pragma mark Internal Definitions
+
+// About 1 MB of spans, enough for several seconds of fast scrolling
+static const NSUInteger FICImageCacheTraceDefaultMaximumSpanCount = 8192;
+
+#pragma mark - Class Extension
+
+@interface FICImageCacheTrace () {
+    FICTrace _trace;
+}
+
+@end
+
+#pragma mark
+
+@implementation FICImageCacheTrace
+
+#pragma mark - Property Accessors
+
+- (NSUInteger)maximumSpanCount {
+    return _trace.capacity;
+}
+
+- (BOOL)isEnabled {
+    return FICTraceIsEnabled(&_trace);
+}
+
+- (void)setEnabled:(BOOL)enabled {
+    // Starting and stopping the trace must not race each other, but recording spans doesn't need the lock
+    @synchronized (self) {
+        if (enabled) {
+            FICTraceStart(&_trace);
+        } else {
+            FICTraceStop(&_trace);
+        }
+    }
+}
+
+#pragma mark - Object Lifecycle
+
+- (instancetype)init {
+    return [self initWithMaximumSpanCount:FICImageCacheTraceDefaultMaximumSpanCount];
+}
+
+- (instancetype)initWithMaximumSpanCount:(NSUInteger)maximumSpanCount {
+    self = [super init];
+
+    if (self != nil) {
+        if (FICTraceInit(&_trace, MAX(maximumSpanCount, (NSUInteger)1)) == false) {
+            return nil;
+        }
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    FICTraceDestroy(&_trace);
+}
+
+#pragma mark - Recording Spans
+
+- (uint64_t)spanStartTime {
+    return FICTraceIsEnabled(&_trace) ? FICStatisticsNanoseconds() : 0;
+}
+
+- (void)recordSpanForStage:(FICTraceStage)stage startTime:(uint64_t)startTime entityUUID:(NSString *)entityUUID formatName:(NSString *)formatName {
+    if (startTime != 0 && FICTraceIsEnabled(&_trace)) {
+        CFUUIDBytes entityUUIDBytes = entityUUID != nil ? FICUUIDBytesWithString(entityUUID) : (CFUUIDBytes){ 0 };
+        FICTraceRecord(&_trace, stage, startTime, FICStatisticsNanoseconds(), entityUUID != nil ? (const uint8_t *)&entityUUIDBytes : NULL, [formatName UTF8String]);
+    }
+}
+
+- (void)recordSpanForStage:(FICTraceStage)stage startTime:(uint64_t)startTime entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes formatName:(NSString *)formatName {
+    if (startTime != 0 && FICTraceIsEnabled(&_trace)) {
+        FICTraceRecord(&_trace, stage, startTime, FICStatisticsNanoseconds(), (const uint8_t *)&entityUUIDBytes, [formatName UTF8String]);
+    }
+}
+
+#pragma mark - Exporting Spans
+
+- (NSData *)chromeTraceData {
+    size_t length = 0;
+    char *document = FICTraceCreateChromeJSON(&_trace, &length);
+
+    return document != NULL ? [NSData dataWithBytesNoCopy:document length:length freeWhenDone:YES] : nil;
+}
+
+@end
@@ -28,6 +28,22 @@ typedef NS_ENUM(NSUInteger, FICImageFormatProtectionMode) {
     FICImageFormatProtectionModeCompleteUntilFirstUserAuthentication,
 };
 
+typedef NS_ENUM(NSUInteger, FICImageFormatDurability) {
+    FICImageFormatDurabilitySynchronous,
+    FICImageFormatDurabilityAsynchronous,
+    FICImageFormatDurabilityDeferred,
+};
+
+typedef NS_ENUM(NSUInteger, FICImageFormatMappingMode) {
+    FICImageFormatMappingModeChunked,
+    FICImageFormatMappingModeReserved,
+};
+
+typedef NS_ENUM(NSUInteger, FICImageFormatEvictionPolicy) {
+    FICImageFormatEvictionPolicyLRU,
+    FICImageFormatEvictionPolicyTinyLFU,
+};
+
 /**
  `FICImageFormat` acts as a definition for the types of images that are stored in the image cache. Each image format must have a unique name, but multiple formats can belong to the same family.
  All images associated with a particular format must have the same image dimentions and opacity preference. You can define the maximum number of entries that an image format can accommodate to
@@ -147,6 +163,118 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, assign, readonly) NSString *protectionModeString;
 
+/**
+ How soon newly stored image data is written to disk.
+ 
+ `FICImageFormatDurability` has the following values:
+ 
+ - `FICImageFormatDurabilitySynchronous`: Image data is written to disk before the image is stored. This is the default, and the slowest option.
+ - `FICImageFormatDurabilityAsynchronous`: Writing image data to disk is started when the image is stored, but isn't waited for. This only protects against the app crashing:
+ once the image is stored, the operating system writes its data back on its own schedule even if the app is gone. If the device loses power or the operating system crashes
+ before then, the image is kept across the restart without its data, and is only caught by its checksum the first time it's used.
+ - `FICImageFormatDurabilityDeferred`: Image data is collected in memory and written to disk in batches, either periodically or once enough of it has built up. Neighboring entries
+ are written together, so this is the cheapest option when many images are stored at once.
+ 
+ @discussion Images can be retrieved as soon as they are stored, whatever the durability. Durability only decides how much recently stored image data can be lost if the app
+ or device stops unexpectedly. An image is only kept across launches once its data has been written, or for `FICImageFormatDurabilityAsynchronous`, handed to the operating system
+ to write, so an image the app stopped partway through drawing is never shown. Image data is also checksummed, and checked the first time it's used after its image table is
+ opened, so data that was torn or damaged on disk anyway is discarded rather than shown.
+ 
+ Since every image in the image cache can be recreated from its source image, formats storing many images are usually better off with `FICImageFormatDurabilityDeferred`.
+ 
+ @note Changing the durability of an image format does not invalidate its image table.
+ */
+@property (nonatomic, assign) FICImageFormatDurability durability;
+
+/**
+ How the image table file is mapped into memory.
+ 
+ `FICImageFormatMappingMode` has the following values:
+ 
+ - `FICImageFormatMappingModeChunked`: The image table file is mapped in chunks of about 2 MB as they are needed. This is the default.
+ - `FICImageFormatMappingModeReserved`: Address space for the largest the image table file can grow to is reserved up front, and the whole file is mapped into it. The
+ file grows in place, and finding an entry's image data doesn't involve any chunk bookkeeping.
+ 
+ @discussion The reserved mode trades address space for speed. It reserves the full size of `<maximumCount>` entries whether or not they are ever used, so it is best suited
+ to formats with a modest maximum count that are used heavily. If the address space can't be reserved, the image table falls back to the chunked mode.
+ 
+ Both modes store the same entries. When every entry is in use and none can be evicted, the image table file grows past `<maximumCount>` entries either way; in the reserved
+ mode, the entries past the reserved address space are mapped in chunks.
+ 
+ @note Changing the mapping mode of an image format does not invalidate its image table.
+ */
+@property (nonatomic, assign) FICImageFormatMappingMode mappingMode;
+
+/**
+ How the image table picks the entry to evict when it's full.
+ 
+ `FICImageFormatEvictionPolicy` has the following values:
+ 
+ - `FICImageFormatEvictionPolicyLRU`: The least recently used entry is evicted. This is the default.
+ - `FICImageFormatEvictionPolicyTinyLFU`: New entries are kept in a small window, and only take the place of an older entry once they've been used more often than it. Entries
+ that are used repeatedly are protected from those that are only used once.
+ 
+ @discussion LRU works well when recently used images are likely to be used again soon. When images are used unevenly, such as avatars of a few frequent contacts mixed in with
+ long feeds that are scrolled past once, TinyLFU keeps the popular images that LRU would evict to make room for the feed. It keeps an estimate of how often each entity has been
+ used recently, which takes about 8 bytes per entry of `<maximumCount>`.
+ 
+ @note Changing the eviction policy of an image format does not invalidate its image table.
+ */
+@property (nonatomic, assign) FICImageFormatEvictionPolicy evictionPolicy;
+
+/**
+ How expensive an image of this format is to recreate, relative to the image formats it shares a disk budget with. The default is 1.
+ 
+ @discussion When an image cache has a `<[FICImageCache maximumDiskLength]>`, its image formats compete for the disk space. An entry's worth is its recreation cost divided by
+ its length, so formats whose images are small or slow to draw, such as heavily processed thumbnails, keep their entries longer than formats whose images are large or quick to
+ fetch again. Entries that aren't accessed lose out over time, whatever their cost.
+ 
+ @note Changing the recreation cost of an image format does not invalidate its image table.
+ */
+@property (nonatomic, assign) CGFloat recreationCost;
+
+/**
+ The maximum size, in bytes, of the cold storage file that keeps entries evicted from the image table. The default is 0, which disables cold storage.
+ 
+ @discussion Every entry in an image table occupies a full, uncompressed slot, whether or not it is used. With cold storage enabled, an entry that is evicted to make room for a new
+ one is compressed and kept in a separate file instead of being discarded. If the entry is requested again, its image data is decompressed back into the image table, which is much
+ faster than having the delegate fetch the source image and processing it again. Once the cold storage file is full, the entries that were evicted longest ago are discarded.
+ 
+ Cold storage lets an image format with a modest `<maximumCount>` keep many more images on disk. Images with large flat areas, such as transparent backgrounds, compress the most;
+ photographs compress much less.
+ 
+ @note Changing the cold storage size of an image format does not invalidate its image table.
+ */
+@property (nonatomic, assign) NSUInteger coldStorageMaximumLength;
+
+/**
+ The optional name of a format in the same image cache whose image data this format's image data is converted from, instead of being drawn. The default is `nil`.
+ 
+ @discussion Formats that differ only in style can share a single drawing. When an image is processed for both a format and its primary format, the entity's drawing block only runs for
+ the primary format, and this format's image data is converted from the result, which is much faster than drawing it again. If the primary format doesn't have an image for the entity,
+ this format's image data is drawn as usual.
+ 
+ The primary format must use the `FICImageFormatStyle32BitBGRA` style and have the same `<pixelSize>` as this format, and this format must use one of the other styles. The conversion
+ composites the primary format's image data over an opaque white background, which is what a drawing block would do by filling an opaque context with white before drawing.
+ 
+ @note Changing the primary format of an image format does not invalidate its image table.
+ */
+@property (nonatomic, copy, nullable) NSString *primaryFormatName;
+
+/**
+ Whether or not a missing image can be created by downscaling the image of a larger format in the same family. The default is `NO`.
+
+ @discussion When an entity has no image for this format, the image cache usually has to ask its delegate for the source image again and run the entity's drawing block. With this
+ enabled, if the entity already has an image in a larger format of the same `<family>`, that image is downscaled into this format instead, which takes microseconds instead of a
+ round trip for the source image. The smallest suitable format with an image for the entity is used.
+
+ The larger format must have the same `<style>` and the same aspect ratio as this format, and neither can use the `FICImageFormatStyle16BitBGR` style. The downscaled image is an area
+ average of the larger image, so this is only suitable for formats whose drawing blocks draw the same picture at different sizes, like a thumbnail and a full-size photo.
+
+ @note Changing whether an image format downscales from its family does not invalidate its image table.
+ */
+@property (nonatomic, assign) BOOL downscalesFromFamily;
+
 /**
  The dictionary representation of this image format.
  
@@ -32,6 +32,13 @@ static NSString *const FICImageFormatProtectionModeKey = @"protectionMode";
     NSInteger _maximumCount;
     FICImageFormatDevices _devices;
     FICImageFormatProtectionMode _protectionMode;
+    FICImageFormatDurability _durability;
+    FICImageFormatMappingMode _mappingMode;
+    FICImageFormatEvictionPolicy _evictionPolicy;
+    CGFloat _recreationCost;
+    NSUInteger _coldStorageMaximumLength;
+    NSString *_primaryFormatName;
+    BOOL _downscalesFromFamily;
 }
 
 @end
@@ -48,6 +55,13 @@ static NSString *const FICImageFormatProtectionModeKey = @"protectionMode";
 @synthesize maximumCount = _maximumCount;
 @synthesize devices = _devices;
 @synthesize protectionMode = _protectionMode;
+@synthesize durability = _durability;
+@synthesize mappingMode = _mappingMode;
+@synthesize evictionPolicy = _evictionPolicy;
+@synthesize recreationCost = _recreationCost;
+@synthesize coldStorageMaximumLength = _coldStorageMaximumLength;
+@synthesize primaryFormatName = _primaryFormatName;
+@synthesize downscalesFromFamily = _downscalesFromFamily;
 
 #pragma mark - Property Accessors
 
@@ -145,6 +159,16 @@ static NSString *const FICImageFormatProtectionModeKey = @"protectionMode";
 
 #pragma mark - Object Lifecycle
 
+- (instancetype)init {
+    self = [super init];
+    
+    if (self != nil) {
+        _recreationCost = 1;
+    }
+    
+    return self;
+}
+
 + (instancetype)formatWithName:(NSString *)name family:(NSString *)family imageSize:(CGSize)imageSize style:(FICImageFormatStyle)style maximumCount:(NSInteger)maximumCount devices:(FICImageFormatDevices)devices protectionMode:(FICImageFormatProtectionMode)protectionMode {
     FICImageFormat *imageFormat = [[FICImageFormat alloc] init];
     
@@ -193,6 +217,13 @@ static NSString *const FICImageFormatProtectionModeKey = @"protectionMode";
     [imageFormatCopy setMaximumCount:[self maximumCount]];
     [imageFormatCopy setDevices:[self devices]];
     [imageFormatCopy setProtectionMode:[self protectionMode]];
+    [imageFormatCopy setDurability:[self durability]];
+    [imageFormatCopy setMappingMode:[self mappingMode]];
+    [imageFormatCopy setEvictionPolicy:[self evictionPolicy]];
+    [imageFormatCopy setRecreationCost:[self recreationCost]];
+    [imageFormatCopy setColdStorageMaximumLength:[self coldStorageMaximumLength]];
+    [imageFormatCopy setPrimaryFormatName:[self primaryFormatName]];
+    [imageFormatCopy setDownscalesFromFamily:[self downscalesFromFamily]];
     
     return imageFormatCopy;
 }
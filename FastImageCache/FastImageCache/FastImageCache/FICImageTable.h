@@ -12,6 +12,9 @@
 
 @class FICImageFormat;
 @class FICImageTableChunk;
+@class FICImageTableChunkCache;
+@class FICImageCacheTrace;
+@class FICImageTableDiskBudget;
 @class FICImageTableEntry;
 @class FICImage;
 
@@ -24,6 +27,10 @@ extern NSString *const FICImageTableScreenScaleKey;
  `FICImageTable` is the primary class that efficiently stores and retrieves cached image data. Image tables are defined by instances of `<FICImageFormat>`. Each image table is backed by a single
  file on disk that sequentially stores image entry data. All images in an image table are either opaque or not and have the same dimensions. Therefore, when defining your image formats, keep in
  mind that you cannot mix image dimensions or whether or not an image is opaque.
+ 
+ Image tables are thread-safe. Retrieving images and checking for entries only take shared locks, so they run concurrently with each other on any number of threads. Storing and
+ deleting entries briefly excludes other operations while the table's bookkeeping is updated, and drawing an entry only excludes readers of that entry and of the few entries that
+ share its lock.
  */
 @interface FICImageTable : NSObject
 
@@ -41,11 +48,40 @@ extern NSString *const FICImageTableScreenScaleKey;
  */
 @property (nonatomic, copy, readonly) NSString *metadataFilePath;
 
+/**
+ The file system path where the image table's cold storage file is located.
+ 
+ @discussion The file only exists if the image format enables cold storage. See `<[FICImageFormat coldStorageMaximumLength]>` for more information.
+ */
+@property (nonatomic, copy, readonly) NSString *coldStorageFilePath;
+
 /**
  The image format that describes the image table.
  */
 @property (nonatomic, strong, readonly) FICImageFormat *imageFormat;
 
+/**
+ The chunk cache that keeps recently used parts of the image table file mapped into memory.
+ 
+ @discussion Each image table starts out with a chunk cache of its own. `<FICImageCache>` gives all of its image tables the same chunk cache, so that its mapped length budget
+ covers the whole image cache.
+ */
+@property (nonatomic, strong) FICImageTableChunkCache *chunkCache;
+
+/**
+ The disk budget the image table shares with other image tables, if any.
+
+ @discussion `<FICImageCache>` gives all of its image tables the same disk budget, whose maximum length is the image cache's `<[FICImageCache maximumDiskLength]>`.
+ */
+@property (nonatomic, strong, nullable) FICImageTableDiskBudget *diskBudget;
+
+/**
+ The trace the image table records how long writing entries to disk takes in, if any.
+
+ @discussion `<FICImageCache>` gives all of its image tables its own trace, before they're used. Changing the trace while the image table is in use isn't thread-safe.
+ */
+@property (nonatomic, strong, nullable) FICImageCacheTrace *trace;
+
 ///-----------------------------------------------
 /// @name Accessing Information about Image Tables
 ///-----------------------------------------------
@@ -103,12 +139,69 @@ extern NSString *const FICImageTableScreenScaleKey;
  @discussion Objects conforming to `<FICEntity>` are responsible for providing an image drawing block that does the actual drawing of their source images to a bitmap context provided
  by the image table. Drawing in the provided bitmap context writes the uncompressed image data directly to the image table file on disk.
  
+ The entry is locked while it is drawn, so the drawing block must not retrieve or store images in the same image table.
+ 
  @note If any of the parameters to this method are `nil`, this method does nothing.
  
  @see [FICEntity drawingBlockForImage:withFormatName:]
  */
 - (void)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID imageDrawingBlock:(FICEntityImageDrawingBlock)imageDrawingBlock;
 
+/**
+ Stores new image entry data in the image table by converting the image data of another image table's entry.
+
+ @param entityUUID The UUID of the entity that uniquely identifies an image table entry. Must not be `nil`.
+
+ @param sourceImageUUID The UUID of the source image that represents the actual image data stored in an image table entry. Must not be `nil`.
+
+ @param primaryImageTable The image table to convert image data from. Its format must use the `FICImageFormatStyle32BitBGRA` style and have the same pixel size as this image
+ table's format, which must use one of the other styles.
+
+ @return `YES` if the entry was stored. `NO` if `primaryImageTable` has no entry for the entity drawn from the source image, or if the two image formats can't be converted.
+
+ @discussion The primary image table's entry is locked for reading while it is converted, so it can't change halfway through.
+
+ @see [FICImageFormat primaryFormatName]
+ */
+- (BOOL)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID convertingEntryFromImageTable:(FICImageTable *)primaryImageTable;
+
+/**
+ Returns whether image data can be converted from another image table's entries into this image table's entries.
+
+ @param primaryImageTable The image table to convert image data from.
+
+ @return `YES` if the primary image table's format uses the `FICImageFormatStyle32BitBGRA` style and has the same pixel size as this image table's format, which uses one of the other
+ styles.
+ */
+- (BOOL)canConvertEntriesFromImageTable:(FICImageTable *)primaryImageTable;
+
+/**
+ Stores new image entry data in the image table by downscaling the image data of a larger image table's entry.
+
+ @param entityUUID The UUID of the entity that uniquely identifies an image table entry. Must not be `nil`.
+
+ @param sourceImageUUID The UUID of the source image that represents the actual image data stored in an image table entry. Must not be `nil`.
+
+ @param largerImageTable The image table to downscale image data from. See `<canScaleEntriesFromImageTable:>` for which image tables can be used.
+
+ @return `YES` if the entry was stored. `NO` if `largerImageTable` has no entry for the entity drawn from the source image, or if its image data can't be downscaled into this image table.
+
+ @discussion Image data is area averaged straight from the larger image table's entry into this one, which is locked for reading while it is downscaled.
+
+ @see [FICImageFormat downscalesFromFamily]
+ */
+- (BOOL)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID scalingEntryFromImageTable:(FICImageTable *)largerImageTable;
+
+/**
+ Returns whether image data can be downscaled from a larger image table's entries into this image table's entries.
+
+ @param largerImageTable The image table to downscale image data from.
+
+ @return `YES` if the larger image table's format has the same style as this image table's format, other than `FICImageFormatStyle16BitBGR`, and a larger pixel size with the same
+ aspect ratio.
+ */
+- (BOOL)canScaleEntriesFromImageTable:(FICImageTable *)largerImageTable;
+
 /**
  Returns a new image from the image entry data in the image table.
  
@@ -129,6 +222,22 @@ extern NSString *const FICImageTableScreenScaleKey;
  */
 - (nullable UIImage *)newImageForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID preheatData:(BOOL)preheatData;
 
+/**
+ Returns new images for several entries at once.
+ 
+ @param entityUUIDs The UUIDs of the entities that uniquely identify the image table entries.
+ 
+ @param sourceImageUUIDs The UUIDs of the source images the entries should hold, in the same order as `entityUUIDs`.
+ 
+ @param preheatData A `BOOL` indicating whether or not the entries' image data should be preheated. See `<[FICImageTableEntry preheat]>` for more information.
+ 
+ @return An array with one element for each entity UUID, in the same order. Each element is either a new image or `NSNull` if the image table has no image for that entity
+ and source image.
+ 
+ @discussion Behaves like calling `<newImageForEntityUUID:sourceImageUUID:preheatData:>` for each entity, but every entry is looked up in a single pass over the image table.
+ */
+- (NSArray *)newImagesForEntityUUIDs:(NSArray <NSString *> *)entityUUIDs sourceImageUUIDs:(NSArray <NSString *> *)sourceImageUUIDs preheatData:(BOOL)preheatData;
+
 /**
  Deletes image entry data in the image table.
  
@@ -158,6 +267,155 @@ extern NSString *const FICImageTableScreenScaleKey;
  */
 - (BOOL)entryExistsForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID;
 
+///--------------------------------
+/// @name Working with Cold Storage
+///--------------------------------
+
+/**
+ Returns whether or not the image table's cold storage holds image data for an entity that was evicted from the image table.
+ 
+ @param entityUUID The UUID of the entity that uniquely identifies an image table entry.
+ 
+ @param sourceImageUUID The UUID of the source image the image data should have been drawn from.
+ 
+ @return `YES` if the image data can be restored with `<restoreEntryForEntityUUID:sourceImageUUID:>`. Always `NO` if the image format doesn't enable cold storage.
+ */
+- (BOOL)coldEntryExistsForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID;
+
+/**
+ Moves image data for an entity from the image table's cold storage back into the image table.
+ 
+ @param entityUUID The UUID of the entity that uniquely identifies an image table entry.
+ 
+ @param sourceImageUUID The UUID of the source image the image data should have been drawn from.
+ 
+ @return `YES` if the entity now has an entry in the image table, either because it was restored or because it already had one. `NO` if cold storage has no image data for the
+ entity, or if the image data was damaged, in which case it is discarded.
+ 
+ @discussion Image data is decompressed straight into the entry, which makes restoring an entry much faster than drawing it again. Like storing an entry, restoring one may evict
+ the least recently used entry, which then moves to cold storage in turn.
+ */
+- (BOOL)restoreEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID;
+
+///-------------------------------
+/// @name Prefetching Entry Data
+///-------------------------------
+
+/**
+ Asks the operating system to start reading the image data of several entries into memory.
+ 
+ @param entityUUIDs The UUIDs of the entities whose entries are about to be used.
+ 
+ @param sourceImageUUIDs The UUIDs of the source images the entries should hold, in the same order as `entityUUIDs`.
+ 
+ @discussion Entries that don't exist, or that hold a different source image, are skipped. The rest are sorted by where they are in the image table file, and neighboring
+ entries are merged so their data is requested together. This method returns as soon as the reads have been requested; it doesn't wait for them to finish.
+ */
+- (void)prefetchEntriesForEntityUUIDs:(NSArray <NSString *> *)entityUUIDs sourceImageUUIDs:(NSArray <NSString *> *)sourceImageUUIDs;
+
+///---------------------------
+/// @name Verifying Entry Data
+///---------------------------
+
+/**
+ Checks the image data of entries against their checksums, continuing from where the previous scrub stopped.
+ 
+ @param length The number of bytes of image data to check before returning.
+ 
+ @return The number of bytes of image data that were checked. Less than `length` if the scrub reached the end of the image table, in which case the next scrub starts over
+ at the beginning.
+ 
+ @discussion Every entry stores a checksum of its image data. Entries are always checked the first time they're used after the image table is opened, but image data can also
+ be damaged on disk later. Scrubbing checks entries in the background, whether or not they've been used, and deletes any whose image data is damaged. Checking is limited to
+ `length` bytes at a time, so scrubbing a little at a time keeps it from competing with image retrieval for the disk.
+ */
+- (size_t)scrubEntriesUpToLength:(size_t)length;
+
+///--------------------------------------
+/// @name Compacting the Image Table File
+///--------------------------------------
+
+/**
+ Moves entries toward the start of the image table file and gives the space they leave behind back to the file system, continuing from where the previous step stopped.
+
+ @param length The number of bytes of entry data to move or release before returning.
+
+ @return The number of bytes of entry data that were moved or released. Less than `length` once there's nothing left to compact, or when the entry that would be moved next is in use.
+
+ @discussion Deleting and evicting entries leaves free entries behind, so an image table file never shrinks on its own, not even after its format's `maximumCount` is lowered.
+ Compaction moves the entry nearest the end of the file into the first free entry, one entry at a time, then truncates the file after the last chunk that still holds an entry.
+ Free entries past the last entry that the file can't be truncated to, such as the rest of its last chunk, have their disk blocks released by punching holes in the file. So do free
+ entries between other entries, which compaction can't always move an entry into, once they've stayed free for a minute, since they're the first ones new entries are stored in.
+
+ Entries backing images that are still alive are never moved, overwritten, or truncated away, and entries stored with deferred durability wait until they're written to disk.
+ Moving entries writes to the disk, so compaction is limited to `length` bytes at a time, like scrubbing.
+
+ @see compactableLength
+ */
+- (size_t)compactEntriesUpToLength:(size_t)length;
+
+/**
+ The number of bytes compaction could still give back to the file system by moving entries and truncating the image table file.
+ */
+@property (nonatomic, assign, readonly) unsigned long long compactableLength;
+
+/**
+ The number of entries compaction has moved since the image table was opened.
+ */
+@property (nonatomic, assign, readonly) NSUInteger compactedEntryCount;
+
+/**
+ The number of bytes compaction has truncated from the end of the image table file since the image table was opened.
+ */
+@property (nonatomic, assign, readonly) unsigned long long truncatedLength;
+
+/**
+ The number of bytes of free entries whose disk blocks compaction has released since the image table was opened, without truncating the image table file.
+ */
+@property (nonatomic, assign, readonly) unsigned long long punchedLength;
+
+///----------------------------
+/// @name Sharing a Disk Budget
+///----------------------------
+
+/**
+ The combined length, in bytes, of the entries stored in the image table.
+
+ @discussion Space freed by deleting or evicting entries stops counting right away, even though the image table file only shrinks when it's compacted.
+ */
+@property (nonatomic, assign, readonly) size_t usedLength;
+
+/**
+ The GreedyDual-Size priority of the entry the image table would evict next, or `DBL_MAX` if every entry is in use.
+
+ @discussion The image format's eviction policy picks the entry; the priority only decides which image table of a disk budget gives it up.
+ */
+@property (nonatomic, assign, readonly) double diskBudgetEvictionPriority;
+
+/**
+ Evicts the entry the image table would evict next, as if the table were full.
+
+ @return The GreedyDual-Size priority of the evicted entry, or `DBL_MAX` if every entry is in use.
+ */
+- (double)evictEntryForDiskBudget;
+
+/**
+ The priority of the last entry evicted for the image table's disk budget, which is added to the priority of every entry accessed from now on.
+ */
+@property (nonatomic, assign) double diskBudgetInflation;
+
+///-------------------------------------
+/// @name Measuring Image Table Activity
+///-------------------------------------
+
+/**
+ What the image table has done since it was opened.
+
+ @discussion Counters and histograms are kept in shards picked by thread and updated without a lock, and reading them takes no lock either, so the statistics can be read from
+ any thread at any time. Resetting the image table doesn't reset them.
+ */
+@property (nonatomic, assign, readonly) FICImageTableStatistics statistics;
+
 ///--------------------------------
 /// @name Resetting the Image Table
 ///--------------------------------
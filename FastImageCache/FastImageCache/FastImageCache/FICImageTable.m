@@ -10,12 +10,23 @@
 #import "FICImageFormat.h"
 #import "FICImageCache.h"
 #import "FICImageTableChunk.h"
+#import "FICImageTableChunkCache.h"
+#import "FICImageTableDiskBudget.h"
+#import "FICImageCacheTrace.h"
 #import "FICImageTableEntry.h"
 #import "FICUtilities.h"
-#import <libkern/OSAtomic.h>
+#import "FICTableEngine.h"
+#import "FICColdStore.h"
+#import "FICCompression.h"
+#import "FICPixelConversion.h"
+#import "FICPixelScaling.h"
 
 #import "FICImageCache+FICErrorLogging.h"
 
+#import <pthread.h>
+#import <fcntl.h>
+#import <sys/mman.h>
+
 #pragma mark External Definitions
 
 NSString *const FICImageTableEntryDataVersionKey = @"FICImageTableEntryDataVersionKey";
@@ -25,12 +36,22 @@ NSString *const FICImageTableScreenScaleKey = @"FICImageTableScreenScaleKey";
 
 static NSString *const FICImageTableMetadataFileExtension = @"metadata";
 static NSString *const FICImageTableFileExtension = @"imageTable";
+static NSString *const FICImageTableColdStorageFileExtension = @"coldStorage";
 
 static NSString *const FICImageTableIndexMapKey = @"indexMap";
 static NSString *const FICImageTableContextMapKey = @"contextMap";
 static NSString *const FICImageTableMRUArrayKey = @"mruArray";
 static NSString *const FICImageTableFormatKey = @"format";
 
+// Entries stored with deferred durability are written to disk once enough image data has built up, or after this interval, whichever comes first
+static const NSTimeInterval FICImageTableDirtyEntryFlushInterval = 1.0;
+
+// Free entries between other entries are reused first, so their disk blocks are only released once they've stayed free this long
+static const NSTimeInterval FICImageTableIdleEntryHolePunchingInterval = 60.0;
+
+// Stands in for the source image UUID of entries migrated from metadata that didn't record one
+static const CFUUIDBytes FICImageTableEmptyUUIDBytes = { 0 };
+
 #pragma mark - Class Extension
 
 @interface FICImageTable () {
@@ -39,32 +60,37 @@ static NSString *const FICImageTableFormatKey = @"format";
     NSInteger _imageRowLength;
     
     NSString *_filePath;
-    int _fileDescriptor;
-    off_t _fileLength;
-    
-    NSUInteger _entryCount;
-    NSInteger _entryLength;
-    NSUInteger _entriesPerChunk;
+    FICTableEngine _engine;                                         // The table file, its metadata and journal, and the locks that guard them
     NSInteger _imageLength;
     
-    size_t _chunkLength;
-    NSInteger _chunkCount;
-    
-    NSMutableDictionary *_chunkDictionary;
-    NSCountedSet *_chunkSet;
+    FICImageTableChunk *_reservedChunk;                             // Maps the table file up to its length in the reserved mapping mode, instead of separate chunks
+    NSMapTable *_chunkDictionary;                                   // Holds chunks weakly; they're kept alive by the entries using them and by _chunkCache
+    FICImageTableChunkCache *_chunkCache;
     
-    NSRecursiveLock *_lock;
-    CFMutableDictionaryRef _indexNumbers;
+    pthread_mutex_t _chunkLock;                                     // Guards _chunkDictionary and _chunkCache
+    pthread_mutex_t _flushLock;                                     // Guards _dirtyChunks
+    pthread_mutex_t _coldLock;                                      // Guards _coldStore
     
     // Image table metadata
-    NSMutableDictionary *_indexMap;         // Key: entity UUID, value: integer index into the table file
-    NSMutableDictionary *_sourceImageMap;   // Key: entity UUID, value: source image UUID
-    NSMutableIndexSet *_occupiedIndexes;
-    NSMutableOrderedSet *_MRUEntries;
-    NSCountedSet *_inUseEntries;
     NSDictionary *_imageFormatDictionary;
-    int32_t _metadataVersion;
-
+    NSData *_imageFormatData;
+    void *_metadataMapping;                                         // The metadata file, mapped copy-on-write. The engine's entry index, slot allocator, and recency list may work in place on its snapshot.
+    size_t _metadataMappingLength;
+    
+    // Entries stored with deferred durability
+    NSMutableDictionary *_dirtyChunks;                              // Key: chunk index, value: chunk mapping kept alive until its entries are written
+    
+    // Cold storage of evicted entries
+    FICColdStore _coldStore;
+    BOOL _coldStorageEnabled;
+    
+    // Disk budget shared with other image tables, guarded by the engine's recency lock
+    FICImageTableDiskBudget *_diskBudget;
+    double *_diskBudgetPriorities;                                  // GreedyDual-Size priority of each entry, as of its last access
+    size_t _diskBudgetPriorityCount;
+    double _diskBudgetInflation;
+    double _diskBudgetCostPerByte;                                  // The format's recreation cost divided by the entry length
+    
     NSString *_fileDataProtectionMode;
     BOOL _canAccessData;
 }
@@ -95,6 +121,13 @@ static NSString *const FICImageTableFormatKey = @"format";
     return metadataFilePath;
 }
 
+- (NSString *)coldStorageFilePath {
+    NSString *coldStorageFilePath = [[_imageFormat name] stringByAppendingPathExtension:FICImageTableColdStorageFileExtension];
+    coldStorageFilePath = [[self directoryPath] stringByAppendingPathComponent:coldStorageFilePath];
+    
+    return coldStorageFilePath;
+}
+
 - (NSString *) directoryPath {
     NSString *directoryPath = [FICImageTable directoryPath];
     if (self.imageCache.nameSpace) {
@@ -106,14 +139,7 @@ static NSString *const FICImageTableFormatKey = @"format";
 #pragma mark - Class-Level Definitions
 
 + (int)pageSize {
-    static int __pageSize = 0;
-    
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        __pageSize = getpagesize();
-    });
-
-    return __pageSize;
+    return (int)FICTableFilePageSize();
 }
 
 + (NSString *)directoryPath {
@@ -134,6 +160,81 @@ static NSString *const FICImageTableFormatKey = @"format";
     return __directoryPath;
 }
 
+#pragma mark - Engine Delegate
+
+static bool _FICImageTableMetadataFormatMatches(void *context, const void *formatBytes, size_t formatLength) {
+    return [(__bridge FICImageTable *)context _metadataFormatMatchesData:[NSData dataWithBytesNoCopy:(void *)formatBytes length:formatLength freeWhenDone:NO]];
+}
+
+static bool _FICImageTableEntryCountDidChange(void *context, size_t oldEntryCount) {
+    return [(__bridge FICImageTable *)context _entryCountDidChange:oldEntryCount];
+}
+
+static void _FICImageTableEntryWasAccessed(void *context, uint32_t slot) {
+    [(__bridge FICImageTable *)context _entryWasAccessedAtIndex:slot];
+}
+
+static void _FICImageTableEntryWasMoved(void *context, uint32_t slot, uint32_t newSlot) {
+    [(__bridge FICImageTable *)context _entryWasMovedFromIndex:slot toIndex:newSlot];
+}
+
+static void _FICImageTableJournalNeedsFlush(void *context) {
+    FICImageTable *imageTable = (__bridge FICImageTable *)context;
+    dispatch_async([FICImageTable _metadataQueue], ^{
+        [imageTable _flushJournal];
+    });
+}
+
+static void _FICImageTableOperationDidFail(void *context, FICTableEngineOperation operation, size_t detail, int error) {
+    [(__bridge FICImageTable *)context _engineOperation:operation didFailWithDetail:detail error:error];
+}
+
+static const FICTableEngineDelegate FICImageTableEngineDelegate = {
+    _FICImageTableMetadataFormatMatches,
+    _FICImageTableEntryCountDidChange,
+    _FICImageTableEntryWasAccessed,
+    _FICImageTableEntryWasMoved,
+    _FICImageTableJournalNeedsFlush,
+    _FICImageTableOperationDidFail,
+};
+
+- (BOOL)_metadataFormatMatchesData:(NSData *)formatData {
+    NSDictionary *formatDictionary = (NSDictionary *)[NSJSONSerialization JSONObjectWithData:formatData options:kNilOptions error:NULL];
+    
+    return [formatDictionary isEqualToDictionary:_imageFormatDictionary];
+}
+
+- (void)_engineOperation:(FICTableEngineOperation)operation didFailWithDetail:(size_t)detail error:(int)error {
+    NSString *formatName = [_imageFormat name];
+    NSString *message = nil;
+    
+    switch (operation) {
+        case FICTableEngineOperationResizeFile:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s ftruncate failed, error = %d, filePath = %@, length = %lld", __PRETTY_FUNCTION__, error, _filePath, (long long)(detail * _engine.file.entryLength)];
+            break;
+        case FICTableEngineOperationEvictEntry:
+            message = [NSString stringWithFormat:@"FICImageTable - unable to evict entry from table '%@' to make room. New index %zu, desired max %ld", formatName, detail, (long)[self _maximumCount]];
+            break;
+        case FICTableEngineOperationConfigureEvictionPolicy:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't allocate the eviction policy for format %@; entries are evicted as if none had been used before", __PRETTY_FUNCTION__, formatName];
+            break;
+        case FICTableEngineOperationFlushEntries:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s msync of entries from index %zu of format %@ failed errno=%d", __PRETTY_FUNCTION__, detail, formatName, error];
+            break;
+        case FICTableEngineOperationAppendJournal:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't append metadata for format %@, error = %d", __PRETTY_FUNCTION__, formatName, error];
+            break;
+        case FICTableEngineOperationWriteCheckpoint:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't write metadata for format %@, error = %d", __PRETTY_FUNCTION__, formatName, error];
+            break;
+        case FICTableEngineOperationPunchHole:
+            message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't punch a hole in the image table file for format %@, error = %d", __PRETTY_FUNCTION__, formatName, error];
+            break;
+    }
+    
+    [self.imageCache _logMessage:message];
+}
+
 #pragma mark - Object Lifecycle
 
 - (instancetype)initWithFormat:(FICImageFormat *)imageFormat imageCache:(FICImageCache *)imageCache {
@@ -149,11 +250,13 @@ static NSString *const FICImageTableFormatKey = @"format";
         
         self.imageCache = imageCache;
         
-        _lock = [[NSRecursiveLock alloc] init];
-        _indexNumbers = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+        pthread_mutex_init(&_chunkLock, NULL);
+        pthread_mutex_init(&_flushLock, NULL);
+        pthread_mutex_init(&_coldLock, NULL);
         
         _imageFormat = [imageFormat copy];
         _imageFormatDictionary = [imageFormat dictionaryRepresentation];
+        _imageFormatData = [NSJSONSerialization dataWithJSONObject:_imageFormatDictionary options:kNilOptions error:NULL];
         
         _screenScale = [[UIScreen mainScreen] scale];
         
@@ -162,20 +265,25 @@ static NSString *const FICImageTableFormatKey = @"format";
         _imageRowLength = (NSInteger)FICByteAlignForCoreAnimation(pixelSize.width * bytesPerPixel);
         _imageLength = _imageRowLength * (NSInteger)pixelSize.height;
         
-        _chunkDictionary = [[NSMutableDictionary alloc] init];
-        _chunkSet = [[NSCountedSet alloc] init];
-        
-        _indexMap = [[NSMutableDictionary alloc] init];
-        _occupiedIndexes = [[NSMutableIndexSet alloc] init];
-        
-        _MRUEntries = [[NSMutableOrderedSet alloc] init];
-        _inUseEntries = [NSCountedSet set];
-
-        _sourceImageMap = [[NSMutableDictionary alloc] init];
+        _chunkDictionary = [NSMapTable strongToWeakObjectsMapTable];
+        _chunkCache = [[FICImageTableChunkCache alloc] init];
         
         _filePath = [[self tableFilePath] copy];
+        _dirtyChunks = [[NSMutableDictionary alloc] init];
+        _coldStorageEnabled = [_imageFormat coldStorageMaximumLength] > 0;
         
-        [self _loadMetadata];
+        // Evicted entries are only remembered while their image data can still be moved to cold storage
+        FICTableEngineConfiguration configuration;
+        configuration.imageLength = (size_t)_imageLength;
+        configuration.maximumCount = (size_t)[_imageFormat maximumCount];
+        configuration.evictionPolicyKind = [_imageFormat evictionPolicy] == FICImageFormatEvictionPolicyTinyLFU ? FICEvictionPolicyKindTinyLFU : FICEvictionPolicyKindLRU;
+        configuration.metadataPath = [[self metadataFilePath] fileSystemRepresentation];
+        configuration.keepsEvictedEntries = _coldStorageEnabled;
+        configuration.delegate = FICImageTableEngineDelegate;
+        configuration.context = (__bridge void *)self;
+        FICTableEngineInit(&_engine, &configuration);
+        
+        FICColdStoreInit(&_coldStore, [[self coldStorageFilePath] fileSystemRepresentation], [_imageFormat coldStorageMaximumLength], (uint32_t)_imageLength, FICColdStoreFormatChecksum([_imageFormatData bytes], [_imageFormatData length]));
         
         NSString *directoryPath = [self directoryPath];
         
@@ -186,6 +294,12 @@ static NSString *const FICImageTableFormatKey = @"format";
             [fileManager createDirectoryAtPath:directoryPath withIntermediateDirectories:YES attributes:nil error:nil];
         }
         
+        // Entries loaded from the metadata are ranked as if nothing had been evicted for the disk budget yet
+        _diskBudgetCostPerByte = MAX([_imageFormat recreationCost], 0) / _engine.file.entryLength;
+        
+        // The journal is written on the metadata queue, so the directory has to exist before metadata is loaded
+        [self _loadMetadata];
+        
         if ([fileManager fileExistsAtPath:_filePath] == NO) {
             NSMutableDictionary *attributes = [NSMutableDictionary dictionary];
             [attributes setValue:[_imageFormat protectionModeString] forKeyPath:NSFileProtectionKey];
@@ -195,31 +309,27 @@ static NSString *const FICImageTableFormatKey = @"format";
         NSDictionary *attributes = [fileManager attributesOfItemAtPath:_filePath error:NULL];
         _fileDataProtectionMode = [attributes objectForKey:NSFileProtectionKey];
         
-        _fileDescriptor = open([_filePath fileSystemRepresentation], O_RDWR | O_CREAT, 0666);
-        
-        if (_fileDescriptor >= 0) {
-            // The size of each entry in the table needs to be page-aligned. This will cause each entry to have a page-aligned base
-            // address, which will help us avoid Core Animation having to copy our images when we eventually set them on layers.
-            _entryLength = (NSInteger)FICByteAlign(_imageLength + sizeof(FICImageTableEntryMetadata), [FICImageTable pageSize]);
-            
-            // Each chunk will map in n entries. Try to keep the chunkLength around 2MB.
-            NSInteger goalChunkLength = 2 * (1024 * 1024);
-            NSInteger goalEntriesPerChunk = goalChunkLength / _entryLength;
-            _entriesPerChunk = MAX(4, goalEntriesPerChunk);
+        // The table file lays out page-aligned entries in chunks of around 2MB
+        if (FICTableEngineOpenFile(&_engine, [_filePath fileSystemRepresentation])) {
             if ([self _maximumCount] > [_imageFormat maximumCount]) {
                 NSString *message = [NSString stringWithFormat:@"*** FIC Warning: growing desired maximumCount (%ld) for format %@ to fill a chunk (%ld)", (long)[_imageFormat maximumCount], [_imageFormat name], (long)[self _maximumCount]];
                 [self.imageCache _logMessage:message];
             }
-            _chunkLength = (size_t)(_entryLength * _entriesPerChunk);
             
-            _fileLength = lseek(_fileDescriptor, 0, SEEK_END);
-            _entryCount = (NSInteger)(_fileLength / _entryLength);
-            _chunkCount = (_entryCount + _entriesPerChunk - 1) / _entriesPerChunk;
+            if ([_imageFormat mappingMode] == FICImageFormatMappingModeReserved) {
+                [self _reserveAddressSpace];
+            }
+            
+            if (_coldStorageEnabled) {
+                [self _openColdStorage];
+            }
             
-            if ([_indexMap count] > _entryCount) {
+            if (_engine.index.count > _engine.file.entryCount) {
                 // It's possible that someone deleted the image table file but left behind the metadata file. If this happens, the metadata
                 // will obviously become out of sync with the image table file, so we need to reset the image table.
                 [self reset];
+            } else {
+                FICTableEngineRemoveEntriesBeyondEntryCount(&_engine);
             }
         } else {
             // If something goes wrong and we can't open the image table file, then we have no choice but to release and nil self.
@@ -234,8 +344,58 @@ static NSString *const FICImageTableFormatKey = @"format";
 }
 
 - (void)dealloc {
-    if (_fileDescriptor >= 0) {
-        close(_fileDescriptor);
+    // The chunk cache may be shared with other image tables and outlive this one
+    [_chunkCache removeChunks:[[_chunkDictionary objectEnumerator] allObjects]];
+    
+    // The engine's structures may still borrow storage from the metadata mapping, so it's unmapped after them
+    FICTableEngineDestroy(&_engine);
+    free(_diskBudgetPriorities);
+    [self _unmapMetadataFile];
+    FICColdStoreDestroy(&_coldStore);
+    
+    pthread_mutex_destroy(&_chunkLock);
+    pthread_mutex_destroy(&_flushLock);
+    pthread_mutex_destroy(&_coldLock);
+}
+
+#pragma mark - Property Accessors
+
+- (FICImageTableChunkCache *)chunkCache {
+    pthread_mutex_lock(&_chunkLock);
+    FICImageTableChunkCache *chunkCache = _chunkCache;
+    pthread_mutex_unlock(&_chunkLock);
+    
+    return chunkCache;
+}
+
+- (void)setChunkCache:(FICImageTableChunkCache *)chunkCache {
+    pthread_mutex_lock(&_chunkLock);
+    if (chunkCache != _chunkCache) {
+        // Chunks kept mapped by the old cache no longer count against its budget
+        [_chunkCache removeChunks:[[_chunkDictionary objectEnumerator] allObjects]];
+        _chunkCache = chunkCache;
+    }
+    pthread_mutex_unlock(&_chunkLock);
+}
+
+- (FICImageTableDiskBudget *)diskBudget {
+    pthread_mutex_lock(&_engine.recencyLock);
+    FICImageTableDiskBudget *diskBudget = _diskBudget;
+    pthread_mutex_unlock(&_engine.recencyLock);
+    
+    return diskBudget;
+}
+
+- (void)setDiskBudget:(FICImageTableDiskBudget *)diskBudget {
+    pthread_mutex_lock(&_engine.recencyLock);
+    FICImageTableDiskBudget *oldDiskBudget = _diskBudget;
+    _diskBudget = diskBudget;
+    pthread_mutex_unlock(&_engine.recencyLock);
+    
+    // Budgets call back into the table, so they're told outside the lock
+    if (diskBudget != oldDiskBudget) {
+        [oldDiskBudget removeImageTable:self];
+        [diskBudget addImageTable:self];
     }
 }
 
@@ -254,21 +414,40 @@ static NSString *const FICImageTableFormatKey = @"format";
     }
 }
 
+- (void)_reserveAddressSpace {
+    // The table file only grows past the chunk that holds the last entry it can have when no entry can be evicted, and what's past it is mapped in chunks
+    size_t reservedLength = MAX(FICTableFileChunkAlignedEntryCount(&_engine.file, (size_t)[self _maximumCount]) * _engine.file.entryLength, (size_t)_engine.file.length);
+    
+    FICImageTableChunk *chunk = [[FICImageTableChunk alloc] initWithFileDescriptor:_engine.file.fileDescriptor reservedLength:reservedLength];
+    if (chunk != nil && [chunk mapFileDataToLength:(size_t)_engine.file.length]) {
+        _reservedChunk = chunk;
+        [self _chunkDidMapFileData:chunk];
+    } else {
+        NSString *message = [NSString stringWithFormat:@"*** FIC Notice: Couldn't reserve %zu bytes of address space for format %@; mapping it in chunks instead.", reservedLength, [_imageFormat name]];
+        [self.imageCache _logMessage:message];
+    }
+}
+
+// Entries past the reserved chunk, if the table file outgrew it, are mapped in chunks like in the chunked mode
+- (BOOL)_entryIsInReservedChunk:(NSInteger)index {
+    return _reservedChunk != nil && (size_t)(index + 1) * _engine.file.entryLength <= [_reservedChunk length];
+}
+
 - (FICImageTableChunk *)_chunkAtIndex:(NSInteger)index {
     FICImageTableChunk *chunk = nil;
     
-    if (index < _chunkCount) {
+    if ((size_t)index < _engine.file.chunkCount) {
         chunk = [self _cachedChunkAtIndex:index];
         
         if (chunk == nil) {
-            size_t chunkLength = _chunkLength;
-            off_t chunkOffset = index * (off_t)_chunkLength;
-            if (chunkOffset + chunkLength > _fileLength) {
-                chunkLength = (size_t)(_fileLength - chunkOffset);
-            }
-                    
-            chunk = [[FICImageTableChunk alloc] initWithFileDescriptor:_fileDescriptor index:index length:chunkLength];
+            // The last chunk is shorter if the table file ends partway through it
+            size_t chunkLength = FICTableFileChunkLength(&_engine.file, (size_t)index);
+            chunk = [[FICImageTableChunk alloc] initWithFileDescriptor:_engine.file.fileDescriptor index:index length:chunkLength];
             [self _setChunk:chunk index:index];
+            
+            if (chunk != nil) {
+                [self _chunkDidMapFileData:chunk];
+            }
         }
     }
     
@@ -280,135 +459,388 @@ static NSString *const FICImageTableFormatKey = @"format";
     return chunk;
 }
 
+// Chunks can outlive the image table, so they count their unmapping only if it's still around
+- (void)_chunkDidMapFileData:(FICImageTableChunk *)chunk {
+    FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterChunkMapping, 1);
+    
+    if ([chunk unmappingBlock] == nil) {
+        __weak FICImageTable *weakSelf = self;
+        [chunk setUnmappingBlock:^{
+            [weakSelf _chunkDidUnmapFileData];
+        }];
+    }
+}
+
+- (void)_chunkDidUnmapFileData {
+    FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterChunkUnmapping, 1);
+}
+
 #pragma mark - Storing, Retrieving, and Deleting Entries
 
 - (void)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID imageDrawingBlock:(FICEntityImageDrawingBlock)imageDrawingBlock {
     if (entityUUID != nil && sourceImageUUID != nil && imageDrawingBlock != NULL) {
-        [_lock lock];
-        
-        NSInteger newEntryIndex = [self _indexOfEntryForEntityUUID:entityUUID];
-        if (newEntryIndex == NSNotFound) {
-            newEntryIndex = [self _nextEntryIndex];
-            
-            if (newEntryIndex >= _entryCount) {
-                // Determine how many chunks we need to support new entry index.
-                // Number of entries should always be a multiple of _entriesPerChunk
-                NSInteger numberOfEntriesRequired = newEntryIndex + 1;
-                NSInteger newChunkCount = _entriesPerChunk > 0 ? ((numberOfEntriesRequired + _entriesPerChunk - 1) / _entriesPerChunk) : 0;
-                NSInteger newEntryCount = newChunkCount * _entriesPerChunk;
-                [self _setEntryCount:newEntryCount];
-            }
-        }
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        CFUUIDBytes sourceImageUUIDBytes = FICUUIDBytesWithString(sourceImageUUID);
         
-        if (newEntryIndex < _entryCount) {
+        BOOL entryWasStored = [self _setEntryForEntityUUIDBytes:entityUUIDBytes sourceImageUUIDBytes:sourceImageUUIDBytes fillBlock:^BOOL(FICImageTableEntry *entryData) {
             CGSize pixelSize = [_imageFormat pixelSize];
             CGBitmapInfo bitmapInfo = [_imageFormat bitmapInfo];
             CGColorSpaceRef colorSpace = [_imageFormat isGrayscale] ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
             NSInteger bitsPerComponent = [_imageFormat bitsPerComponent];
             
             // Create context whose backing store *is* the mapped file data
-            FICImageTableEntry *entryData = [self _entryDataAtIndex:newEntryIndex];
-            if (entryData != nil) {
-                [entryData setEntityUUIDBytes:FICUUIDBytesWithString(entityUUID)];
-                [entryData setSourceImageUUIDBytes:FICUUIDBytesWithString(sourceImageUUID)];
-                
-                // Update our book-keeping
-                [_indexMap setObject:[NSNumber numberWithUnsignedInteger:newEntryIndex] forKey:entityUUID];
-                [_occupiedIndexes addIndex:newEntryIndex];
-                [_sourceImageMap setObject:sourceImageUUID forKey:entityUUID];
-                
-                // Update MRU array
-                [self _entryWasAccessedWithEntityUUID:entityUUID];
-                [self saveMetadata];
-                
-                // Unique, unchanging pointer for this entry's index
-                NSNumber *indexNumber = [self _numberForEntryAtIndex:newEntryIndex];
-                
-                // Relinquish the image table lock before calling potentially slow imageDrawingBlock to unblock other FIC operations
-                [_lock unlock];
-                
-                CGContextRef context = CGBitmapContextCreate([entryData bytes], pixelSize.width, pixelSize.height, bitsPerComponent, _imageRowLength, colorSpace, bitmapInfo);
-                
-                CGContextTranslateCTM(context, 0, pixelSize.height);
-                CGContextScaleCTM(context, _screenScale, -_screenScale);
-                
-                @synchronized(indexNumber) {
-                    // Call drawing block to allow client to draw into the context
-                    imageDrawingBlock(context, [_imageFormat imageSize]);
-                    CGContextRelease(context);
-                
-                    // Write the data back to the filesystem
-                    [entryData flush];
-                }
-            } else {
-                [_lock unlock];
-            }
+            CGContextRef context = CGBitmapContextCreate([entryData bytes], pixelSize.width, pixelSize.height, bitsPerComponent, _imageRowLength, colorSpace, bitmapInfo);
             
+            CGContextTranslateCTM(context, 0, pixelSize.height);
+            CGContextScaleCTM(context, _screenScale, -_screenScale);
+            
+            // Call drawing block to allow client to draw into the context
+            imageDrawingBlock(context, [_imageFormat imageSize]);
+            CGContextRelease(context);
             CGColorSpaceRelease(colorSpace);
+            
+            return YES;
+        }];
+        
+        if (entryWasStored) {
+            [self _entryWasStored];
+        }
+    }
+}
+
+- (BOOL)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID convertingEntryFromImageTable:(FICImageTable *)primaryImageTable {
+    if (entityUUID == nil || sourceImageUUID == nil || [self canConvertEntriesFromImageTable:primaryImageTable] == NO) {
+        return NO;
+    }
+    
+    CGSize pixelSize = [_imageFormat pixelSize];
+    size_t width = (size_t)pixelSize.width;
+    size_t height = (size_t)pixelSize.height;
+    size_t rowLength = (size_t)_imageRowLength;
+    FICImageFormatStyle style = [_imageFormat style];
+    
+    return [self _setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID fromImageTable:primaryImageTable fillBlock:^BOOL(FICImageTableEntry *entryData, const void *primaryBytes, size_t primaryRowLength) {
+        BOOL styleIsConvertible = YES;
+        switch (style) {
+            case FICImageFormatStyle32BitBGR:
+                FICPixelConvertBGRAToBGR(primaryBytes, primaryRowLength, [entryData bytes], rowLength, width, height);
+                break;
+            case FICImageFormatStyle16BitBGR:
+                FICPixelConvertBGRAToBGR555(primaryBytes, primaryRowLength, [entryData bytes], rowLength, width, height);
+                break;
+            case FICImageFormatStyle8BitGrayscale:
+                FICPixelConvertBGRAToGrayscale(primaryBytes, primaryRowLength, [entryData bytes], rowLength, width, height);
+                break;
+            case FICImageFormatStyle32BitBGRA:
+                styleIsConvertible = NO;
+                break;
+        }
+        
+        return styleIsConvertible;
+    }];
+}
+
+- (BOOL)canConvertEntriesFromImageTable:(FICImageTable *)primaryImageTable {
+    FICImageFormat *primaryImageFormat = [primaryImageTable imageFormat];
+    BOOL stylesAreConvertible = [primaryImageFormat style] == FICImageFormatStyle32BitBGRA && [_imageFormat style] != FICImageFormatStyle32BitBGRA;
+    
+    return primaryImageTable != nil && stylesAreConvertible && CGSizeEqualToSize([primaryImageFormat pixelSize], [_imageFormat pixelSize]);
+}
+
+- (BOOL)setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID scalingEntryFromImageTable:(FICImageTable *)largerImageTable {
+    if (entityUUID == nil || sourceImageUUID == nil || [self canScaleEntriesFromImageTable:largerImageTable] == NO) {
+        return NO;
+    }
+    
+    CGSize pixelSize = [_imageFormat pixelSize];
+    CGSize largerPixelSize = [[largerImageTable imageFormat] pixelSize];
+    size_t rowLength = (size_t)_imageRowLength;
+    size_t bytesPerPixel = (size_t)[_imageFormat bytesPerPixel];
+    
+    return [self _setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID fromImageTable:largerImageTable fillBlock:^BOOL(FICImageTableEntry *entryData, const void *largerBytes, size_t largerRowLength) {
+        return FICPixelDownscale(largerBytes, largerRowLength, (size_t)largerPixelSize.width, (size_t)largerPixelSize.height, [entryData bytes], rowLength, (size_t)pixelSize.width, (size_t)pixelSize.height, bytesPerPixel);
+    }];
+}
+
+- (BOOL)canScaleEntriesFromImageTable:(FICImageTable *)largerImageTable {
+    FICImageFormat *largerImageFormat = [largerImageTable imageFormat];
+    CGSize largerPixelSize = [largerImageFormat pixelSize];
+    CGSize pixelSize = [_imageFormat pixelSize];
+    
+    // 16-bit pixels pack their components into bits that can't be averaged on their own
+    BOOL stylesAreScalable = [largerImageFormat style] == [_imageFormat style] && [_imageFormat style] != FICImageFormatStyle16BitBGR;
+    BOOL sizeIsLarger = largerPixelSize.width >= pixelSize.width && largerPixelSize.height >= pixelSize.height && CGSizeEqualToSize(largerPixelSize, pixelSize) == NO;
+    
+    // Images with a different aspect ratio were cropped or stretched differently, so scaling them would distort them. Rounding to whole pixels is allowed for.
+    BOOL aspectRatiosMatch = sizeIsLarger && fabs(largerPixelSize.height * pixelSize.width / largerPixelSize.width - pixelSize.height) < 1;
+    
+    return largerImageTable != nil && stylesAreScalable && aspectRatiosMatch;
+}
+
+// Stores an entry whose image data is filled in from another image table's entry for the same entity and source image, which fillBlock is called with. The other entry stays locked for
+// reading while the entry is filled in. Entries of two image tables are only ever locked at once here, and image data only flows from 32-bit BGRA to other styles of the same size,
+// or to smaller sizes of the same style. Image tables can't be both sides of these in a cycle, so no two of these can wait on each other.
+- (BOOL)_setEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID fromImageTable:(FICImageTable *)otherImageTable fillBlock:(BOOL (^)(FICImageTableEntry *entryData, const void *otherBytes, size_t otherRowLength))fillBlock {
+    CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+    CFUUIDBytes sourceImageUUIDBytes = FICUUIDBytesWithString(sourceImageUUID);
+    
+    pthread_rwlock_t *otherEntryLock = NULL;
+    FICImageTableEntry *otherEntryData = [otherImageTable _lockEntryDataForEntityUUIDBytes:entityUUIDBytes pin:NO entryLock:&otherEntryLock];
+    if (otherEntryData == nil) {
+        return NO;
+    }
+    
+    BOOL entryWasFilled = NO;
+    BOOL otherEntryIsCorrect = FICUUIDBytesEqual(entityUUIDBytes, [otherEntryData entityUUIDBytes]) && FICUUIDBytesEqual(sourceImageUUIDBytes, [otherEntryData sourceImageUUIDBytes]);
+    otherEntryIsCorrect = otherEntryIsCorrect && [otherImageTable _lockedEntryDataIsVerified:otherEntryData entityUUIDBytes:entityUUIDBytes];
+    if (otherEntryIsCorrect) {
+        const void *otherBytes = [otherEntryData bytes];
+        size_t otherRowLength = (size_t)otherImageTable->_imageRowLength;
+        
+        entryWasFilled = [self _setEntryForEntityUUIDBytes:entityUUIDBytes sourceImageUUIDBytes:sourceImageUUIDBytes fillBlock:^BOOL(FICImageTableEntry *entryData) {
+            return fillBlock(entryData, otherBytes, otherRowLength);
+        }];
+    }
+    
+    pthread_rwlock_unlock(otherEntryLock);
+    
+    if (entryWasFilled) {
+        [self _entryWasStored];
+    }
+    
+    return entryWasFilled;
+}
+
+// Stores an entry whose image data is filled in by fillBlock, which is called with the entry locked for writing and nothing else of this image table locked. If fillBlock returns NO,
+// the entry is deleted again before anyone can read it. Callers tell the disk budget about a stored entry with -_entryWasStored once they've released their own locks.
+- (BOOL)_setEntryForEntityUUIDBytes:(CFUUIDBytes)entityUUIDBytes sourceImageUUIDBytes:(CFUUIDBytes)sourceImageUUIDBytes fillBlock:(BOOL (^)(FICImageTableEntry *entryData))fillBlock {
+    BOOL entryWasFilled = NO;
+    
+    FICTableEngineLock(&_engine, true);
+    
+    uint32_t newEntryIndex;
+    pthread_rwlock_t *entryLock = FICTableEngineLockSlotForStoring(&_engine, (const uint8_t *)&entityUUIDBytes, &newEntryIndex);
+    
+    FICImageTableEntry *entryData = entryLock != NULL ? [self _entryDataAtIndex:newEntryIndex] : nil;
+    if (entryData != nil) {
+        // An entry that was just evicted still holds the evicted image data, which is moved to cold storage before it's overwritten
+        CFUUIDBytes evictedEntityUUIDBytes = [entryData entityUUIDBytes];
+        CFUUIDBytes evictedSourceImageUUIDBytes = [entryData sourceImageUUIDBytes];
+        
+        [entryData setEntityUUIDBytes:entityUUIDBytes];
+        [entryData setSourceImageUUIDBytes:sourceImageUUIDBytes];
+        
+        // Update our book-keeping
+        bool entryWasEvicted;
+        FICTableEngineSetEntry(&_engine, newEntryIndex, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes, &entryWasEvicted);
+        
+        // Relinquish the image table lock before calling potentially slow fillBlock to unblock other FIC operations.
+        // Readers of this entry wait on its entry lock until the new image data has been filled in.
+        FICTableEngineUnlock(&_engine);
+        
+        if (entryWasEvicted) {
+            [self _moveEntryData:entryData toColdStorageForEntityUUIDBytes:evictedEntityUUIDBytes sourceImageUUIDBytes:evictedSourceImageUUIDBytes];
+        }
+        
+        entryWasFilled = fillBlock(entryData);
+        
+        if (entryWasFilled) {
+            FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterStoredEntry, 1);
+            FICTableEngineSealEntry(&_engine, newEntryIndex, [entryData bytes]);
+            
+            // Write the data back to the filesystem
+            [self _writeEntryData:entryData entityUUIDBytes:entityUUIDBytes sourceImageUUIDBytes:sourceImageUUIDBytes];
         } else {
-            [_lock unlock];
+            FICTableEngineDeleteEntry(&_engine, (const uint8_t *)&entityUUIDBytes, newEntryIndex);
         }
+    } else {
+        FICTableEngineUnlock(&_engine);
     }
+    
+    if (entryLock != NULL) {
+        pthread_rwlock_unlock(entryLock);
+    }
+    
+    return entryWasFilled;
+}
+
+// The budget evicts entries from any of its tables, including this one and any table an entry was filled in from, so it's only told once the caller holds no entry locks
+- (void)_entryWasStored {
+    [[self diskBudget] imageTableDidStoreEntry:self];
 }
 
 - (UIImage *)newImageForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID preheatData:(BOOL)preheatData {
     UIImage *image = nil;
     
     if (entityUUID != nil && sourceImageUUID != nil) {
-        [_lock lock];
-
-        FICImageTableEntry *entryData = [self _entryDataForEntityUUID:entityUUID];
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        CFUUIDBytes sourceImageUUIDBytes = FICUUIDBytesWithString(sourceImageUUID);
+        
+        pthread_rwlock_t *entryLock = NULL;
+        FICImageTableEntry *entryData = [self _lockEntryDataForEntityUUIDBytes:entityUUIDBytes pin:YES entryLock:&entryLock];
         if (entryData != nil) {
-            NSString *entryEntityUUID = FICStringWithUUIDBytes([entryData entityUUIDBytes]);
-            NSString *entrySourceImageUUID = FICStringWithUUIDBytes([entryData sourceImageUUIDBytes]);
-            BOOL entityUUIDIsCorrect = entityUUID == nil || [entityUUID caseInsensitiveCompare:entryEntityUUID] == NSOrderedSame;
-            BOOL sourceImageUUIDIsCorrect = sourceImageUUID == nil || [sourceImageUUID caseInsensitiveCompare:entrySourceImageUUID] == NSOrderedSame;
+            NSInteger entryIndex = [entryData index];
+            BOOL entryIsCorrect = NO;
+            image = [self _newImageWithLockedEntryData:entryData entityUUIDBytes:entityUUIDBytes sourceImageUUIDBytes:sourceImageUUIDBytes preheatData:preheatData entryIsCorrect:&entryIsCorrect];
             
-            NSNumber *indexNumber = [self _numberForEntryAtIndex:[entryData index]];
-            @synchronized(indexNumber) {
-                if (entityUUIDIsCorrect == NO || sourceImageUUIDIsCorrect == NO) {
-                    // The UUIDs don't match, so we need to invalidate the entry.
-                    [self deleteEntryForEntityUUID:entityUUID];
-                } else {
-                    [self _entryWasAccessedWithEntityUUID:entityUUID];
-                    
-                    // Create CGImageRef whose backing store *is* the mapped image table entry. We avoid a memcpy this way.
-                    CGDataProviderRef dataProvider = CGDataProviderCreateWithData((__bridge_retained void *)entryData, [entryData bytes], [entryData imageLength], _FICReleaseImageData);
-                    
-                    [_inUseEntries addObject:entityUUID];
-                    __weak FICImageTable *weakSelf = self;
-                    [entryData executeBlockOnDealloc:^{
-                        [weakSelf removeInUseForEntityUUID:entityUUID];
-                    }];
-                    
-                    CGSize pixelSize = [_imageFormat pixelSize];
-                    CGBitmapInfo bitmapInfo = [_imageFormat bitmapInfo];
-                    NSInteger bitsPerComponent = [_imageFormat bitsPerComponent];
-                    NSInteger bitsPerPixel = [_imageFormat bytesPerPixel] * 8;
-                    CGColorSpaceRef colorSpace = [_imageFormat isGrayscale] ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
-                    
-                    CGImageRef imageRef = CGImageCreate(pixelSize.width, pixelSize.height, bitsPerComponent, bitsPerPixel, _imageRowLength, colorSpace, bitmapInfo, dataProvider, NULL, false, (CGColorRenderingIntent)0);
-                    CGDataProviderRelease(dataProvider);
-                    CGColorSpaceRelease(colorSpace);
-                    
-                    if (imageRef != NULL) {
-                        image = [[UIImage alloc] initWithCGImage:imageRef scale:_screenScale orientation:UIImageOrientationUp];
-                        CGImageRelease(imageRef);
-                    } else {
-                        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s could not create a new CGImageRef for entity UUID %@.", __PRETTY_FUNCTION__, entityUUID];
-                        [self.imageCache _logMessage:message];
-                    }
-                    
-                    if (image != nil && preheatData) {
-                        [entryData preheat];
-                    }
-                }
+            pthread_rwlock_unlock(entryLock);
+            
+            if (entryIsCorrect == NO) {
+                // The UUIDs don't match or the image data is damaged, so we need to invalidate the entry.
+                [self _deleteEntryForEntityUUIDBytes:entityUUIDBytes index:entryIndex];
             }
         }
         
-        [_lock unlock];
+        FICStatisticsAdd(&_engine.statistics, image != nil ? FICTableEngineCounterHit : FICTableEngineCounterMiss, 1);
+    }
+    
+    return image;
+}
+
+- (NSArray *)newImagesForEntityUUIDs:(NSArray *)entityUUIDs sourceImageUUIDs:(NSArray *)sourceImageUUIDs preheatData:(BOOL)preheatData {
+    NSUInteger count = MIN([entityUUIDs count], [sourceImageUUIDs count]);
+    NSMutableArray *images = [NSMutableArray arrayWithCapacity:count];
+    if (count == 0) {
+        return images;
+    }
+    
+    CFUUIDBytes *UUIDBytes = malloc(count * 2 * sizeof(CFUUIDBytes));
+    pthread_rwlock_t **entryLocks = malloc(count * sizeof(pthread_rwlock_t *));
+    if (UUIDBytes == NULL || entryLocks == NULL) {
+        // Without memory for a batch, the entries are retrieved one at a time instead
+        free(UUIDBytes);
+        free(entryLocks);
+        
+        for (NSUInteger i = 0; i < count; i++) {
+            UIImage *image = [self newImageForEntityUUID:[entityUUIDs objectAtIndex:i] sourceImageUUID:[sourceImageUUIDs objectAtIndex:i] preheatData:preheatData];
+            [images addObject:image != nil ? image : [NSNull null]];
+        }
+        
+        return images;
+    }
+    
+    // UUIDs are parsed before the image table lock is taken
+    for (NSUInteger i = 0; i < count; i++) {
+        UUIDBytes[i * 2] = FICUUIDBytesWithString([entityUUIDs objectAtIndex:i]);
+        UUIDBytes[i * 2 + 1] = FICUUIDBytesWithString([sourceImageUUIDs objectAtIndex:i]);
+        [images addObject:[NSNull null]];
+    }
+    
+    NSMutableArray *entriesData = [NSMutableArray arrayWithCapacity:count];
+    NSMutableIndexSet *entryPositions = [[NSMutableIndexSet alloc] init];       // Positions in entityUUIDs of the entries in entriesData
+    NSMutableIndexSet *busyEntryPositions = [[NSMutableIndexSet alloc] init];
+    
+    // Every entry is looked up in one pass over the table. Since nothing may wait for an entry lock while holding the image table lock, entries that are being drawn
+    // are left for afterwards.
+    FICTableEngineLock(&_engine, false);
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        uint32_t index = FICTableEngineSlotOfEntry(&_engine, (const uint8_t *)&UUIDBytes[i * 2]);
+        if (index == FICEntryIndexNoSlot) {
+            continue;
+        }
+        
+        pthread_rwlock_t *entryLock = FICTableEngineEntryLock(&_engine, index);
+        if (pthread_rwlock_tryrdlock(entryLock) != 0) {
+            [busyEntryPositions addIndex:i];
+            continue;
+        }
+        
+        FICImageTableEntry *entryData = [self _entryDataAtIndex:index];
+        if (entryData == nil) {
+            pthread_rwlock_unlock(entryLock);
+            continue;
+        }
+        
+        FICTableEngineEntryWasRetrieved(&_engine, index, (const uint8_t *)&UUIDBytes[i * 2], true);
+        
+        __weak FICImageTable *weakSelf = self;
+        [entryData executeBlockOnDealloc:^{
+            [weakSelf _removeInUseForEntryAtIndex:index];
+        }];
+        
+        entryLocks[[entriesData count]] = entryLock;
+        [entriesData addObject:entryData];
+        [entryPositions addIndex:i];
+    }
+    
+    FICTableEngineUnlock(&_engine);
+    
+    __block NSUInteger entryDataIndex = 0;
+    __block NSUInteger hitCount = 0;
+    [entryPositions enumerateIndexesUsingBlock:^(NSUInteger position, BOOL *stop) {
+        FICImageTableEntry *entryData = [entriesData objectAtIndex:entryDataIndex];
+        BOOL entryIsCorrect = NO;
+        UIImage *image = [self _newImageWithLockedEntryData:entryData entityUUIDBytes:UUIDBytes[position * 2] sourceImageUUIDBytes:UUIDBytes[position * 2 + 1] preheatData:preheatData entryIsCorrect:&entryIsCorrect];
+        pthread_rwlock_unlock(entryLocks[entryDataIndex]);
+        entryDataIndex++;
+        
+        if (image != nil) {
+            [images replaceObjectAtIndex:position withObject:image];
+            hitCount++;
+        } else if (entryIsCorrect == NO) {
+            // The UUIDs don't match or the image data is damaged, so we need to invalidate the entry. Waiting for the image table lock is fine while the remaining entry locks are held.
+            [self _deleteEntryForEntityUUIDBytes:UUIDBytes[position * 2] index:[entryData index]];
+        }
+    }];
+    
+    // Entries that were busy are counted as they're retrieved one at a time
+    FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterHit, hitCount);
+    FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterMiss, count - [busyEntryPositions count] - hitCount);
+    
+    [busyEntryPositions enumerateIndexesUsingBlock:^(NSUInteger position, BOOL *stop) {
+        UIImage *image = [self newImageForEntityUUID:[entityUUIDs objectAtIndex:position] sourceImageUUID:[sourceImageUUIDs objectAtIndex:position] preheatData:preheatData];
+        if (image != nil) {
+            [images replaceObjectAtIndex:position withObject:image];
+        }
+    }];
+    
+    free(entryLocks);
+    free(UUIDBytes);
+    
+    return images;
+}
+
+// The caller must hold the entry's lock
+- (UIImage *)_newImageWithLockedEntryData:(FICImageTableEntry *)entryData entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes sourceImageUUIDBytes:(CFUUIDBytes)sourceImageUUIDBytes preheatData:(BOOL)preheatData entryIsCorrect:(BOOL *)entryIsCorrect {
+    UIImage *image = nil;
+    
+    // The metadata stored alongside the image data is the final word on what the entry holds
+    BOOL entityUUIDIsCorrect = FICUUIDBytesEqual(entityUUIDBytes, [entryData entityUUIDBytes]);
+    BOOL sourceImageUUIDIsCorrect = FICUUIDBytesEqual(sourceImageUUIDBytes, [entryData sourceImageUUIDBytes]);
+    BOOL imageDataIsCorrect = entityUUIDIsCorrect && sourceImageUUIDIsCorrect && [self _lockedEntryDataIsVerified:entryData entityUUIDBytes:entityUUIDBytes];
+    
+    if (imageDataIsCorrect) {
+        FICTableEngineJournalRecord(&_engine, FICMetadataJournalRecordTypeTouch, (uint32_t)[entryData index], (const uint8_t *)&entityUUIDBytes, NULL);
+        
+        // Create CGImageRef whose backing store *is* the mapped image table entry. We avoid a memcpy this way.
+        CGDataProviderRef dataProvider = CGDataProviderCreateWithData((__bridge_retained void *)entryData, [entryData bytes], [entryData imageLength], _FICReleaseImageData);
+        
+        CGSize pixelSize = [_imageFormat pixelSize];
+        CGBitmapInfo bitmapInfo = [_imageFormat bitmapInfo];
+        NSInteger bitsPerComponent = [_imageFormat bitsPerComponent];
+        NSInteger bitsPerPixel = [_imageFormat bytesPerPixel] * 8;
+        CGColorSpaceRef colorSpace = [_imageFormat isGrayscale] ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
+        
+        CGImageRef imageRef = CGImageCreate(pixelSize.width, pixelSize.height, bitsPerComponent, bitsPerPixel, _imageRowLength, colorSpace, bitmapInfo, dataProvider, NULL, false, (CGColorRenderingIntent)0);
+        CGDataProviderRelease(dataProvider);
+        CGColorSpaceRelease(colorSpace);
+        
+        if (imageRef != NULL) {
+            image = [[UIImage alloc] initWithCGImage:imageRef scale:_screenScale orientation:UIImageOrientationUp];
+            CGImageRelease(imageRef);
+        } else {
+            NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s could not create a new CGImageRef for entity UUID %@.", __PRETTY_FUNCTION__, FICStringWithUUIDBytes(entityUUIDBytes)];
+            [self.imageCache _logMessage:message];
+        }
+        
+        if (image != nil && preheatData) {
+            [entryData preheat];
+        }
     }
     
+    *entryIsCorrect = imageDataIsCorrect;
+    
     return image;
 }
 
@@ -418,31 +850,245 @@ static void _FICReleaseImageData(void *info, const void *data, size_t size) {
     }
 }
 
-- (void)removeInUseForEntityUUID:(NSString *)entityUUID {
-    [_lock lock];
-    [_inUseEntries removeObject:entityUUID];
-    [_lock unlock];
+- (void)_removeInUseForEntryAtIndex:(NSInteger)index {
+    FICTableEngineUnpinEntry(&_engine, (uint32_t)index);
 }
 
 - (void)deleteEntryForEntityUUID:(NSString *)entityUUID {
     if (entityUUID != nil) {
-        [_lock lock];
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        [self _deleteEntryForEntityUUIDBytes:entityUUIDBytes index:NSNotFound];
         
-        NSInteger MRUIndex = [_MRUEntries indexOfObject:entityUUID];
-        if (MRUIndex != NSNotFound) {
-            [_MRUEntries removeObjectAtIndex:MRUIndex];
+        if (_coldStorageEnabled) {
+            pthread_mutex_lock(&_coldLock);
+            FICColdStoreRemove(&_coldStore, (const uint8_t *)&entityUUIDBytes);
+            pthread_mutex_unlock(&_coldLock);
         }
+    }
+}
+
+// Readers find entries before they lock them, so an entry they ask to delete may have been replaced in the meantime. Passing the index they found only deletes the entry if it's still there.
+- (void)_deleteEntryForEntityUUIDBytes:(CFUUIDBytes)entityUUIDBytes index:(NSInteger)expectedIndex {
+    FICTableEngineDeleteEntry(&_engine, (const uint8_t *)&entityUUIDBytes, expectedIndex != NSNotFound ? (uint32_t)expectedIndex : FICEntryIndexNoSlot);
+}
+
+#pragma mark - Verifying Entry Data
+
+// The caller must hold the entry's lock. Entries read back from disk are checked the first time they're used after the image table is opened; entries written since then are trusted.
+- (BOOL)_lockedEntryDataIsVerified:(FICImageTableEntry *)entryData entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes {
+    return FICTableEngineEntryWasVerified(&_engine, (uint32_t)[entryData index]) || [self _verifyLockedEntryData:entryData entityUUIDBytes:entityUUIDBytes];
+}
+
+// The caller must hold the entry's lock
+- (BOOL)_verifyLockedEntryData:(FICImageTableEntry *)entryData entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes {
+    BOOL entryIsVerified = FICTableEngineVerifyEntry(&_engine, (uint32_t)[entryData index], [entryData bytes]);
+    if (entryIsVerified == NO) {
+        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s the image data of entity UUID %@ in format %@ doesn't match its checksum, so it was discarded.", __PRETTY_FUNCTION__, FICStringWithUUIDBytes(entityUUIDBytes), [_imageFormat name]];
+        [self.imageCache _logMessage:message];
+    }
+    
+    return entryIsVerified;
+}
+
+- (size_t)scrubEntriesUpToLength:(size_t)length {
+    size_t scrubbedLength = 0;
+    
+    while (scrubbedLength < length) {
+        CFUUIDBytes entityUUIDBytes;
+        uint32_t index = FICTableEngineNextScrubbedEntry(&_engine, (uint8_t *)&entityUUIDBytes);
+        if (index == FICEntryIndexNoSlot) {
+            break;
+        }
+        
+        pthread_rwlock_t *entryLock = NULL;
+        FICImageTableEntry *entryData = [self _lockEntryDataForEntityUUIDBytes:entityUUIDBytes pin:NO entryLock:&entryLock];
+        if (entryData == nil) {
+            continue;
+        }
+        
+        // The entry may have moved since it was found, in which case it's checked when the scrub gets to it again. Entries are checked even if they were written or verified
+        // since the image table was opened, since their data can still be damaged on disk later.
+        BOOL entryIsCorrect = YES;
+        if ([entryData index] == (NSInteger)index) {
+            entryIsCorrect = [self _verifyLockedEntryData:entryData entityUUIDBytes:entityUUIDBytes];
+            scrubbedLength += (size_t)_imageLength;
+        }
+        
+        pthread_rwlock_unlock(entryLock);
+        
+        if (entryIsCorrect == NO) {
+            [self _deleteEntryForEntityUUIDBytes:entityUUIDBytes index:index];
+        }
+    }
+    
+    return scrubbedLength;
+}
+
+#pragma mark - Working with Cold Storage
+
+- (void)_openColdStorage {
+    NSString *coldStorageFilePath = [self coldStorageFilePath];
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    if ([fileManager fileExistsAtPath:coldStorageFilePath] == NO) {
+        NSMutableDictionary *attributes = [NSMutableDictionary dictionary];
+        [attributes setValue:[_imageFormat protectionModeString] forKeyPath:NSFileProtectionKey];
+        [fileManager createFileAtPath:coldStorageFilePath contents:nil attributes:attributes];
+    }
+    
+    pthread_mutex_lock(&_coldLock);
+    BOOL opened = FICColdStoreOpen(&_coldStore);
+    pthread_mutex_unlock(&_coldLock);
+    
+    if (opened == NO) {
+        // The image table works without cold storage, so evicted entries are just discarded
+        _coldStorageEnabled = NO;
+        _engine.keepsEvictedEntries = false;
+        
+        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s could not open the cold storage file at path %@, error = %d", __PRETTY_FUNCTION__, coldStorageFilePath, errno];
+        [self.imageCache _logMessage:message];
+    }
+}
+
+// Called with the entry locked for writing, before the image data evicted from it is overwritten
+- (void)_moveEntryData:(FICImageTableEntry *)entryData toColdStorageForEntityUUIDBytes:(CFUUIDBytes)entityUUIDBytes sourceImageUUIDBytes:(CFUUIDBytes)sourceImageUUIDBytes {
+    // Entries restored from cold storage keep their record there, so they don't have to be compressed again when they're evicted again
+    pthread_mutex_lock(&_coldLock);
+    BOOL isStored = FICColdStorePayloadLength(&_coldStore, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes) > 0;
+    pthread_mutex_unlock(&_coldLock);
+    
+    // Damaged image data would only be restored to be discarded again
+    if (isStored == NO && [self _lockedEntryDataIsVerified:entryData entityUUIDBytes:entityUUIDBytes]) {
+        size_t compressedCapacity = FICCompressionBound((size_t)_imageLength);
+        void *compressedBytes = malloc(compressedCapacity);
+        size_t compressedLength = compressedBytes != NULL ? FICCompress([entryData bytes], (size_t)_imageLength, compressedBytes, compressedCapacity) : 0;
         
-        NSInteger index = [self _indexOfEntryForEntityUUID:entityUUID];
-        if (index != NSNotFound) {
-            [_sourceImageMap removeObjectForKey:entityUUID];
-            [_indexMap removeObjectForKey:entityUUID];
-            [_occupiedIndexes removeIndex:index];
-            [self saveMetadata];
+        if (compressedLength > 0) {
+            pthread_mutex_lock(&_coldLock);
+            BOOL didAppend = FICColdStoreAppend(&_coldStore, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes, compressedBytes, compressedLength);
+            pthread_mutex_unlock(&_coldLock);
+            
+            if (didAppend) {
+                FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterWrittenLength, compressedLength);
+            }
         }
         
-        [_lock unlock];
+        free(compressedBytes);
+    }
+}
+
+- (BOOL)coldEntryExistsForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID {
+    if (_coldStorageEnabled == NO || entityUUID == nil || sourceImageUUID == nil) {
+        return NO;
     }
+    
+    CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+    CFUUIDBytes sourceImageUUIDBytes = FICUUIDBytesWithString(sourceImageUUID);
+    
+    pthread_mutex_lock(&_coldLock);
+    BOOL coldEntryExists = FICColdStorePayloadLength(&_coldStore, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes) > 0;
+    pthread_mutex_unlock(&_coldLock);
+    
+    return coldEntryExists;
+}
+
+- (BOOL)restoreEntryForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID {
+    if (_coldStorageEnabled == NO || entityUUID == nil || sourceImageUUID == nil) {
+        return NO;
+    }
+    
+    if ([self entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]) {
+        return YES;
+    }
+    
+    CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+    CFUUIDBytes sourceImageUUIDBytes = FICUUIDBytesWithString(sourceImageUUID);
+    
+    // The compressed data is read up front, so the cold storage lock isn't held while the entry is locked
+    pthread_mutex_lock(&_coldLock);
+    size_t compressedLength = FICColdStorePayloadLength(&_coldStore, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes);
+    void *compressedBytes = compressedLength > 0 ? malloc(compressedLength) : NULL;
+    BOOL didRead = compressedBytes != NULL && FICColdStoreRead(&_coldStore, (const uint8_t *)&entityUUIDBytes, compressedBytes, compressedLength);
+    pthread_mutex_unlock(&_coldLock);
+    
+    BOOL didRestore = NO;
+    if (didRead) {
+        __block BOOL didDecompress = YES;
+        NSInteger imageLength = _imageLength;
+        didRestore = [self _setEntryForEntityUUIDBytes:entityUUIDBytes sourceImageUUIDBytes:sourceImageUUIDBytes fillBlock:^BOOL(FICImageTableEntry *entryData) {
+            didDecompress = FICDecompress(compressedBytes, compressedLength, [entryData bytes], (size_t)imageLength);
+            return didDecompress;
+        }];
+        
+        if (didDecompress == NO) {
+            pthread_mutex_lock(&_coldLock);
+            FICColdStoreRemove(&_coldStore, (const uint8_t *)&entityUUIDBytes);
+            pthread_mutex_unlock(&_coldLock);
+            
+            NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s could not decompress the cold storage data for entity UUID %@.", __PRETTY_FUNCTION__, entityUUID];
+            [self.imageCache _logMessage:message];
+        }
+    }
+    
+    free(compressedBytes);
+    
+    if (didRestore) {
+        [self _entryWasStored];
+    }
+    
+    return didRestore;
+}
+
+#pragma mark - Prefetching Entry Data
+
+- (void)prefetchEntriesForEntityUUIDs:(NSArray *)entityUUIDs sourceImageUUIDs:(NSArray *)sourceImageUUIDs {
+    NSUInteger count = MIN([entityUUIDs count], [sourceImageUUIDs count]);
+    if (count == 0) {
+        return;
+    }
+    
+    // UUIDs are parsed before the image table lock is taken. Prefetching is only a hint, so without memory for them there's nothing to do.
+    CFUUIDBytes *UUIDBytes = malloc(count * 2 * sizeof(CFUUIDBytes));
+    if (UUIDBytes == NULL) {
+        return;
+    }
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        UUIDBytes[i * 2] = FICUUIDBytesWithString([entityUUIDs objectAtIndex:i]);
+        UUIDBytes[i * 2 + 1] = FICUUIDBytesWithString([sourceImageUUIDs objectAtIndex:i]);
+    }
+    
+    FICTableEngineLock(&_engine, false);
+    
+    // An index set keeps the entries sorted by their position in the file and merges neighbors into ranges
+    NSMutableIndexSet *entryIndexes = [[NSMutableIndexSet alloc] init];
+    for (NSUInteger i = 0; i < count; i++) {
+        const FICEntryIndexEntry *entry = FICEntryIndexFind(&_engine.index, (const uint8_t *)&UUIDBytes[i * 2]);
+        if (entry != NULL && entry->slot < _engine.file.entryCount && memcmp(entry->sourceImageUUIDBytes, &UUIDBytes[i * 2 + 1], sizeof(CFUUIDBytes)) == 0) {
+            [entryIndexes addIndex:entry->slot];
+        }
+    }
+    
+    if ([entryIndexes count] > 0 && [self canAccessEntryData]) {
+        [entryIndexes enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
+            [self _prefetchEntriesInRange:range];
+        }];
+    }
+    
+    FICTableEngineUnlock(&_engine);
+    
+    free(UUIDBytes);
+}
+
+// The caller must hold the image table lock, which keeps the table file from changing size. Advice only starts reads, so it doesn't block for long.
+- (void)_prefetchEntriesInRange:(NSRange)range {
+    // Failures aren't reported, since the data is read on demand either way
+    if ([self _entryIsInReservedChunk:range.location]) {
+        // The reserved part of the file is mapped, so the kernel can map the pages in as it reads them
+        size_t length = MIN(range.length * _engine.file.entryLength, [_reservedChunk length] - range.location * _engine.file.entryLength);
+        madvise((uint8_t *)[_reservedChunk bytes] + range.location * _engine.file.entryLength, length, MADV_WILLNEED);
+    }
+    
+    FICTableFilePrefetch(&_engine.file, range.location, range.length);
 }
 
 #pragma mark - Checking for Entry Existence
@@ -450,60 +1096,192 @@ static void _FICReleaseImageData(void *info, const void *data, size_t size) {
 - (BOOL)entryExistsForEntityUUID:(NSString *)entityUUID sourceImageUUID:(NSString *)sourceImageUUID {
     BOOL imageExists = NO;
 
-    [_lock lock];
+    if (entityUUID == nil) {
+        return NO;
+    }
     
-    FICImageTableEntry *entryData = [self _entryDataForEntityUUID:entityUUID];
-    if (entryData != nil && sourceImageUUID != nil) {
-        NSString *existingEntityUUID = FICStringWithUUIDBytes([entryData entityUUIDBytes]);
-        BOOL entityUUIDIsCorrect = [entityUUID isEqualToString:existingEntityUUID];
+    CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+    
+    pthread_rwlock_t *entryLock = NULL;
+    FICImageTableEntry *entryData = [self _lockEntryDataForEntityUUIDBytes:entityUUIDBytes pin:NO entryLock:&entryLock];
+    if (entryData != nil) {
+        BOOL entryIsCorrect = YES;
+        if (sourceImageUUID != nil) {
+            BOOL entityUUIDIsCorrect = FICUUIDBytesEqual(entityUUIDBytes, [entryData entityUUIDBytes]);
+            BOOL sourceImageUUIDIsCorrect = FICUUIDBytesEqual(FICUUIDBytesWithString(sourceImageUUID), [entryData sourceImageUUIDBytes]);
+            entryIsCorrect = entityUUIDIsCorrect && sourceImageUUIDIsCorrect;
+        }
         
-        NSString *existingSourceImageUUID = FICStringWithUUIDBytes([entryData sourceImageUUIDBytes]);
-        BOOL sourceImageUUIDIsCorrect = [sourceImageUUID isEqualToString:existingSourceImageUUID];
+        pthread_rwlock_unlock(entryLock);
         
-        if (entityUUIDIsCorrect == NO || sourceImageUUIDIsCorrect == NO) {
+        if (entryIsCorrect == NO) {
             // The source image UUIDs don't match, so the image data should be deleted for this entity.
-            [self deleteEntryForEntityUUID:entityUUID];
+            [self _deleteEntryForEntityUUIDBytes:entityUUIDBytes index:[entryData index]];
             entryData = nil;
         }
     }
     
-    [_lock unlock];
-    
     imageExists = entryData != nil;
     
     return imageExists;
 }
 
+#pragma mark - Locking Entries
+
+// Returns the entry data for an entity with its entry locked for reading, or nil with no entry lock held if the entity has no entry. Entries are pinned before the image table
+// lock is released if requested, since nothing else stops them from being evicted once it is.
+- (FICImageTableEntry *)_lockEntryDataForEntityUUIDBytes:(CFUUIDBytes)entityUUIDBytes pin:(BOOL)pin entryLock:(pthread_rwlock_t **)entryLock {
+    FICImageTableEntry *entryData = nil;
+    uint32_t index;
+    
+    FICTableEngineLock(&_engine, false);
+    
+    pthread_rwlock_t *heldEntryLock = FICTableEngineLockSlotForReading(&_engine, (const uint8_t *)&entityUUIDBytes, &index);
+    if (heldEntryLock != NULL) {
+        entryData = [self _entryDataAtIndex:index];
+    }
+    
+    if (entryData != nil && pin) {
+        FICTableEngineEntryWasRetrieved(&_engine, index, (const uint8_t *)&entityUUIDBytes, true);
+        
+        __weak FICImageTable *weakSelf = self;
+        [entryData executeBlockOnDealloc:^{
+            [weakSelf _removeInUseForEntryAtIndex:index];
+        }];
+    }
+    
+    FICTableEngineUnlock(&_engine);
+    
+    if (entryData == nil && heldEntryLock != NULL) {
+        pthread_rwlock_unlock(heldEntryLock);
+        heldEntryLock = NULL;
+    }
+    
+    *entryLock = heldEntryLock;
+    
+    return entryData;
+}
+
+#pragma mark - Writing Entries to Disk
+
+// Called with the entry locked for writing, once its image data has been drawn
+- (void)_writeEntryData:(FICImageTableEntry *)entryData entityUUIDBytes:(CFUUIDBytes)entityUUIDBytes sourceImageUUIDBytes:(CFUUIDBytes)sourceImageUUIDBytes {
+    FICImageFormatDurability durability = [_imageFormat durability];
+    if (durability == FICImageFormatDurabilityDeferred) {
+        [self _addDirtyEntryData:entryData];
+        return;
+    }
+    
+    // Without waiting for the disk, the commit only guards against the app itself stopping mid-draw, since the kernel writes the data back on its own schedule
+    uint64_t startTime = FICStatisticsNanoseconds();
+    BOOL synchronously = durability == FICImageFormatDurabilitySynchronous;
+    if (FICTableEngineWriteEntry(&_engine, (uint32_t)[entryData index], (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes, [entryData bytes], synchronously)) {
+        [_trace recordSpanForStage:FICTraceStageFlush startTime:startTime entityUUIDBytes:entityUUIDBytes formatName:[_imageFormat name]];
+    }
+}
+
+- (void)_addDirtyEntryData:(FICImageTableEntry *)entryData {
+    FICImageTableChunk *chunk = [entryData imageTableChunk];
+    NSNumber *chunkIndexNumber = @([chunk index]);
+    
+    // The chunk is kept mapped until its entries are written. If the table grew in the meantime, the longer mapping covers every dirty entry in the chunk.
+    pthread_mutex_lock(&_flushLock);
+    FICImageTableChunk *dirtyChunk = [_dirtyChunks objectForKey:chunkIndexNumber];
+    if (dirtyChunk == nil || [chunk length] > [dirtyChunk length]) {
+        [_dirtyChunks setObject:chunk forKey:chunkIndexNumber];
+    }
+    pthread_mutex_unlock(&_flushLock);
+    
+    unsigned flushNeeds = FICTableEngineAddDirtyEntry(&_engine, (uint32_t)[entryData index]);
+    
+    if (flushNeeds & FICTableEngineDirtyFlushImmediately) {
+        dispatch_async([FICImageTable _metadataQueue], ^{
+            [self _flushDirtyEntries];
+        });
+    }
+    
+    if (flushNeeds & FICTableEngineDirtyFlushLater) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(FICImageTableDirtyEntryFlushInterval * NSEC_PER_SEC)), [FICImageTable _metadataQueue], ^{
+            FICTableEngineDirtyFlushIntervalDidPass(&_engine);
+            [self _flushDirtyEntries];
+        });
+    }
+}
+
+- (void)_flushDirtyEntries {
+    // The chunks are taken first, so every entry taken below has its chunk among them
+    pthread_mutex_lock(&_flushLock);
+    NSDictionary *dirtyChunks = _dirtyChunks;
+    _dirtyChunks = [[NSMutableDictionary alloc] init];
+    pthread_mutex_unlock(&_flushLock);
+    
+    FICSlotAllocator dirtyEntryIndexes;
+    uint64_t dirtyEntryGeneration = FICTableEngineTakeDirtyEntries(&_engine, &dirtyEntryIndexes);
+    
+    // Neighboring entries are neighbors in the file too, as long as they're in the same chunk, so each run of them is written with a single msync
+    size_t index = 0;
+    size_t count;
+    while ((count = FICTableEngineNextDirtyRun(&_engine, &dirtyEntryIndexes, &index)) > 0) {
+        // The reserved part of the table file is a single chunk. Runs never cross its end, since it's a whole number of chunks long.
+        NSInteger chunkIndex = [self _entryIsInReservedChunk:(NSInteger)index] ? [_reservedChunk index] : (NSInteger)(index / _engine.file.entriesPerChunk);
+        FICImageTableChunk *chunk = [dirtyChunks objectForKey:@(chunkIndex)];
+        
+        off_t offsetInChunk = (off_t)(index * _engine.file.entryLength) - [chunk fileOffset];
+        BOOL chunkHoldsEntries = chunk != nil && offsetInChunk < (off_t)[chunk length];
+        void *bytes = chunkHoldsEntries ? (uint8_t *)[chunk bytes] + offsetInChunk : NULL;
+        size_t mappedLength = chunkHoldsEntries ? [chunk length] - (size_t)offsetInChunk : 0;
+        
+        uint64_t startTime = FICStatisticsNanoseconds();
+        if (FICTableEngineFlushEntries(&_engine, index, count, bytes, mappedLength, dirtyEntryGeneration) > 0) {
+            [_trace recordSpanForStage:FICTraceStageFlush startTime:startTime entityUUID:nil formatName:[_imageFormat name]];
+        }
+        
+        index += count;
+    }
+    
+    FICSlotAllocatorDestroy(&dirtyEntryIndexes);
+}
+
 #pragma mark - Working with Entries
 
 - (NSInteger)_maximumCount {
-    return MAX([_imageFormat maximumCount], _entriesPerChunk);
+    return (NSInteger)_engine.maximumCount;
 }
 
-- (void)_setEntryCount:(NSInteger)entryCount {
-    if (entryCount != _entryCount) {        
-        off_t fileLength = entryCount * _entryLength;
-        int result = ftruncate(_fileDescriptor, fileLength);
+// Called by the engine with the image table lock held for writing, once the table file has been resized
+- (BOOL)_entryCountDidChange:(size_t)oldEntryCount {
+    // The file only grows past the reserved chunk when no entry can be evicted, and what's past it is mapped in chunks
+    off_t fileLength = _reservedChunk != nil ? MIN(_engine.file.length, (off_t)[_reservedChunk length]) : _engine.file.length;
+    off_t oldFileLength = (off_t)(oldEntryCount * _engine.file.entryLength);
+    
+    if (_reservedChunk != nil && [_reservedChunk mapFileDataToLength:(size_t)fileLength] == NO) {
+        // Entries past the mapped file data couldn't be used, so the engine puts the file back to its old length
+        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't map %lld bytes of the image table file for format %@, error = %d", __PRETTY_FUNCTION__, fileLength, [_imageFormat name], errno];
+        [self.imageCache _logMessage:message];
         
-        if (result != 0) {
-            NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s ftruncate returned %d, error = %d, fd = %d, filePath = %@, length = %lld", __PRETTY_FUNCTION__, result, errno, _fileDescriptor, _filePath, fileLength];
-            [self.imageCache _logMessage:message];
-        } else {
-            _fileLength = fileLength;
-            _entryCount = entryCount;
-            _chunkCount = _entriesPerChunk > 0 ? ((_entryCount + _entriesPerChunk - 1) / _entriesPerChunk) : 0;
-            
-            NSDictionary *chunkDictionary = [_chunkDictionary copy];
-            for (FICImageTableChunk *chunk in [chunkDictionary allValues]) {
-                if ([chunk length] != _chunkLength) {
-                    // Issue 31: https://github.com/path/FastImageCache/issues/31
-                    // Somehow, we have a partial chunk whose length needs to be adjusted
-                    // since we changed our file length.
-                    [self _setChunk:nil index:[chunk index]];
-                }
-            }
+        return NO;
+    }
+    
+    if (_reservedChunk != nil && fileLength > oldFileLength) {
+        // Growing the reserved chunk maps the new file data in place
+        FICStatisticsAdd(&_engine.statistics, FICTableEngineCounterChunkMapping, 1);
+    }
+    
+    pthread_mutex_lock(&_chunkLock);
+    NSMutableArray *partialChunks = [NSMutableArray array];
+    for (FICImageTableChunk *chunk in [[_chunkDictionary objectEnumerator] allObjects]) {
+        if ([chunk length] != _engine.file.chunkLength || (size_t)[chunk index] >= _engine.file.chunkCount) {
+            // Issue 31: https://github.com/path/FastImageCache/issues/31
+            // Somehow, we have a partial chunk whose length needs to be adjusted
+            // since we changed our file length.
+            [self _setChunk:nil index:[chunk index]];
+            [partialChunks addObject:chunk];
         }
     }
+    [_chunkCache removeChunks:partialChunks];
+    pthread_mutex_unlock(&_chunkLock);
+    
+    return YES;
 }
 
 // There's inherently a race condition between when you ask whether the data is
@@ -535,39 +1313,48 @@ static void _FICReleaseImageData(void *info, const void *data, size_t size) {
     return _canAccessData;
 }
 
+// The caller must hold the image table lock, which keeps the table file from changing size
 - (FICImageTableEntry *)_entryDataAtIndex:(NSInteger)index {
     FICImageTableEntry *entryData = nil;
     
-    [_lock lock];
-
     BOOL canAccessData = [self canAccessEntryData];
-    if (index < _entryCount && canAccessData) {
-        off_t entryOffset = index * _entryLength;
-        size_t chunkIndex = (size_t)(entryOffset / _chunkLength);
-        
-        FICImageTableChunk *chunk = [self _chunkAtIndex:chunkIndex];
-        if (chunk != nil) {
-            off_t chunkOffset = chunkIndex * _chunkLength;
-            off_t entryOffsetInChunk = entryOffset - chunkOffset;
-            void *mappedChunkAddress = [chunk bytes];
-            void *mappedEntryAddress = mappedChunkAddress + entryOffsetInChunk;
-            entryData = [[FICImageTableEntry alloc] initWithImageTableChunk:chunk bytes:mappedEntryAddress length:_entryLength];
+    if (index < _engine.file.entryCount && canAccessData) {
+        off_t entryOffset = index * _engine.file.entryLength;
+        
+        if ([self _entryIsInReservedChunk:index]) {
+            // The reserved part of the table file is mapped already, so the entry's address is all there is to find
+            void *mappedEntryAddress = (uint8_t *)[_reservedChunk bytes] + entryOffset;
+            entryData = [[FICImageTableEntry alloc] initWithImageTableChunk:_reservedChunk bytes:mappedEntryAddress length:_engine.file.entryLength];
+        } else {
+            size_t chunkIndex = (size_t)(entryOffset / _engine.file.chunkLength);
+            
+            pthread_mutex_lock(&_chunkLock);
+            
+            FICImageTableChunk *chunk = [self _chunkAtIndex:chunkIndex];
+            FICImageTableChunkCache *chunkCache = _chunkCache;
+            if (chunk != nil) {
+                off_t chunkOffset = chunkIndex * _engine.file.chunkLength;
+                off_t entryOffsetInChunk = entryOffset - chunkOffset;
+                void *mappedChunkAddress = [chunk bytes];
+                void *mappedEntryAddress = mappedChunkAddress + entryOffsetInChunk;
+                entryData = [[FICImageTableEntry alloc] initWithImageTableChunk:chunk bytes:mappedEntryAddress length:_engine.file.entryLength];
+            }
             
-            if (entryData) {
-                [entryData setImageCache:self.imageCache];
-                [entryData setIndex:index];
-                [_chunkSet addObject:chunk];
+            pthread_mutex_unlock(&_chunkLock);
             
-                __weak FICImageTable *weakSelf = self;
-                [entryData executeBlockOnDealloc:^{
-                    [weakSelf _entryWasDeallocatedFromChunk:chunk];
-                }];
+            // The entry keeps its chunk mapped while it's alive. The chunk cache keeps it mapped for a while longer, so entries near this one can be used again without mapping
+            // their chunk again.
+            if (chunk != nil) {
+                [chunkCache chunkWasUsed:chunk];
             }
         }
+        
+        if (entryData) {
+            [entryData setImageCache:self.imageCache];
+            [entryData setIndex:index];
+        }
     }
     
-    [_lock unlock];
-    
     if (!entryData) {
         NSString *message = nil;
         if (canAccessData) {
@@ -581,207 +1368,405 @@ static void _FICReleaseImageData(void *info, const void *data, size_t size) {
     return entryData;
 }
 
-- (void)_entryWasDeallocatedFromChunk:(FICImageTableChunk *)chunk {
-    [_lock lock];
-    [_chunkSet removeObject:chunk];
-    if ([_chunkSet countForObject:chunk] == 0) {
-        [self _setChunk:nil index:[chunk index]];
+#pragma mark - Working with Metadata
+
++ (dispatch_queue_t)_metadataQueue {
+    static dispatch_queue_t __metadataQueue = nil;
+    
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        __metadataQueue = dispatch_queue_create("com.path.FastImageCache.ImageTableMetadataQueue", NULL);
+    });
+    
+    return __metadataQueue;
+}
+
+- (void)_flushJournal {
+    FICTableEngineFlushJournal(&_engine);
+    
+    // This is checked here rather than as records are added, so recording a cache hit never has to schedule a checkpoint
+    if (FICTableEngineCheckpointIsDue(&_engine)) {
+        [self saveMetadata];
+    }
+}
+
+- (void)saveMetadata {
+    if (FICTableEngineScheduleCheckpoint(&_engine)) {
+        dispatch_async([FICImageTable _metadataQueue], ^{
+            FICTableEngineWriteCheckpoint(&_engine, [_imageFormatData bytes], [_imageFormatData length]);
+        });
     }
-    [_lock unlock];
 }
 
-- (NSInteger)_nextEntryIndex {
-    NSMutableIndexSet *unoccupiedIndexes = [[NSMutableIndexSet alloc] initWithIndexesInRange:NSMakeRange(0, _entryCount)];
-    [unoccupiedIndexes removeIndexes:_occupiedIndexes];
+- (BOOL)_loadMetadataJournalData:(NSData *)metadataData {
+    size_t validLength = 0;
+    if (FICTableEngineLoadMetadata(&_engine, [metadataData bytes], [metadataData length], &validLength) == false) {
+        return NO;
+    }
+    
+    // Anything past the last complete record was torn by a crash and is discarded before new records are appended
+    dispatch_async([FICImageTable _metadataQueue], ^{
+        if (FICMetadataJournalOpen(&_engine.journal, validLength) == false) {
+            NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't open metadata for format %@, error = %d", __PRETTY_FUNCTION__, [_imageFormat name], errno];
+            [self.imageCache _logMessage:message];
+        }
+    });
+    
+    FICTableEngineRemoveUncommittedEntries(&_engine);
     
-    NSInteger index = [unoccupiedIndexes firstIndex];
-    if (index == NSNotFound) {
-        index = _entryCount;
+    if (FICMetadataJournalNeedsUpgrade([metadataData bytes], [metadataData length])) {
+        [self saveMetadata];
     }
     
-    if (index >= [self _maximumCount] && [_MRUEntries count]) {
-        // Evict the oldest/least-recently accessed entry here
+    return YES;
+}
 
-        NSString *oldestEvictableEntityUUID = [self oldestEvictableEntityUUID];
-        if (oldestEvictableEntityUUID) {
-            [self deleteEntryForEntityUUID:oldestEvictableEntityUUID];
-            index = [self _nextEntryIndex];
+- (BOOL)_loadLegacyMetadataData:(NSData *)metadataData {
+    NSDictionary *metadataDictionary = (NSDictionary *)[NSJSONSerialization JSONObjectWithData:metadataData options:kNilOptions error:NULL];
+    
+    if (!metadataDictionary) {
+        // The image table was likely previously stored as a .plist
+        metadataDictionary = (NSDictionary *)[NSPropertyListSerialization propertyListWithData:metadataData options:0 format:NULL error:NULL];
+    }
+    
+    NSDictionary *formatDictionary = [metadataDictionary objectForKey:FICImageTableFormatKey];
+    if ([formatDictionary isEqualToDictionary:_imageFormatDictionary] == NO) {
+        return NO;
+    }
+    
+    NSDictionary *indexMap = [metadataDictionary objectForKey:FICImageTableIndexMapKey];
+    NSDictionary *sourceImageMap = [metadataDictionary objectForKey:FICImageTableContextMapKey];
+    
+    [indexMap enumerateKeysAndObjectsUsingBlock:^(NSString *entityUUID, NSNumber *index, BOOL *stop) {
+        NSString *sourceImageUUID = [sourceImageMap objectForKey:entityUUID];
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        CFUUIDBytes sourceImageUUIDBytes = sourceImageUUID != nil ? FICUUIDBytesWithString(sourceImageUUID) : FICImageTableEmptyUUIDBytes;
+        
+        FICEntryIndexSet(&_engine.index, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&sourceImageUUIDBytes, [index unsignedIntValue]);
+        FICSlotAllocatorMarkOccupied(&_engine.allocator, [index unsignedIntegerValue]);
+    }];
+    
+    FICEvictionPolicyRemoveAll(&_engine.policy);
+    FICTableEngineConfigureEvictionPolicy(&_engine);
+    
+    // The MRU array is ordered from most to least recently used, so walk it backwards to rebuild the list
+    NSArray *mruArray = [metadataDictionary objectForKey:FICImageTableMRUArrayKey];
+    for (NSString *entityUUID in [mruArray reverseObjectEnumerator]) {
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        const FICEntryIndexEntry *entry = FICEntryIndexFind(&_engine.index, (const uint8_t *)&entityUUIDBytes);
+        if (entry != NULL) {
+            FICEvictionPolicyTouch(&_engine.policy, entry->slot, entry->entityUUIDBytes);
         }
     }
+    
+    return YES;
+}
 
-    if (index >= [self _maximumCount]) {
-        NSString *message = [NSString stringWithFormat:@"FICImageTable - unable to evict entry from table '%@' to make room. New index %ld, desired max %ld", [_imageFormat name], (long)index, (long)[self _maximumCount]];
+// The mapping is private, so the structures that work in place on the snapshot in it can modify it without changing the file. Pages are only copied once they're modified.
+- (NSData *)_mapMetadataFile {
+    _metadataMapping = FICMetadataJournalMapFile(&_engine.journal, &_metadataMappingLength);
+    
+    return _metadataMapping != NULL ? [NSData dataWithBytesNoCopy:_metadataMapping length:_metadataMappingLength freeWhenDone:NO] : nil;
+}
+
+- (void)_unmapMetadataFile {
+    if (_metadataMapping != NULL) {
+        FICMetadataJournalUnmapFile(_metadataMapping, _metadataMappingLength);
+        _metadataMapping = NULL;
+        _metadataMappingLength = 0;
+    }
+}
+
+- (void)_loadMetadata {
+    NSString *metadataFilePath = [self metadataFilePath];
+    NSData *metadataData = [self _mapMetadataFile];
+    BOOL metadataExists = metadataData != nil;
+    BOOL metadataWasLoaded = NO;
+    if (metadataData != nil && FICMetadataJournalIsJournalData([metadataData bytes], [metadataData length])) {
+        metadataWasLoaded = [self _loadMetadataJournalData:metadataData];
+    } else if (metadataData != nil && [self _loadLegacyMetadataData:metadataData]) {
+        // Metadata stored as JSON or a .plist is migrated to a journal checkpoint
+        [self saveMetadata];
+        metadataWasLoaded = YES;
+    }
+    
+    // Structures that copied their storage out of the snapshot while records were replayed don't need it anymore. Those that still use it keep it mapped until the image table
+    // is deallocated, which costs address space, but no memory beyond the pages that were modified.
+    if (_engine.index.borrowsStorage == false && _engine.allocator.borrowsStorage == false && _engine.policy.list.borrowsStorage == false &&
+        _engine.policy.sketch.borrowsStorage == false) {
+        metadataData = nil;
+        [self _unmapMetadataFile];
+    }
+    
+    if (metadataWasLoaded) {
+        return;
+    }
+    
+    if (metadataExists) {
+        // Something about this image format has changed, so the existing metadata is no longer valid. The image table file
+        // must be deleted and recreated.
+        [[NSFileManager defaultManager] removeItemAtPath:_filePath error:NULL];
+        [[NSFileManager defaultManager] removeItemAtPath:metadataFilePath error:NULL];
+        
+        NSString *message = [NSString stringWithFormat:@"*** FIC Notice: Image format %@ has changed; deleting data and starting over.", [_imageFormat name]];
         [self.imageCache _logMessage:message];
     }
     
-    return index;
+    FICTableEngineConfigureEvictionPolicy(&_engine);
+    
+    // Start a new journal
+    [self saveMetadata];
 }
 
-- (NSString *)oldestEvictableEntityUUID {
-    NSString *uuid = nil;
-    for (NSInteger i = [_MRUEntries count] - 1; i >= 0; i--) {
-        NSString *candidateUUID = [_MRUEntries objectAtIndex:i];
-        if (![_inUseEntries containsObject:candidateUUID]) {
-            uuid = candidateUUID;
-            break;
-        }
+#pragma mark - Compacting the Image Table File
+
+- (size_t)compactEntriesUpToLength:(size_t)length {
+    size_t compactedLength = 0;
+    
+    while (compactedLength < length && [self _moveLastEntry]) {
+        compactedLength += _engine.file.entryLength;
+    }
+    
+    [self _truncateAfterLastEntry];
+    
+    if (compactedLength < length) {
+        compactedLength += FICTableEnginePunchHoles(&_engine, length - compactedLength, (uint64_t)(FICImageTableIdleEntryHolePunchingInterval * NSEC_PER_SEC));
     }
+    
+    return compactedLength;
+}
 
-    return uuid;
+- (unsigned long long)compactableLength {
+    return FICTableEngineCompactableLength(&_engine);
 }
 
-- (NSInteger)_indexOfEntryForEntityUUID:(NSString *)entityUUID {
-    NSInteger index = NSNotFound;
-    if (_indexMap != nil && entityUUID != nil) {
-        NSNumber *indexNumber = [_indexMap objectForKey:entityUUID];
-        index = indexNumber ? [indexNumber integerValue] : NSNotFound;
-        
-        if (index != NSNotFound && index >= _entryCount) {
-            [_indexMap removeObjectForKey:entityUUID];
-            [_occupiedIndexes removeIndex:index];
-            [_sourceImageMap removeObjectForKey:entityUUID];
-            index = NSNotFound;
+- (NSUInteger)compactedEntryCount {
+    FICTableEngineLock(&_engine, false);
+    NSUInteger compactedEntryCount = _engine.compactedEntryCount;
+    FICTableEngineUnlock(&_engine);
+    
+    return compactedEntryCount;
+}
+
+- (unsigned long long)truncatedLength {
+    FICTableEngineLock(&_engine, false);
+    unsigned long long truncatedLength = _engine.truncatedLength;
+    FICTableEngineUnlock(&_engine);
+    
+    return truncatedLength;
+}
+
+- (unsigned long long)punchedLength {
+    FICTableEngineLock(&_engine, false);
+    unsigned long long punchedLength = _engine.punchedLength;
+    FICTableEngineUnlock(&_engine);
+    
+    return punchedLength;
+}
+
+// Moves the entry nearest the end of the table file into the first free entry. Returns NO if there's no entry to move, or if it can't be moved right now.
+- (BOOL)_moveLastEntry {
+    uint32_t index;
+    uint32_t newIndex;
+    if (FICTableEngineLockEntryToMove(&_engine, &index, &newIndex) == false) {
+        return NO;
+    }
+    
+    FICImageTableEntry *entryData = [self _entryDataAtIndex:index];
+    FICImageTableEntry *newEntryData = entryData != nil ? [self _entryDataAtIndex:newIndex] : nil;
+    BOOL entryWasMoved = newEntryData != nil;
+    
+    if (entryWasMoved) {
+        // A free entry that was just evicted still holds the evicted image data, which is moved to cold storage before it's overwritten. Evicted entries are usually reused
+        // right away, so this rarely holds up the image table.
+        if (FICTableEngineTakeEvictedEntry(&_engine, newIndex)) {
+            [self _moveEntryData:newEntryData toColdStorageForEntityUUIDBytes:[newEntryData entityUUIDBytes] sourceImageUUIDBytes:[newEntryData sourceImageUUIDBytes]];
         }
+        
+        FICTableEngineMoveEntry(&_engine, index, newIndex, [entryData bytes], [newEntryData bytes]);
+    }
+    
+    FICTableEngineUnlock(&_engine);
+    
+    if (entryWasMoved) {
+        [self _writeEntryData:newEntryData entityUUIDBytes:[newEntryData entityUUIDBytes] sourceImageUUIDBytes:[newEntryData sourceImageUUIDBytes]];
     }
     
-    return index;
+    FICTableEngineUnlockEntriesToMove(&_engine, index, newIndex);
+    
+    return entryWasMoved;
 }
 
-- (FICImageTableEntry *)_entryDataForEntityUUID:(NSString *)entityUUID {
-    FICImageTableEntry *entryData = nil;
-    NSInteger index = [self _indexOfEntryForEntityUUID:entityUUID];
-    if (index != NSNotFound) {
-        entryData = [self _entryDataAtIndex:index];
+- (void)_truncateAfterLastEntry {
+    size_t entryCount;
+    if (FICTableEngineLockForTruncation(&_engine, &entryCount) == false) {
+        return;
     }
     
-    return entryData;
+    // Evicted image data past the new end of the file is moved to cold storage first, since there's no other entry left for it to be moved from
+    size_t index = entryCount;
+    while ((index = FICSlotAllocatorNextOccupiedSlot(&_engine.evictedSlots, index)) < _engine.file.entryCount) {
+        FICImageTableEntry *entryData = [self _entryDataAtIndex:index];
+        if (entryData != nil) {
+            [self _moveEntryData:entryData toColdStorageForEntityUUIDBytes:[entryData entityUUIDBytes] sourceImageUUIDBytes:[entryData sourceImageUUIDBytes]];
+        }
+        index++;
+    }
+    
+    FICTableEngineTruncate(&_engine, entryCount);
+    
+    FICTableEngineUnlock(&_engine);
+    FICTableEngineUnlockAllEntries(&_engine);
 }
 
-- (void)_entryWasAccessedWithEntityUUID:(NSString *)entityUUID {
-    // Update MRU array
-    NSInteger index = [_MRUEntries indexOfObject:entityUUID];
-    if (index == NSNotFound) {
-        [_MRUEntries insertObject:entityUUID atIndex:0];
-    } else if (index != 0) {
-        [_MRUEntries removeObjectAtIndex:index];
-        [_MRUEntries insertObject:entityUUID atIndex:0];
-    }
+#pragma mark - Sharing a Disk Budget
+
+- (size_t)usedLength {
+    return FICTableEngineUsedLength(&_engine);
 }
 
-// Unchanging pointer value for a given entry index to synchronize on
-- (NSNumber *)_numberForEntryAtIndex:(NSInteger)index {
-    NSNumber *resultNumber = (__bridge id)CFDictionaryGetValue(_indexNumbers, (const void *)index);
-    if (!resultNumber) {
-        resultNumber = [NSNumber numberWithInteger:index];
-        CFDictionarySetValue(_indexNumbers, (const void *)index, (__bridge void *)resultNumber);
+- (double)diskBudgetEvictionPriority {
+    double priority = DBL_MAX;
+    
+    FICTableEngineLock(&_engine, false);
+    pthread_mutex_lock(&_engine.recencyLock);
+    
+    uint32_t slot = FICEvictionPolicyPeekVictim(&_engine.policy, &_engine.index);
+    if (slot != FICRecencyListNone) {
+        priority = [self _diskBudgetPriorityOfEntryAtIndex:slot];
     }
-    return resultNumber;
+    
+    pthread_mutex_unlock(&_engine.recencyLock);
+    FICTableEngineUnlock(&_engine);
+    
+    return priority;
 }
 
-#pragma mark - Working with Metadata
-
-- (void)saveMetadata {
-    @autoreleasepool {
-        [_lock lock];
-        
-        NSDictionary *metadataDictionary = [NSDictionary dictionaryWithObjectsAndKeys:
-                                            [_indexMap copy], FICImageTableIndexMapKey,
-                                            [_sourceImageMap copy], FICImageTableContextMapKey,
-                                            [[_MRUEntries array] copy], FICImageTableMRUArrayKey,
-                                            [_imageFormatDictionary copy], FICImageTableFormatKey, nil];
+- (double)evictEntryForDiskBudget {
+    double priority = DBL_MAX;
+    
+    FICTableEngineLock(&_engine, true);
+    
+    uint32_t index;
+    if (FICTableEngineEvictEntry(&_engine, &index)) {
+        pthread_mutex_lock(&_engine.recencyLock);
+        priority = [self _diskBudgetPriorityOfEntryAtIndex:index];
+        pthread_mutex_unlock(&_engine.recencyLock);
+    }
+    
+    FICTableEngineUnlock(&_engine);
+    
+    return priority;
+}
 
-        __block int32_t metadataVersion = OSAtomicIncrement32(&_metadataVersion);
+- (double)diskBudgetInflation {
+    pthread_mutex_lock(&_engine.recencyLock);
+    double inflation = _diskBudgetInflation;
+    pthread_mutex_unlock(&_engine.recencyLock);
+    
+    return inflation;
+}
 
-        [_lock unlock];
-        
-        static dispatch_queue_t __metadataQueue = nil;
-        static dispatch_once_t onceToken;
-        dispatch_once(&onceToken, ^{
-            __metadataQueue = dispatch_queue_create("com.path.FastImageCache.ImageTableMetadataQueue", NULL);
-        });
-        
-        dispatch_async(__metadataQueue, ^{
-            // Cancel serialization if a new metadata version is queued to be saved
-            if (metadataVersion != _metadataVersion) {
-                return;
-            }
+- (void)setDiskBudgetInflation:(double)diskBudgetInflation {
+    pthread_mutex_lock(&_engine.recencyLock);
+    _diskBudgetInflation = diskBudgetInflation;
+    pthread_mutex_unlock(&_engine.recencyLock);
+}
 
-            @autoreleasepool {
-                NSData *data = [NSJSONSerialization dataWithJSONObject:metadataDictionary options:kNilOptions error:NULL];
+// Called by the engine with its recency lock held whenever an entry is stored or accessed
+- (void)_entryWasAccessedAtIndex:(NSInteger)index {
+    [self _setDiskBudgetPriority:_diskBudgetInflation + _diskBudgetCostPerByte ofEntryAtIndex:index];
+}
 
-                // Cancel disk writing if a new metadata version is queued to be saved
-                if (metadataVersion != _metadataVersion) {
-                    return;
-                }
+// Called by the engine with its recency lock held when compaction moves an entry
+- (void)_entryWasMovedFromIndex:(NSInteger)index toIndex:(NSInteger)newIndex {
+    [self _setDiskBudgetPriority:[self _diskBudgetPriorityOfEntryAtIndex:index] ofEntryAtIndex:newIndex];
+}
 
-                BOOL fileWriteResult = [data writeToFile:[self metadataFilePath] atomically:NO];
-                if (fileWriteResult == NO) {
-                    NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s couldn't write metadata for format %@", __PRETTY_FUNCTION__, [_imageFormat name]];
-                    [self.imageCache _logMessage:message];
-                }
-            }
-        });
-    }
+// The caller must hold the engine's recency lock
+- (double)_diskBudgetPriorityOfEntryAtIndex:(NSInteger)index {
+    // Entries that haven't been accessed since the image table was opened rank as if nothing had been evicted yet
+    return (size_t)index < _diskBudgetPriorityCount ? _diskBudgetPriorities[index] : _diskBudgetCostPerByte;
 }
 
-- (void)_loadMetadata {
-    NSString *metadataFilePath = [self metadataFilePath];
-    NSData *metadataData = [NSData dataWithContentsOfURL:[NSURL fileURLWithPath:metadataFilePath] options:NSDataReadingMappedAlways error:NULL];
-    if (metadataData != nil) {
-        NSDictionary *metadataDictionary = (NSDictionary *)[NSJSONSerialization JSONObjectWithData:metadataData options:kNilOptions error:NULL];
-        
-        if (!metadataDictionary) {
-            // The image table was likely previously stored as a .plist
-            // We'll read it into memory as a .plist and later store it (during -saveMetadata) using NSJSONSerialization for performance reasons
-            metadataDictionary = (NSDictionary *)[NSPropertyListSerialization propertyListWithData:metadataData options:0 format:NULL error:NULL];
-        }
-        
-        NSDictionary *formatDictionary = [metadataDictionary objectForKey:FICImageTableFormatKey];
-        if ([formatDictionary isEqualToDictionary:_imageFormatDictionary] == NO) {
-            // Something about this image format has changed, so the existing metadata is no longer valid. The image table file
-            // must be deleted and recreated.
-            [[NSFileManager defaultManager] removeItemAtPath:_filePath error:NULL];
-            [[NSFileManager defaultManager] removeItemAtPath:metadataFilePath error:NULL];
-            metadataDictionary = nil;
-            
-            NSString *message = [NSString stringWithFormat:@"*** FIC Notice: Image format %@ has changed; deleting data and starting over.", [_imageFormat name]];
-            [self.imageCache _logMessage:message];
+// The caller must hold the engine's recency lock
+- (void)_setDiskBudgetPriority:(double)priority ofEntryAtIndex:(NSInteger)index {
+    if ((size_t)index >= _diskBudgetPriorityCount) {
+        size_t count = MAX(_diskBudgetPriorityCount * 2, (size_t)256);
+        while (count <= (size_t)index) {
+            count *= 2;
         }
         
-        [_indexMap setDictionary:[metadataDictionary objectForKey:FICImageTableIndexMapKey]];
-        
-        for (NSNumber *index in [_indexMap allValues]) {
-            [_occupiedIndexes addIndex:[index intValue]];
+        double *priorities = realloc(_diskBudgetPriorities, count * sizeof(double));
+        if (priorities == NULL) {
+            // The entry keeps the priority of one that hasn't been accessed, which only makes it evicted sooner
+            return;
         }
         
-        [_sourceImageMap setDictionary:[metadataDictionary objectForKey:FICImageTableContextMapKey]];
-        
-        [_MRUEntries removeAllObjects];
-        
-        NSArray *mruArray = [metadataDictionary objectForKey:FICImageTableMRUArrayKey];
-        if (mruArray) {
-            [_MRUEntries addObjectsFromArray:mruArray];
+        for (size_t i = _diskBudgetPriorityCount; i < count; i++) {
+            priorities[i] = _diskBudgetCostPerByte;
         }
+        _diskBudgetPriorities = priorities;
+        _diskBudgetPriorityCount = count;
     }
+    
+    _diskBudgetPriorities[index] = priority;
+}
+
+#pragma mark - Measuring Image Table Activity
+
+- (FICImageTableStatistics)statistics {
+    FICStatistics *engineStatistics = &_engine.statistics;
+    
+    FICImageTableStatistics statistics;
+    statistics.hitCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterHit);
+    statistics.missCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterMiss);
+    statistics.storedEntryCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterStoredEntry);
+    statistics.evictedEntryCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterEvictedEntry);
+    statistics.chunkMappingCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterChunkMapping);
+    statistics.chunkUnmappingCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterChunkUnmapping);
+    statistics.writtenLength = FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterWrittenLength);
+    statistics.lockCount = (NSUInteger)FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterLock);
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramLockWait, &statistics.lockWaitDurations);
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramFlush, &statistics.flushDurations);
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramJournalWrite, &statistics.journalWriteDurations);
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramCheckpoint, &statistics.checkpointDurations);
+    
+    return statistics;
 }
 
 #pragma mark - Resetting the Image Table
 
 - (void)reset {
-    [_lock lock];
+    // Every entry lock is taken first, so nothing is reading or drawing entry data when the table file is truncated. Writers that wait for an entry lock take the image table lock
+    // after it too, so this order can't deadlock with them.
+    FICTableEngineLockAllEntries(&_engine);
+    FICTableEngineLock(&_engine, true);
     
-    [_indexMap removeAllObjects];
-    [_occupiedIndexes removeAllIndexes];
-    [_inUseEntries removeAllObjects];
-    [_MRUEntries removeAllObjects];
-    [_sourceImageMap removeAllObjects];
+    pthread_mutex_lock(&_engine.recencyLock);
+    free(_diskBudgetPriorities);
+    _diskBudgetPriorities = NULL;
+    _diskBudgetPriorityCount = 0;
+    pthread_mutex_unlock(&_engine.recencyLock);
+    
+    pthread_mutex_lock(&_chunkLock);
+    [_chunkCache removeChunks:[[_chunkDictionary objectEnumerator] allObjects]];
     [_chunkDictionary removeAllObjects];
-    [_chunkSet removeAllObjects];
+    pthread_mutex_unlock(&_chunkLock);
+    
+    pthread_mutex_lock(&_flushLock);
+    [_dirtyChunks removeAllObjects];
+    pthread_mutex_unlock(&_flushLock);
+    
+    pthread_mutex_lock(&_coldLock);
+    FICColdStoreRemoveAll(&_coldStore);
+    pthread_mutex_unlock(&_coldLock);
     
-    [self _setEntryCount:0];
+    FICTableEngineRemoveAll(&_engine);
     [self saveMetadata];
     
-    [_lock unlock];
+    FICTableEngineUnlock(&_engine);
+    FICTableEngineUnlockAllEntries(&_engine);
 }
 
 @end
@@ -43,6 +43,13 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, assign, readonly) size_t length;
 
+/**
+ A block called when the chunk unmaps its file data, as it's deallocated.
+
+ @discussion Image tables use this to count unmappings of their own chunks, which can outlive them. The block is called on whichever thread releases the chunk last, so it must be
+ quick and must not take any locks.
+ */
+@property (nonatomic, copy, nullable) dispatch_block_t unmappingBlock;
 
 ///----------------------------------------
 /// @name Initializing an Image Table Chunk
@@ -61,6 +68,53 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (nullable instancetype)initWithFileDescriptor:(int)fileDescriptor index:(NSInteger)index length:(size_t)length;
 
+/**
+ Initializes a new image table chunk that reserves address space for a whole image table file.
+ 
+ @param fileDescriptor The image table's file descriptor to map from.
+ 
+ @param reservedLength The length, in bytes, of address space to reserve. This becomes the chunk's `<length>`.
+ 
+ @return A new image table chunk whose index and file offset are both 0, or `nil` if the address space couldn't be reserved.
+ 
+ @discussion None of the file is mapped until `<mapFileDataToLength:>` is called.
+ */
+- (nullable instancetype)initWithFileDescriptor:(int)fileDescriptor reservedLength:(size_t)reservedLength;
+
+///----------------------------------------
+/// @name Growing a Reserved Chunk in Place
+///----------------------------------------
+
+/**
+ Maps image table file data into the address space reserved by the chunk, starting from the beginning of the file.
+ 
+ @param length The length, in bytes, of file data that should be mapped. Must not be more than the chunk's `<length>`.
+ 
+ @return `YES` if the file data is mapped.
+ 
+ @discussion File data that is already mapped stays where it is, so pointers into it remain valid as the file grows. Making the length shorter doesn't unmap anything; the file
+ data past the new length is mapped again the next time the length grows. This method must not be called on chunks made with
+ `<initWithFileDescriptor:index:length:>`, and must not be called on the same chunk from more than one thread at a time.
+ */
+- (BOOL)mapFileDataToLength:(size_t)length;
+
+///----------------------------------
+/// @name Counting Mapping Operations
+///----------------------------------
+
+/**
+ Returns the number of times an image table chunk has mapped file data into memory since the app launched.
+ 
+ @discussion Together with `<unmappingCount>`, this shows how often scrolling has to go back to the kernel for image data. Once every visible chunk is kept mapped by an
+ `<FICImageTableChunkCache>`, neither count should change.
+ */
++ (NSUInteger)mappingCount;
+
+/**
+ Returns the number of times an image table chunk has unmapped its file data since the app launched.
+ */
++ (NSUInteger)unmappingCount;
+
 @end
 
 NS_ASSUME_NONNULL_END
\ No newline at end of file
@@ -7,8 +7,15 @@
 //
 
 #import "FICImageTableChunk.h"
+#import "FICTableFile.h"
+#import "FICUtilities.h"
 
-#import <sys/mman.h>
+#import <stdatomic.h>
+
+#pragma mark Internal Definitions
+
+static atomic_ulong FICImageTableChunkMappingCount;
+static atomic_ulong FICImageTableChunkUnmappingCount;
 
 #pragma mark - Class Extension
 
@@ -17,6 +24,8 @@
     void *_bytes;
     size_t _length;
     off_t _fileOffset;
+    int _fileDescriptor;
+    size_t _mappedLength;                                           // How much of the reserved address space holds file data
 }
 
 @end
@@ -38,11 +47,29 @@
         _index = index;
         _length = length;
         _fileOffset = _index * _length;
-        _bytes = mmap(NULL, _length, (PROT_READ|PROT_WRITE), (MAP_FILE|MAP_SHARED), fileDescriptor, _fileOffset);
+        _bytes = FICTableFileMap(fileDescriptor, _fileOffset, _length);
 
-        if (_bytes == MAP_FAILED) {
+        if (_bytes == NULL) {
             NSLog(@"Failed to map chunk. errno=%d", errno);
-            _bytes = NULL;
+            self = nil;
+        } else {
+            atomic_fetch_add_explicit(&FICImageTableChunkMappingCount, 1, memory_order_relaxed);
+        }
+    }
+    
+    return self;
+}
+
+- (instancetype)initWithFileDescriptor:(int)fileDescriptor reservedLength:(size_t)reservedLength {
+    self = [super init];
+    
+    if (self != nil) {
+        _fileDescriptor = fileDescriptor;
+        _length = FICByteAlign(reservedLength, FICTableFilePageSize());
+        _bytes = FICTableFileReserveAddressSpace(_length);
+        
+        if (_bytes == NULL) {
+            NSLog(@"Failed to reserve address space for chunk. errno=%d", errno);
             self = nil;
         }
     }
@@ -52,8 +79,45 @@
 
 - (void)dealloc {
     if (_bytes != NULL) {
-        munmap(_bytes, _length);
+        FICTableFileUnmap(_bytes, _length);
+        atomic_fetch_add_explicit(&FICImageTableChunkUnmappingCount, 1, memory_order_relaxed);
+        
+        if (_unmappingBlock != nil) {
+            _unmappingBlock();
+        }
+    }
+}
+
+#pragma mark - Growing a Reserved Chunk in Place
+
+- (BOOL)mapFileDataToLength:(size_t)length {
+    length = FICByteAlign(length, FICTableFilePageSize());
+    if (length > _length) {
+        return NO;
+    }
+    
+    if (length > _mappedLength) {
+        if (FICTableFileMapIntoReservedAddressSpace(_fileDescriptor, _bytes, _mappedLength, length) == NO) {
+            NSLog(@"Failed to map chunk. errno=%d", errno);
+            return NO;
+        }
+        
+        atomic_fetch_add_explicit(&FICImageTableChunkMappingCount, 1, memory_order_relaxed);
     }
+    
+    _mappedLength = length;
+    
+    return YES;
+}
+
+#pragma mark - Counting Mapping Operations
+
++ (NSUInteger)mappingCount {
+    return atomic_load_explicit(&FICImageTableChunkMappingCount, memory_order_relaxed);
+}
+
++ (NSUInteger)unmappingCount {
+    return atomic_load_explicit(&FICImageTableChunkUnmappingCount, memory_order_relaxed);
 }
 
 @end
@@ -0,0 +1,64 @@
+//
+//  FICImageTableChunkCache.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImports.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class FICImageTableChunk;
+
+/**
+ `FICImageTableChunkCache` keeps recently used image table chunks mapped after the last entry using them goes away, so scrolling back and forth over the same images doesn't map
+ and unmap the same file data over and over again.
+
+ @discussion Chunks are kept in least-recently-used order until their combined length exceeds `<maximumLength>`, at which point the least recently used chunks are released.
+ A released chunk is only unmapped once nothing else is using it.
+
+ Chunk caches are thread-safe.
+ */
+@interface FICImageTableChunkCache : NSObject
+
+///---------------------------------------------
+/// @name Configuring an Image Table Chunk Cache
+///---------------------------------------------
+
+/**
+ The maximum combined length, in bytes, of the chunks kept mapped by the cache.
+
+ @discussion Defaults to 32 MB. Setting it to 0 unmaps every chunk as soon as nothing else is using it.
+ */
+@property (nonatomic, assign) size_t maximumLength;
+
+/**
+ The combined length, in bytes, of the chunks currently kept mapped by the cache.
+ */
+@property (nonatomic, assign, readonly) size_t length;
+
+///----------------------------
+/// @name Keeping Chunks Mapped
+///----------------------------
+
+/**
+ Marks a chunk as the most recently used one, adding it to the cache if necessary.
+
+ @param chunk The chunk that was used.
+
+ @discussion Chunks that no longer fit in the cache are released before this method returns.
+ */
+- (void)chunkWasUsed:(FICImageTableChunk *)chunk;
+
+/**
+ Releases chunks that must not be used again, such as chunks of an image table file that was truncated.
+
+ @param chunks The chunks to remove. Chunks that aren't in the cache are ignored.
+ */
+- (void)removeChunks:(NSArray <FICImageTableChunk *> *)chunks;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,143 @@
+//
+//  FICImageTableChunkCache.m
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImageTableChunkCache.h"
+#import "FICImageTableChunk.h"
+
+#import <pthread.h>
+
+#pragma mark Internal Definitions
+
+static const size_t FICImageTableChunkCacheDefaultMaximumLength = 32 * 1024 * 1024;
+
+#pragma mark - Class Extension
+
+@interface FICImageTableChunkCache () {
+    pthread_mutex_t _lock;
+    NSMutableArray *_chunks;                                        // Least recently used first
+    size_t _length;
+    size_t _maximumLength;
+}
+
+@end
+
+#pragma mark
+
+@implementation FICImageTableChunkCache
+
+#pragma mark - Property Accessors
+
+- (size_t)maximumLength {
+    pthread_mutex_lock(&_lock);
+    size_t maximumLength = _maximumLength;
+    pthread_mutex_unlock(&_lock);
+
+    return maximumLength;
+}
+
+- (void)setMaximumLength:(size_t)maximumLength {
+    pthread_mutex_lock(&_lock);
+    _maximumLength = maximumLength;
+    NSArray *evictedChunks = [self _evictChunks];
+    pthread_mutex_unlock(&_lock);
+
+    // Evicted chunks are unmapped as they're released here, outside the lock
+    evictedChunks = nil;
+}
+
+- (size_t)length {
+    pthread_mutex_lock(&_lock);
+    size_t length = _length;
+    pthread_mutex_unlock(&_lock);
+
+    return length;
+}
+
+#pragma mark - Object Lifecycle
+
+- (instancetype)init {
+    self = [super init];
+
+    if (self != nil) {
+        pthread_mutex_init(&_lock, NULL);
+        _chunks = [[NSMutableArray alloc] init];
+        _maximumLength = FICImageTableChunkCacheDefaultMaximumLength;
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+#pragma mark - Keeping Chunks Mapped
+
+// The caller must hold the lock
+- (NSArray *)_evictChunks {
+    NSUInteger evictedChunkCount = 0;
+    while (_length > _maximumLength && evictedChunkCount < [_chunks count]) {
+        _length -= [[_chunks objectAtIndex:evictedChunkCount] length];
+        evictedChunkCount++;
+    }
+
+    NSArray *evictedChunks = nil;
+    if (evictedChunkCount > 0) {
+        NSRange evictedRange = NSMakeRange(0, evictedChunkCount);
+        evictedChunks = [_chunks subarrayWithRange:evictedRange];
+        [_chunks removeObjectsInRange:evictedRange];
+    }
+
+    return evictedChunks;
+}
+
+- (void)chunkWasUsed:(FICImageTableChunk *)chunk {
+    NSArray *evictedChunks = nil;
+
+    pthread_mutex_lock(&_lock);
+
+    // Scrolling tends to use the same chunk many times in a row, which doesn't change the order at all
+    if ([_chunks lastObject] != chunk) {
+        NSUInteger index = [_chunks indexOfObjectIdenticalTo:chunk];
+        if (index != NSNotFound) {
+            [_chunks removeObjectAtIndex:index];
+        } else {
+            _length += [chunk length];
+        }
+        [_chunks addObject:chunk];
+
+        evictedChunks = [self _evictChunks];
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    // Evicted chunks are unmapped as they're released here, outside the lock
+    evictedChunks = nil;
+}
+
+- (void)removeChunks:(NSArray *)chunks {
+    NSMutableArray *removedChunks = [NSMutableArray arrayWithCapacity:[chunks count]];
+
+    pthread_mutex_lock(&_lock);
+
+    for (FICImageTableChunk *chunk in chunks) {
+        NSUInteger index = [_chunks indexOfObjectIdenticalTo:chunk];
+        if (index != NSNotFound) {
+            _length -= [chunk length];
+            [removedChunks addObject:chunk];
+            [_chunks removeObjectAtIndex:index];
+        }
+    }
+
+    pthread_mutex_unlock(&_lock);
+
+    // Removed chunks are unmapped as they're released here, outside the lock
+    removedChunks = nil;
+}
+
+@end
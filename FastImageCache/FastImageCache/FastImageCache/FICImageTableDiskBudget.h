@@ -0,0 +1,85 @@
+//
+//  FICImageTableDiskBudget.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImports.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class FICImageTable;
+
+/**
+ `FICImageTableDiskBudget` limits the combined length of the entries stored by several image tables, evicting entries from whichever table holds the one that is cheapest to lose.
+
+ @discussion Each image table ranks its entries with the GreedyDual-Size algorithm: accessing an entry gives it a priority of the budget's `<inflation>` plus its format's
+ `<[FICImageFormat recreationCost]>` divided by the length of the entry. When the tables hold more than `<maximumLength>` bytes of entries, the budget asks the table whose
+ eviction candidate has the lowest priority to evict it, and raises its inflation to that priority. Entries that aren't accessed again fall behind every entry that is, so large
+ entries that are cheap to recreate go first, but no entry stays in the cache forever just because it was expensive once.
+
+ Every image table still evicts entries on its own once it holds its format's `<[FICImageFormat maximumCount]>` entries; the budget only decides which tables give up space when
+ they can't all have that many.
+
+ Disk budgets are thread-safe. Image tables are only held weakly.
+ */
+@interface FICImageTableDiskBudget : NSObject
+
+///---------------------------------------------
+/// @name Configuring an Image Table Disk Budget
+///---------------------------------------------
+
+/**
+ The maximum combined length, in bytes, of the entries stored by the budget's image tables.
+
+ @discussion Defaults to 0, which doesn't limit the image tables at all. Lowering it evicts entries right away.
+ */
+@property (nonatomic, assign) size_t maximumLength;
+
+/**
+ The combined length, in bytes, of the entries currently stored by the budget's image tables.
+ */
+@property (nonatomic, assign, readonly) size_t length;
+
+/**
+ The priority of the last entry evicted for the budget, which accessed entries are ranked above.
+ */
+@property (nonatomic, assign, readonly) double inflation;
+
+/**
+ The number of entries evicted for the budget since it was created.
+ */
+@property (nonatomic, assign, readonly) NSUInteger evictedEntryCount;
+
+///------------------------------------
+/// @name Sharing a Budget Among Tables
+///------------------------------------
+
+/**
+ Adds an image table to the budget, evicting entries if the table doesn't fit.
+
+ @param imageTable The image table to add. Adding a table that's already part of the budget does nothing.
+ */
+- (void)addImageTable:(FICImageTable *)imageTable;
+
+/**
+ Removes an image table from the budget.
+
+ @param imageTable The image table to remove. Tables that aren't part of the budget are ignored.
+ */
+- (void)removeImageTable:(FICImageTable *)imageTable;
+
+/**
+ Evicts entries until the budget's image tables fit in it again.
+
+ @param imageTable The image table that stored a new entry.
+
+ @discussion Image tables call this method after storing an entry, once they no longer hold any locks, including the entry lock of another image table the entry was filled in from.
+ */
+- (void)imageTableDidStoreEntry:(FICImageTable *)imageTable;
+
+@end
+
+NS_ASSUME_NONNULL_END
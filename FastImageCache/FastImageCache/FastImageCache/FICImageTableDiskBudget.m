@@ -0,0 +1,165 @@
+//
+//  FICImageTableDiskBudget.m
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#import "FICImageTableDiskBudget.h"
+#import "FICImageTable.h"
+
+#import <pthread.h>
+
+#pragma mark Class Extension
+
+@interface FICImageTableDiskBudget () {
+    pthread_mutex_t _lock;                                          // Held while evicting, so tables storing entries at the same time don't both evict for the same overflow
+    NSHashTable *_imageTables;
+    size_t _maximumLength;
+    double _inflation;
+    NSUInteger _evictedEntryCount;
+}
+
+@end
+
+#pragma mark
+
+@implementation FICImageTableDiskBudget
+
+#pragma mark - Property Accessors
+
+- (size_t)maximumLength {
+    pthread_mutex_lock(&_lock);
+    size_t maximumLength = _maximumLength;
+    pthread_mutex_unlock(&_lock);
+
+    return maximumLength;
+}
+
+- (void)setMaximumLength:(size_t)maximumLength {
+    pthread_mutex_lock(&_lock);
+    _maximumLength = maximumLength;
+    [self _evictEntries];
+    pthread_mutex_unlock(&_lock);
+}
+
+- (size_t)length {
+    pthread_mutex_lock(&_lock);
+    size_t length = [self _length];
+    pthread_mutex_unlock(&_lock);
+
+    return length;
+}
+
+- (double)inflation {
+    pthread_mutex_lock(&_lock);
+    double inflation = _inflation;
+    pthread_mutex_unlock(&_lock);
+
+    return inflation;
+}
+
+- (NSUInteger)evictedEntryCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger evictedEntryCount = _evictedEntryCount;
+    pthread_mutex_unlock(&_lock);
+
+    return evictedEntryCount;
+}
+
+#pragma mark - Object Lifecycle
+
+- (instancetype)init {
+    self = [super init];
+
+    if (self != nil) {
+        pthread_mutex_init(&_lock, NULL);
+        _imageTables = [NSHashTable weakObjectsHashTable];
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+#pragma mark - Sharing a Budget Among Tables
+
+- (void)addImageTable:(FICImageTable *)imageTable {
+    pthread_mutex_lock(&_lock);
+
+    if ([_imageTables containsObject:imageTable] == NO) {
+        [_imageTables addObject:imageTable];
+        [imageTable setDiskBudgetInflation:_inflation];
+        [self _evictEntries];
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)removeImageTable:(FICImageTable *)imageTable {
+    pthread_mutex_lock(&_lock);
+    [_imageTables removeObject:imageTable];
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)imageTableDidStoreEntry:(FICImageTable *)imageTable {
+    pthread_mutex_lock(&_lock);
+    [self _evictEntries];
+    pthread_mutex_unlock(&_lock);
+}
+
+#pragma mark - Evicting Entries
+
+// The caller must hold the lock
+- (size_t)_length {
+    size_t length = 0;
+    for (FICImageTable *imageTable in _imageTables) {
+        length += [imageTable usedLength];
+    }
+
+    return length;
+}
+
+// The caller must hold the lock
+- (void)_evictEntries {
+    if (_maximumLength == 0) {
+        return;
+    }
+
+    NSArray *imageTables = [_imageTables allObjects];
+    while ([self _length] > _maximumLength) {
+        FICImageTable *victimImageTable = nil;
+        double victimPriority = DBL_MAX;
+        for (FICImageTable *imageTable in imageTables) {
+            double priority = [imageTable diskBudgetEvictionPriority];
+            if (priority < victimPriority) {
+                victimImageTable = imageTable;
+                victimPriority = priority;
+            }
+        }
+
+        // Every remaining entry is in use, so there's nothing left to evict until images backed by them go away
+        if (victimImageTable == nil) {
+            break;
+        }
+
+        // The table evicts whichever entry is its candidate by now, and has nothing to evict if images backed by its last entries were created in the meantime
+        double priority = [victimImageTable evictEntryForDiskBudget];
+        if (priority == DBL_MAX) {
+            break;
+        }
+
+        _evictedEntryCount++;
+        if (priority > _inflation) {
+            _inflation = priority;
+            for (FICImageTable *imageTable in imageTables) {
+                [imageTable setDiskBudgetInflation:_inflation];
+            }
+        }
+    }
+}
+
+@end
@@ -7,16 +7,14 @@
 //
 
 #import "FICImports.h"
+#import "FICTableFile.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class FICImageTableChunk;
 @class FICImageCache;
 
-typedef struct {
-    CFUUIDBytes _entityUUIDBytes;
-    CFUUIDBytes _sourceImageUUIDBytes;
-} FICImageTableEntryMetadata;
+typedef FICTableFileEntryMetadata FICImageTableEntryMetadata;
 
 /**
  `FICImageTableEntry` represents an entry in an image table. It contains the necessary data and metadata to store a single entry of image data. Entries are created from instances of
@@ -55,6 +53,18 @@ typedef struct {
  */
 @property (nonatomic, assign) CFUUIDBytes sourceImageUUIDBytes;
 
+/**
+ The write generation of the entry. Every time an entry is written, it's given a larger generation than any entry written to its image table before it.
+ */
+@property (nonatomic, assign) uint64_t generation;
+
+/**
+ The CRC-32C checksum of the entry's generation followed by its image data, which detects image data that was torn or damaged on disk.
+ 
+ @see FICChecksumCRC32C
+ */
+@property (nonatomic, assign) uint32_t imageChecksum;
+
 /**
  The image table chunk that contains this entry.
  */
@@ -98,6 +108,8 @@ typedef struct {
 
 /**
  Forces the kernel to page in the memory-mapped, on-disk data backing this entry right away.
+ 
+ @discussion The whole entry is requested from disk at once before its pages are touched, so it's read with one request instead of one page fault at a time.
  */
 - (void)preheat;
 
@@ -107,8 +119,17 @@ typedef struct {
 
 /**
  Writes a modified image table entry back to disk.
+ 
+ @return `YES` if the entry was written to disk, or `NO` if an error occurred.
+ */
+- (BOOL)flush;
+
+/**
+ Starts writing a modified image table entry back to disk without waiting for it to finish.
+ 
+ @return `YES` if the write was started, or `NO` if an error occurred.
  */
-- (void)flush;
+- (BOOL)flushAsynchronously;
 
 ///--------------------------------------------
 /// @name Versioning Image Table Entry Metadata
@@ -7,14 +7,11 @@
 //
 
 #import "FICImageTableEntry.h"
-#import "FICImageTable.h"
 #import "FICImageTableChunk.h"
 #import "FICImageCache.h"
 
 #import "FICImageCache+FICErrorLogging.h"
 
-#import <sys/mman.h>
-
 #pragma mark Class Extension
 
 @interface FICImageTableEntry () {
@@ -44,19 +41,39 @@
 }
 
 - (CFUUIDBytes)entityUUIDBytes {
-    return [self _metadata]->_entityUUIDBytes;
+    CFUUIDBytes entityUUIDBytes;
+    memcpy(&entityUUIDBytes, [self _metadata]->entityUUIDBytes, sizeof(entityUUIDBytes));
+    return entityUUIDBytes;
 }
 
 - (void)setEntityUUIDBytes:(CFUUIDBytes)entityUUIDBytes {
-    [self _metadata]->_entityUUIDBytes = entityUUIDBytes;
+    memcpy([self _metadata]->entityUUIDBytes, &entityUUIDBytes, sizeof(entityUUIDBytes));
 }
 
 - (CFUUIDBytes)sourceImageUUIDBytes {
-    return [self _metadata]->_sourceImageUUIDBytes;
+    CFUUIDBytes sourceImageUUIDBytes;
+    memcpy(&sourceImageUUIDBytes, [self _metadata]->sourceImageUUIDBytes, sizeof(sourceImageUUIDBytes));
+    return sourceImageUUIDBytes;
 }
 
 - (void)setSourceImageUUIDBytes:(CFUUIDBytes)sourceImageUUIDBytes {
-    [self _metadata]->_sourceImageUUIDBytes = sourceImageUUIDBytes;
+    memcpy([self _metadata]->sourceImageUUIDBytes, &sourceImageUUIDBytes, sizeof(sourceImageUUIDBytes));
+}
+
+- (uint64_t)generation {
+    return [self _metadata]->generation;
+}
+
+- (void)setGeneration:(uint64_t)generation {
+    [self _metadata]->generation = generation;
+}
+
+- (uint32_t)imageChecksum {
+    return [self _metadata]->imageChecksum;
+}
+
+- (void)setImageChecksum:(uint32_t)imageChecksum {
+    [self _metadata]->imageChecksum = imageChecksum;
 }
 
 #pragma mark - Object Lifecycle
@@ -94,39 +111,36 @@
 #pragma mark - Other Accessors
 
 + (NSInteger)metadataVersion {
-    return 8;
+    return 9;
 }
 
 - (FICImageTableEntryMetadata *)_metadata {
-    return (FICImageTableEntryMetadata *)(_bytes + [self imageLength]);
+    return FICTableFileEntryMetadataForEntry(_bytes, _length);
 }
 
 #pragma mark - Flushing a Modified Image Table Entry
 
-- (void)flush {
-    int pageSize = [FICImageTable pageSize];
-    void *address = _bytes;
-    size_t pageIndex = (size_t)address / pageSize;
-    void *pageAlignedAddress = (void *)(pageIndex * pageSize);
-    size_t bytesBeforeData = address - pageAlignedAddress;
-    size_t bytesToFlush = (bytesBeforeData + _length);
-    int result = msync(pageAlignedAddress, bytesToFlush, MS_SYNC);
+- (BOOL)flush {
+    return [self _flushSynchronously:YES];
+}
+
+- (BOOL)flushAsynchronously {
+    return [self _flushSynchronously:NO];
+}
+
+- (BOOL)_flushSynchronously:(BOOL)synchronously {
+    BOOL flushed = FICTableFileFlush(_bytes, _length, synchronously);
     
-    if (result) {
-        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s msync(%p, %ld) returned %d errno=%d", __PRETTY_FUNCTION__, pageAlignedAddress, bytesToFlush, result, errno];
+    if (flushed == NO) {
+        NSString *message = [NSString stringWithFormat:@"*** FIC Error: %s msync(%p, %ld) failed errno=%d", __PRETTY_FUNCTION__, _bytes, _length, errno];
         [self.imageCache _logMessage:message];
     }
+    
+    return flushed;
 }
 
 - (void)preheat {
-    int pageSize = [FICImageTable pageSize];
-    void *bytes = [self bytes];
-    NSUInteger length = [self length];
-    
-    // Read a byte off of each VM page to force the kernel to page in the data
-    for (NSUInteger i = 0; i < length; i += pageSize) {
-        *((volatile uint8_t *)bytes + i);
-    }
+    FICTableFilePreheat(_bytes, _length);
 }
 
 @end
@@ -0,0 +1,330 @@
+//
+//  FICMetadataJournal.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICMetadataJournal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+// Values are stored in host byte order. Journals live in the caches directory of the device that wrote them.
+static const uint8_t FICMetadataJournalMagic[4] = { 'F', 'I', 'C', 'J' };
+static const uint32_t FICMetadataJournalVersion = 3;
+
+// Version 1 journals predate commit records and record flags
+static const uint32_t FICMetadataJournalUncommittedVersion = 1;
+
+// Version 2 journals checkpoint with one set record per entry instead of a snapshot
+static const uint32_t FICMetadataJournalRecordCheckpointVersion = 2;
+
+#define FICMetadataJournalHeaderLength 16
+#define FICMetadataJournalSnapshotHeaderLength 16
+#define FICMetadataJournalRecordLength 44
+#define FICMetadataJournalTemporaryPathSuffix ".checkpoint"
+
+static uint32_t _FICMetadataJournalChecksum(uint32_t hash, const void *bytes, size_t length) {
+    // 32-bit FNV-1a
+    const uint8_t *byte = bytes;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= byte[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define FICMetadataJournalChecksumSeed 2166136261u
+
+static void _FICMetadataJournalEncodeRecord(const FICMetadataJournalRecord *record, uint8_t *bytes) {
+    memset(bytes, 0, FICMetadataJournalRecordLength);
+    bytes[0] = record->type;
+    bytes[1] = record->flags;
+    memcpy(bytes + 4, &record->index, sizeof(uint32_t));
+    memcpy(bytes + 8, record->entityUUIDBytes, 16);
+    memcpy(bytes + 24, record->sourceImageUUIDBytes, 16);
+
+    uint32_t checksum = _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, bytes, FICMetadataJournalRecordLength - sizeof(uint32_t));
+    memcpy(bytes + 40, &checksum, sizeof(uint32_t));
+}
+
+static bool _FICMetadataJournalDecodeRecord(const uint8_t *bytes, uint32_t version, FICMetadataJournalRecord *record) {
+    uint32_t checksum;
+    memcpy(&checksum, bytes + 40, sizeof(uint32_t));
+    if (checksum != _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, bytes, FICMetadataJournalRecordLength - sizeof(uint32_t))) {
+        return false;
+    }
+
+    record->type = bytes[0];
+    record->flags = bytes[1];
+    if (record->type < FICMetadataJournalRecordTypeSet || record->type > FICMetadataJournalRecordTypeCommit) {
+        return false;
+    }
+
+    if (version == FICMetadataJournalUncommittedVersion && record->type == FICMetadataJournalRecordTypeSet) {
+        record->flags |= FICMetadataJournalRecordFlagCommitted;
+    }
+
+    memcpy(&record->index, bytes + 4, sizeof(uint32_t));
+    memcpy(record->entityUUIDBytes, bytes + 8, 16);
+    memcpy(record->sourceImageUUIDBytes, bytes + 24, 16);
+
+    return true;
+}
+
+static inline size_t _FICMetadataJournalSnapshotOffset(size_t formatLength) {
+    // Snapshots are used in place once mapped, so they start on an 8-byte boundary
+    return (FICMetadataJournalHeaderLength + formatLength + FICMetadataJournalSnapshotHeaderLength + 7) & ~(size_t)7;
+}
+
+static void _FICMetadataJournalEncodeSnapshotHeader(uint64_t snapshotLength, uint8_t *bytes) {
+    memset(bytes, 0, FICMetadataJournalSnapshotHeaderLength);
+    memcpy(bytes, &snapshotLength, sizeof(uint64_t));
+
+    uint32_t checksum = _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, bytes, sizeof(uint64_t));
+    memcpy(bytes + 8, &checksum, sizeof(uint32_t));
+}
+
+static bool _FICMetadataJournalWriteFully(int fileDescriptor, const void *bytes, size_t length) {
+    const uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t written = write(fileDescriptor, cursor, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static bool _FICMetadataJournalWriteRecords(int fileDescriptor, const FICMetadataJournalRecord *records, size_t count) {
+    // Encode in batches to keep the number of write calls low without allocating
+    uint8_t buffer[FICMetadataJournalRecordLength * 64];
+    size_t index = 0;
+    while (index < count) {
+        size_t batchCount = 0;
+        while (index < count && batchCount < 64) {
+            _FICMetadataJournalEncodeRecord(&records[index], buffer + batchCount * FICMetadataJournalRecordLength);
+            batchCount++;
+            index++;
+        }
+
+        if (_FICMetadataJournalWriteFully(fileDescriptor, buffer, batchCount * FICMetadataJournalRecordLength) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#pragma mark - Journal Lifecycle
+
+void FICMetadataJournalInit(FICMetadataJournal *journal, const char *path) {
+    journal->fileDescriptor = -1;
+    journal->path = strdup(path);
+}
+
+void FICMetadataJournalDestroy(FICMetadataJournal *journal) {
+    if (journal->fileDescriptor >= 0) {
+        close(journal->fileDescriptor);
+        journal->fileDescriptor = -1;
+    }
+    free(journal->path);
+    journal->path = NULL;
+}
+
+#pragma mark - Reading Journals
+
+bool FICMetadataJournalIsJournalData(const void *bytes, size_t length) {
+    return length >= sizeof(FICMetadataJournalMagic) && memcmp(bytes, FICMetadataJournalMagic, sizeof(FICMetadataJournalMagic)) == 0;
+}
+
+bool FICMetadataJournalNeedsUpgrade(const void *bytes, size_t length) {
+    uint32_t version;
+    if (length < FICMetadataJournalHeaderLength || FICMetadataJournalIsJournalData(bytes, length) == false) {
+        return false;
+    }
+
+    memcpy(&version, (const uint8_t *)bytes + 4, sizeof(uint32_t));
+
+    return version != FICMetadataJournalVersion;
+}
+
+size_t FICMetadataJournalReplay(const void *bytes, size_t length, const void **formatBytes, size_t *formatLength, const void **snapshotBytes, size_t *snapshotLength, FICMetadataJournalRecordHandler handler, void *context) {
+    const uint8_t *header = bytes;
+    if (length < FICMetadataJournalHeaderLength || FICMetadataJournalIsJournalData(bytes, length) == false) {
+        return 0;
+    }
+
+    uint32_t version, storedFormatLength, storedChecksum;
+    memcpy(&version, header + 4, sizeof(uint32_t));
+    memcpy(&storedFormatLength, header + 8, sizeof(uint32_t));
+    memcpy(&storedChecksum, header + 12, sizeof(uint32_t));
+    if ((version != FICMetadataJournalVersion && version != FICMetadataJournalRecordCheckpointVersion && version != FICMetadataJournalUncommittedVersion) || storedFormatLength > length - FICMetadataJournalHeaderLength) {
+        return 0;
+    }
+
+    uint32_t checksum = _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, header, 12);
+    checksum = _FICMetadataJournalChecksum(checksum, header + FICMetadataJournalHeaderLength, storedFormatLength);
+    if (checksum != storedChecksum) {
+        return 0;
+    }
+
+    *formatBytes = header + FICMetadataJournalHeaderLength;
+    *formatLength = storedFormatLength;
+    *snapshotBytes = NULL;
+    *snapshotLength = 0;
+
+    size_t offset = FICMetadataJournalHeaderLength + storedFormatLength;
+    if (version == FICMetadataJournalVersion) {
+        // The snapshot header sits right before the snapshot, after any padding
+        size_t snapshotOffset = _FICMetadataJournalSnapshotOffset(storedFormatLength);
+        if (snapshotOffset > length) {
+            return 0;
+        }
+
+        uint64_t storedSnapshotLength;
+        uint32_t snapshotChecksum;
+        const uint8_t *snapshotHeader = header + snapshotOffset - FICMetadataJournalSnapshotHeaderLength;
+        memcpy(&storedSnapshotLength, snapshotHeader, sizeof(uint64_t));
+        memcpy(&snapshotChecksum, snapshotHeader + 8, sizeof(uint32_t));
+        if (snapshotChecksum != _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, snapshotHeader, sizeof(uint64_t)) || storedSnapshotLength > length - snapshotOffset) {
+            return 0;
+        }
+
+        *snapshotBytes = header + snapshotOffset;
+        *snapshotLength = (size_t)storedSnapshotLength;
+        offset = snapshotOffset + (size_t)storedSnapshotLength;
+    }
+
+    FICMetadataJournalRecord record;
+    while (offset + FICMetadataJournalRecordLength <= length && _FICMetadataJournalDecodeRecord(header + offset, version, &record)) {
+        if (handler != NULL) {
+            handler(&record, context);
+        }
+        offset += FICMetadataJournalRecordLength;
+    }
+
+    return offset;
+}
+
+void * FICMetadataJournalMapFile(const FICMetadataJournal *journal, size_t *length) {
+    *length = 0;
+    int fileDescriptor = journal->path != NULL ? open(journal->path, O_RDONLY) : -1;
+    if (fileDescriptor < 0) {
+        return NULL;
+    }
+
+    struct stat fileStatus;
+    void *mapping = MAP_FAILED;
+    if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0) {
+        mapping = mmap(NULL, (size_t)fileStatus.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0);
+    }
+    close(fileDescriptor);
+
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    *length = (size_t)fileStatus.st_size;
+
+    return mapping;
+}
+
+void FICMetadataJournalUnmapFile(void *mapping, size_t length) {
+    if (mapping != NULL) {
+        munmap(mapping, length);
+    }
+}
+
+#pragma mark - Writing Journals
+
+bool FICMetadataJournalOpen(FICMetadataJournal *journal, size_t validLength) {
+    if (journal->fileDescriptor >= 0) {
+        close(journal->fileDescriptor);
+    }
+
+    journal->fileDescriptor = open(journal->path, O_RDWR | O_CREAT, 0666);
+    if (journal->fileDescriptor < 0) {
+        return false;
+    }
+
+    if (ftruncate(journal->fileDescriptor, (off_t)validLength) != 0 || lseek(journal->fileDescriptor, 0, SEEK_END) < 0) {
+        close(journal->fileDescriptor);
+        journal->fileDescriptor = -1;
+        return false;
+    }
+
+    return true;
+}
+
+bool FICMetadataJournalAppendRecords(FICMetadataJournal *journal, const FICMetadataJournalRecord *records, size_t count) {
+    if (journal->fileDescriptor < 0) {
+        return false;
+    }
+
+    return _FICMetadataJournalWriteRecords(journal->fileDescriptor, records, count);
+}
+
+bool FICMetadataJournalWriteCheckpoint(FICMetadataJournal *journal, const void *formatBytes, size_t formatLength, const void *snapshotBytes, size_t snapshotLength) {
+    size_t temporaryPathLength = strlen(journal->path) + sizeof(FICMetadataJournalTemporaryPathSuffix);
+    char *temporaryPath = malloc(temporaryPathLength);
+    if (temporaryPath == NULL) {
+        return false;
+    }
+    snprintf(temporaryPath, temporaryPathLength, "%s%s", journal->path, FICMetadataJournalTemporaryPathSuffix);
+
+    bool success = false;
+    int fileDescriptor = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fileDescriptor >= 0) {
+        uint8_t header[FICMetadataJournalHeaderLength];
+        uint32_t storedFormatLength = (uint32_t)formatLength;
+        memcpy(header, FICMetadataJournalMagic, sizeof(FICMetadataJournalMagic));
+        memcpy(header + 4, &FICMetadataJournalVersion, sizeof(uint32_t));
+        memcpy(header + 8, &storedFormatLength, sizeof(uint32_t));
+
+        uint32_t checksum = _FICMetadataJournalChecksum(FICMetadataJournalChecksumSeed, header, 12);
+        checksum = _FICMetadataJournalChecksum(checksum, formatBytes, formatLength);
+        memcpy(header + 12, &checksum, sizeof(uint32_t));
+
+        // Padding goes in front of the snapshot header, so both end up right before the snapshot
+        uint8_t snapshotHeader[FICMetadataJournalSnapshotHeaderLength + 7];
+        size_t snapshotHeaderLength = _FICMetadataJournalSnapshotOffset(formatLength) - FICMetadataJournalHeaderLength - formatLength;
+        memset(snapshotHeader, 0, sizeof(snapshotHeader));
+        _FICMetadataJournalEncodeSnapshotHeader(snapshotLength, snapshotHeader + snapshotHeaderLength - FICMetadataJournalSnapshotHeaderLength);
+
+        success = _FICMetadataJournalWriteFully(fileDescriptor, header, sizeof(header))
+            && _FICMetadataJournalWriteFully(fileDescriptor, formatBytes, formatLength)
+            && _FICMetadataJournalWriteFully(fileDescriptor, snapshotHeader, snapshotHeaderLength)
+            && _FICMetadataJournalWriteFully(fileDescriptor, snapshotBytes, snapshotLength)
+            && fsync(fileDescriptor) == 0;
+
+        close(fileDescriptor);
+
+        success = success && rename(temporaryPath, journal->path) == 0;
+        if (success == false) {
+            unlink(temporaryPath);
+        }
+    }
+    free(temporaryPath);
+
+    if (success) {
+        size_t length = _FICMetadataJournalSnapshotOffset(formatLength) + snapshotLength;
+        success = FICMetadataJournalOpen(journal, length);
+    }
+
+    return success;
+}
@@ -0,0 +1,145 @@
+//
+//  FICMetadataJournal.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICMetadataJournal_h
+#define FICMetadataJournal_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FICMetadataJournalRecordTypeSet = 1,
+    FICMetadataJournalRecordTypeDelete = 2,
+    FICMetadataJournalRecordTypeTouch = 3,
+    FICMetadataJournalRecordTypeCommit = 4,
+} FICMetadataJournalRecordType;
+
+typedef enum {
+    FICMetadataJournalRecordFlagCommitted = 1 << 0,
+} FICMetadataJournalRecordFlags;
+
+/**
+ A single change to an image table's metadata.
+
+ - `FICMetadataJournalRecordTypeSet`: The entity now occupies `index` and was drawn from the source image. Also marks the entity as the most recently used one. Unless the
+   `FICMetadataJournalRecordFlagCommitted` flag is set, the image data isn't known to be on disk yet.
+ - `FICMetadataJournalRecordTypeDelete`: The entity no longer has an entry. `index` and `sourceImageUUIDBytes` are ignored.
+ - `FICMetadataJournalRecordTypeTouch`: The entity was accessed and is now the most recently used one. `sourceImageUUIDBytes` is ignored.
+ - `FICMetadataJournalRecordTypeCommit`: The image data the entity at `index` was drawn from the source image has been written to disk.
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t index;
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+} FICMetadataJournalRecord;
+
+typedef void (*FICMetadataJournalRecordHandler)(const FICMetadataJournalRecord *record, void *context);
+
+/**
+ `FICMetadataJournal` persists image table metadata as an append-only log of fixed-size binary records.
+
+ @discussion A journal file starts with a header that carries the serialized image format, followed by a checkpoint, followed by any number of records appended since the checkpoint.
+ Every record carries its own checksum, so a record torn by a crash is detected on replay and the file is truncated back to the last complete record.
+
+ The checkpoint is a metadata snapshot (see `<FICMetadataSnapshotWrite>`) that starts on an 8-byte boundary, so a journal mapped into memory can be used in place and only the records
+ after it have to be replayed.
+
+ Older journals are still read. Their checkpoints are one set record per live entry, ordered from least to most recently used, and are replayed like any other records. Journals
+ written before commit records existed have their set records treated as committed, since image data used to be written synchronously.
+
+ Checkpoints are written to a temporary file that atomically replaces the journal, so the journal is never left half-rewritten.
+
+ A journal is not thread-safe; callers are expected to serialize access, typically on a single dispatch queue.
+ */
+typedef struct {
+    int fileDescriptor;
+    char *path;
+} FICMetadataJournal;
+
+/**
+ Initializes a closed journal for the file at `path`.
+ */
+void FICMetadataJournalInit(FICMetadataJournal *journal, const char *path);
+
+/**
+ Closes the journal file and frees the memory owned by the journal.
+ */
+void FICMetadataJournalDestroy(FICMetadataJournal *journal);
+
+/**
+ Returns whether or not `bytes` begin with a journal header, as opposed to a legacy JSON or property list metadata file.
+ */
+bool FICMetadataJournalIsJournalData(const void *bytes, size_t length);
+
+/**
+ Returns whether or not journal data was written in an older version of the journal format and should be replaced with a new checkpoint.
+ */
+bool FICMetadataJournalNeedsUpgrade(const void *bytes, size_t length);
+
+/**
+ Replays journal data, calling `handler` once per valid record in file order.
+
+ @param formatBytes On return, points to the serialized image format stored in the header.
+
+ @param formatLength On return, the length of the serialized image format.
+
+ @param snapshotBytes On return, points to the metadata snapshot of the checkpoint, or `NULL` if the journal was written in an older version that checkpoints with records.
+
+ @param snapshotLength On return, the length of the metadata snapshot.
+
+ @return The number of leading bytes of `bytes` that are valid, which is where the next record should be appended. Returns 0 if the header itself is invalid.
+ */
+size_t FICMetadataJournalReplay(const void *bytes, size_t length, const void **formatBytes, size_t *formatLength, const void **snapshotBytes, size_t *snapshotLength, FICMetadataJournalRecordHandler handler, void *context);
+
+/**
+ Maps the journal file into memory copy-on-write, so structures that work in place on its checkpoint can modify it without changing the file.
+
+ @param length On return, the length of the mapping.
+
+ @return The mapping, to be unmapped with `<FICMetadataJournalUnmapFile>`, or `NULL` if the file doesn't exist, is empty, or could not be mapped.
+ */
+void * FICMetadataJournalMapFile(const FICMetadataJournal *journal, size_t *length);
+
+/**
+ Unmaps a mapping returned by `<FICMetadataJournalMapFile>`.
+ */
+void FICMetadataJournalUnmapFile(void *mapping, size_t length);
+
+/**
+ Opens the journal file for appending, discarding anything past `validLength`, such as a record torn by a crash.
+
+ @return `false` if the file could not be opened or truncated.
+ */
+bool FICMetadataJournalOpen(FICMetadataJournal *journal, size_t validLength);
+
+/**
+ Appends records to the end of the journal file.
+
+ @return `false` if the journal is not open or the records could not be written.
+ */
+bool FICMetadataJournalAppendRecords(FICMetadataJournal *journal, const FICMetadataJournalRecord *records, size_t count);
+
+/**
+ Atomically replaces the journal file with a header and a checkpoint made of a metadata snapshot, then reopens it for appending.
+
+ @return `false` if the checkpoint could not be written, in which case the previous journal file is left in place.
+ */
+bool FICMetadataJournalWriteCheckpoint(FICMetadataJournal *journal, const void *formatBytes, size_t formatLength, const void *snapshotBytes, size_t snapshotLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
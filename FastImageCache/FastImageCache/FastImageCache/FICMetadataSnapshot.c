@@ -0,0 +1,367 @@
+//
+//  FICMetadataSnapshot.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICMetadataSnapshot.h"
+#include "FICChecksum.h"
+
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICMetadataSnapshotVersion 2
+#define FICMetadataSnapshotBitsPerWord 64
+
+// Version 1 snapshots had a single recency list and no frequency sketch. They're still adopted, as an LRU list.
+typedef struct {
+    uint32_t version;
+    uint32_t entryLength;
+    uint64_t bucketCount;
+    uint64_t entryCount;
+    uint64_t slotCapacity;
+    uint64_t wordCapacity;
+    uint64_t occupiedCount;
+    uint64_t listCapacity;
+    uint64_t linkedCount;
+    uint64_t trackedCount;
+    uint32_t head;
+    uint32_t tail;
+    uint64_t uncommittedSlotCount;
+    uint32_t checksum;
+    uint32_t reserved;
+} FICMetadataSnapshotVersion1Header;
+
+typedef struct {
+    uint64_t linkedCount;
+    uint64_t trackedCount;
+    uint32_t head;
+    uint32_t tail;
+} FICMetadataSnapshotSegment;
+
+typedef struct {
+    uint32_t version;
+    uint32_t entryLength;
+    uint64_t bucketCount;
+    uint64_t entryCount;
+    uint64_t slotCapacity;
+    uint64_t wordCapacity;
+    uint64_t occupiedCount;
+    uint64_t listCapacity;
+    FICMetadataSnapshotSegment segments[FICRecencyListSegmentCount];
+    uint64_t sketchWordCount;
+    uint64_t sketchAdditionCount;
+    uint64_t uncommittedSlotCount;
+    uint32_t checksum;
+    uint32_t reserved;
+} FICMetadataSnapshotHeader;
+
+// Offsets of each array from the start of the snapshot. 64-bit math keeps lengths read from disk from overflowing on 32-bit devices.
+typedef struct {
+    uint64_t buckets;
+    uint64_t entityUUIDBytesBySlot;
+    uint64_t words;
+    uint64_t summary;
+    uint64_t previous;
+    uint64_t next;
+    uint64_t pinCounts;
+    uint64_t states;
+    uint64_t sketchWords;
+    uint64_t uncommittedSlots;
+    uint64_t length;
+} FICMetadataSnapshotLayout;
+
+static inline uint64_t _FICMetadataSnapshotAlign(uint64_t length) {
+    return (length + 7) & ~(uint64_t)7;
+}
+
+static FICMetadataSnapshotLayout _FICMetadataSnapshotLayoutForHeader(const FICMetadataSnapshotHeader *header, size_t headerLength) {
+    FICMetadataSnapshotLayout layout;
+    uint64_t offset = _FICMetadataSnapshotAlign(headerLength);
+
+    layout.buckets = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->bucketCount * sizeof(FICEntryIndexEntry));
+    layout.entityUUIDBytesBySlot = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->slotCapacity * 16);
+    layout.words = offset;
+    offset += header->wordCapacity * sizeof(uint64_t);
+    layout.summary = offset;
+    offset += header->wordCapacity / FICMetadataSnapshotBitsPerWord * sizeof(uint64_t);
+    layout.previous = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->listCapacity * sizeof(uint32_t));
+    layout.next = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->listCapacity * sizeof(uint32_t));
+    layout.pinCounts = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->listCapacity * sizeof(uint32_t));
+    layout.states = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->listCapacity * sizeof(uint8_t));
+    layout.sketchWords = offset;
+    offset += header->sketchWordCount * sizeof(uint64_t);
+    layout.uncommittedSlots = offset;
+    offset = _FICMetadataSnapshotAlign(offset + header->uncommittedSlotCount * sizeof(uint32_t));
+    layout.length = offset;
+
+    return layout;
+}
+
+static void _FICMetadataSnapshotFillHeader(FICMetadataSnapshotHeader *header, const FICEntryIndex *index, const FICSlotAllocator *allocator, const FICEvictionPolicy *policy, size_t uncommittedSlotCount) {
+    memset(header, 0, sizeof(FICMetadataSnapshotHeader));
+    header->version = FICMetadataSnapshotVersion;
+    header->entryLength = sizeof(FICEntryIndexEntry);
+    header->bucketCount = index->bucketCount;
+    header->entryCount = index->count;
+    header->slotCapacity = index->slotCapacity;
+    header->wordCapacity = allocator->wordCapacity;
+    header->occupiedCount = allocator->occupiedCount;
+    header->listCapacity = policy->list.capacity;
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        header->segments[segment].linkedCount = policy->list.segments[segment].linkedCount;
+        header->segments[segment].trackedCount = policy->list.segments[segment].trackedCount;
+        header->segments[segment].head = policy->list.segments[segment].head;
+        header->segments[segment].tail = policy->list.segments[segment].tail;
+    }
+    header->sketchWordCount = policy->sketch.wordCount;
+    header->sketchAdditionCount = policy->sketch.additionCount;
+    header->uncommittedSlotCount = uncommittedSlotCount;
+}
+
+// The checksum covers the header with its checksum field zeroed. Arrays aren't covered: checking them would read every page of the snapshot at open.
+static uint32_t _FICMetadataSnapshotHeaderChecksum(const FICMetadataSnapshotHeader *header) {
+    FICMetadataSnapshotHeader copy = *header;
+    copy.checksum = 0;
+
+    return FICChecksumCRC32C(0, &copy, sizeof(copy));
+}
+
+static uint32_t _FICMetadataSnapshotVersion1HeaderChecksum(const FICMetadataSnapshotVersion1Header *header) {
+    FICMetadataSnapshotVersion1Header copy = *header;
+    copy.checksum = 0;
+
+    return FICChecksumCRC32C(0, &copy, sizeof(copy));
+}
+
+// Reads the header of either version, converting a version 1 header into one whose recency list is all in the first segment
+static bool _FICMetadataSnapshotReadHeader(const uint8_t *snapshot, size_t length, FICMetadataSnapshotHeader *header, size_t *headerLength) {
+    uint32_t version;
+    if (length < sizeof(version)) {
+        return false;
+    }
+    memcpy(&version, snapshot, sizeof(version));
+
+    if (version == FICMetadataSnapshotVersion && length >= sizeof(FICMetadataSnapshotHeader)) {
+        memcpy(header, snapshot, sizeof(FICMetadataSnapshotHeader));
+        *headerLength = sizeof(FICMetadataSnapshotHeader);
+        return header->checksum == _FICMetadataSnapshotHeaderChecksum(header);
+    }
+
+    FICMetadataSnapshotVersion1Header version1Header;
+    if (version != 1 || length < sizeof(version1Header)) {
+        return false;
+    }
+
+    memcpy(&version1Header, snapshot, sizeof(version1Header));
+    if (version1Header.checksum != _FICMetadataSnapshotVersion1HeaderChecksum(&version1Header)) {
+        return false;
+    }
+
+    memset(header, 0, sizeof(FICMetadataSnapshotHeader));
+    header->version = version1Header.version;
+    header->entryLength = version1Header.entryLength;
+    header->bucketCount = version1Header.bucketCount;
+    header->entryCount = version1Header.entryCount;
+    header->slotCapacity = version1Header.slotCapacity;
+    header->wordCapacity = version1Header.wordCapacity;
+    header->occupiedCount = version1Header.occupiedCount;
+    header->listCapacity = version1Header.listCapacity;
+    header->segments[0].linkedCount = version1Header.linkedCount;
+    header->segments[0].trackedCount = version1Header.trackedCount;
+    header->segments[0].head = version1Header.head;
+    header->segments[0].tail = version1Header.tail;
+    for (unsigned segment = 1; segment < FICRecencyListSegmentCount; segment++) {
+        header->segments[segment].head = FICRecencyListNone;
+        header->segments[segment].tail = FICRecencyListNone;
+    }
+    header->uncommittedSlotCount = version1Header.uncommittedSlotCount;
+    *headerLength = sizeof(version1Header);
+
+    return true;
+}
+
+static bool _FICMetadataSnapshotHeaderIsValid(const FICMetadataSnapshotHeader *header, size_t headerLength, size_t length) {
+    if (header->entryLength != sizeof(FICEntryIndexEntry)) {
+        return false;
+    }
+
+    // Every array element takes at least one byte, so this bounds the counts before any of them is multiplied
+    if (header->bucketCount > length || header->slotCapacity > length || header->wordCapacity > length || header->listCapacity > length || header->sketchWordCount > length ||
+        header->uncommittedSlotCount > length) {
+        return false;
+    }
+
+    // Lookups stop at the first empty bucket, so the load factor cap has to hold for the index to be usable
+    if ((header->bucketCount & (header->bucketCount - 1)) != 0 || header->entryCount > header->bucketCount || header->entryCount * 4 > header->bucketCount * 3) {
+        return false;
+    }
+
+    if (header->wordCapacity % FICMetadataSnapshotBitsPerWord != 0 || header->occupiedCount > header->wordCapacity * FICMetadataSnapshotBitsPerWord) {
+        return false;
+    }
+
+    // Counters are picked by masking a hash, so the sketch has to have a power-of-two number of words
+    if ((header->sketchWordCount & (header->sketchWordCount - 1)) != 0) {
+        return false;
+    }
+
+    uint64_t trackedCount = 0;
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        const FICMetadataSnapshotSegment *snapshotSegment = &header->segments[segment];
+        if (snapshotSegment->linkedCount > snapshotSegment->trackedCount || snapshotSegment->trackedCount > header->listCapacity) {
+            return false;
+        }
+
+        bool headIsValid = snapshotSegment->linkedCount > 0 ? snapshotSegment->head < header->listCapacity : snapshotSegment->head == FICRecencyListNone;
+        bool tailIsValid = snapshotSegment->linkedCount > 0 ? snapshotSegment->tail < header->listCapacity : snapshotSegment->tail == FICRecencyListNone;
+        if (headIsValid == false || tailIsValid == false) {
+            return false;
+        }
+
+        trackedCount += snapshotSegment->trackedCount;
+    }
+
+    return trackedCount <= header->listCapacity && _FICMetadataSnapshotLayoutForHeader(header, headerLength).length == length;
+}
+
+#pragma mark - Writing Snapshots
+
+size_t FICMetadataSnapshotLength(const FICEntryIndex *index, const FICSlotAllocator *allocator, const FICEvictionPolicy *policy, size_t uncommittedSlotCount) {
+    FICMetadataSnapshotHeader header;
+    _FICMetadataSnapshotFillHeader(&header, index, allocator, policy, uncommittedSlotCount);
+
+    return (size_t)_FICMetadataSnapshotLayoutForHeader(&header, sizeof(header)).length;
+}
+
+void FICMetadataSnapshotWrite(void *bytes, const FICEntryIndex *index, const FICSlotAllocator *allocator, const FICEvictionPolicy *policy, const uint32_t *uncommittedSlots, size_t uncommittedSlotCount) {
+    uint8_t *snapshot = bytes;
+    FICMetadataSnapshotHeader header;
+    _FICMetadataSnapshotFillHeader(&header, index, allocator, policy, uncommittedSlotCount);
+    FICMetadataSnapshotLayout layout = _FICMetadataSnapshotLayoutForHeader(&header, sizeof(header));
+
+    // Padding is zeroed so the same structures always produce the same bytes
+    memset(snapshot, 0, (size_t)layout.length);
+
+    if (index->bucketCount > 0) {
+        memcpy(snapshot + layout.buckets, index->buckets, index->bucketCount * sizeof(FICEntryIndexEntry));
+    }
+    if (index->slotCapacity > 0) {
+        memcpy(snapshot + layout.entityUUIDBytesBySlot, index->entityUUIDBytesBySlot, index->slotCapacity * 16);
+    }
+    if (allocator->wordCapacity > 0) {
+        memcpy(snapshot + layout.words, allocator->words, allocator->wordCapacity * sizeof(uint64_t));
+        memcpy(snapshot + layout.summary, allocator->summary, allocator->wordCapacity / FICMetadataSnapshotBitsPerWord * sizeof(uint64_t));
+    }
+    if (policy->sketch.wordCount > 0) {
+        memcpy(snapshot + layout.sketchWords, policy->sketch.words, policy->sketch.wordCount * sizeof(uint64_t));
+    }
+    if (uncommittedSlotCount > 0) {
+        memcpy(snapshot + layout.uncommittedSlots, uncommittedSlots, uncommittedSlotCount * sizeof(uint32_t));
+    }
+
+    const FICRecencyList *list = &policy->list;
+    if (list->capacity > 0) {
+        memcpy(snapshot + layout.previous, list->previous, list->capacity * sizeof(uint32_t));
+        memcpy(snapshot + layout.next, list->next, list->capacity * sizeof(uint32_t));
+        memcpy(snapshot + layout.pinCounts, list->pinCounts, list->capacity * sizeof(uint32_t));
+        memcpy(snapshot + layout.states, list->states, list->capacity * sizeof(uint8_t));
+
+        // Unpinning is done on a list that borrows the copied arrays, which leaves the caller's list alone
+        FICRecencyList copy = *list;
+        copy.previous = (uint32_t *)(snapshot + layout.previous);
+        copy.next = (uint32_t *)(snapshot + layout.next);
+        copy.pinCounts = (uint32_t *)(snapshot + layout.pinCounts);
+        copy.states = snapshot + layout.states;
+        copy.borrowsStorage = true;
+        FICRecencyListRemoveAllPins(&copy);
+
+        for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+            header.segments[segment].linkedCount = copy.segments[segment].linkedCount;
+            header.segments[segment].head = copy.segments[segment].head;
+            header.segments[segment].tail = copy.segments[segment].tail;
+        }
+    }
+
+    header.checksum = _FICMetadataSnapshotHeaderChecksum(&header);
+    memcpy(snapshot, &header, sizeof(header));
+}
+
+#pragma mark - Adopting Snapshots
+
+bool FICMetadataSnapshotAdopt(void *bytes, size_t length, FICEntryIndex *index, FICSlotAllocator *allocator, FICEvictionPolicy *policy, const uint32_t **uncommittedSlots, size_t *uncommittedSlotCount) {
+    uint8_t *snapshot = bytes;
+    FICMetadataSnapshotHeader header;
+    size_t headerLength;
+    if (_FICMetadataSnapshotReadHeader(snapshot, length, &header, &headerLength) == false || _FICMetadataSnapshotHeaderIsValid(&header, headerLength, length) == false) {
+        return false;
+    }
+
+    uint64_t trackedCount = 0;
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        trackedCount += header.segments[segment].trackedCount;
+    }
+
+    // Structures without storage of their own stay that way, so growing them later never has to copy an empty array
+    bool indexHasStorage = header.bucketCount > 0 && header.slotCapacity > 0;
+    if ((indexHasStorage == false && header.entryCount > 0) || (header.listCapacity == 0 && trackedCount > 0)) {
+        return false;
+    }
+
+    FICMetadataSnapshotLayout layout = _FICMetadataSnapshotLayoutForHeader(&header, headerLength);
+
+    if (indexHasStorage) {
+        index->buckets = (FICEntryIndexEntry *)(snapshot + layout.buckets);
+        index->bucketCount = (size_t)header.bucketCount;
+        index->count = (size_t)header.entryCount;
+        index->entityUUIDBytesBySlot = (uint8_t (*)[16])(snapshot + layout.entityUUIDBytesBySlot);
+        index->slotCapacity = (size_t)header.slotCapacity;
+        index->borrowsStorage = true;
+    }
+
+    if (header.wordCapacity > 0) {
+        allocator->words = (uint64_t *)(snapshot + layout.words);
+        allocator->summary = (uint64_t *)(snapshot + layout.summary);
+        allocator->wordCapacity = (size_t)header.wordCapacity;
+        allocator->occupiedCount = (size_t)header.occupiedCount;
+        allocator->searchHint = 0;
+        allocator->borrowsStorage = true;
+    }
+
+    if (header.listCapacity > 0) {
+        FICRecencyList *list = &policy->list;
+        list->previous = (uint32_t *)(snapshot + layout.previous);
+        list->next = (uint32_t *)(snapshot + layout.next);
+        list->pinCounts = (uint32_t *)(snapshot + layout.pinCounts);
+        list->states = snapshot + layout.states;
+        list->capacity = (size_t)header.listCapacity;
+        for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+            list->segments[segment].linkedCount = (size_t)header.segments[segment].linkedCount;
+            list->segments[segment].trackedCount = (size_t)header.segments[segment].trackedCount;
+            list->segments[segment].head = header.segments[segment].head;
+            list->segments[segment].tail = header.segments[segment].tail;
+        }
+        list->borrowsStorage = true;
+    }
+
+    if (header.sketchWordCount > 0) {
+        policy->sketch.words = (uint64_t *)(snapshot + layout.sketchWords);
+        policy->sketch.wordCount = (size_t)header.sketchWordCount;
+        policy->sketch.additionCount = (size_t)header.sketchAdditionCount;
+        policy->sketch.borrowsStorage = true;
+    }
+
+    *uncommittedSlots = (const uint32_t *)(snapshot + layout.uncommittedSlots);
+    *uncommittedSlotCount = (size_t)header.uncommittedSlotCount;
+
+    return true;
+}
@@ -0,0 +1,70 @@
+//
+//  FICMetadataSnapshot.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICMetadataSnapshot_h
+#define FICMetadataSnapshot_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FICEntryIndex.h"
+#include "FICSlotAllocator.h"
+#include "FICEvictionPolicy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ A metadata snapshot is a copy of the in-memory structures of an image table, laid out so they can be used in place once the snapshot is mapped back into memory.
+
+ @discussion A snapshot is a fixed-size header followed by the raw arrays of an `<FICEntryIndex>`, an `<FICSlotAllocator>`, and the recency list and frequency sketch of an
+ `<FICEvictionPolicy>`, then the slots whose image data wasn't known to be on disk yet. Every array starts on an 8-byte boundary. Adopting a snapshot only checks the header, which carries a checksum of its own, so opening an
+ image table takes the same time no matter how many entries it has; pages of the snapshot are read from disk as lookups touch them.
+
+ Values are stored in host byte order, like the rest of the metadata journal.
+ */
+
+/**
+ Returns the length of the snapshot `<FICMetadataSnapshotWrite>` writes for these structures.
+ */
+size_t FICMetadataSnapshotLength(const FICEntryIndex *index, const FICSlotAllocator *allocator, const FICEvictionPolicy *policy, size_t uncommittedSlotCount);
+
+/**
+ Copies the structures into a snapshot.
+
+ @param bytes Memory at least `<FICMetadataSnapshotLength>` bytes long, aligned to 8 bytes.
+
+ @param uncommittedSlots The slots whose image data isn't known to be on disk yet.
+
+ @discussion Pins belong to images that are alive in this process, so pinned slots are saved at the front of their recency list segments, unpinned.
+ */
+void FICMetadataSnapshotWrite(void *bytes, const FICEntryIndex *index, const FICSlotAllocator *allocator, const FICEvictionPolicy *policy, const uint32_t *uncommittedSlots, size_t uncommittedSlotCount);
+
+/**
+ Makes freshly initialized structures work in place on the arrays of a snapshot.
+
+ @param bytes A snapshot aligned to 8 bytes. The structures modify it in place, so it's typically a private, copy-on-write mapping of the metadata file. It has to stay mapped until
+ the structures are destroyed.
+
+ @param uncommittedSlots On return, points to the slots whose image data wasn't known to be on disk when the snapshot was written.
+
+ @return `false` if the snapshot header doesn't describe a snapshot of exactly `length` bytes, in which case the structures are left empty.
+
+ @discussion The slot count of the allocator isn't part of the snapshot, since it depends on the length of the image table file. Neither is the kind of the policy, which
+ comes from the image format, so the policy has to be configured once the snapshot is adopted. Snapshots written before the policy had a frequency sketch are adopted with every slot
+ in the first segment of the recency list.
+ */
+bool FICMetadataSnapshotAdopt(void *bytes, size_t length, FICEntryIndex *index, FICSlotAllocator *allocator, FICEvictionPolicy *policy, const uint32_t **uncommittedSlots, size_t *uncommittedSlotCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
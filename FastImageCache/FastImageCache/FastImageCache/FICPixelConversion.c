@@ -0,0 +1,205 @@
+//
+//  FICPixelConversion.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICPixelConversion.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FIC_PIXEL_CONVERSION_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FIC_PIXEL_CONVERSION_SSE2 1
+#endif
+
+#pragma mark Internal Definitions
+
+#define FICPixelConversionBlockWidth 16
+
+// Rec. 601 luma weights in 8-bit fixed point, which add up to 256 so that white stays white
+#define FICPixelConversionRedWeight 77
+#define FICPixelConversionGreenWeight 150
+#define FICPixelConversionBlueWeight 29
+
+// Composites a premultiplied color component over white. Saturates, so image data that isn't properly premultiplied can't wrap around.
+static inline uint8_t _FICPixelConversionComposite(uint8_t component, uint8_t alpha) {
+    unsigned int value = (unsigned int)component + (255u - alpha);
+    return (uint8_t)(value > 255 ? 255 : value);
+}
+
+#if FIC_PIXEL_CONVERSION_SSE2
+
+// Composites 4 premultiplied BGRA pixels over white, which also sets each alpha byte to 255
+static inline __m128i _FICPixelConversionCompositeSSE2(__m128i pixels) {
+    __m128i transparency = _mm_xor_si128(_mm_srli_epi32(pixels, 24), _mm_set1_epi32(0xff));
+    transparency = _mm_or_si128(transparency, _mm_slli_epi32(transparency, 8));
+    transparency = _mm_or_si128(transparency, _mm_slli_epi32(transparency, 16));
+    return _mm_adds_epu8(pixels, transparency);
+}
+
+// Packs 4 opaque BGRA pixels into 16-bit BGR pixels in the low half of each 32-bit lane
+static inline __m128i _FICPixelConversionBGR555SSE2(__m128i pixels) {
+    __m128i blue = _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x001f));
+    __m128i green = _mm_and_si128(_mm_srli_epi32(pixels, 6), _mm_set1_epi32(0x03e0));
+    __m128i red = _mm_and_si128(_mm_srli_epi32(pixels, 9), _mm_set1_epi32(0x7c00));
+    return _mm_or_si128(_mm_or_si128(blue, green), red);
+}
+
+// Computes the luma of 4 opaque BGRA pixels in each 32-bit lane
+static inline __m128i _FICPixelConversionLumaSSE2(__m128i pixels) {
+    __m128i mask = _mm_set1_epi32(0x00ff00ff);
+    __m128i blueAndRed = _mm_and_si128(pixels, mask);
+    __m128i greenAndAlpha = _mm_and_si128(_mm_srli_epi32(pixels, 8), mask);
+    __m128i luma = _mm_madd_epi16(blueAndRed, _mm_set1_epi32((FICPixelConversionRedWeight << 16) | FICPixelConversionBlueWeight));
+    luma = _mm_add_epi32(luma, _mm_madd_epi16(greenAndAlpha, _mm_set1_epi32(FICPixelConversionGreenWeight)));
+    return _mm_srli_epi32(_mm_add_epi32(luma, _mm_set1_epi32(128)), 8);
+}
+
+#endif
+
+#pragma mark - Converting Rows
+
+static void _FICPixelConvertRowBGRAToBGR(const uint8_t *source, uint8_t *destination, size_t width) {
+    size_t x = 0;
+
+#if FIC_PIXEL_CONVERSION_NEON
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        uint8x16x4_t pixels = vld4q_u8(source + x * 4);
+        uint8x16_t transparency = vmvnq_u8(pixels.val[3]);
+        pixels.val[0] = vqaddq_u8(pixels.val[0], transparency);
+        pixels.val[1] = vqaddq_u8(pixels.val[1], transparency);
+        pixels.val[2] = vqaddq_u8(pixels.val[2], transparency);
+        pixels.val[3] = vdupq_n_u8(255);
+        vst4q_u8(destination + x * 4, pixels);
+    }
+#elif FIC_PIXEL_CONVERSION_SSE2
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        for (size_t i = 0; i < FICPixelConversionBlockWidth; i += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(source + (x + i) * 4));
+            _mm_storeu_si128((__m128i *)(destination + (x + i) * 4), _FICPixelConversionCompositeSSE2(pixels));
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        const uint8_t *pixel = source + x * 4;
+        uint8_t *convertedPixel = destination + x * 4;
+        convertedPixel[0] = _FICPixelConversionComposite(pixel[0], pixel[3]);
+        convertedPixel[1] = _FICPixelConversionComposite(pixel[1], pixel[3]);
+        convertedPixel[2] = _FICPixelConversionComposite(pixel[2], pixel[3]);
+        convertedPixel[3] = 255;
+    }
+}
+
+static void _FICPixelConvertRowBGRAToBGR555(const uint8_t *source, uint16_t *destination, size_t width) {
+    size_t x = 0;
+
+#if FIC_PIXEL_CONVERSION_NEON
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        uint8x16x4_t pixels = vld4q_u8(source + x * 4);
+        uint8x16_t transparency = vmvnq_u8(pixels.val[3]);
+        uint8x16_t blue = vshrq_n_u8(vqaddq_u8(pixels.val[0], transparency), 3);
+        uint8x16_t green = vshrq_n_u8(vqaddq_u8(pixels.val[1], transparency), 3);
+        uint8x16_t red = vshrq_n_u8(vqaddq_u8(pixels.val[2], transparency), 3);
+
+        uint16x8_t low = vmovl_u8(vget_low_u8(blue));
+        low = vsliq_n_u16(low, vmovl_u8(vget_low_u8(green)), 5);
+        low = vsliq_n_u16(low, vmovl_u8(vget_low_u8(red)), 10);
+        uint16x8_t high = vmovl_u8(vget_high_u8(blue));
+        high = vsliq_n_u16(high, vmovl_u8(vget_high_u8(green)), 5);
+        high = vsliq_n_u16(high, vmovl_u8(vget_high_u8(red)), 10);
+
+        vst1q_u16(destination + x, low);
+        vst1q_u16(destination + x + 8, high);
+    }
+#elif FIC_PIXEL_CONVERSION_SSE2
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        for (size_t i = 0; i < FICPixelConversionBlockWidth; i += 8) {
+            __m128i first = _FICPixelConversionCompositeSSE2(_mm_loadu_si128((const __m128i *)(source + (x + i) * 4)));
+            __m128i second = _FICPixelConversionCompositeSSE2(_mm_loadu_si128((const __m128i *)(source + (x + i + 4) * 4)));
+
+            // Converted pixels never have bit 15 set, so the signed saturation doesn't change them
+            __m128i packed = _mm_packs_epi32(_FICPixelConversionBGR555SSE2(first), _FICPixelConversionBGR555SSE2(second));
+            _mm_storeu_si128((__m128i *)(destination + x + i), packed);
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        const uint8_t *pixel = source + x * 4;
+        uint16_t blue = _FICPixelConversionComposite(pixel[0], pixel[3]) >> 3;
+        uint16_t green = _FICPixelConversionComposite(pixel[1], pixel[3]) >> 3;
+        uint16_t red = _FICPixelConversionComposite(pixel[2], pixel[3]) >> 3;
+        destination[x] = (uint16_t)((red << 10) | (green << 5) | blue);
+    }
+}
+
+static void _FICPixelConvertRowBGRAToGrayscale(const uint8_t *source, uint8_t *destination, size_t width) {
+    size_t x = 0;
+
+#if FIC_PIXEL_CONVERSION_NEON
+    uint8x8_t redWeight = vdup_n_u8(FICPixelConversionRedWeight);
+    uint8x8_t greenWeight = vdup_n_u8(FICPixelConversionGreenWeight);
+    uint8x8_t blueWeight = vdup_n_u8(FICPixelConversionBlueWeight);
+
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        uint8x16x4_t pixels = vld4q_u8(source + x * 4);
+        uint8x16_t transparency = vmvnq_u8(pixels.val[3]);
+        uint8x16_t blue = vqaddq_u8(pixels.val[0], transparency);
+        uint8x16_t green = vqaddq_u8(pixels.val[1], transparency);
+        uint8x16_t red = vqaddq_u8(pixels.val[2], transparency);
+
+        uint16x8_t low = vmull_u8(vget_low_u8(red), redWeight);
+        low = vmlal_u8(low, vget_low_u8(green), greenWeight);
+        low = vmlal_u8(low, vget_low_u8(blue), blueWeight);
+        uint16x8_t high = vmull_u8(vget_high_u8(red), redWeight);
+        high = vmlal_u8(high, vget_high_u8(green), greenWeight);
+        high = vmlal_u8(high, vget_high_u8(blue), blueWeight);
+
+        vst1q_u8(destination + x, vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8)));
+    }
+#elif FIC_PIXEL_CONVERSION_SSE2
+    for (; x + FICPixelConversionBlockWidth <= width; x += FICPixelConversionBlockWidth) {
+        __m128i luma[4];
+        for (size_t i = 0; i < 4; i++) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(source + (x + i * 4) * 4));
+            luma[i] = _FICPixelConversionLumaSSE2(_FICPixelConversionCompositeSSE2(pixels));
+        }
+
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(luma[0], luma[1]), _mm_packs_epi32(luma[2], luma[3]));
+        _mm_storeu_si128((__m128i *)(destination + x), packed);
+    }
+#endif
+
+    for (; x < width; x++) {
+        const uint8_t *pixel = source + x * 4;
+        unsigned int blue = _FICPixelConversionComposite(pixel[0], pixel[3]);
+        unsigned int green = _FICPixelConversionComposite(pixel[1], pixel[3]);
+        unsigned int red = _FICPixelConversionComposite(pixel[2], pixel[3]);
+        destination[x] = (uint8_t)((FICPixelConversionRedWeight * red + FICPixelConversionGreenWeight * green + FICPixelConversionBlueWeight * blue + 128) >> 8);
+    }
+}
+
+#pragma mark - Converting Image Data
+
+void FICPixelConvertBGRAToBGR(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        _FICPixelConvertRowBGRAToBGR((const uint8_t *)source + y * sourceRowLength, (uint8_t *)destination + y * destinationRowLength, width);
+    }
+}
+
+void FICPixelConvertBGRAToBGR555(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        _FICPixelConvertRowBGRAToBGR555((const uint8_t *)source + y * sourceRowLength, (uint16_t *)((uint8_t *)destination + y * destinationRowLength), width);
+    }
+}
+
+void FICPixelConvertBGRAToGrayscale(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        _FICPixelConvertRowBGRAToGrayscale((const uint8_t *)source + y * sourceRowLength, (uint8_t *)destination + y * destinationRowLength, width);
+    }
+}
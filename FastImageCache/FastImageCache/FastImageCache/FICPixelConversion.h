@@ -0,0 +1,64 @@
+//
+//  FICPixelConversion.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICPixelConversion_h
+#define FICPixelConversion_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Conversion of 32-bit BGRA image data, with premultiplied alpha, into the other image format styles.
+
+ @discussion Every conversion composites the source pixels over an opaque white background, since none of the destination styles have an alpha channel. Drawing an image into an
+ opaque style with a white fill first gives the same result.
+
+ - 32-bit BGR keeps 8 bits per color component, and the unused byte is set to 255.
+ - 16-bit BGR keeps the top 5 bits of each color component, with red in bits 10-14, green in bits 5-9 and blue in bits 0-4 of each host-endian pixel.
+ - 8-bit grayscale uses the Rec. 601 luma weights.
+
+ Pixels are converted 16 at a time with NEON on ARM and SSE2 on x86, and one at a time elsewhere and at the end of each row. Source and destination rows can have any length and
+ alignment, but must not overlap.
+ */
+
+/**
+ Converts 32-bit BGRA image data into 32-bit BGR image data.
+
+ @param source The first row of source pixels.
+
+ @param sourceRowLength The distance between the starts of two source rows, in bytes.
+
+ @param destination The first row of destination pixels.
+
+ @param destinationRowLength The distance between the starts of two destination rows, in bytes.
+
+ @param width The number of pixels in each row.
+
+ @param height The number of rows.
+ */
+void FICPixelConvertBGRAToBGR(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height);
+
+/**
+ Converts 32-bit BGRA image data into 16-bit BGR image data. The parameters are the same as those of `FICPixelConvertBGRAToBGR`.
+ */
+void FICPixelConvertBGRAToBGR555(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height);
+
+/**
+ Converts 32-bit BGRA image data into 8-bit grayscale image data. The parameters are the same as those of `FICPixelConvertBGRAToBGR`.
+ */
+void FICPixelConvertBGRAToGrayscale(const void *source, size_t sourceRowLength, void *destination, size_t destinationRowLength, size_t width, size_t height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+//
+//  FICPixelScaling.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICPixelScaling.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FIC_PIXEL_SCALING_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FIC_PIXEL_SCALING_SSE2 1
+#endif
+
+#pragma mark Internal Definitions
+
+// The weights of the source pixels covered by a destination pixel add up to this in each direction. Summing a column of 8-bit components with these weights stays within 16 bits,
+// and summing a row of those sums stays within 32 bits.
+#define FICPixelScalingWeightTotal 256
+
+// The source pixels a destination pixel covers in one direction
+typedef struct {
+    size_t start;
+    size_t count;
+    const uint16_t *weights;
+} FICPixelScalingSpan;
+
+// Destination pixel d covers source coordinates [d * sourceCount / destinationCount, (d + 1) * sourceCount / destinationCount). Everything is measured in units of
+// 1 / destinationCount of a source pixel to stay in whole numbers. Weights are rounded from the running total of the coverage, so they always add up to the weight total.
+static void _FICPixelScalingFillSpans(FICPixelScalingSpan *spans, uint16_t *weights, size_t maximumSpanCount, size_t sourceCount, size_t destinationCount) {
+    for (size_t d = 0; d < destinationCount; d++) {
+        size_t low = d * sourceCount;
+        size_t high = (d + 1) * sourceCount;
+        size_t first = low / destinationCount;
+        size_t last = (high - 1) / destinationCount;
+        uint16_t *spanWeights = weights + d * maximumSpanCount;
+
+        size_t coverage = 0;
+        size_t previousWeightTotal = 0;
+        for (size_t i = first; i <= last; i++) {
+            size_t pixelLow = i * destinationCount;
+            size_t pixelHigh = pixelLow + destinationCount;
+            coverage += (pixelHigh < high ? pixelHigh : high) - (pixelLow > low ? pixelLow : low);
+
+            size_t weightTotal = (coverage * FICPixelScalingWeightTotal + sourceCount / 2) / sourceCount;
+            spanWeights[i - first] = (uint16_t)(weightTotal - previousWeightTotal);
+            previousWeightTotal = weightTotal;
+        }
+
+        spans[d].start = first;
+        spans[d].count = last - first + 1;
+        spans[d].weights = spanWeights;
+    }
+}
+
+// Adds a source row times its weight to the column sums
+static void _FICPixelScalingAccumulateRow(uint16_t *sums, const uint8_t *row, size_t length, uint16_t weight) {
+    size_t i = 0;
+
+#if FIC_PIXEL_SCALING_NEON
+    uint16x8_t weights = vdupq_n_u16(weight);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t bytes = vld1q_u8(row + i);
+        uint16x8_t low = vmlaq_u16(vld1q_u16(sums + i), vmovl_u8(vget_low_u8(bytes)), weights);
+        uint16x8_t high = vmlaq_u16(vld1q_u16(sums + i + 8), vmovl_u8(vget_high_u8(bytes)), weights);
+        vst1q_u16(sums + i, low);
+        vst1q_u16(sums + i + 8, high);
+    }
+#elif FIC_PIXEL_SCALING_SSE2
+    __m128i weights = _mm_set1_epi16((short)weight);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(bytes, zero), weights);
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(bytes, zero), weights);
+        _mm_storeu_si128((__m128i *)(sums + i), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(sums + i)), low));
+        _mm_storeu_si128((__m128i *)(sums + i + 8), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(sums + i + 8)), high));
+    }
+#endif
+
+    for (; i < length; i++) {
+        sums[i] = (uint16_t)(sums[i] + row[i] * weight);
+    }
+}
+
+static inline uint8_t _FICPixelScalingAverage(uint32_t sum) {
+    return (uint8_t)((sum + FICPixelScalingWeightTotal * FICPixelScalingWeightTotal / 2) / (FICPixelScalingWeightTotal * FICPixelScalingWeightTotal));
+}
+
+// Sums the column sums covered by each destination pixel with their weights
+static void _FICPixelScalingNarrowRow(uint8_t *destinationRow, const uint16_t *sums, const FICPixelScalingSpan *columnSpans, size_t destinationWidth, size_t bytesPerPixel) {
+    for (size_t x = 0; x < destinationWidth; x++) {
+        FICPixelScalingSpan columnSpan = columnSpans[x];
+        const uint16_t *columnSums = sums + columnSpan.start * bytesPerPixel;
+        for (size_t component = 0; component < bytesPerPixel; component++) {
+            uint32_t sum = 0;
+            for (size_t k = 0; k < columnSpan.count; k++) {
+                sum += (uint32_t)columnSums[k * bytesPerPixel + component] * columnSpan.weights[k];
+            }
+            destinationRow[x * bytesPerPixel + component] = _FICPixelScalingAverage(sum);
+        }
+    }
+}
+
+// The same for 32-bit pixels, with the four components summed side by side
+static void _FICPixelScalingNarrowRow4(uint8_t *destinationRow, const uint16_t *sums, const FICPixelScalingSpan *columnSpans, size_t destinationWidth) {
+    for (size_t x = 0; x < destinationWidth; x++) {
+        FICPixelScalingSpan columnSpan = columnSpans[x];
+        const uint16_t *columnSums = sums + columnSpan.start * 4;
+        uint32_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+        for (size_t k = 0; k < columnSpan.count; k++) {
+            uint32_t weight = columnSpan.weights[k];
+            sum0 += columnSums[k * 4 + 0] * weight;
+            sum1 += columnSums[k * 4 + 1] * weight;
+            sum2 += columnSums[k * 4 + 2] * weight;
+            sum3 += columnSums[k * 4 + 3] * weight;
+        }
+        destinationRow[x * 4 + 0] = _FICPixelScalingAverage(sum0);
+        destinationRow[x * 4 + 1] = _FICPixelScalingAverage(sum1);
+        destinationRow[x * 4 + 2] = _FICPixelScalingAverage(sum2);
+        destinationRow[x * 4 + 3] = _FICPixelScalingAverage(sum3);
+    }
+}
+
+#pragma mark - Downscaling Image Data
+
+bool FICPixelDownscale(const void *source, size_t sourceRowLength, size_t sourceWidth, size_t sourceHeight, void *destination, size_t destinationRowLength, size_t destinationWidth, size_t destinationHeight, size_t bytesPerPixel) {
+    if (destinationWidth == 0 || destinationHeight == 0 || destinationWidth > sourceWidth || destinationHeight > sourceHeight || bytesPerPixel == 0) {
+        return false;
+    }
+
+    // A destination pixel covers at most this many source pixels in each direction, counting partly covered ones at both ends
+    size_t maximumColumnCount = (sourceWidth + destinationWidth - 1) / destinationWidth + 1;
+    size_t maximumRowCount = (sourceHeight + destinationHeight - 1) / destinationHeight + 1;
+
+    FICPixelScalingSpan *columnSpans = malloc(destinationWidth * sizeof(FICPixelScalingSpan));
+    FICPixelScalingSpan *rowSpans = malloc(destinationHeight * sizeof(FICPixelScalingSpan));
+    uint16_t *columnWeights = malloc(destinationWidth * maximumColumnCount * sizeof(uint16_t));
+    uint16_t *rowWeights = malloc(destinationHeight * maximumRowCount * sizeof(uint16_t));
+    uint16_t *sums = malloc(sourceWidth * bytesPerPixel * sizeof(uint16_t));
+
+    bool didScale = columnSpans != NULL && rowSpans != NULL && columnWeights != NULL && rowWeights != NULL && sums != NULL;
+    if (didScale) {
+        _FICPixelScalingFillSpans(columnSpans, columnWeights, maximumColumnCount, sourceWidth, destinationWidth);
+        _FICPixelScalingFillSpans(rowSpans, rowWeights, maximumRowCount, sourceHeight, destinationHeight);
+
+        size_t sourceLength = sourceWidth * bytesPerPixel;
+        for (size_t y = 0; y < destinationHeight; y++) {
+            // Each destination row is a weighted sum of source rows, which is then narrowed down to destination columns
+            FICPixelScalingSpan rowSpan = rowSpans[y];
+            memset(sums, 0, sourceLength * sizeof(uint16_t));
+            for (size_t k = 0; k < rowSpan.count; k++) {
+                _FICPixelScalingAccumulateRow(sums, (const uint8_t *)source + (rowSpan.start + k) * sourceRowLength, sourceLength, rowSpan.weights[k]);
+            }
+
+            uint8_t *destinationRow = (uint8_t *)destination + y * destinationRowLength;
+            if (bytesPerPixel == 4) {
+                _FICPixelScalingNarrowRow4(destinationRow, sums, columnSpans, destinationWidth);
+            } else {
+                _FICPixelScalingNarrowRow(destinationRow, sums, columnSpans, destinationWidth, bytesPerPixel);
+            }
+        }
+    }
+
+    free(columnSpans);
+    free(rowSpans);
+    free(columnWeights);
+    free(rowWeights);
+    free(sums);
+
+    return didScale;
+}
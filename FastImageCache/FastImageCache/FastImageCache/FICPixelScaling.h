@@ -0,0 +1,55 @@
+//
+//  FICPixelScaling.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICPixelScaling_h
+#define FICPixelScaling_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Downscales image data by area averaging.
+
+ @param source The first row of source pixels.
+
+ @param sourceRowLength The distance between the starts of two source rows, in bytes.
+
+ @param sourceWidth The number of pixels in each source row.
+
+ @param sourceHeight The number of source rows.
+
+ @param destination The first row of destination pixels.
+
+ @param destinationRowLength The distance between the starts of two destination rows, in bytes.
+
+ @param destinationWidth The number of pixels in each destination row. Must not be larger than `sourceWidth`.
+
+ @param destinationHeight The number of destination rows. Must not be larger than `sourceHeight`.
+
+ @param bytesPerPixel The number of bytes in each pixel. Every byte is averaged on its own, so this works for image data with 8-bit components, such as 32-bit BGRA with
+ premultiplied alpha or 8-bit grayscale, but not for 16-bit BGR.
+
+ @return `false` if the destination is larger than the source or empty, or if memory for the scaling weights couldn't be allocated.
+
+ @discussion Each destination pixel is the average of the source pixels it covers, weighted by how much of each one it covers, so the scale doesn't have to be a whole number. Weights
+ have 8 bits of precision. When the scale divides 256, as 2 and 4 do, every covered source pixel has the same weight and the result is the exact rounded average.
+
+ Source rows, which make up most of the work, are accumulated 16 bytes at a time with NEON on ARM and SSE2 on x86.
+ */
+bool FICPixelDownscale(const void *source, size_t sourceRowLength, size_t sourceWidth, size_t sourceHeight, void *destination, size_t destinationRowLength, size_t destinationWidth, size_t destinationHeight, size_t bytesPerPixel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
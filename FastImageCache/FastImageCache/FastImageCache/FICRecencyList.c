@@ -0,0 +1,411 @@
+//
+//  FICRecencyList.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICRecencyList.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+typedef enum {
+    FICRecencyListSlotStateUntracked = 0,
+    FICRecencyListSlotStateLinked,
+    FICRecencyListSlotStatePinned,
+} FICRecencyListSlotState;
+
+// Each slot's state byte holds its state in the low bits and its segment above them
+#define FICRecencyListSlotStateMask 0x3
+#define FICRecencyListSegmentShift 2
+
+static inline FICRecencyListSlotState _FICRecencyListStateOfSlot(const FICRecencyList *list, uint32_t slot) {
+    return (FICRecencyListSlotState)(list->states[slot] & FICRecencyListSlotStateMask);
+}
+
+// States may come from a snapshot on disk, whose arrays aren't checksummed, so a segment that can't exist is never used as one
+static inline unsigned _FICRecencyListSegmentOfSlot(const FICRecencyList *list, uint32_t slot) {
+    unsigned segment = list->states[slot] >> FICRecencyListSegmentShift;
+    return segment < FICRecencyListSegmentCount ? segment : 0;
+}
+
+static inline void _FICRecencyListSetStateOfSlot(FICRecencyList *list, uint32_t slot, FICRecencyListSlotState state, unsigned segment) {
+    list->states[slot] = (uint8_t)(state | (segment << FICRecencyListSegmentShift));
+}
+
+// Growing borrowed storage can't reallocate it, so it's copied into memory the list owns first
+static bool _FICRecencyListOwnStorage(FICRecencyList *list) {
+    if (list->borrowsStorage == false) {
+        return true;
+    }
+
+    uint32_t *previous = malloc(list->capacity * sizeof(uint32_t));
+    uint32_t *next = malloc(list->capacity * sizeof(uint32_t));
+    uint32_t *pinCounts = malloc(list->capacity * sizeof(uint32_t));
+    uint8_t *states = malloc(list->capacity * sizeof(uint8_t));
+    if (previous == NULL || next == NULL || pinCounts == NULL || states == NULL) {
+        free(previous);
+        free(next);
+        free(pinCounts);
+        free(states);
+        return false;
+    }
+
+    memcpy(previous, list->previous, list->capacity * sizeof(uint32_t));
+    memcpy(next, list->next, list->capacity * sizeof(uint32_t));
+    memcpy(pinCounts, list->pinCounts, list->capacity * sizeof(uint32_t));
+    memcpy(states, list->states, list->capacity * sizeof(uint8_t));
+    list->previous = previous;
+    list->next = next;
+    list->pinCounts = pinCounts;
+    list->states = states;
+    list->borrowsStorage = false;
+
+    return true;
+}
+
+static bool _FICRecencyListEnsureCapacity(FICRecencyList *list, size_t slotCount) {
+    if (slotCount <= list->capacity) {
+        return true;
+    }
+
+    size_t newCapacity = list->capacity > 0 ? list->capacity : 256;
+    while (newCapacity < slotCount) {
+        newCapacity *= 2;
+    }
+
+    if (_FICRecencyListOwnStorage(list) == false) {
+        return false;
+    }
+
+    uint32_t *previous = realloc(list->previous, newCapacity * sizeof(uint32_t));
+    if (previous == NULL) {
+        return false;
+    }
+    list->previous = previous;
+
+    uint32_t *next = realloc(list->next, newCapacity * sizeof(uint32_t));
+    if (next == NULL) {
+        return false;
+    }
+    list->next = next;
+
+    uint32_t *pinCounts = realloc(list->pinCounts, newCapacity * sizeof(uint32_t));
+    if (pinCounts == NULL) {
+        return false;
+    }
+    list->pinCounts = pinCounts;
+
+    uint8_t *states = realloc(list->states, newCapacity * sizeof(uint8_t));
+    if (states == NULL) {
+        return false;
+    }
+    list->states = states;
+
+    size_t addedCount = newCapacity - list->capacity;
+    memset(list->pinCounts + list->capacity, 0, addedCount * sizeof(uint32_t));
+    memset(list->states + list->capacity, FICRecencyListSlotStateUntracked, addedCount * sizeof(uint8_t));
+    list->capacity = newCapacity;
+
+    return true;
+}
+
+static void _FICRecencyListLinkAtHead(FICRecencyList *list, uint32_t slot, unsigned segment) {
+    FICRecencyListSegment *listSegment = &list->segments[segment];
+    list->previous[slot] = FICRecencyListNone;
+    list->next[slot] = listSegment->head;
+
+    if (listSegment->head != FICRecencyListNone) {
+        list->previous[listSegment->head] = slot;
+    } else {
+        listSegment->tail = slot;
+    }
+
+    listSegment->head = slot;
+    listSegment->linkedCount++;
+}
+
+static void _FICRecencyListUnlink(FICRecencyList *list, uint32_t slot) {
+    FICRecencyListSegment *listSegment = &list->segments[_FICRecencyListSegmentOfSlot(list, slot)];
+    uint32_t previous = list->previous[slot];
+    uint32_t next = list->next[slot];
+
+    if (previous != FICRecencyListNone) {
+        list->next[previous] = next;
+    } else {
+        listSegment->head = next;
+    }
+
+    if (next != FICRecencyListNone) {
+        list->previous[next] = previous;
+    } else {
+        listSegment->tail = previous;
+    }
+
+    listSegment->linkedCount--;
+}
+
+static size_t _FICRecencyListPinnedCount(const FICRecencyList *list) {
+    size_t pinnedCount = 0;
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        pinnedCount += list->segments[segment].trackedCount - list->segments[segment].linkedCount;
+    }
+
+    return pinnedCount;
+}
+
+#pragma mark - List Lifecycle
+
+void FICRecencyListInit(FICRecencyList *list) {
+    memset(list, 0, sizeof(FICRecencyList));
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        list->segments[segment].head = FICRecencyListNone;
+        list->segments[segment].tail = FICRecencyListNone;
+    }
+}
+
+void FICRecencyListDestroy(FICRecencyList *list) {
+    if (list->borrowsStorage == false) {
+        free(list->previous);
+        free(list->next);
+        free(list->pinCounts);
+        free(list->states);
+    }
+    FICRecencyListInit(list);
+}
+
+#pragma mark - Tracking Slots
+
+bool FICRecencyListTouch(FICRecencyList *list, uint32_t slot) {
+    unsigned segment = FICRecencyListContains(list, slot) ? _FICRecencyListSegmentOfSlot(list, slot) : 0;
+
+    return FICRecencyListTouchInSegment(list, slot, segment);
+}
+
+bool FICRecencyListTouchInSegment(FICRecencyList *list, uint32_t slot, unsigned segment) {
+    if (_FICRecencyListEnsureCapacity(list, (size_t)slot + 1) == false) {
+        return false;
+    }
+
+    switch (_FICRecencyListStateOfSlot(list, slot)) {
+        case FICRecencyListSlotStateUntracked:
+            list->segments[segment].trackedCount++;
+            if (list->pinCounts[slot] > 0) {
+                _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStatePinned, segment);
+            } else {
+                _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateLinked, segment);
+                _FICRecencyListLinkAtHead(list, slot, segment);
+            }
+            break;
+        case FICRecencyListSlotStateLinked:
+            if (list->segments[segment].head != slot) {
+                _FICRecencyListUnlink(list, slot);
+                list->segments[_FICRecencyListSegmentOfSlot(list, slot)].trackedCount--;
+                list->segments[segment].trackedCount++;
+                _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateLinked, segment);
+                _FICRecencyListLinkAtHead(list, slot, segment);
+            }
+            break;
+        case FICRecencyListSlotStatePinned:
+            // Pinned slots are put at the front of their segment once they are unpinned.
+            list->segments[_FICRecencyListSegmentOfSlot(list, slot)].trackedCount--;
+            list->segments[segment].trackedCount++;
+            _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStatePinned, segment);
+            break;
+    }
+
+    return true;
+}
+
+void FICRecencyListRemove(FICRecencyList *list, uint32_t slot) {
+    if (FICRecencyListContains(list, slot)) {
+        if (_FICRecencyListStateOfSlot(list, slot) == FICRecencyListSlotStateLinked) {
+            _FICRecencyListUnlink(list, slot);
+        }
+
+        list->segments[_FICRecencyListSegmentOfSlot(list, slot)].trackedCount--;
+        _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateUntracked, 0);
+    }
+}
+
+bool FICRecencyListContains(const FICRecencyList *list, uint32_t slot) {
+    return slot < list->capacity && _FICRecencyListStateOfSlot(list, slot) != FICRecencyListSlotStateUntracked;
+}
+
+unsigned FICRecencyListSegmentOfSlot(const FICRecencyList *list, uint32_t slot) {
+    return slot < list->capacity ? _FICRecencyListSegmentOfSlot(list, slot) : 0;
+}
+
+bool FICRecencyListMoveSlot(FICRecencyList *list, uint32_t slot, uint32_t newSlot) {
+    if (FICRecencyListContains(list, slot) == false) {
+        return true;
+    }
+
+    if (_FICRecencyListStateOfSlot(list, slot) == FICRecencyListSlotStatePinned || FICRecencyListContains(list, newSlot) || FICRecencyListIsPinned(list, newSlot)) {
+        return false;
+    }
+
+    if (_FICRecencyListEnsureCapacity(list, (size_t)newSlot + 1) == false) {
+        return false;
+    }
+
+    unsigned segment = _FICRecencyListSegmentOfSlot(list, slot);
+    FICRecencyListSegment *listSegment = &list->segments[segment];
+    uint32_t previous = list->previous[slot];
+    uint32_t next = list->next[slot];
+    list->previous[newSlot] = previous;
+    list->next[newSlot] = next;
+
+    if (previous != FICRecencyListNone) {
+        list->next[previous] = newSlot;
+    } else {
+        listSegment->head = newSlot;
+    }
+
+    if (next != FICRecencyListNone) {
+        list->previous[next] = newSlot;
+    } else {
+        listSegment->tail = newSlot;
+    }
+
+    _FICRecencyListSetStateOfSlot(list, newSlot, FICRecencyListSlotStateLinked, segment);
+    _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateUntracked, 0);
+
+    return true;
+}
+
+#pragma mark - Pinning Slots
+
+bool FICRecencyListPin(FICRecencyList *list, uint32_t slot) {
+    if (_FICRecencyListEnsureCapacity(list, (size_t)slot + 1) == false) {
+        return false;
+    }
+
+    list->pinCounts[slot]++;
+    if (_FICRecencyListStateOfSlot(list, slot) == FICRecencyListSlotStateLinked) {
+        _FICRecencyListUnlink(list, slot);
+        _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStatePinned, _FICRecencyListSegmentOfSlot(list, slot));
+    }
+
+    return true;
+}
+
+void FICRecencyListUnpin(FICRecencyList *list, uint32_t slot) {
+    if (slot < list->capacity && list->pinCounts[slot] > 0) {
+        list->pinCounts[slot]--;
+        if (list->pinCounts[slot] == 0 && _FICRecencyListStateOfSlot(list, slot) == FICRecencyListSlotStatePinned) {
+            unsigned segment = _FICRecencyListSegmentOfSlot(list, slot);
+            _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateLinked, segment);
+            _FICRecencyListLinkAtHead(list, slot, segment);
+        }
+    }
+}
+
+bool FICRecencyListIsPinned(const FICRecencyList *list, uint32_t slot) {
+    return slot < list->capacity && list->pinCounts[slot] > 0;
+}
+
+#pragma mark - Inspecting the List
+
+uint32_t FICRecencyListLeastRecentSlot(const FICRecencyList *list) {
+    return list->segments[0].tail;
+}
+
+uint32_t FICRecencyListLeastRecentSlotInSegment(const FICRecencyList *list, unsigned segment) {
+    return list->segments[segment].tail;
+}
+
+size_t FICRecencyListTrackedCount(const FICRecencyList *list) {
+    size_t trackedCount = 0;
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        trackedCount += list->segments[segment].trackedCount;
+    }
+
+    return trackedCount;
+}
+
+size_t FICRecencyListGetSlots(const FICRecencyList *list, uint32_t *slots, size_t maximumCount) {
+    size_t count = 0;
+
+    size_t pinnedCount = _FICRecencyListPinnedCount(list);
+    for (size_t slot = 0; slot < list->capacity && pinnedCount > 0 && count < maximumCount; slot++) {
+        if (_FICRecencyListStateOfSlot(list, (uint32_t)slot) == FICRecencyListSlotStatePinned) {
+            slots[count++] = (uint32_t)slot;
+            pinnedCount--;
+        }
+    }
+
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        for (uint32_t slot = list->segments[segment].head; slot != FICRecencyListNone && count < maximumCount; slot = list->next[slot]) {
+            slots[count++] = slot;
+        }
+    }
+
+    return count;
+}
+
+#pragma mark - Changing Every Slot
+
+void FICRecencyListMergeSegments(FICRecencyList *list) {
+    size_t pinnedCount = 0;
+    for (unsigned segment = 1; segment < FICRecencyListSegmentCount; segment++) {
+        FICRecencyListSegment *listSegment = &list->segments[segment];
+        pinnedCount += listSegment->trackedCount - listSegment->linkedCount;
+
+        // Walking from the tail and linking each slot at the head keeps the segment's order
+        uint32_t slot = listSegment->tail;
+        while (slot != FICRecencyListNone) {
+            uint32_t previous = list->previous[slot];
+            _FICRecencyListSetStateOfSlot(list, slot, FICRecencyListSlotStateLinked, 0);
+            _FICRecencyListLinkAtHead(list, slot, 0);
+            slot = previous;
+        }
+
+        list->segments[0].trackedCount += listSegment->trackedCount;
+        listSegment->head = FICRecencyListNone;
+        listSegment->tail = FICRecencyListNone;
+        listSegment->linkedCount = 0;
+        listSegment->trackedCount = 0;
+    }
+
+    for (size_t slot = 0; slot < list->capacity && pinnedCount > 0; slot++) {
+        if (_FICRecencyListStateOfSlot(list, (uint32_t)slot) == FICRecencyListSlotStatePinned && _FICRecencyListSegmentOfSlot(list, (uint32_t)slot) != 0) {
+            _FICRecencyListSetStateOfSlot(list, (uint32_t)slot, FICRecencyListSlotStatePinned, 0);
+            pinnedCount--;
+        }
+    }
+}
+
+void FICRecencyListRemoveAllPins(FICRecencyList *list) {
+    size_t pinnedCount = _FICRecencyListPinnedCount(list);
+    for (size_t slot = 0; slot < list->capacity && pinnedCount > 0; slot++) {
+        if (_FICRecencyListStateOfSlot(list, (uint32_t)slot) == FICRecencyListSlotStatePinned) {
+            unsigned segment = _FICRecencyListSegmentOfSlot(list, (uint32_t)slot);
+            _FICRecencyListSetStateOfSlot(list, (uint32_t)slot, FICRecencyListSlotStateLinked, segment);
+            _FICRecencyListLinkAtHead(list, (uint32_t)slot, segment);
+            pinnedCount--;
+        }
+    }
+
+    if (list->capacity > 0) {
+        memset(list->pinCounts, 0, list->capacity * sizeof(uint32_t));
+    }
+}
+
+void FICRecencyListRemoveAll(FICRecencyList *list) {
+    if (list->capacity > 0) {
+        memset(list->pinCounts, 0, list->capacity * sizeof(uint32_t));
+        memset(list->states, FICRecencyListSlotStateUntracked, list->capacity * sizeof(uint8_t));
+    }
+
+    for (unsigned segment = 0; segment < FICRecencyListSegmentCount; segment++) {
+        list->segments[segment].head = FICRecencyListNone;
+        list->segments[segment].tail = FICRecencyListNone;
+        list->segments[segment].linkedCount = 0;
+        list->segments[segment].trackedCount = 0;
+    }
+}
@@ -0,0 +1,170 @@
+//
+//  FICRecencyList.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICRecencyList_h
+#define FICRecencyList_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FICRecencyListNone UINT32_MAX
+#define FICRecencyListSegmentCount 3
+
+/**
+ One of the separately ordered parts of a `<FICRecencyList>`.
+ */
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    size_t linkedCount;
+    size_t trackedCount;
+} FICRecencyListSegment;
+
+/**
+ `FICRecencyList` orders the occupied slots of an image table from most to least recently accessed.
+
+ @discussion The list is intrusive and indexed by slot: each slot has a previous and next link stored in flat arrays, so moving an entry to the front, removing it and finding the
+ least recently used entry are all constant-time operations.
+
+ Slots can also be pinned while images backed by their data are alive. A pinned slot is taken off the list entirely, so the tail of the list is always the least recently used slot that
+ can actually be evicted. When the last pin is released, the slot is put back at the front of the list.
+
+ Every tracked slot belongs to one of `FICRecencyListSegmentCount` segments, each ordered on its own, so eviction policies can keep recently added and frequently used slots apart
+ without a list for each. Slots are tracked in the first segment unless they're moved to another one, so a list whose other segments are never used is a plain LRU list. See
+ `<FICEvictionPolicy>`.
+
+ Like `<FICEntryIndex>`, a list can work in place on borrowed storage, which it copies into memory of its own the first time it has to grow.
+
+ The list is not thread-safe; image tables guard it with a lock of its own so that recording cache hits doesn't hold up the rest of the table.
+ */
+typedef struct {
+    uint32_t *previous;
+    uint32_t *next;
+    uint32_t *pinCounts;
+    uint8_t *states;
+    size_t capacity;
+    FICRecencyListSegment segments[FICRecencyListSegmentCount];
+    bool borrowsStorage;
+} FICRecencyList;
+
+/**
+ Initializes an empty list.
+ */
+void FICRecencyListInit(FICRecencyList *list);
+
+/**
+ Frees the memory owned by the list.
+ */
+void FICRecencyListDestroy(FICRecencyList *list);
+
+/**
+ Marks a slot as the most recently accessed one in its segment, adding it to the first segment if it is not already tracked.
+
+ @discussion Pinned slots become tracked but stay off the list until they are unpinned.
+
+ @return `false` if memory for the list could not be allocated.
+ */
+bool FICRecencyListTouch(FICRecencyList *list, uint32_t slot);
+
+/**
+ Marks a slot as the most recently accessed one in a segment, moving it there from the segment it was in, or adding it if it is not already tracked.
+
+ @return `false` if memory for the list could not be allocated.
+ */
+bool FICRecencyListTouchInSegment(FICRecencyList *list, uint32_t slot, unsigned segment);
+
+/**
+ Stops tracking a slot. Pins on the slot are kept, since they belong to images that are still alive.
+ */
+void FICRecencyListRemove(FICRecencyList *list, uint32_t slot);
+
+/**
+ Adds a pin to a slot, taking it off the list if it was evictable.
+
+ @return `false` if memory for the list could not be allocated.
+ */
+bool FICRecencyListPin(FICRecencyList *list, uint32_t slot);
+
+/**
+ Removes a pin from a slot. When the last pin is removed from a tracked slot, it is put back at the front of its segment.
+ */
+void FICRecencyListUnpin(FICRecencyList *list, uint32_t slot);
+
+/**
+ Returns whether or not a slot is tracked, whether it is pinned or not.
+ */
+bool FICRecencyListContains(const FICRecencyList *list, uint32_t slot);
+
+/**
+ Returns the segment a tracked slot belongs to.
+ */
+unsigned FICRecencyListSegmentOfSlot(const FICRecencyList *list, uint32_t slot);
+
+/**
+ Returns whether or not images backed by a slot's data are still alive, whether the slot is tracked or not.
+ */
+bool FICRecencyListIsPinned(const FICRecencyList *list, uint32_t slot);
+
+/**
+ Moves a tracked slot's place in the list to another slot, which must be neither tracked nor pinned. Does nothing if the slot being moved isn't tracked.
+
+ @discussion Slots are moved when the image data they hold is moved elsewhere in the image table file, which doesn't count as an access.
+
+ @return `false` if the slot being moved is pinned, or if memory for the list could not be allocated.
+ */
+bool FICRecencyListMoveSlot(FICRecencyList *list, uint32_t slot, uint32_t newSlot);
+
+/**
+ Returns the least recently accessed slot of the first segment that is not pinned, or `FICRecencyListNone` if there is none.
+ */
+uint32_t FICRecencyListLeastRecentSlot(const FICRecencyList *list);
+
+/**
+ Returns the least recently accessed slot of a segment that is not pinned, or `FICRecencyListNone` if there is none.
+ */
+uint32_t FICRecencyListLeastRecentSlotInSegment(const FICRecencyList *list, unsigned segment);
+
+/**
+ Returns the number of slots tracked in all segments, whether they're pinned or not.
+ */
+size_t FICRecencyListTrackedCount(const FICRecencyList *list);
+
+/**
+ Copies every tracked slot into `slots`, pinned slots first, followed by the evictable slots of each segment in turn from most to least recently accessed.
+
+ @return The number of slots copied, which is at most `maximumCount`.
+ */
+size_t FICRecencyListGetSlots(const FICRecencyList *list, uint32_t *slots, size_t maximumCount);
+
+/**
+ Moves every slot into the first segment. The slots of later segments end up in front of those already in the first segment, in their own order.
+ */
+void FICRecencyListMergeSegments(FICRecencyList *list);
+
+/**
+ Drops every pin, putting the slots that were pinned at the front of their segments.
+
+ @discussion Pins belong to images that are alive in memory, so they're dropped from copies of the list that are saved to disk.
+ */
+void FICRecencyListRemoveAllPins(FICRecencyList *list);
+
+/**
+ Stops tracking every slot and drops all pins.
+ */
+void FICRecencyListRemoveAll(FICRecencyList *list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
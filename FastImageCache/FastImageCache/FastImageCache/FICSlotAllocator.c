@@ -0,0 +1,255 @@
+//
+//  FICSlotAllocator.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICSlotAllocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark Internal Definitions
+
+#define FICSlotAllocatorBitsPerWord 64
+
+// The bitmap always grows in multiples of 64 words so that each summary word describes exactly 64 bitmap words.
+#define FICSlotAllocatorWordGranularity 64
+
+static inline size_t _FICSlotAllocatorSummaryWordCount(size_t wordCapacity) {
+    return wordCapacity / FICSlotAllocatorBitsPerWord;
+}
+
+static inline void _FICSlotAllocatorWordBecameFree(FICSlotAllocator *allocator, size_t wordIndex) {
+    allocator->summary[wordIndex / FICSlotAllocatorBitsPerWord] |= (uint64_t)1 << (wordIndex % FICSlotAllocatorBitsPerWord);
+}
+
+static inline void _FICSlotAllocatorWordBecameFull(FICSlotAllocator *allocator, size_t wordIndex) {
+    allocator->summary[wordIndex / FICSlotAllocatorBitsPerWord] &= ~((uint64_t)1 << (wordIndex % FICSlotAllocatorBitsPerWord));
+}
+
+// Growing borrowed storage can't reallocate it, so it's copied into memory the allocator owns first
+static bool _FICSlotAllocatorOwnStorage(FICSlotAllocator *allocator) {
+    if (allocator->borrowsStorage == false) {
+        return true;
+    }
+
+    size_t summaryWordCount = _FICSlotAllocatorSummaryWordCount(allocator->wordCapacity);
+    uint64_t *words = malloc(allocator->wordCapacity * sizeof(uint64_t));
+    uint64_t *summary = malloc(summaryWordCount * sizeof(uint64_t));
+    if (words == NULL || summary == NULL) {
+        free(words);
+        free(summary);
+        return false;
+    }
+
+    memcpy(words, allocator->words, allocator->wordCapacity * sizeof(uint64_t));
+    memcpy(summary, allocator->summary, summaryWordCount * sizeof(uint64_t));
+    allocator->words = words;
+    allocator->summary = summary;
+    allocator->borrowsStorage = false;
+
+    return true;
+}
+
+static bool _FICSlotAllocatorEnsureCapacity(FICSlotAllocator *allocator, size_t slotCount) {
+    size_t requiredWords = (slotCount + FICSlotAllocatorBitsPerWord - 1) / FICSlotAllocatorBitsPerWord;
+    if (requiredWords <= allocator->wordCapacity) {
+        return true;
+    }
+
+    size_t newWordCapacity = allocator->wordCapacity > 0 ? allocator->wordCapacity : FICSlotAllocatorWordGranularity;
+    while (newWordCapacity < requiredWords) {
+        newWordCapacity *= 2;
+    }
+
+    if (_FICSlotAllocatorOwnStorage(allocator) == false) {
+        return false;
+    }
+
+    uint64_t *words = realloc(allocator->words, newWordCapacity * sizeof(uint64_t));
+    if (words == NULL) {
+        return false;
+    }
+    allocator->words = words;
+
+    size_t oldSummaryWordCount = _FICSlotAllocatorSummaryWordCount(allocator->wordCapacity);
+    size_t newSummaryWordCount = _FICSlotAllocatorSummaryWordCount(newWordCapacity);
+    uint64_t *summary = realloc(allocator->summary, newSummaryWordCount * sizeof(uint64_t));
+    if (summary == NULL) {
+        return false;
+    }
+    allocator->summary = summary;
+
+    // New words start out entirely free, so every new summary bit is set.
+    memset(allocator->words + allocator->wordCapacity, 0, (newWordCapacity - allocator->wordCapacity) * sizeof(uint64_t));
+    memset(allocator->summary + oldSummaryWordCount, 0xFF, (newSummaryWordCount - oldSummaryWordCount) * sizeof(uint64_t));
+
+    if (allocator->searchHint > oldSummaryWordCount) {
+        allocator->searchHint = oldSummaryWordCount;
+    }
+    allocator->wordCapacity = newWordCapacity;
+
+    return true;
+}
+
+#pragma mark - Allocator Lifecycle
+
+void FICSlotAllocatorInit(FICSlotAllocator *allocator) {
+    memset(allocator, 0, sizeof(FICSlotAllocator));
+}
+
+void FICSlotAllocatorDestroy(FICSlotAllocator *allocator) {
+    if (allocator->borrowsStorage == false) {
+        free(allocator->words);
+        free(allocator->summary);
+    }
+    memset(allocator, 0, sizeof(FICSlotAllocator));
+}
+
+bool FICSlotAllocatorSetSlotCount(FICSlotAllocator *allocator, size_t slotCount) {
+    bool success = _FICSlotAllocatorEnsureCapacity(allocator, slotCount);
+    if (success) {
+        allocator->slotCount = slotCount;
+    }
+
+    return success;
+}
+
+#pragma mark - Marking Slots
+
+bool FICSlotAllocatorMarkOccupied(FICSlotAllocator *allocator, size_t slot) {
+    if (_FICSlotAllocatorEnsureCapacity(allocator, slot + 1) == false) {
+        return false;
+    }
+
+    size_t wordIndex = slot / FICSlotAllocatorBitsPerWord;
+    uint64_t mask = (uint64_t)1 << (slot % FICSlotAllocatorBitsPerWord);
+    uint64_t word = allocator->words[wordIndex];
+    if ((word & mask) == 0) {
+        word |= mask;
+        allocator->words[wordIndex] = word;
+        allocator->occupiedCount++;
+
+        if (word == UINT64_MAX) {
+            _FICSlotAllocatorWordBecameFull(allocator, wordIndex);
+        }
+    }
+
+    return true;
+}
+
+void FICSlotAllocatorMarkFree(FICSlotAllocator *allocator, size_t slot) {
+    size_t wordIndex = slot / FICSlotAllocatorBitsPerWord;
+    if (wordIndex < allocator->wordCapacity) {
+        uint64_t mask = (uint64_t)1 << (slot % FICSlotAllocatorBitsPerWord);
+        uint64_t word = allocator->words[wordIndex];
+        if (word & mask) {
+            if (word == UINT64_MAX) {
+                _FICSlotAllocatorWordBecameFree(allocator, wordIndex);
+            }
+
+            allocator->words[wordIndex] = word & ~mask;
+            allocator->occupiedCount--;
+
+            size_t summaryIndex = wordIndex / FICSlotAllocatorBitsPerWord;
+            if (summaryIndex < allocator->searchHint) {
+                allocator->searchHint = summaryIndex;
+            }
+        }
+    }
+}
+
+bool FICSlotAllocatorIsOccupied(const FICSlotAllocator *allocator, size_t slot) {
+    size_t wordIndex = slot / FICSlotAllocatorBitsPerWord;
+    if (wordIndex >= allocator->wordCapacity) {
+        return false;
+    }
+
+    return (allocator->words[wordIndex] >> (slot % FICSlotAllocatorBitsPerWord)) & 1;
+}
+
+bool FICSlotAllocatorHasOccupiedSlotsFromSlot(const FICSlotAllocator *allocator, size_t slot) {
+    size_t wordIndex = slot / FICSlotAllocatorBitsPerWord;
+    if (wordIndex >= allocator->wordCapacity) {
+        return false;
+    }
+
+    if (allocator->words[wordIndex] >> (slot % FICSlotAllocatorBitsPerWord)) {
+        return true;
+    }
+
+    for (wordIndex++; wordIndex < allocator->wordCapacity; wordIndex++) {
+        if (allocator->words[wordIndex] != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t FICSlotAllocatorNextOccupiedSlot(const FICSlotAllocator *allocator, size_t slot) {
+    size_t wordIndex = slot / FICSlotAllocatorBitsPerWord;
+    if (wordIndex >= allocator->wordCapacity) {
+        return SIZE_MAX;
+    }
+
+    uint64_t word = allocator->words[wordIndex] >> (slot % FICSlotAllocatorBitsPerWord);
+    if (word != 0) {
+        return slot + (size_t)__builtin_ctzll(word);
+    }
+
+    for (wordIndex++; wordIndex < allocator->wordCapacity; wordIndex++) {
+        if (allocator->words[wordIndex] != 0) {
+            return wordIndex * FICSlotAllocatorBitsPerWord + (size_t)__builtin_ctzll(allocator->words[wordIndex]);
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+size_t FICSlotAllocatorOccupiedSlotLimit(const FICSlotAllocator *allocator) {
+    for (size_t wordIndex = allocator->wordCapacity; wordIndex > 0; wordIndex--) {
+        uint64_t word = allocator->words[wordIndex - 1];
+        if (word != 0) {
+            return (wordIndex - 1) * FICSlotAllocatorBitsPerWord + (FICSlotAllocatorBitsPerWord - (size_t)__builtin_clzll(word));
+        }
+    }
+
+    return 0;
+}
+
+void FICSlotAllocatorRemoveAll(FICSlotAllocator *allocator) {
+    if (allocator->wordCapacity > 0) {
+        memset(allocator->words, 0, allocator->wordCapacity * sizeof(uint64_t));
+        memset(allocator->summary, 0xFF, _FICSlotAllocatorSummaryWordCount(allocator->wordCapacity) * sizeof(uint64_t));
+    }
+
+    allocator->occupiedCount = 0;
+    allocator->searchHint = 0;
+}
+
+#pragma mark - Finding Free Slots
+
+size_t FICSlotAllocatorFirstFreeSlot(FICSlotAllocator *allocator) {
+    size_t summaryWordCount = _FICSlotAllocatorSummaryWordCount(allocator->wordCapacity);
+
+    for (size_t summaryIndex = allocator->searchHint; summaryIndex < summaryWordCount; summaryIndex++) {
+        uint64_t summaryWord = allocator->summary[summaryIndex];
+        if (summaryWord != 0) {
+            // Every summary word below this one describes only full bitmap words, so later searches can start here.
+            allocator->searchHint = summaryIndex;
+
+            size_t wordIndex = summaryIndex * FICSlotAllocatorBitsPerWord + (size_t)__builtin_ctzll(summaryWord);
+            size_t slot = wordIndex * FICSlotAllocatorBitsPerWord + (size_t)__builtin_ctzll(~allocator->words[wordIndex]);
+
+            return slot < allocator->slotCount ? slot : allocator->slotCount;
+        }
+    }
+
+    allocator->searchHint = summaryWordCount;
+
+    return allocator->slotCount;
+}
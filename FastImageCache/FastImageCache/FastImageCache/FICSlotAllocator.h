@@ -0,0 +1,106 @@
+//
+//  FICSlotAllocator.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICSlotAllocator_h
+#define FICSlotAllocator_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ `FICSlotAllocator` tracks which entry slots of an image table are occupied and hands out the lowest free slot.
+
+ @discussion Occupancy is kept in a word-packed bitmap where a set bit marks an occupied slot. A second, summary bitmap has one bit per bitmap word that is set while that word still
+ has at least one free slot. Finding the lowest free slot is a find-first-set on the summary followed by a find-first-set on a single bitmap word, so it touches at most one summary
+ word per 4,096 slots rather than building an index set covering the whole table.
+
+ Like `<FICEntryIndex>`, an allocator can work in place on borrowed storage, which it copies into memory of its own the first time the bitmap has to grow.
+
+ The allocator is not thread-safe; callers are expected to hold the image table lock.
+ */
+typedef struct {
+    uint64_t *words;
+    uint64_t *summary;
+    size_t wordCapacity;
+    size_t slotCount;
+    size_t occupiedCount;
+    size_t searchHint;
+    bool borrowsStorage;
+} FICSlotAllocator;
+
+/**
+ Initializes an empty allocator with no slots.
+ */
+void FICSlotAllocatorInit(FICSlotAllocator *allocator);
+
+/**
+ Frees the memory owned by the allocator.
+ */
+void FICSlotAllocatorDestroy(FICSlotAllocator *allocator);
+
+/**
+ Sets the number of slots that can be handed out by `<FICSlotAllocatorFirstFreeSlot>`.
+
+ @discussion Occupancy of slots at or beyond the new slot count is preserved, so that metadata loaded before the image table file is sized is not lost.
+
+ @return `false` if memory for the bitmap could not be allocated.
+ */
+bool FICSlotAllocatorSetSlotCount(FICSlotAllocator *allocator, size_t slotCount);
+
+/**
+ Marks a slot as occupied, growing the bitmap if needed.
+
+ @return `false` if memory for the bitmap could not be allocated.
+ */
+bool FICSlotAllocatorMarkOccupied(FICSlotAllocator *allocator, size_t slot);
+
+/**
+ Marks a slot as free. Does nothing if the slot is not occupied.
+ */
+void FICSlotAllocatorMarkFree(FICSlotAllocator *allocator, size_t slot);
+
+/**
+ Returns whether or not a slot is occupied.
+ */
+bool FICSlotAllocatorIsOccupied(const FICSlotAllocator *allocator, size_t slot);
+
+/**
+ Returns whether or not any slot at or after `slot` is occupied, including slots beyond the slot count.
+ */
+bool FICSlotAllocatorHasOccupiedSlotsFromSlot(const FICSlotAllocator *allocator, size_t slot);
+
+/**
+ Returns the lowest occupied slot at or after `slot`, including slots beyond the slot count, or `SIZE_MAX` if there is none.
+ */
+size_t FICSlotAllocatorNextOccupiedSlot(const FICSlotAllocator *allocator, size_t slot);
+
+/**
+ Returns one past the highest occupied slot, including slots beyond the slot count, or 0 if no slot is occupied.
+ */
+size_t FICSlotAllocatorOccupiedSlotLimit(const FICSlotAllocator *allocator);
+
+/**
+ Returns the lowest free slot below the slot count, or the slot count itself if every slot is occupied.
+ */
+size_t FICSlotAllocatorFirstFreeSlot(FICSlotAllocator *allocator);
+
+/**
+ Marks every slot as free without changing the slot count.
+ */
+void FICSlotAllocatorRemoveAll(FICSlotAllocator *allocator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+//
+//  FICStatistics.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICStatistics.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#pragma mark Internal Definitions
+
+// A power of two, so a thread's shard is the top bits of its hashed thread ID
+#define FICStatisticsShardCountLog2 4
+#define FICStatisticsShardCount (1 << FICStatisticsShardCountLog2)
+
+#define FICStatisticsWordsPerCacheLine 8
+
+// Each histogram is its count, its total, its maximum, and its buckets
+#define FICStatisticsWordsPerHistogram (3 + FICStatisticsHistogramBucketCount)
+
+static inline _Atomic uint64_t * _FICStatisticsShard(const FICStatistics *statistics, size_t shardIndex) {
+    return (_Atomic uint64_t *)statistics->shards + shardIndex * statistics->shardLength;
+}
+
+// Thread IDs are addresses on every platform we run on, so the multiplication mixes their high bits into the top bits that pick the shard
+static inline _Atomic uint64_t * _FICStatisticsCurrentShard(const FICStatistics *statistics) {
+    uint64_t thread = (uint64_t)(uintptr_t)pthread_self();
+    size_t shardIndex = (size_t)((thread * 0x9E3779B97F4A7C15ull) >> (64 - FICStatisticsShardCountLog2));
+    return _FICStatisticsShard(statistics, shardIndex);
+}
+
+static inline size_t _FICStatisticsHistogramOffset(const FICStatistics *statistics, size_t histogram) {
+    return statistics->counterCount + histogram * FICStatisticsWordsPerHistogram;
+}
+
+static inline unsigned _FICStatisticsBucketIndex(uint64_t nanoseconds) {
+    unsigned bucketIndex = nanoseconds > 0 ? 64 - (unsigned)__builtin_clzll(nanoseconds) : 0;
+    return bucketIndex < FICStatisticsHistogramBucketCount ? bucketIndex : FICStatisticsHistogramBucketCount - 1;
+}
+
+#pragma mark - Statistics Lifecycle
+
+bool FICStatisticsInit(FICStatistics *statistics, size_t counterCount, size_t histogramCount) {
+    memset(statistics, 0, sizeof(FICStatistics));
+
+    size_t wordCount = counterCount + histogramCount * FICStatisticsWordsPerHistogram;
+    size_t shardLength = (wordCount + FICStatisticsWordsPerCacheLine - 1) / FICStatisticsWordsPerCacheLine * FICStatisticsWordsPerCacheLine;
+    if (shardLength == 0) {
+        return true;
+    }
+
+    void *shards = NULL;
+    if (posix_memalign(&shards, FICStatisticsWordsPerCacheLine * sizeof(uint64_t), FICStatisticsShardCount * shardLength * sizeof(uint64_t)) != 0) {
+        return false;
+    }
+
+    statistics->counterCount = counterCount;
+    statistics->histogramCount = histogramCount;
+    statistics->shardLength = shardLength;
+    statistics->shards = shards;
+
+    for (size_t i = 0; i < FICStatisticsShardCount * shardLength; i++) {
+        atomic_init((_Atomic uint64_t *)shards + i, 0);
+    }
+
+    return true;
+}
+
+void FICStatisticsDestroy(FICStatistics *statistics) {
+    free(statistics->shards);
+    memset(statistics, 0, sizeof(FICStatistics));
+}
+
+#pragma mark - Updating Statistics
+
+void FICStatisticsAdd(FICStatistics *statistics, size_t counter, uint64_t amount) {
+    if (counter < statistics->counterCount) {
+        atomic_fetch_add_explicit(_FICStatisticsCurrentShard(statistics) + counter, amount, memory_order_relaxed);
+    }
+}
+
+void FICStatisticsRecordDuration(FICStatistics *statistics, size_t histogram, uint64_t nanoseconds) {
+    if (histogram >= statistics->histogramCount) {
+        return;
+    }
+
+    _Atomic uint64_t *words = _FICStatisticsCurrentShard(statistics) + _FICStatisticsHistogramOffset(statistics, histogram);
+    atomic_fetch_add_explicit(&words[0], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&words[1], nanoseconds, memory_order_relaxed);
+    atomic_fetch_add_explicit(&words[3 + _FICStatisticsBucketIndex(nanoseconds)], 1, memory_order_relaxed);
+
+    // Threads only race for the maximum when they share a shard, so this almost never loops
+    uint64_t maximumNanoseconds = atomic_load_explicit(&words[2], memory_order_relaxed);
+    while (nanoseconds > maximumNanoseconds && atomic_compare_exchange_weak_explicit(&words[2], &maximumNanoseconds, nanoseconds, memory_order_relaxed, memory_order_relaxed) == false) {
+    }
+}
+
+#pragma mark - Reading Statistics
+
+uint64_t FICStatisticsCounterValue(const FICStatistics *statistics, size_t counter) {
+    uint64_t value = 0;
+    if (counter < statistics->counterCount) {
+        for (size_t i = 0; i < FICStatisticsShardCount; i++) {
+            value += atomic_load_explicit(_FICStatisticsShard(statistics, i) + counter, memory_order_relaxed);
+        }
+    }
+
+    return value;
+}
+
+void FICStatisticsGetHistogram(const FICStatistics *statistics, size_t histogram, FICStatisticsHistogram *histogramOut) {
+    memset(histogramOut, 0, sizeof(FICStatisticsHistogram));
+    if (histogram >= statistics->histogramCount) {
+        return;
+    }
+
+    for (size_t i = 0; i < FICStatisticsShardCount; i++) {
+        _Atomic uint64_t *words = _FICStatisticsShard(statistics, i) + _FICStatisticsHistogramOffset(statistics, histogram);
+        histogramOut->count += atomic_load_explicit(&words[0], memory_order_relaxed);
+        histogramOut->totalNanoseconds += atomic_load_explicit(&words[1], memory_order_relaxed);
+
+        uint64_t maximumNanoseconds = atomic_load_explicit(&words[2], memory_order_relaxed);
+        if (maximumNanoseconds > histogramOut->maximumNanoseconds) {
+            histogramOut->maximumNanoseconds = maximumNanoseconds;
+        }
+
+        for (size_t j = 0; j < FICStatisticsHistogramBucketCount; j++) {
+            histogramOut->bucketCounts[j] += atomic_load_explicit(&words[3 + j], memory_order_relaxed);
+        }
+    }
+}
+
+void FICStatisticsHistogramMerge(FICStatisticsHistogram *combinedHistogram, const FICStatisticsHistogram *histogram) {
+    combinedHistogram->count += histogram->count;
+    combinedHistogram->totalNanoseconds += histogram->totalNanoseconds;
+    if (histogram->maximumNanoseconds > combinedHistogram->maximumNanoseconds) {
+        combinedHistogram->maximumNanoseconds = histogram->maximumNanoseconds;
+    }
+
+    for (size_t i = 0; i < FICStatisticsHistogramBucketCount; i++) {
+        combinedHistogram->bucketCounts[i] += histogram->bucketCounts[i];
+    }
+}
+
+uint64_t FICStatisticsHistogramPercentile(const FICStatisticsHistogram *histogram, double fraction) {
+    // The buckets are read separately from the count, so they're what the rank is taken from
+    uint64_t count = 0;
+    for (size_t i = 0; i < FICStatisticsHistogramBucketCount; i++) {
+        count += histogram->bucketCounts[i];
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    fraction = fraction < 0 ? 0 : (fraction > 1 ? 1 : fraction);
+    double exactRank = fraction * (double)count;
+    uint64_t rank = (uint64_t)exactRank;
+    rank += (double)rank < exactRank || rank == 0 ? 1 : 0;
+
+    uint64_t seenCount = 0;
+    for (size_t i = 0; i < FICStatisticsHistogramBucketCount; i++) {
+        seenCount += histogram->bucketCounts[i];
+        if (seenCount >= rank) {
+            uint64_t upperBound = i > 0 ? (1ull << i) - 1 : 0;
+            if (i == FICStatisticsHistogramBucketCount - 1 || upperBound > histogram->maximumNanoseconds) {
+                upperBound = histogram->maximumNanoseconds;
+            }
+            return upperBound;
+        }
+    }
+
+    return histogram->maximumNanoseconds;
+}
+
+#pragma mark - Measuring Time
+
+#ifdef __APPLE__
+
+static mach_timebase_info_data_t FICStatisticsTimebase;
+static pthread_once_t FICStatisticsTimebaseOnce = PTHREAD_ONCE_INIT;
+
+static void _FICStatisticsInitTimebase(void) {
+    mach_timebase_info(&FICStatisticsTimebase);
+}
+
+uint64_t FICStatisticsNanoseconds(void) {
+    pthread_once(&FICStatisticsTimebaseOnce, _FICStatisticsInitTimebase);
+    return mach_absolute_time() * FICStatisticsTimebase.numer / FICStatisticsTimebase.denom;
+}
+
+#else
+
+uint64_t FICStatisticsNanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,107 @@
+//
+//  FICStatistics.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICStatistics_h
+#define FICStatistics_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Durations are counted in buckets whose bounds are powers of two nanoseconds. The last bucket holds everything from about a second up.
+#define FICStatisticsHistogramBucketCount 32
+
+/**
+ A histogram of durations.
+
+ - `count`: The number of durations recorded.
+ - `totalNanoseconds`: The sum of the durations, so `totalNanoseconds / count` is their mean.
+ - `maximumNanoseconds`: The longest duration.
+ - `bucketCounts`: How many durations fell in each bucket. Bucket 0 counts durations of 0, and bucket `i` counts durations from 2<sup>i - 1</sup> up to 2<sup>i</sup> nanoseconds.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t totalNanoseconds;
+    uint64_t maximumNanoseconds;
+    uint64_t bucketCounts[FICStatisticsHistogramBucketCount];
+} FICStatisticsHistogram;
+
+/**
+ `FICStatistics` keeps a fixed set of counters and duration histograms that any number of threads update at once.
+
+ @discussion Updates never take a lock. Every counter and histogram is kept in several shards, each padded to its own cache lines, and each thread updates the shard its thread ID
+ hashes to, so threads rarely touch the same cache line and most updates are a single uncontended atomic add. Reading a counter or histogram adds its shards up, which is cheap enough
+ to do from any thread at any time; since the shards are read one after another, a value read while other threads are updating it may be a moment out of date, but it never goes backwards.
+
+ Counters and histograms are identified by their indexes, which the owner of the statistics defines.
+ */
+typedef struct {
+    size_t counterCount;
+    size_t histogramCount;
+    size_t shardLength;                     // In 64-bit words, a multiple of a cache line
+    void *shards;
+} FICStatistics;
+
+/**
+ Initializes statistics with `counterCount` counters and `histogramCount` histograms, all starting at 0.
+
+ @return `false` if memory for the shards could not be allocated, in which case the statistics have no counters or histograms, and updating them does nothing.
+ */
+bool FICStatisticsInit(FICStatistics *statistics, size_t counterCount, size_t histogramCount);
+
+/**
+ Frees the memory owned by the statistics.
+ */
+void FICStatisticsDestroy(FICStatistics *statistics);
+
+/**
+ Adds `amount` to a counter. Counters past the end of the statistics are ignored.
+ */
+void FICStatisticsAdd(FICStatistics *statistics, size_t counter, uint64_t amount);
+
+/**
+ Records a duration in a histogram. Histograms past the end of the statistics are ignored.
+ */
+void FICStatisticsRecordDuration(FICStatistics *statistics, size_t histogram, uint64_t nanoseconds);
+
+/**
+ Returns the value of a counter.
+ */
+uint64_t FICStatisticsCounterValue(const FICStatistics *statistics, size_t counter);
+
+/**
+ Copies a histogram into `histogram`.
+ */
+void FICStatisticsGetHistogram(const FICStatistics *statistics, size_t histogram, FICStatisticsHistogram *histogramOut);
+
+/**
+ Adds the durations of `histogram` to `combinedHistogram`, as if they had been recorded in both.
+ */
+void FICStatisticsHistogramMerge(FICStatisticsHistogram *combinedHistogram, const FICStatisticsHistogram *histogram);
+
+/**
+ Returns an upper bound on the duration that `fraction` of the durations in the histogram are no longer than, such as 0.99 for the 99th percentile.
+
+ @discussion The bound is the upper bound of the bucket the percentile falls in, but never more than the histogram's `maximumNanoseconds`. It's 0 if the histogram is empty.
+ */
+uint64_t FICStatisticsHistogramPercentile(const FICStatisticsHistogram *histogram, double fraction);
+
+/**
+ Returns the current time of a monotonic clock, in nanoseconds, for measuring durations.
+ */
+uint64_t FICStatisticsNanoseconds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1281 @@
+//
+//  FICTableEngine.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICTableEngine.h"
+#include "FICChecksum.h"
+#include "FICMetadataSnapshot.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#pragma mark Internal Definitions
+
+// The journal gets a new checkpoint once this many records have been appended since the last one. Opening a table only replays the records after the checkpoint, so this bounds
+// the work done at open no matter how many entries the table has.
+static const size_t FICTableEngineCheckpointRecordCount = 4096;
+
+// Entries stored with deferred durability are written to disk once this much image data has built up
+static const size_t FICTableEngineMaximumDirtyLength = 4 * 1024 * 1024;
+
+// Stands in for the source image UUID in journal records that don't carry one
+static const uint8_t FICTableEngineEmptyUUIDBytes[16] = { 0 };
+
+static inline size_t _FICTableEngineMin(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static inline size_t _FICTableEngineMax(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+static void _FICTableEngineOperationDidFail(FICTableEngine *engine, FICTableEngineOperation operation, size_t detail, int error) {
+    if (engine->delegate.operationDidFail != NULL) {
+        engine->delegate.operationDidFail(engine->context, operation, detail, error);
+    }
+}
+
+// Counts bytes that were written to disk, and how long writing them took
+static void _FICTableEngineRecordWrite(FICTableEngine *engine, size_t length, FICTableEngineHistogram histogram, uint64_t startTime) {
+    FICStatisticsRecordDuration(&engine->statistics, histogram, FICStatisticsNanoseconds() - startTime);
+    FICStatisticsAdd(&engine->statistics, FICTableEngineCounterWrittenLength, length);
+}
+
+#pragma mark - Engine Lifecycle
+
+void FICTableEngineInit(FICTableEngine *engine, const FICTableEngineConfiguration *configuration) {
+    memset(engine, 0, sizeof(FICTableEngine));
+
+    FICTableFileInit(&engine->file, configuration->imageLength);
+    engine->maximumCount = _FICTableEngineMax(configuration->maximumCount, engine->file.entriesPerChunk);
+    engine->evictionPolicyKind = configuration->evictionPolicyKind;
+    engine->evictionPolicyMaximumCount = configuration->maximumCount;
+    engine->keepsEvictedEntries = configuration->keepsEvictedEntries;
+    engine->delegate = configuration->delegate;
+    engine->context = configuration->context;
+
+    pthread_rwlock_init(&engine->lock, NULL);
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        pthread_rwlock_init(&engine->entryLocks[i], NULL);
+    }
+    pthread_mutex_init(&engine->recencyLock, NULL);
+    pthread_mutex_init(&engine->journalLock, NULL);
+    pthread_mutex_init(&engine->journalWriteLock, NULL);
+    pthread_mutex_init(&engine->dirtyLock, NULL);
+    pthread_mutex_init(&engine->verificationLock, NULL);
+
+    FICEntryIndexInit(&engine->index);
+    FICSlotAllocatorInit(&engine->allocator);
+    FICSlotAllocatorInit(&engine->evictedSlots);
+    FICSlotAllocatorInit(&engine->idleSlots);
+    FICSlotAllocatorInit(&engine->punchedSlots);
+    FICEvictionPolicyInit(&engine->policy);
+    FICMetadataJournalInit(&engine->journal, configuration->metadataPath != NULL ? configuration->metadataPath : "");
+    FICSlotAllocatorInit(&engine->uncommittedSlots);
+    FICSlotAllocatorInit(&engine->dirtySlots);
+    FICSlotAllocatorInit(&engine->verifiedSlots);
+
+    FICStatisticsInit(&engine->statistics, FICTableEngineCounterCount, FICTableEngineHistogramCount);
+}
+
+void FICTableEngineDestroy(FICTableEngine *engine) {
+    FICTableFileClose(&engine->file);
+
+    FICEntryIndexDestroy(&engine->index);
+    FICSlotAllocatorDestroy(&engine->allocator);
+    FICSlotAllocatorDestroy(&engine->evictedSlots);
+    FICSlotAllocatorDestroy(&engine->idleSlots);
+    FICSlotAllocatorDestroy(&engine->punchedSlots);
+    FICEvictionPolicyDestroy(&engine->policy);
+    FICMetadataJournalDestroy(&engine->journal);
+    free(engine->pendingRecords);
+    free(engine->flushingRecords);
+    FICSlotAllocatorDestroy(&engine->uncommittedSlots);
+    FICSlotAllocatorDestroy(&engine->dirtySlots);
+    FICSlotAllocatorDestroy(&engine->verifiedSlots);
+
+    pthread_rwlock_destroy(&engine->lock);
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        pthread_rwlock_destroy(&engine->entryLocks[i]);
+    }
+    pthread_mutex_destroy(&engine->recencyLock);
+    pthread_mutex_destroy(&engine->journalLock);
+    pthread_mutex_destroy(&engine->journalWriteLock);
+    pthread_mutex_destroy(&engine->dirtyLock);
+    pthread_mutex_destroy(&engine->verificationLock);
+
+    FICStatisticsDestroy(&engine->statistics);
+}
+
+bool FICTableEngineOpenFile(FICTableEngine *engine, const char *path) {
+    if (FICTableFileOpen(&engine->file, path) == false) {
+        return false;
+    }
+
+    FICSlotAllocatorSetSlotCount(&engine->allocator, engine->file.entryCount);
+    engine->holeStartIndex = engine->file.entryCount;
+    engine->holePunchingEnabled = true;
+
+    return true;
+}
+
+#pragma mark - Bookkeeping
+
+// The caller must hold the recency lock
+static void _FICTableEngineEntryWasAccessed(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16]) {
+    FICEvictionPolicyTouch(&engine->policy, slot, entityUUIDBytes);
+
+    if (engine->delegate.entryWasAccessed != NULL) {
+        engine->delegate.entryWasAccessed(engine->context, slot);
+    }
+}
+
+// The caller must hold the table lock for writing. The slot is about to hold image data again, so it's neither idle nor a hole anymore.
+static void _FICTableEngineSlotWasFilled(FICTableEngine *engine, size_t slot) {
+    FICSlotAllocatorMarkFree(&engine->idleSlots, slot);
+    FICSlotAllocatorMarkFree(&engine->punchedSlots, slot);
+}
+
+// The caller must hold the table lock for writing
+static void _FICTableEngineAddBookkeeping(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    FICEntryIndexSet(&engine->index, entityUUIDBytes, sourceImageUUIDBytes, slot);
+    FICSlotAllocatorMarkOccupied(&engine->allocator, slot);
+    _FICTableEngineSlotWasFilled(engine, slot);
+
+    pthread_mutex_lock(&engine->recencyLock);
+    _FICTableEngineEntryWasAccessed(engine, slot, entityUUIDBytes);
+    pthread_mutex_unlock(&engine->recencyLock);
+}
+
+// The caller must hold the table lock for writing
+static void _FICTableEngineRemoveBookkeeping(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16]) {
+    FICEntryIndexRemove(&engine->index, entityUUIDBytes);
+    FICSlotAllocatorMarkFree(&engine->allocator, slot);
+
+    pthread_mutex_lock(&engine->recencyLock);
+    FICEvictionPolicyRemove(&engine->policy, slot);
+    pthread_mutex_unlock(&engine->recencyLock);
+}
+
+#pragma mark - Loading and Saving Metadata
+
+static void _FICTableEngineReplayJournalRecord(const FICMetadataJournalRecord *record, void *context) {
+    FICTableEngine *engine = context;
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&engine->index, record->entityUUIDBytes);
+    uint32_t existingSlot = entry != NULL ? entry->slot : FICEntryIndexNoSlot;
+
+    switch ((FICMetadataJournalRecordType)record->type) {
+        case FICMetadataJournalRecordTypeSet: {
+            if (existingSlot != FICEntryIndexNoSlot) {
+                _FICTableEngineRemoveBookkeeping(engine, existingSlot, record->entityUUIDBytes);
+                FICSlotAllocatorMarkFree(&engine->uncommittedSlots, existingSlot);
+            }
+
+            // An entry that was evicted to make room for this one is implicitly gone
+            const FICEntryIndexEntry *displacedEntry = FICEntryIndexFindSlot(&engine->index, record->index);
+            if (displacedEntry != NULL) {
+                uint8_t displacedEntityUUIDBytes[16];
+                memcpy(displacedEntityUUIDBytes, displacedEntry->entityUUIDBytes, sizeof(displacedEntityUUIDBytes));
+                _FICTableEngineRemoveBookkeeping(engine, record->index, displacedEntityUUIDBytes);
+            }
+
+            _FICTableEngineAddBookkeeping(engine, record->index, record->entityUUIDBytes, record->sourceImageUUIDBytes);
+
+            if (record->flags & FICMetadataJournalRecordFlagCommitted) {
+                FICSlotAllocatorMarkFree(&engine->uncommittedSlots, record->index);
+            } else {
+                FICSlotAllocatorMarkOccupied(&engine->uncommittedSlots, record->index);
+            }
+            break;
+        }
+        case FICMetadataJournalRecordTypeDelete:
+            if (existingSlot != FICEntryIndexNoSlot) {
+                _FICTableEngineRemoveBookkeeping(engine, existingSlot, record->entityUUIDBytes);
+                FICSlotAllocatorMarkFree(&engine->uncommittedSlots, existingSlot);
+            }
+            break;
+        case FICMetadataJournalRecordTypeTouch:
+            if (existingSlot != FICEntryIndexNoSlot) {
+                pthread_mutex_lock(&engine->recencyLock);
+                _FICTableEngineEntryWasAccessed(engine, existingSlot, record->entityUUIDBytes);
+                pthread_mutex_unlock(&engine->recencyLock);
+            }
+            break;
+        case FICMetadataJournalRecordTypeCommit:
+            if (existingSlot == record->index && memcmp(entry->sourceImageUUIDBytes, record->sourceImageUUIDBytes, sizeof(record->sourceImageUUIDBytes)) == 0) {
+                FICSlotAllocatorMarkFree(&engine->uncommittedSlots, existingSlot);
+            }
+            break;
+    }
+
+    engine->journalRecordCount++;
+}
+
+bool FICTableEngineLoadMetadata(FICTableEngine *engine, const void *bytes, size_t length, size_t *validLength) {
+    if (FICMetadataJournalIsJournalData(bytes, length) == false) {
+        return false;
+    }
+
+    const void *formatBytes = NULL;
+    size_t formatLength = 0;
+    const void *snapshotBytes = NULL;
+    size_t snapshotLength = 0;
+    size_t journalLength = FICMetadataJournalReplay(bytes, length, &formatBytes, &formatLength, &snapshotBytes, &snapshotLength, NULL, NULL);
+    if (journalLength == 0) {
+        return false;
+    }
+
+    if (engine->delegate.metadataFormatMatches != NULL && engine->delegate.metadataFormatMatches(engine->context, formatBytes, formatLength) == false) {
+        return false;
+    }
+
+    if (snapshotBytes != NULL) {
+        // The checkpoint is used in place instead of being rebuilt, so only the records appended after it take time to load
+        const uint32_t *uncommittedSlots = NULL;
+        size_t uncommittedSlotCount = 0;
+        if (FICMetadataSnapshotAdopt((void *)snapshotBytes, snapshotLength, &engine->index, &engine->allocator, &engine->policy, &uncommittedSlots, &uncommittedSlotCount) == false) {
+            // A checkpoint that doesn't hold together is treated like no metadata at all
+            FICEntryIndexRemoveAll(&engine->index);
+            FICSlotAllocatorRemoveAll(&engine->allocator);
+            FICEvictionPolicyRemoveAll(&engine->policy);
+            return false;
+        }
+
+        for (size_t i = 0; i < uncommittedSlotCount; i++) {
+            FICSlotAllocatorMarkOccupied(&engine->uncommittedSlots, uncommittedSlots[i]);
+        }
+    }
+
+    FICTableEngineConfigureEvictionPolicy(engine);
+
+    FICMetadataJournalReplay(bytes, length, &formatBytes, &formatLength, &snapshotBytes, &snapshotLength, _FICTableEngineReplayJournalRecord, engine);
+
+    // Anything past the last complete record was torn by a crash and is discarded before new records are appended
+    *validLength = journalLength;
+
+    return true;
+}
+
+void FICTableEngineConfigureEvictionPolicy(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->recencyLock);
+    bool configured = FICEvictionPolicyConfigure(&engine->policy, engine->evictionPolicyKind, engine->evictionPolicyMaximumCount);
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    if (configured == false) {
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationConfigureEvictionPolicy, 0, ENOMEM);
+    }
+}
+
+void FICTableEngineRemoveUncommittedEntries(FICTableEngine *engine) {
+    FICTableEngineLock(engine, true);
+
+    // The image data of these entries may have been torn by a crash, so they're dropped rather than shown. Removing an entry journals a record that takes it out of the set,
+    // which is why the set is only read a slot at a time.
+    size_t slot = 0;
+    while (true) {
+        pthread_mutex_lock(&engine->journalLock);
+        slot = FICSlotAllocatorNextOccupiedSlot(&engine->uncommittedSlots, slot);
+        pthread_mutex_unlock(&engine->journalLock);
+
+        if (slot == SIZE_MAX) {
+            break;
+        }
+
+        const FICEntryIndexEntry *entry = FICEntryIndexFindSlot(&engine->index, (uint32_t)slot);
+        if (entry != NULL) {
+            uint8_t entityUUIDBytes[16];
+            memcpy(entityUUIDBytes, entry->entityUUIDBytes, sizeof(entityUUIDBytes));
+            FICTableEngineRemoveEntry(engine, (uint32_t)slot, entityUUIDBytes);
+        }
+
+        slot++;
+    }
+
+    pthread_mutex_lock(&engine->journalLock);
+    FICSlotAllocatorRemoveAll(&engine->uncommittedSlots);
+    pthread_mutex_unlock(&engine->journalLock);
+
+    FICTableEngineUnlock(engine);
+}
+
+void FICTableEngineRemoveEntriesBeyondEntryCount(FICTableEngine *engine) {
+    FICEntryIndexEntry *staleEntries = NULL;
+    size_t staleEntryCount = 0;
+    size_t staleEntryCapacity = 0;
+
+    FICTableEngineLock(engine, true);
+
+    // The slot bitmap answers whether there's anything to remove without walking the whole index, which keeps opening the table fast
+    if (FICSlotAllocatorHasOccupiedSlotsFromSlot(&engine->allocator, engine->file.entryCount)) {
+        // Entries are collected first, since removing them while iterating over the index would skip some
+        size_t position = 0;
+        const FICEntryIndexEntry *entry;
+        while ((entry = FICEntryIndexNextEntry(&engine->index, &position)) != NULL) {
+            if (entry->slot < engine->file.entryCount) {
+                continue;
+            }
+
+            if (staleEntryCount == staleEntryCapacity) {
+                size_t capacity = staleEntryCapacity > 0 ? staleEntryCapacity * 2 : 64;
+                FICEntryIndexEntry *entries = realloc(staleEntries, capacity * sizeof(FICEntryIndexEntry));
+                if (entries == NULL) {
+                    break;
+                }
+
+                staleEntries = entries;
+                staleEntryCapacity = capacity;
+            }
+
+            staleEntries[staleEntryCount++] = *entry;
+        }
+    }
+
+    for (size_t i = 0; i < staleEntryCount; i++) {
+        FICTableEngineRemoveEntry(engine, staleEntries[i].slot, staleEntries[i].entityUUIDBytes);
+    }
+
+    FICTableEngineUnlock(engine);
+
+    free(staleEntries);
+}
+
+void FICTableEngineJournalRecord(FICTableEngine *engine, FICMetadataJournalRecordType type, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    FICMetadataJournalRecord record;
+    record.type = (uint8_t)type;
+    record.flags = 0;
+    record.index = slot;
+    memcpy(record.entityUUIDBytes, entityUUIDBytes, sizeof(record.entityUUIDBytes));
+    memcpy(record.sourceImageUUIDBytes, sourceImageUUIDBytes != NULL ? sourceImageUUIDBytes : FICTableEngineEmptyUUIDBytes, sizeof(record.sourceImageUUIDBytes));
+
+    pthread_mutex_lock(&engine->journalLock);
+
+    if (engine->pendingRecordCount == engine->pendingRecordCapacity) {
+        size_t capacity = engine->pendingRecordCapacity > 0 ? engine->pendingRecordCapacity * 2 : 64;
+        FICMetadataJournalRecord *records = realloc(engine->pendingRecords, capacity * sizeof(FICMetadataJournalRecord));
+        if (records != NULL) {
+            engine->pendingRecords = records;
+            engine->pendingRecordCapacity = capacity;
+        }
+    }
+
+    // A record that can't be buffered is lost, just like one whose write fails
+    if (engine->pendingRecordCount < engine->pendingRecordCapacity) {
+        engine->pendingRecords[engine->pendingRecordCount++] = record;
+    }
+    engine->journalRecordCount++;
+
+    // Entries aren't trusted after the table is reopened until their image data is known to be on disk
+    if (type == FICMetadataJournalRecordTypeSet) {
+        FICSlotAllocatorMarkOccupied(&engine->uncommittedSlots, slot);
+    } else if (type == FICMetadataJournalRecordTypeDelete || type == FICMetadataJournalRecordTypeCommit) {
+        FICSlotAllocatorMarkFree(&engine->uncommittedSlots, slot);
+    }
+
+    bool needsFlush = engine->journalFlushScheduled == false;
+    engine->journalFlushScheduled = true;
+
+    pthread_mutex_unlock(&engine->journalLock);
+
+    // Records that arrive before the flush runs are coalesced into a single write
+    if (needsFlush && engine->delegate.journalNeedsFlush != NULL) {
+        engine->delegate.journalNeedsFlush(engine->context);
+    }
+}
+
+size_t FICTableEnginePendingJournalRecordCount(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->journalLock);
+    size_t pendingRecordCount = engine->pendingRecordCount;
+    pthread_mutex_unlock(&engine->journalLock);
+
+    return pendingRecordCount;
+}
+
+bool FICTableEngineFlushJournal(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->journalWriteLock);
+
+    // The buffers are swapped, so records can keep being added while these are written
+    pthread_mutex_lock(&engine->journalLock);
+    FICMetadataJournalRecord *records = engine->pendingRecords;
+    size_t recordCount = engine->pendingRecordCount;
+    engine->pendingRecords = engine->flushingRecords;
+    engine->flushingRecords = records;
+    size_t capacity = engine->pendingRecordCapacity;
+    engine->pendingRecordCapacity = engine->flushingRecordCapacity;
+    engine->flushingRecordCapacity = capacity;
+    engine->pendingRecordCount = 0;
+    engine->journalFlushScheduled = false;
+    pthread_mutex_unlock(&engine->journalLock);
+
+    bool flushed = true;
+    uint64_t startTime = FICStatisticsNanoseconds();
+    if (recordCount > 0) {
+        flushed = FICMetadataJournalAppendRecords(&engine->journal, records, recordCount);
+        if (flushed) {
+            _FICTableEngineRecordWrite(engine, recordCount * sizeof(FICMetadataJournalRecord), FICTableEngineHistogramJournalWrite, startTime);
+        } else {
+            _FICTableEngineOperationDidFail(engine, FICTableEngineOperationAppendJournal, recordCount, errno);
+        }
+    }
+
+    pthread_mutex_unlock(&engine->journalWriteLock);
+
+    return flushed;
+}
+
+bool FICTableEngineCheckpointIsDue(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->journalLock);
+    bool checkpointIsDue = engine->journalRecordCount > FICTableEngineCheckpointRecordCount;
+    pthread_mutex_unlock(&engine->journalLock);
+
+    return checkpointIsDue;
+}
+
+bool FICTableEngineScheduleCheckpoint(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->journalLock);
+    bool needsCheckpoint = engine->checkpointScheduled == false;
+    engine->checkpointScheduled = true;
+    pthread_mutex_unlock(&engine->journalLock);
+
+    return needsCheckpoint;
+}
+
+bool FICTableEngineWriteCheckpoint(FICTableEngine *engine, const void *formatBytes, size_t formatLength) {
+    uint64_t startTime = FICStatisticsNanoseconds();
+
+    // Records flushed after the snapshot is taken are appended after the checkpoint that replaces them
+    pthread_mutex_lock(&engine->journalWriteLock);
+
+    // Holding the table lock keeps entries from being set or deleted while they're copied, so no record is lost between the checkpoint and the pending records it replaces
+    FICTableEngineLock(engine, false);
+
+    // The checkpoint supersedes everything that hasn't been flushed yet, including commit records, so it carries the entries that still aren't known to be on disk
+    pthread_mutex_lock(&engine->journalLock);
+    size_t uncommittedCount = engine->uncommittedSlots.occupiedCount;
+    uint32_t *uncommittedSlots = malloc(_FICTableEngineMax(uncommittedCount, 1) * sizeof(uint32_t));
+    if (uncommittedSlots != NULL) {
+        size_t slot = 0;
+        for (size_t i = 0; i < uncommittedCount; i++) {
+            slot = FICSlotAllocatorNextOccupiedSlot(&engine->uncommittedSlots, slot);
+            uncommittedSlots[i] = (uint32_t)slot++;
+        }
+    }
+    engine->pendingRecordCount = 0;
+    engine->journalRecordCount = 0;
+    engine->checkpointScheduled = false;
+    pthread_mutex_unlock(&engine->journalLock);
+
+    // Accesses recorded between the two locks end up in both the snapshot and the journal, which is harmless: replaying one again just moves its entry to the front again
+    void *snapshotBytes = NULL;
+    size_t snapshotLength = 0;
+    if (uncommittedSlots != NULL) {
+        pthread_mutex_lock(&engine->recencyLock);
+        snapshotLength = FICMetadataSnapshotLength(&engine->index, &engine->allocator, &engine->policy, uncommittedCount);
+        snapshotBytes = malloc(snapshotLength);
+        if (snapshotBytes != NULL) {
+            FICMetadataSnapshotWrite(snapshotBytes, &engine->index, &engine->allocator, &engine->policy, uncommittedSlots, uncommittedCount);
+        }
+        pthread_mutex_unlock(&engine->recencyLock);
+    }
+
+    FICTableEngineUnlock(engine);
+
+    bool written = snapshotBytes != NULL && FICMetadataJournalWriteCheckpoint(&engine->journal, formatBytes, formatLength, snapshotBytes, snapshotLength);
+    if (written) {
+        _FICTableEngineRecordWrite(engine, formatLength + snapshotLength, FICTableEngineHistogramCheckpoint, startTime);
+    } else {
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationWriteCheckpoint, 0, snapshotBytes != NULL ? errno : ENOMEM);
+    }
+
+    pthread_mutex_unlock(&engine->journalWriteLock);
+
+    free(snapshotBytes);
+    free(uncommittedSlots);
+
+    return written;
+}
+
+#pragma mark - Locking Entries
+
+// The wait is only timed when the lock is busy, so taking a free lock costs no more than counting it
+void FICTableEngineLock(FICTableEngine *engine, bool forWriting) {
+    FICStatisticsAdd(&engine->statistics, FICTableEngineCounterLock, 1);
+
+    int result = forWriting ? pthread_rwlock_trywrlock(&engine->lock) : pthread_rwlock_tryrdlock(&engine->lock);
+    if (result != 0) {
+        uint64_t startTime = FICStatisticsNanoseconds();
+        if (forWriting) {
+            pthread_rwlock_wrlock(&engine->lock);
+        } else {
+            pthread_rwlock_rdlock(&engine->lock);
+        }
+        FICStatisticsRecordDuration(&engine->statistics, FICTableEngineHistogramLockWait, FICStatisticsNanoseconds() - startTime);
+    }
+}
+
+void FICTableEngineUnlock(FICTableEngine *engine) {
+    pthread_rwlock_unlock(&engine->lock);
+}
+
+pthread_rwlock_t * FICTableEngineEntryLock(FICTableEngine *engine, size_t slot) {
+    return &engine->entryLocks[slot % FICTableEngineEntryLockCount];
+}
+
+// Every entry lock is taken in ascending order, so this can't deadlock with anything else that takes more than one
+void FICTableEngineLockAllEntries(FICTableEngine *engine) {
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        pthread_rwlock_wrlock(&engine->entryLocks[i]);
+    }
+}
+
+void FICTableEngineUnlockAllEntries(FICTableEngine *engine) {
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        pthread_rwlock_unlock(&engine->entryLocks[i]);
+    }
+}
+
+uint32_t FICTableEngineSlotOfEntry(FICTableEngine *engine, const uint8_t entityUUIDBytes[16]) {
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&engine->index, entityUUIDBytes);
+
+    return entry != NULL && entry->slot < engine->file.entryCount ? entry->slot : FICEntryIndexNoSlot;
+}
+
+// Callers hold the table lock while they look an entry up, but only try to take the entry lock while they do. Waiting for an entry lock with the table lock held would let one slow
+// drawing block stall the whole table, so when the entry lock is busy, the table lock is dropped while waiting and the caller starts over with both held. Nothing waits for the table
+// lock while holding it, so it's always safe to wait for it with an entry lock held.
+static bool _FICTableEngineTryLockEntryLock(FICTableEngine *engine, pthread_rwlock_t *entryLock, bool forWriting, pthread_rwlock_t **heldEntryLock) {
+    if (entryLock == *heldEntryLock) {
+        return true;
+    }
+
+    if (*heldEntryLock != NULL) {
+        pthread_rwlock_unlock(*heldEntryLock);
+        *heldEntryLock = NULL;
+    }
+
+    if (entryLock == NULL) {
+        return true;
+    }
+
+    int result = forWriting ? pthread_rwlock_trywrlock(entryLock) : pthread_rwlock_tryrdlock(entryLock);
+    if (result == 0) {
+        *heldEntryLock = entryLock;
+        return true;
+    }
+
+    FICTableEngineUnlock(engine);
+    if (forWriting) {
+        pthread_rwlock_wrlock(entryLock);
+    } else {
+        pthread_rwlock_rdlock(entryLock);
+    }
+    *heldEntryLock = entryLock;
+    FICTableEngineLock(engine, forWriting);
+
+    return false;
+}
+
+pthread_rwlock_t * FICTableEngineLockSlotForReading(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t *slot) {
+    pthread_rwlock_t *heldEntryLock = NULL;
+    bool locked = false;
+
+    while (locked == false) {
+        *slot = FICTableEngineSlotOfEntry(engine, entityUUIDBytes);
+        pthread_rwlock_t *entryLock = *slot != FICEntryIndexNoSlot ? FICTableEngineEntryLock(engine, *slot) : NULL;
+        locked = _FICTableEngineTryLockEntryLock(engine, entryLock, false, &heldEntryLock);
+    }
+
+    return heldEntryLock;
+}
+
+// The caller must hold the table lock for writing. Returns the first free slot, evicting an entry if the table is full. When nothing can be evicted, the slot is past the maximum count,
+// and the table file grows past it rather than failing to store the entry.
+static size_t _FICTableEngineNextSlot(FICTableEngine *engine) {
+    // Returns the table file's entry count if every slot in it is occupied
+    size_t slot = FICSlotAllocatorFirstFreeSlot(&engine->allocator);
+
+    while (slot >= engine->maximumCount && FICTableEngineEvictEntry(engine, NULL)) {
+        slot = FICSlotAllocatorFirstFreeSlot(&engine->allocator);
+    }
+
+    if (slot >= engine->maximumCount) {
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationEvictEntry, slot, 0);
+    }
+
+    return slot;
+}
+
+pthread_rwlock_t * FICTableEngineLockSlotForStoring(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t *slot) {
+    pthread_rwlock_t *heldEntryLock = NULL;
+    bool locked = false;
+    size_t storingSlot = 0;
+
+    while (locked == false) {
+        storingSlot = FICTableEngineSlotOfEntry(engine, entityUUIDBytes);
+        if (storingSlot == FICEntryIndexNoSlot) {
+            storingSlot = _FICTableEngineNextSlot(engine);
+
+            if (storingSlot >= engine->file.entryCount) {
+                // The table file grows a whole chunk at a time, so the number of entries is always a multiple of entriesPerChunk
+                FICTableEngineSetEntryCount(engine, FICTableFileChunkAlignedEntryCount(&engine->file, storingSlot + 1));
+            }
+        }
+
+        pthread_rwlock_t *entryLock = storingSlot < engine->file.entryCount ? FICTableEngineEntryLock(engine, storingSlot) : NULL;
+        locked = _FICTableEngineTryLockEntryLock(engine, entryLock, true, &heldEntryLock);
+    }
+
+    *slot = heldEntryLock != NULL ? (uint32_t)storingSlot : FICEntryIndexNoSlot;
+
+    return heldEntryLock;
+}
+
+#pragma mark - Storing and Removing Entries
+
+void FICTableEngineSetEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], bool *slotHeldEvictedEntry) {
+    bool slotWasEvicted = FICTableEngineTakeEvictedEntry(engine, slot);
+    if (slotHeldEvictedEntry != NULL) {
+        *slotHeldEvictedEntry = slotWasEvicted;
+    }
+
+    _FICTableEngineAddBookkeeping(engine, slot, entityUUIDBytes, sourceImageUUIDBytes);
+    FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeSet, slot, entityUUIDBytes, sourceImageUUIDBytes);
+}
+
+void FICTableEngineRemoveEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16]) {
+    _FICTableEngineRemoveBookkeeping(engine, slot, entityUUIDBytes);
+    FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeDelete, slot, entityUUIDBytes, NULL);
+}
+
+bool FICTableEngineDeleteEntry(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t expectedSlot) {
+    FICTableEngineLock(engine, true);
+
+    uint32_t slot = FICTableEngineSlotOfEntry(engine, entityUUIDBytes);
+    bool entryWasRemoved = slot != FICEntryIndexNoSlot && (expectedSlot == FICEntryIndexNoSlot || slot == expectedSlot);
+    if (entryWasRemoved) {
+        FICTableEngineRemoveEntry(engine, slot, entityUUIDBytes);
+    }
+
+    FICTableEngineUnlock(engine);
+
+    return entryWasRemoved;
+}
+
+bool FICTableEngineEvictEntry(FICTableEngine *engine, uint32_t *slot) {
+    // Entries in use are pinned off the recency list, so the policy only ever picks evictable ones
+    pthread_mutex_lock(&engine->recencyLock);
+    uint32_t victim = FICEvictionPolicyChooseVictim(&engine->policy, &engine->index);
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    const FICEntryIndexEntry *entry = victim != FICRecencyListNone ? FICEntryIndexFindSlot(&engine->index, victim) : NULL;
+    if (entry == NULL) {
+        return false;
+    }
+
+    uint8_t entityUUIDBytes[16];
+    memcpy(entityUUIDBytes, entry->entityUUIDBytes, sizeof(entityUUIDBytes));
+
+    FICStatisticsAdd(&engine->statistics, FICTableEngineCounterEvictedEntry, 1);
+    FICTableEngineRemoveEntry(engine, victim, entityUUIDBytes);
+    if (engine->keepsEvictedEntries) {
+        FICSlotAllocatorMarkOccupied(&engine->evictedSlots, victim);
+    }
+
+    if (slot != NULL) {
+        *slot = victim;
+    }
+
+    return true;
+}
+
+void FICTableEngineEntryWasRetrieved(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], bool pin) {
+    // Pinned entries are kept off the eviction list for as long as the image is alive
+    pthread_mutex_lock(&engine->recencyLock);
+    _FICTableEngineEntryWasAccessed(engine, slot, entityUUIDBytes);
+    if (pin) {
+        FICRecencyListPin(&engine->policy.list, slot);
+    }
+    pthread_mutex_unlock(&engine->recencyLock);
+}
+
+void FICTableEngineUnpinEntry(FICTableEngine *engine, uint32_t slot) {
+    pthread_mutex_lock(&engine->recencyLock);
+    FICRecencyListUnpin(&engine->policy.list, slot);
+    pthread_mutex_unlock(&engine->recencyLock);
+}
+
+bool FICTableEngineEntryExists(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    FICTableEngineLock(engine, false);
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&engine->index, entityUUIDBytes);
+    bool entryExists = entry != NULL && entry->slot < engine->file.entryCount && memcmp(entry->sourceImageUUIDBytes, sourceImageUUIDBytes, sizeof(entry->sourceImageUUIDBytes)) == 0;
+    FICTableEngineUnlock(engine);
+
+    return entryExists;
+}
+
+size_t FICTableEngineEntryCount(FICTableEngine *engine) {
+    FICTableEngineLock(engine, false);
+    size_t entryCount = engine->index.count;
+    FICTableEngineUnlock(engine);
+
+    return entryCount;
+}
+
+bool FICTableEngineTakeEvictedEntry(FICTableEngine *engine, size_t slot) {
+    bool slotWasEvicted = FICSlotAllocatorIsOccupied(&engine->evictedSlots, slot);
+    FICSlotAllocatorMarkFree(&engine->evictedSlots, slot);
+
+    return slotWasEvicted;
+}
+
+bool FICTableEngineSetEntryCount(FICTableEngine *engine, size_t entryCount) {
+    if (entryCount == engine->file.entryCount) {
+        return true;
+    }
+
+    size_t oldEntryCount = engine->file.entryCount;
+    if (FICTableFileSetEntryCount(&engine->file, entryCount) == false) {
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationResizeFile, entryCount, errno);
+        return false;
+    }
+
+    if (engine->delegate.entryCountDidChange != NULL && engine->delegate.entryCountDidChange(engine->context, oldEntryCount) == false) {
+        FICTableFileSetEntryCount(&engine->file, oldEntryCount);
+        return false;
+    }
+
+    FICSlotAllocatorSetSlotCount(&engine->allocator, engine->file.entryCount);
+
+    // Entries added past the old end of the file are holes until they're written
+    engine->holeStartIndex = _FICTableEngineMin(engine->holeStartIndex, engine->file.entryCount);
+
+    return true;
+}
+
+void FICTableEngineRemoveAll(FICTableEngine *engine) {
+    FICEntryIndexRemoveAll(&engine->index);
+    FICSlotAllocatorRemoveAll(&engine->allocator);
+    FICSlotAllocatorRemoveAll(&engine->evictedSlots);
+    FICSlotAllocatorRemoveAll(&engine->idleSlots);
+    FICSlotAllocatorRemoveAll(&engine->punchedSlots);
+
+    pthread_mutex_lock(&engine->recencyLock);
+    FICEvictionPolicyRemoveAll(&engine->policy);
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    pthread_mutex_lock(&engine->dirtyLock);
+    FICSlotAllocatorRemoveAll(&engine->dirtySlots);
+    engine->dirtyLength = 0;
+    engine->dirtyGeneration++;
+    pthread_mutex_unlock(&engine->dirtyLock);
+
+    pthread_mutex_lock(&engine->journalLock);
+    FICSlotAllocatorRemoveAll(&engine->uncommittedSlots);
+    pthread_mutex_unlock(&engine->journalLock);
+
+    pthread_mutex_lock(&engine->verificationLock);
+    FICSlotAllocatorRemoveAll(&engine->verifiedSlots);
+    engine->scrubbingIndex = 0;
+    pthread_mutex_unlock(&engine->verificationLock);
+
+    FICTableEngineSetEntryCount(engine, 0);
+}
+
+#pragma mark - Verifying Image Data
+
+static uint32_t _FICTableEngineChecksum(const FICTableEngine *engine, const void *entryBytes, uint64_t generation) {
+    uint32_t checksum = FICChecksumCRC32C(0, &generation, sizeof(generation));
+
+    return FICChecksumCRC32C(checksum, entryBytes, engine->file.imageLength);
+}
+
+void FICTableEngineSealEntry(FICTableEngine *engine, uint32_t slot, void *entryBytes) {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    uint64_t now = (uint64_t)time.tv_sec * 1000000 + (uint64_t)time.tv_usec;
+
+    pthread_mutex_lock(&engine->verificationLock);
+    uint64_t generation = engine->lastGeneration + 1 > now ? engine->lastGeneration + 1 : now;
+    engine->lastGeneration = generation;
+    FICSlotAllocatorMarkOccupied(&engine->verifiedSlots, slot);
+    pthread_mutex_unlock(&engine->verificationLock);
+
+    FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry(entryBytes, engine->file.entryLength);
+    metadata->generation = generation;
+    metadata->imageChecksum = _FICTableEngineChecksum(engine, entryBytes, generation);
+}
+
+bool FICTableEngineEntryWasVerified(FICTableEngine *engine, uint32_t slot) {
+    pthread_mutex_lock(&engine->verificationLock);
+    bool entryWasVerified = FICSlotAllocatorIsOccupied(&engine->verifiedSlots, slot);
+    pthread_mutex_unlock(&engine->verificationLock);
+
+    return entryWasVerified;
+}
+
+bool FICTableEngineVerifyEntry(FICTableEngine *engine, uint32_t slot, const void *entryBytes) {
+    const FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry((void *)entryBytes, engine->file.entryLength);
+    bool entryIsVerified = _FICTableEngineChecksum(engine, entryBytes, metadata->generation) == metadata->imageChecksum;
+
+    if (entryIsVerified) {
+        pthread_mutex_lock(&engine->verificationLock);
+        FICSlotAllocatorMarkOccupied(&engine->verifiedSlots, slot);
+        pthread_mutex_unlock(&engine->verificationLock);
+    }
+
+    return entryIsVerified;
+}
+
+uint32_t FICTableEngineNextScrubbedEntry(FICTableEngine *engine, uint8_t entityUUIDBytes[16]) {
+    uint32_t slot = FICEntryIndexNoSlot;
+
+    FICTableEngineLock(engine, false);
+    pthread_mutex_lock(&engine->verificationLock);
+
+    while (slot == FICEntryIndexNoSlot && engine->scrubbingIndex < engine->file.entryCount) {
+        size_t scrubbingIndex = engine->scrubbingIndex;
+        const FICEntryIndexEntry *entry = FICSlotAllocatorIsOccupied(&engine->allocator, scrubbingIndex) ? FICEntryIndexFindSlot(&engine->index, (uint32_t)scrubbingIndex) : NULL;
+        if (entry != NULL) {
+            memcpy(entityUUIDBytes, entry->entityUUIDBytes, 16);
+            slot = (uint32_t)scrubbingIndex;
+        }
+        engine->scrubbingIndex++;
+    }
+
+    if (slot == FICEntryIndexNoSlot) {
+        engine->scrubbingIndex = 0;
+    }
+
+    pthread_mutex_unlock(&engine->verificationLock);
+    FICTableEngineUnlock(engine);
+
+    return slot;
+}
+
+#pragma mark - Writing Entries to Disk
+
+bool FICTableEngineWriteEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], void *entryBytes, bool synchronously) {
+    uint64_t startTime = FICStatisticsNanoseconds();
+
+    bool written = FICTableFileFlush(entryBytes, engine->file.entryLength, synchronously);
+    if (written) {
+        _FICTableEngineRecordWrite(engine, engine->file.entryLength, FICTableEngineHistogramFlush, startTime);
+        FICTableEngineCommitEntry(engine, slot, entityUUIDBytes, sourceImageUUIDBytes);
+    } else {
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationFlushEntries, slot, errno);
+    }
+
+    return written;
+}
+
+void FICTableEngineCommitEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    FICTableEngineLock(engine, false);
+
+    // The entry may have been deleted or replaced since it was written, in which case there's nothing left to commit
+    const FICEntryIndexEntry *entry = FICEntryIndexFindSlot(&engine->index, slot);
+    if (entry != NULL && memcmp(entry->entityUUIDBytes, entityUUIDBytes, 16) == 0 && memcmp(entry->sourceImageUUIDBytes, sourceImageUUIDBytes, 16) == 0) {
+        FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeCommit, slot, entityUUIDBytes, sourceImageUUIDBytes);
+    }
+
+    FICTableEngineUnlock(engine);
+}
+
+unsigned FICTableEngineAddDirtyEntry(FICTableEngine *engine, uint32_t slot) {
+    unsigned flushNeeds = 0;
+
+    pthread_mutex_lock(&engine->dirtyLock);
+
+    if (FICSlotAllocatorIsOccupied(&engine->dirtySlots, slot) == false) {
+        FICSlotAllocatorMarkOccupied(&engine->dirtySlots, slot);
+        engine->dirtyLength += engine->file.entryLength;
+    }
+
+    if (engine->dirtyLength >= FICTableEngineMaximumDirtyLength && engine->dirtyFlushRequested == false) {
+        engine->dirtyFlushRequested = true;
+        flushNeeds |= FICTableEngineDirtyFlushImmediately;
+    }
+
+    if (engine->dirtyFlushScheduled == false) {
+        engine->dirtyFlushScheduled = true;
+        flushNeeds |= FICTableEngineDirtyFlushLater;
+    }
+
+    pthread_mutex_unlock(&engine->dirtyLock);
+
+    return flushNeeds;
+}
+
+void FICTableEngineDirtyFlushIntervalDidPass(FICTableEngine *engine) {
+    pthread_mutex_lock(&engine->dirtyLock);
+    engine->dirtyFlushScheduled = false;
+    pthread_mutex_unlock(&engine->dirtyLock);
+}
+
+uint64_t FICTableEngineTakeDirtyEntries(FICTableEngine *engine, FICSlotAllocator *dirtySlots) {
+    pthread_mutex_lock(&engine->dirtyLock);
+
+    *dirtySlots = engine->dirtySlots;
+    FICSlotAllocatorInit(&engine->dirtySlots);
+    engine->dirtyLength = 0;
+    engine->dirtyFlushRequested = false;
+    uint64_t dirtyGeneration = engine->dirtyGeneration;
+
+    pthread_mutex_unlock(&engine->dirtyLock);
+
+    return dirtyGeneration;
+}
+
+size_t FICTableEngineNextDirtyRun(const FICTableEngine *engine, const FICSlotAllocator *dirtySlots, size_t *slot) {
+    size_t firstSlot = FICSlotAllocatorNextOccupiedSlot(dirtySlots, *slot);
+    if (firstSlot == SIZE_MAX) {
+        return 0;
+    }
+
+    size_t chunkEndSlot = (firstSlot / engine->file.entriesPerChunk + 1) * engine->file.entriesPerChunk;
+    size_t count = 1;
+    while (firstSlot + count < chunkEndSlot && FICSlotAllocatorIsOccupied(dirtySlots, firstSlot + count)) {
+        count++;
+    }
+
+    *slot = firstSlot;
+
+    return count;
+}
+
+size_t FICTableEngineFlushEntries(FICTableEngine *engine, size_t slot, size_t count, void *bytes, size_t mappedLength, uint64_t dirtyGeneration) {
+    size_t entryLength = engine->file.entryLength;
+    size_t flushedLength = 0;
+
+    // The entries are locked for reading so none of them can be redrawn while they're written, which could commit a half-drawn entry. The locks are taken in ascending order, like
+    // FICTableEngineLockAllEntries() takes them.
+    bool entryLockIsNeeded[FICTableEngineEntryLockCount] = { false };
+    for (size_t i = slot; i < slot + count; i++) {
+        entryLockIsNeeded[i % FICTableEngineEntryLockCount] = true;
+    }
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        if (entryLockIsNeeded[i]) {
+            pthread_rwlock_rdlock(&engine->entryLocks[i]);
+        }
+    }
+
+    // Emptying the table may have truncated the table file since the entries were collected
+    pthread_mutex_lock(&engine->dirtyLock);
+    bool tableWasEmptied = dirtyGeneration != engine->dirtyGeneration;
+    pthread_mutex_unlock(&engine->dirtyLock);
+
+    // So may compaction, which takes every entry lock to do it, so the file can't get any shorter while these are held
+    FICTableEngineLock(engine, false);
+    off_t fileLength = engine->file.length;
+    FICTableEngineUnlock(engine);
+
+    off_t entryOffset = (off_t)(slot * entryLength);
+    if (tableWasEmptied == false && bytes != NULL && mappedLength > 0 && entryOffset < fileLength) {
+        size_t length = _FICTableEngineMin(_FICTableEngineMin(count * entryLength, mappedLength), (size_t)(fileLength - entryOffset));
+        uint64_t startTime = FICStatisticsNanoseconds();
+
+        if (FICTableFileFlush(bytes, length, true)) {
+            _FICTableEngineRecordWrite(engine, length, FICTableEngineHistogramFlush, startTime);
+            flushedLength = length;
+
+            for (size_t i = 0; i < length / entryLength; i++) {
+                // The metadata that was just written says what the entry holds
+                const FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry((uint8_t *)bytes + i * entryLength, entryLength);
+                FICTableEngineCommitEntry(engine, (uint32_t)(slot + i), metadata->entityUUIDBytes, metadata->sourceImageUUIDBytes);
+            }
+        } else {
+            _FICTableEngineOperationDidFail(engine, FICTableEngineOperationFlushEntries, slot, errno);
+        }
+    }
+
+    for (size_t i = 0; i < FICTableEngineEntryLockCount; i++) {
+        if (entryLockIsNeeded[i]) {
+            pthread_rwlock_unlock(&engine->entryLocks[i]);
+        }
+    }
+
+    return flushedLength;
+}
+
+#pragma mark - Compacting the Table File
+
+// The caller must hold the table lock for writing. Finds the last entry in the table file and the first free slot before it, and returns whether one can be moved into the other.
+static bool _FICTableEngineFindEntryToMove(FICTableEngine *engine, uint32_t *slot, uint32_t *newSlot) {
+    size_t occupiedSlotLimit = FICSlotAllocatorOccupiedSlotLimit(&engine->allocator);
+    size_t firstFreeSlot = FICSlotAllocatorFirstFreeSlot(&engine->allocator);
+    if (occupiedSlotLimit == 0 || occupiedSlotLimit > engine->file.entryCount || firstFreeSlot >= occupiedSlotLimit - 1) {
+        return false;
+    }
+
+    size_t lastSlot = occupiedSlotLimit - 1;
+
+    // Images backed by either slot would see their image data change underneath them
+    pthread_mutex_lock(&engine->recencyLock);
+    bool entryIsInUse = FICRecencyListIsPinned(&engine->policy.list, (uint32_t)lastSlot) || FICRecencyListIsPinned(&engine->policy.list, (uint32_t)firstFreeSlot);
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    // Entries stored with deferred durability are moved once they've been written, so that the write commits the entry where it actually is
+    pthread_mutex_lock(&engine->dirtyLock);
+    bool entryIsDirty = FICSlotAllocatorIsOccupied(&engine->dirtySlots, lastSlot);
+    pthread_mutex_unlock(&engine->dirtyLock);
+
+    *slot = (uint32_t)lastSlot;
+    *newSlot = (uint32_t)firstFreeSlot;
+
+    return entryIsInUse == false && entryIsDirty == false && FICEntryIndexFindSlot(&engine->index, (uint32_t)lastSlot) != NULL;
+}
+
+bool FICTableEngineLockEntryToMove(FICTableEngine *engine, uint32_t *slot, uint32_t *newSlot) {
+    // Entry locks are taken before the table lock, so the entries are found first and found again once they're locked
+    FICTableEngineLock(engine, true);
+    bool entryCanMove = _FICTableEngineFindEntryToMove(engine, slot, newSlot);
+    FICTableEngineUnlock(engine);
+
+    if (entryCanMove == false) {
+        return false;
+    }
+
+    // The locks are taken in ascending order, like FICTableEngineLockAllEntries() takes them
+    size_t firstLockIndex = _FICTableEngineMin(*slot % FICTableEngineEntryLockCount, *newSlot % FICTableEngineEntryLockCount);
+    size_t secondLockIndex = _FICTableEngineMax(*slot % FICTableEngineEntryLockCount, *newSlot % FICTableEngineEntryLockCount);
+    pthread_rwlock_wrlock(&engine->entryLocks[firstLockIndex]);
+    if (secondLockIndex != firstLockIndex) {
+        pthread_rwlock_wrlock(&engine->entryLocks[secondLockIndex]);
+    }
+
+    FICTableEngineLock(engine, true);
+
+    uint32_t lockedSlot = FICEntryIndexNoSlot;
+    uint32_t lockedNewSlot = FICEntryIndexNoSlot;
+    entryCanMove = _FICTableEngineFindEntryToMove(engine, &lockedSlot, &lockedNewSlot) && lockedSlot == *slot && lockedNewSlot == *newSlot;
+
+    if (entryCanMove == false) {
+        FICTableEngineUnlock(engine);
+        FICTableEngineUnlockEntriesToMove(engine, *slot, *newSlot);
+    }
+
+    return entryCanMove;
+}
+
+void FICTableEngineMoveEntry(FICTableEngine *engine, uint32_t slot, uint32_t newSlot, const void *entryBytes, void *newEntryBytes) {
+    const FICEntryIndexEntry *entry = FICEntryIndexFindSlot(&engine->index, slot);
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    memcpy(entityUUIDBytes, entry->entityUUIDBytes, sizeof(entityUUIDBytes));
+    memcpy(sourceImageUUIDBytes, entry->sourceImageUUIDBytes, sizeof(sourceImageUUIDBytes));
+
+    // The entry's metadata moves along with its image data, checksum and all
+    memcpy(newEntryBytes, entryBytes, engine->file.entryLength);
+
+    // Moving an entry isn't an access, so it keeps its place in the recency list
+    FICEntryIndexSet(&engine->index, entityUUIDBytes, sourceImageUUIDBytes, newSlot);
+    FICSlotAllocatorMarkFree(&engine->allocator, slot);
+    FICSlotAllocatorMarkOccupied(&engine->allocator, newSlot);
+    _FICTableEngineSlotWasFilled(engine, newSlot);
+
+    pthread_mutex_lock(&engine->recencyLock);
+    FICRecencyListMoveSlot(&engine->policy.list, slot, newSlot);
+    if (engine->delegate.entryWasMoved != NULL) {
+        engine->delegate.entryWasMoved(engine->context, slot, newSlot);
+    }
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    pthread_mutex_lock(&engine->verificationLock);
+    if (FICSlotAllocatorIsOccupied(&engine->verifiedSlots, slot)) {
+        FICSlotAllocatorMarkOccupied(&engine->verifiedSlots, newSlot);
+    } else {
+        FICSlotAllocatorMarkFree(&engine->verifiedSlots, newSlot);
+    }
+    FICSlotAllocatorMarkFree(&engine->verifiedSlots, slot);
+    pthread_mutex_unlock(&engine->verificationLock);
+
+    // Replaying the record moves the entity out of its old slot, just like storing it again would
+    FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeSet, newSlot, entityUUIDBytes, sourceImageUUIDBytes);
+    engine->compactedEntryCount++;
+}
+
+void FICTableEngineUnlockEntriesToMove(FICTableEngine *engine, uint32_t slot, uint32_t newSlot) {
+    size_t firstLockIndex = _FICTableEngineMin(slot % FICTableEngineEntryLockCount, newSlot % FICTableEngineEntryLockCount);
+    size_t secondLockIndex = _FICTableEngineMax(slot % FICTableEngineEntryLockCount, newSlot % FICTableEngineEntryLockCount);
+    if (secondLockIndex != firstLockIndex) {
+        pthread_rwlock_unlock(&engine->entryLocks[secondLockIndex]);
+    }
+    pthread_rwlock_unlock(&engine->entryLocks[firstLockIndex]);
+}
+
+// The caller must hold the table lock. Returns the number of entries the table file can be truncated to.
+static size_t _FICTableEngineEntryCountAfterTruncation(FICTableEngine *engine) {
+    size_t entryCount = FICSlotAllocatorOccupiedSlotLimit(&engine->allocator);
+
+    pthread_mutex_lock(&engine->recencyLock);
+    for (size_t slot = engine->file.entryCount; slot > entryCount; slot--) {
+        if (FICRecencyListIsPinned(&engine->policy.list, (uint32_t)(slot - 1))) {
+            entryCount = slot;
+        }
+    }
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    return _FICTableEngineMin(FICTableFileChunkAlignedEntryCount(&engine->file, entryCount), engine->file.entryCount);
+}
+
+bool FICTableEngineLockForTruncation(FICTableEngine *engine, size_t *entryCount) {
+    FICTableEngineLock(engine, false);
+    bool needsTruncation = _FICTableEngineEntryCountAfterTruncation(engine) < engine->file.entryCount;
+    FICTableEngineUnlock(engine);
+
+    if (needsTruncation == false) {
+        return false;
+    }
+
+    // Every entry lock is taken first, so nothing is reading, drawing, or writing image data when the table file is truncated
+    FICTableEngineLockAllEntries(engine);
+    FICTableEngineLock(engine, true);
+
+    *entryCount = _FICTableEngineEntryCountAfterTruncation(engine);
+    if (*entryCount >= engine->file.entryCount) {
+        FICTableEngineUnlock(engine);
+        FICTableEngineUnlockAllEntries(engine);
+        return false;
+    }
+
+    return true;
+}
+
+void FICTableEngineTruncate(FICTableEngine *engine, size_t entryCount) {
+    for (size_t slot = entryCount; slot < engine->file.entryCount; slot++) {
+        FICSlotAllocatorMarkFree(&engine->evictedSlots, slot);
+        FICSlotAllocatorMarkFree(&engine->idleSlots, slot);
+        FICSlotAllocatorMarkFree(&engine->punchedSlots, slot);
+    }
+
+    off_t fileLength = engine->file.length;
+    if (FICTableEngineSetEntryCount(engine, entryCount)) {
+        engine->truncatedLength += (uint64_t)(fileLength - engine->file.length);
+    }
+}
+
+// The caller must hold the table lock for writing
+static bool _FICTableEnginePunchHole(FICTableEngine *engine, size_t slot) {
+    bool punched = FICTableFilePunchHole(&engine->file, slot);
+
+    if (punched == false) {
+        // Free slots still take up disk space on file systems that can't punch holes, until the table file is truncated
+        engine->holePunchingEnabled = false;
+        _FICTableEngineOperationDidFail(engine, FICTableEngineOperationPunchHole, slot, errno);
+    }
+
+    return punched;
+}
+
+// The caller must hold the table lock for writing
+static bool _FICTableEngineSlotCanBePunched(FICTableEngine *engine, size_t slot) {
+    // Slots backing images and evicted image data on its way to cold storage are skipped, and given back when the file is truncated instead
+    pthread_mutex_lock(&engine->recencyLock);
+    bool slotIsInUse = FICRecencyListIsPinned(&engine->policy.list, (uint32_t)slot);
+    pthread_mutex_unlock(&engine->recencyLock);
+
+    return slotIsInUse == false && FICSlotAllocatorIsOccupied(&engine->evictedSlots, slot) == false;
+}
+
+// The caller must hold the table lock for writing
+static size_t _FICTableEnginePunchTrailingHoles(FICTableEngine *engine, size_t length, size_t lastSlot) {
+    size_t punchedLength = 0;
+
+    // Entries stored past the holes since the last step filled some of them in again
+    engine->holeStartIndex = _FICTableEngineMin(_FICTableEngineMax(engine->holeStartIndex, lastSlot), engine->file.entryCount);
+
+    while (engine->holePunchingEnabled && engine->holeStartIndex > lastSlot && punchedLength < length) {
+        size_t slot = engine->holeStartIndex - 1;
+        if (_FICTableEngineSlotCanBePunched(engine, slot)) {
+            if (_FICTableEnginePunchHole(engine, slot) == false) {
+                break;
+            }
+
+            punchedLength += engine->file.entryLength;
+        }
+
+        engine->holeStartIndex = slot;
+    }
+
+    return punchedLength;
+}
+
+// The caller must hold the table lock for writing
+static size_t _FICTableEnginePunchIdleHoles(FICTableEngine *engine, size_t length, size_t lastSlot, uint64_t minimumIdleDuration) {
+    size_t punchedLength = 0;
+
+    // The first call only sweeps, since no slot has been seen free before
+    uint64_t now = FICStatisticsNanoseconds();
+    if (engine->idleSlotSweepTime != 0 && now - engine->idleSlotSweepTime < minimumIdleDuration) {
+        return 0;
+    }
+
+    // Every slot still marked idle has stayed free since the last sweep, which is long enough ago
+    size_t slot = 0;
+    while (engine->holePunchingEnabled && punchedLength < length && (slot = FICSlotAllocatorNextOccupiedSlot(&engine->idleSlots, slot)) < lastSlot) {
+        FICSlotAllocatorMarkFree(&engine->idleSlots, slot);
+
+        if (_FICTableEngineSlotCanBePunched(engine, slot)) {
+            if (_FICTableEnginePunchHole(engine, slot) == false) {
+                break;
+            }
+
+            FICSlotAllocatorMarkOccupied(&engine->punchedSlots, slot);
+            punchedLength += engine->file.entryLength;
+        }
+
+        slot++;
+    }
+
+    // Slots left over for the next step keep the sweep they were found in
+    if (FICSlotAllocatorNextOccupiedSlot(&engine->idleSlots, 0) < lastSlot) {
+        return punchedLength;
+    }
+
+    FICSlotAllocatorRemoveAll(&engine->idleSlots);
+    for (slot = 0; slot < lastSlot; slot++) {
+        if (FICSlotAllocatorIsOccupied(&engine->allocator, slot) == false && FICSlotAllocatorIsOccupied(&engine->punchedSlots, slot) == false) {
+            FICSlotAllocatorMarkOccupied(&engine->idleSlots, slot);
+        }
+    }
+    engine->idleSlotSweepTime = now;
+
+    return punchedLength;
+}
+
+size_t FICTableEnginePunchHoles(FICTableEngine *engine, size_t length, uint64_t minimumIdleDuration) {
+    FICTableEngineLock(engine, true);
+
+    size_t lastSlot = FICSlotAllocatorOccupiedSlotLimit(&engine->allocator);
+    size_t punchedLength = _FICTableEnginePunchTrailingHoles(engine, length, lastSlot);
+    if (punchedLength < length) {
+        punchedLength += _FICTableEnginePunchIdleHoles(engine, length - punchedLength, lastSlot, minimumIdleDuration);
+    }
+
+    engine->punchedLength += punchedLength;
+
+    FICTableEngineUnlock(engine);
+
+    return punchedLength;
+}
+
+uint64_t FICTableEngineCompactableLength(FICTableEngine *engine) {
+    FICTableEngineLock(engine, false);
+    off_t compactedFileLength = (off_t)(FICTableFileChunkAlignedEntryCount(&engine->file, engine->allocator.occupiedCount) * engine->file.entryLength);
+    uint64_t compactableLength = engine->file.length > compactedFileLength ? (uint64_t)(engine->file.length - compactedFileLength) : 0;
+    FICTableEngineUnlock(engine);
+
+    return compactableLength;
+}
+
+size_t FICTableEngineUsedLength(FICTableEngine *engine) {
+    FICTableEngineLock(engine, false);
+    size_t usedLength = engine->allocator.occupiedCount * engine->file.entryLength;
+    FICTableEngineUnlock(engine);
+
+    return usedLength;
+}
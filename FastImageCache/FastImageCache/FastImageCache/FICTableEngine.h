@@ -0,0 +1,542 @@
+//
+//  FICTableEngine.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICTableEngine_h
+#define FICTableEngine_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FICEntryIndex.h"
+#include "FICEvictionPolicy.h"
+#include "FICMetadataJournal.h"
+#include "FICSlotAllocator.h"
+#include "FICStatistics.h"
+#include "FICTableFile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Entries share this many reader/writer locks. Neighboring entries use different locks, so drawing one entry doesn't hold up readers of the entries around it.
+#define FICTableEngineEntryLockCount 64
+
+/**
+ The counters of an engine's statistics. Those about images and chunk mappings are counted by the table wrapping the engine.
+ */
+typedef enum {
+    FICTableEngineCounterHit,
+    FICTableEngineCounterMiss,
+    FICTableEngineCounterStoredEntry,
+    FICTableEngineCounterEvictedEntry,
+    FICTableEngineCounterChunkMapping,
+    FICTableEngineCounterChunkUnmapping,
+    FICTableEngineCounterWrittenLength,
+    FICTableEngineCounterLock,
+    FICTableEngineCounterCount,
+} FICTableEngineCounter;
+
+/**
+ The duration histograms of an engine's statistics.
+ */
+typedef enum {
+    FICTableEngineHistogramLockWait,
+    FICTableEngineHistogramFlush,
+    FICTableEngineHistogramJournalWrite,
+    FICTableEngineHistogramCheckpoint,
+    FICTableEngineHistogramCount,
+} FICTableEngineHistogram;
+
+/**
+ Operations an engine reports the failure of to its delegate.
+
+ - `FICTableEngineOperationResizeFile`: The table file couldn't be resized to `detail` entries.
+ - `FICTableEngineOperationEvictEntry`: No entry could be evicted to make room, so the table file grows past the maximum count to hold slot `detail`.
+ - `FICTableEngineOperationConfigureEvictionPolicy`: The eviction policy couldn't be allocated, so entries are evicted as if none had been used before.
+ - `FICTableEngineOperationFlushEntries`: Image data starting at slot `detail` couldn't be written to disk.
+ - `FICTableEngineOperationAppendJournal`: Journal records couldn't be appended.
+ - `FICTableEngineOperationWriteCheckpoint`: A metadata checkpoint couldn't be written.
+ - `FICTableEngineOperationPunchHole`: A hole couldn't be punched at slot `detail`, so holes aren't punched anymore.
+ */
+typedef enum {
+    FICTableEngineOperationResizeFile,
+    FICTableEngineOperationEvictEntry,
+    FICTableEngineOperationConfigureEvictionPolicy,
+    FICTableEngineOperationFlushEntries,
+    FICTableEngineOperationAppendJournal,
+    FICTableEngineOperationWriteCheckpoint,
+    FICTableEngineOperationPunchHole,
+} FICTableEngineOperation;
+
+/**
+ What storing an entry with deferred durability asks of the caller. See `<FICTableEngineAddDirtyEntry>`.
+ */
+typedef enum {
+    FICTableEngineDirtyFlushImmediately = 1 << 0,
+    FICTableEngineDirtyFlushLater = 1 << 1,
+} FICTableEngineDirtyFlushNeeds;
+
+/**
+ Callbacks through which an engine hands off what only the table wrapping it knows how to do. Any of them can be `NULL`.
+
+ - `metadataFormatMatches`: Returns whether the serialized format stored in loaded metadata is the table's format.
+ - `entryCountDidChange`: Called with the table lock held for writing once the table file has been resized, so mappings of it can be adjusted. Returning `false` puts the file back
+   to `oldEntryCount` entries.
+ - `entryWasAccessed`: Called with the recency lock held whenever an entry is stored or accessed.
+ - `entryWasMoved`: Called with the recency lock held when compaction moves an entry to a new slot.
+ - `journalNeedsFlush`: Called once a journal record is pending after the last `<FICTableEngineFlushJournal>`, so a flush can be scheduled. No engine lock is held.
+ - `operationDidFail`: Called when an operation fails, with `errno` in `error` where there is one.
+ */
+typedef struct {
+    bool (*metadataFormatMatches)(void *context, const void *formatBytes, size_t formatLength);
+    bool (*entryCountDidChange)(void *context, size_t oldEntryCount);
+    void (*entryWasAccessed)(void *context, uint32_t slot);
+    void (*entryWasMoved)(void *context, uint32_t slot, uint32_t newSlot);
+    void (*journalNeedsFlush)(void *context);
+    void (*operationDidFail)(void *context, FICTableEngineOperation operation, size_t detail, int error);
+} FICTableEngineDelegate;
+
+/**
+ Describes the engine to initialize.
+ */
+typedef struct {
+    size_t imageLength;                     // Bytes of image data per entry
+    size_t maximumCount;                    // Grown to fill the first chunk if it's smaller
+    FICEvictionPolicyKind evictionPolicyKind;
+    const char *metadataPath;
+    bool keepsEvictedEntries;               // Whether slots remember that they still hold the image data evicted from them, for moving it to cold storage
+    FICTableEngineDelegate delegate;
+    void *context;                          // Passed to every delegate callback
+} FICTableEngineConfiguration;
+
+/**
+ `FICTableEngine` is the storage engine of an image table: everything it does with its entries that doesn't need Apple frameworks.
+
+ @discussion An engine owns the `<FICTableFile>` entries are stored in, the `<FICEntryIndex>`, `<FICSlotAllocator>` and `<FICEvictionPolicy>` that say where entries are and which
+ one is evicted next, and the `<FICMetadataJournal>` those are persisted in. It picks the slot a new entry goes in, evicting an entry or growing the table file as needed; records
+ every change in the journal and replays the journal when the table is opened again, dropping entries whose image data was never known to be on disk; checksums image data and
+ scrubs it; writes image data back to disk and commits it; and moves entries toward the start of the table file, truncates it, and punches holes in it.
+
+ What is left to the table wrapping the engine is mapping chunks of the table file, turning entries into images, cold storage, and scheduling background work. The engine never maps
+ the table file itself: operations that read or write image data take the mapped bytes of the entries they work on.
+
+ Locks are taken in this order: entry locks, in ascending order when more than one is taken; then `lock`, the table lock, which guards the index, the slot allocator, the set of
+ evicted slots, the compaction state, and the size of the table file; then any one of `recencyLock` (the eviction policy), `journalLock` (pending journal records and the set of
+ uncommitted slots), `dirtyLock` (entries waiting to be written to disk) and `verificationLock` (checksummed slots and scrubbing). The entry locks are only ever tried while the table
+ lock is held; when one is busy, the table lock is dropped while waiting for it, so one slow drawing block can't stall the whole table. `journalWriteLock` serializes writing the
+ journal file and is taken before everything else.
+
+ Slot sets are kept in `<FICSlotAllocator>` bitmaps whose occupied slots are the members of the set.
+
+ Engines are thread-safe, as long as the locking each function documents is followed.
+ */
+typedef struct {
+    FICTableFile file;
+    size_t maximumCount;
+    FICEvictionPolicyKind evictionPolicyKind;
+    size_t evictionPolicyMaximumCount;
+    bool keepsEvictedEntries;
+    FICTableEngineDelegate delegate;
+    void *context;
+
+    pthread_rwlock_t lock;
+    pthread_rwlock_t entryLocks[FICTableEngineEntryLockCount];
+    pthread_mutex_t recencyLock;
+    pthread_mutex_t journalLock;
+    pthread_mutex_t journalWriteLock;
+    pthread_mutex_t dirtyLock;
+    pthread_mutex_t verificationLock;
+
+    // Guarded by the table lock
+    FICEntryIndex index;
+    FICSlotAllocator allocator;
+    FICSlotAllocator evictedSlots;          // Free slots that still hold the image data of the entry evicted from them
+    size_t holeStartIndex;                  // Slots from this one to the end of the table file are known to be holes
+    FICSlotAllocator idleSlots;             // Free slots before the last entry that have stayed free since idleSlotSweepTime
+    FICSlotAllocator punchedSlots;          // Free slots before the last entry that are known to be holes
+    uint64_t idleSlotSweepTime;
+    bool holePunchingEnabled;
+    size_t compactedEntryCount;
+    uint64_t truncatedLength;
+    uint64_t punchedLength;
+
+    // Guarded by the recency lock
+    FICEvictionPolicy policy;
+
+    // Guarded by the journal lock
+    FICMetadataJournal journal;             // Guarded by the journal write lock instead
+    FICMetadataJournalRecord *pendingRecords;
+    size_t pendingRecordCount;
+    size_t pendingRecordCapacity;
+    FICMetadataJournalRecord *flushingRecords;  // Guarded by the journal write lock instead
+    size_t flushingRecordCapacity;
+    size_t journalRecordCount;              // Records since the last checkpoint
+    bool journalFlushScheduled;
+    bool checkpointScheduled;
+    FICSlotAllocator uncommittedSlots;      // Entries whose image data isn't known to be on disk yet
+
+    // Guarded by the dirty lock
+    FICSlotAllocator dirtySlots;
+    size_t dirtyLength;
+    uint64_t dirtyGeneration;               // Changes whenever the table is emptied, so writes that were already collected are dropped
+    bool dirtyFlushScheduled;
+    bool dirtyFlushRequested;
+
+    // Guarded by the verification lock
+    FICSlotAllocator verifiedSlots;         // Entries whose image data was written or checked since the table was opened
+    uint64_t lastGeneration;
+    size_t scrubbingIndex;                  // The slot the next scrub starts at
+
+    FICStatistics statistics;               // Updated without locks, by whichever thread does the work
+} FICTableEngine;
+
+/**
+ Initializes an engine with a closed table file and empty metadata.
+ */
+void FICTableEngineInit(FICTableEngine *engine, const FICTableEngineConfiguration *configuration);
+
+/**
+ Closes the table file and frees everything owned by the engine. Pending journal records that weren't flushed are lost.
+ */
+void FICTableEngineDestroy(FICTableEngine *engine);
+
+/**
+ Opens the table file at `path`, creating it if it doesn't exist yet. Metadata should be loaded first, so entries past the end of the file can be removed afterward with
+ `<FICTableEngineRemoveEntriesBeyondEntryCount>`.
+
+ @return `false` if the file could not be opened.
+ */
+bool FICTableEngineOpenFile(FICTableEngine *engine, const char *path);
+
+/**
+ Loads metadata from the contents of a journal file: the checkpoint is adopted in place, so `bytes` has to stay valid for as long as the engine's structures borrow storage from it,
+ and the records after it are replayed.
+
+ @param validLength Receives the length of the journal up to its last complete record, which `journal` has to be opened with before new records are appended.
+
+ @return `false` if `bytes` isn't a journal, or holds metadata of a different format according to the delegate.
+ */
+bool FICTableEngineLoadMetadata(FICTableEngine *engine, const void *bytes, size_t length, size_t *validLength);
+
+/**
+ Configures the eviction policy for the configured kind and maximum count. Called by `<FICTableEngineLoadMetadata>`; metadata loaded any other way calls it once the policy's state
+ has been loaded.
+ */
+void FICTableEngineConfigureEvictionPolicy(FICTableEngine *engine);
+
+/**
+ Removes the entries whose image data was never known to be on disk, which a crash may have torn. Called once metadata has been loaded and `journal` has been opened.
+ */
+void FICTableEngineRemoveUncommittedEntries(FICTableEngine *engine);
+
+/**
+ Removes entries that point past the end of the table file, which can only happen if it was truncated behind the engine's back. Called once, after the table file is opened.
+ */
+void FICTableEngineRemoveEntriesBeyondEntryCount(FICTableEngine *engine);
+
+/**
+ Adds a record to the pending journal records.
+ */
+void FICTableEngineJournalRecord(FICTableEngine *engine, FICMetadataJournalRecordType type, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]);
+
+/**
+ Returns the number of journal records waiting to be flushed.
+ */
+size_t FICTableEnginePendingJournalRecordCount(FICTableEngine *engine);
+
+/**
+ Appends the pending journal records to the journal file.
+
+ @return `false` if they couldn't be appended, in which case they are lost.
+ */
+bool FICTableEngineFlushJournal(FICTableEngine *engine);
+
+/**
+ Returns whether enough records have been added since the last checkpoint that opening the table again would be faster after a new one.
+ */
+bool FICTableEngineCheckpointIsDue(FICTableEngine *engine);
+
+/**
+ Marks a checkpoint as scheduled.
+
+ @return `true` if the caller should write one with `<FICTableEngineWriteCheckpoint>`, or `false` if one was already scheduled and hasn't been written yet.
+ */
+bool FICTableEngineScheduleCheckpoint(FICTableEngine *engine);
+
+/**
+ Replaces the journal with a checkpoint of the metadata, which supersedes the pending journal records.
+
+ @param formatBytes The serialized format stored with the checkpoint, checked by `metadataFormatMatches` when the table is opened again.
+
+ @return `false` if the checkpoint couldn't be written.
+ */
+bool FICTableEngineWriteCheckpoint(FICTableEngine *engine, const void *formatBytes, size_t formatLength);
+
+/**
+ Takes the table lock, counting it and timing the wait if the lock is busy.
+ */
+void FICTableEngineLock(FICTableEngine *engine, bool forWriting);
+
+/**
+ Releases the table lock.
+ */
+void FICTableEngineUnlock(FICTableEngine *engine);
+
+/**
+ Returns the entry lock of a slot.
+ */
+pthread_rwlock_t * FICTableEngineEntryLock(FICTableEngine *engine, size_t slot);
+
+/**
+ Takes every entry lock for writing, in ascending order, so nothing is reading, drawing or writing image data. Called before the table lock.
+ */
+void FICTableEngineLockAllEntries(FICTableEngine *engine);
+
+/**
+ Releases every entry lock.
+ */
+void FICTableEngineUnlockAllEntries(FICTableEngine *engine);
+
+/**
+ Returns the slot of an entity's entry, or `FICEntryIndexNoSlot` if it has none. The caller must hold the table lock.
+ */
+uint32_t FICTableEngineSlotOfEntry(FICTableEngine *engine, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Finds an entity's entry and locks it for reading. The caller must hold the table lock for reading, which may be dropped and taken again while waiting for the entry lock.
+
+ @param slot Receives the slot of the entry, or `FICEntryIndexNoSlot` if the entity has no entry.
+
+ @return The entry lock that was taken, or `NULL` if the entity has no entry.
+ */
+pthread_rwlock_t * FICTableEngineLockSlotForReading(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t *slot);
+
+/**
+ Picks the slot to store an entity's image data in and locks it for writing: the entity's own slot if it has an entry, or else the first free slot, evicting an entry if the table
+ is full and growing the table file a whole chunk at a time if the slot is past its end. The caller must hold the table lock for writing, which may be dropped and taken again
+ while waiting for the entry lock.
+
+ @param slot Receives the slot, or `FICEntryIndexNoSlot` if the table file couldn't be grown to hold it.
+
+ @return The entry lock that was taken, or `NULL` if there's no slot.
+ */
+pthread_rwlock_t * FICTableEngineLockSlotForStoring(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t *slot);
+
+/**
+ Records that an entity's entry is now in `slot`, and journals it. The caller must hold the table lock for writing and the slot's entry lock for writing.
+
+ @param slotHeldEvictedEntry If not `NULL`, receives whether the slot still holds the image data evicted from it, which is about to be overwritten.
+ */
+void FICTableEngineSetEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], bool *slotHeldEvictedEntry);
+
+/**
+ Removes an entity's entry from `slot`, and journals it. The caller must hold the table lock for writing.
+ */
+void FICTableEngineRemoveEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Removes an entity's entry if it's still in `expectedSlot`, or wherever it is if `expectedSlot` is `FICEntryIndexNoSlot`. Readers find entries before they lock them, so an entry
+ they ask to delete may have been replaced in the meantime. Takes the table lock.
+
+ @return Whether an entry was removed.
+ */
+bool FICTableEngineDeleteEntry(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], uint32_t expectedSlot);
+
+/**
+ Evicts the entry the eviction policy picks. The caller must hold the table lock for writing.
+
+ @param slot If not `NULL`, receives the slot of the evicted entry.
+
+ @return `false` if every entry is in use.
+ */
+bool FICTableEngineEvictEntry(FICTableEngine *engine, uint32_t *slot);
+
+/**
+ Records an access to an entry, optionally pinning it off the eviction policy until `<FICTableEngineUnpinEntry>`.
+ */
+void FICTableEngineEntryWasRetrieved(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], bool pin);
+
+/**
+ Lets a pinned entry be evicted again.
+ */
+void FICTableEngineUnpinEntry(FICTableEngine *engine, uint32_t slot);
+
+/**
+ Returns whether or not the entity has an entry drawn from the source image, without touching the table file. Takes the table lock.
+ */
+bool FICTableEngineEntryExists(FICTableEngine *engine, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]);
+
+/**
+ Returns the number of entries. Takes the table lock.
+ */
+size_t FICTableEngineEntryCount(FICTableEngine *engine);
+
+/**
+ Returns whether a slot still holds evicted image data and forgets that it does, since the caller is about to move it to cold storage or overwrite it. The caller must hold the table
+ lock for writing.
+ */
+bool FICTableEngineTakeEvictedEntry(FICTableEngine *engine, size_t slot);
+
+/**
+ Resizes the table file to hold `entryCount` entries. The caller must hold the table lock for writing.
+
+ @return `false` if the file couldn't be resized.
+ */
+bool FICTableEngineSetEntryCount(FICTableEngine *engine, size_t entryCount);
+
+/**
+ Removes every entry and empties the table file. The caller must hold every entry lock and the table lock for writing.
+ */
+void FICTableEngineRemoveAll(FICTableEngine *engine);
+
+/**
+ Gives an entry whose image data was just filled in a new generation and checksums it. The caller must hold the entry's lock for writing.
+
+ @discussion Generations follow the microsecond clock, so they keep increasing across launches, but never go backwards within one if the clock is set back. The generation is
+ checksummed along with the image data, so image data left behind by an earlier write to the same slot doesn't match the metadata of a later one.
+ */
+void FICTableEngineSealEntry(FICTableEngine *engine, uint32_t slot, void *entryBytes);
+
+/**
+ Returns whether an entry's image data was written or checked since the table was opened, in which case it's trusted. Tracking the slots that don't need checking, rather than the
+ ones that do, keeps opening the table from having to visit every entry.
+ */
+bool FICTableEngineEntryWasVerified(FICTableEngine *engine, uint32_t slot);
+
+/**
+ Checks an entry's image data against its checksum, and trusts it from then on if it matches. The caller must hold the entry's lock.
+ */
+bool FICTableEngineVerifyEntry(FICTableEngine *engine, uint32_t slot, const void *entryBytes);
+
+/**
+ Returns the slot of the next entry to scrub, and its entity UUID, or `FICEntryIndexNoSlot` once every entry has been scrubbed, in which case the next scrub starts over. Takes the
+ table lock.
+ */
+uint32_t FICTableEngineNextScrubbedEntry(FICTableEngine *engine, uint8_t entityUUIDBytes[16]);
+
+/**
+ Writes an entry's image data to disk and commits it. The caller must hold the entry's lock for writing.
+
+ @param synchronously Whether to wait for the data to reach the disk. Without waiting, the commit only protects against the app stopping partway through drawing: the kernel writes
+ the data back on its own schedule, so an entry can be committed while its data is still only in memory.
+
+ @return `false` if the data couldn't be written, in which case the entry stays uncommitted.
+ */
+bool FICTableEngineWriteEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], void *entryBytes, bool synchronously);
+
+/**
+ Records that an entry's image data is on disk, so it can be trusted after the table is reopened. Does nothing if the entry was deleted or replaced since it was written. Takes the
+ table lock.
+ */
+void FICTableEngineCommitEntry(FICTableEngine *engine, uint32_t slot, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]);
+
+/**
+ Adds an entry whose image data is written to disk later, with the others collected by then.
+
+ @return `FICTableEngineDirtyFlushImmediately` if enough image data has built up that it should be written right away, and `FICTableEngineDirtyFlushLater` if no flush is scheduled
+ yet, in which case the caller should schedule one and call `<FICTableEngineDirtyFlushIntervalDidPass>` when it runs.
+ */
+unsigned FICTableEngineAddDirtyEntry(FICTableEngine *engine, uint32_t slot);
+
+/**
+ Lets the next entry added by `<FICTableEngineAddDirtyEntry>` schedule a flush again.
+ */
+void FICTableEngineDirtyFlushIntervalDidPass(FICTableEngine *engine);
+
+/**
+ Takes the entries waiting to be written, leaving none.
+
+ @param dirtySlots Receives the set of slots waiting to be written, which the caller destroys.
+
+ @return The generation the entries were collected in, for `<FICTableEngineFlushEntries>`.
+ */
+uint64_t FICTableEngineTakeDirtyEntries(FICTableEngine *engine, FICSlotAllocator *dirtySlots);
+
+/**
+ Finds the next run of neighboring slots in `dirtySlots`, starting at `*slot`, that lie in one chunk. Neighboring entries are neighbors in the table file too, so each run can be
+ written with a single flush.
+
+ @return The number of slots in the run, which starts at the updated `*slot`, or 0 if there are no more.
+ */
+size_t FICTableEngineNextDirtyRun(const FICTableEngine *engine, const FICSlotAllocator *dirtySlots, size_t *slot);
+
+/**
+ Writes a run of entries to disk and commits them. Takes the entries' locks for reading, so none of them can be redrawn while they're written, which could commit a half-drawn
+ entry. Entries are skipped if the table was emptied since they were collected, or if the table file no longer reaches them.
+
+ @param bytes The mapped bytes of the run, or `NULL` if they couldn't be mapped.
+ @param mappedLength The length of the mapping from `bytes` on, which may end before the run does.
+ @param dirtyGeneration The generation returned by `<FICTableEngineTakeDirtyEntries>`.
+
+ @return The number of bytes written, which is 0 if the entries were skipped or couldn't be written.
+ */
+size_t FICTableEngineFlushEntries(FICTableEngine *engine, size_t slot, size_t count, void *bytes, size_t mappedLength, uint64_t dirtyGeneration);
+
+/**
+ Finds the entry nearest the end of the table file and the first free slot before it, and locks both for writing along with the table lock, if the entry can be moved: neither slot
+ may back an image that's in use, and the entry must have been written to disk if it was stored with deferred durability, so that the write commits it where it actually is.
+
+ @return `false` if there's no entry to move, or it can't be moved right now, in which case no lock is held.
+ */
+bool FICTableEngineLockEntryToMove(FICTableEngine *engine, uint32_t *slot, uint32_t *newSlot);
+
+/**
+ Moves the entry locked by `<FICTableEngineLockEntryToMove>` into the new slot, metadata and checksum and all, and journals it. Moving an entry isn't an access, so it keeps its place
+ in the eviction policy. The moved entry is uncommitted until the caller writes it with `<FICTableEngineWriteEntry>`, once it has released the table lock.
+ */
+void FICTableEngineMoveEntry(FICTableEngine *engine, uint32_t slot, uint32_t newSlot, const void *entryBytes, void *newEntryBytes);
+
+/**
+ Releases the entry locks taken by `<FICTableEngineLockEntryToMove>`, once the caller has released the table lock.
+ */
+void FICTableEngineUnlockEntriesToMove(FICTableEngine *engine, uint32_t slot, uint32_t newSlot);
+
+/**
+ Finds the number of entries the table file can be truncated to: enough whole chunks to hold the last entry, and any free slot past it that's still backing images. If that's fewer
+ than it has, takes every entry lock and the table lock for writing, so the file can be truncated with `<FICTableEngineTruncate>`.
+
+ @return `false` if the file can't get any shorter, in which case no lock is held.
+ */
+bool FICTableEngineLockForTruncation(FICTableEngine *engine, size_t *entryCount);
+
+/**
+ Truncates the table file to `entryCount` entries, forgetting evicted image data past the new end. The caller holds the locks taken by `<FICTableEngineLockForTruncation>`.
+ */
+void FICTableEngineTruncate(FICTableEngine *engine, size_t entryCount);
+
+/**
+ Releases the disk blocks of free slots until about `length` bytes have been released. Slots backing images and evicted image data on its way to cold storage are skipped. Takes the
+ table lock.
+
+ @param minimumIdleDuration How long, in nanoseconds, a free slot before the last entry has to stay free before its disk blocks are released.
+
+ @return The number of bytes released.
+
+ @discussion Free slots past the last entry are the last ones to be reused, so they're released first, from the end of the table file backward. Free slots between entries are the
+ first ones to be reused, so they're only released once they've stayed free for `minimumIdleDuration`: each call that finds the previous sweep at least that old releases the slots
+ that have stayed free since, then sweeps the free slots again. A slot is released somewhere between one and two of these durations after it's freed, as long as calls keep coming.
+ */
+size_t FICTableEnginePunchHoles(FICTableEngine *engine, size_t length, uint64_t minimumIdleDuration);
+
+/**
+ Returns how many bytes truncating the table file would give back if every entry were moved as close to its start as possible. Takes the table lock.
+ */
+uint64_t FICTableEngineCompactableLength(FICTableEngine *engine);
+
+/**
+ Returns the number of bytes of the table file that hold entries. Takes the table lock.
+ */
+size_t FICTableEngineUsedLength(FICTableEngine *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
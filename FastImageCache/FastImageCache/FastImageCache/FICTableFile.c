@@ -0,0 +1,205 @@
+//
+//  FICTableFile.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+// fallocate() is a GNU extension
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "FICTableFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+// Each chunk maps in enough entries to be around this long, and never fewer than FICTableFileMinimumEntriesPerChunk
+static const size_t FICTableFileGoalChunkLength = 2 * 1024 * 1024;
+static const size_t FICTableFileMinimumEntriesPerChunk = 4;
+
+static size_t FICTableFileCachedPageSize;
+static pthread_once_t FICTableFilePageSizeOnce = PTHREAD_ONCE_INIT;
+
+static void _FICTableFileInitPageSize(void) {
+    FICTableFileCachedPageSize = (size_t)getpagesize();
+}
+
+static inline size_t _FICTableFilePageAlign(size_t length) {
+    size_t pageSize = FICTableFilePageSize();
+    return (length + pageSize - 1) / pageSize * pageSize;
+}
+
+#pragma mark - Table File Lifecycle
+
+size_t FICTableFilePageSize(void) {
+    pthread_once(&FICTableFilePageSizeOnce, _FICTableFileInitPageSize);
+    return FICTableFileCachedPageSize;
+}
+
+void FICTableFileInit(FICTableFile *file, size_t imageLength) {
+    memset(file, 0, sizeof(FICTableFile));
+    file->fileDescriptor = -1;
+    file->imageLength = imageLength;
+
+    // Page-aligned entries have page-aligned base addresses, which keeps Core Animation from having to copy images made from them
+    file->entryLength = _FICTableFilePageAlign(imageLength + sizeof(FICTableFileEntryMetadata));
+
+    size_t goalEntriesPerChunk = FICTableFileGoalChunkLength / file->entryLength;
+    file->entriesPerChunk = goalEntriesPerChunk > FICTableFileMinimumEntriesPerChunk ? goalEntriesPerChunk : FICTableFileMinimumEntriesPerChunk;
+    file->chunkLength = file->entryLength * file->entriesPerChunk;
+}
+
+bool FICTableFileOpen(FICTableFile *file, const char *path) {
+    file->fileDescriptor = open(path, O_RDWR | O_CREAT, 0666);
+    if (file->fileDescriptor < 0) {
+        return false;
+    }
+
+    off_t length = lseek(file->fileDescriptor, 0, SEEK_END);
+    file->length = length > 0 ? length : 0;
+    file->entryCount = (size_t)file->length / file->entryLength;
+    file->chunkCount = (file->entryCount + file->entriesPerChunk - 1) / file->entriesPerChunk;
+
+    return true;
+}
+
+void FICTableFileClose(FICTableFile *file) {
+    if (file->fileDescriptor >= 0) {
+        close(file->fileDescriptor);
+        file->fileDescriptor = -1;
+    }
+}
+
+#pragma mark - Sizing Table Files
+
+size_t FICTableFileChunkAlignedEntryCount(const FICTableFile *file, size_t entryCount) {
+    return (entryCount + file->entriesPerChunk - 1) / file->entriesPerChunk * file->entriesPerChunk;
+}
+
+bool FICTableFileSetEntryCount(FICTableFile *file, size_t entryCount) {
+    off_t length = (off_t)(entryCount * file->entryLength);
+    if (length != file->length && ftruncate(file->fileDescriptor, length) != 0) {
+        return false;
+    }
+
+    file->length = length;
+    file->entryCount = entryCount;
+    file->chunkCount = (entryCount + file->entriesPerChunk - 1) / file->entriesPerChunk;
+
+    return true;
+}
+
+size_t FICTableFileChunkLength(const FICTableFile *file, size_t chunkIndex) {
+    off_t chunkOffset = (off_t)(chunkIndex * file->chunkLength);
+    if (chunkOffset >= file->length) {
+        return 0;
+    }
+
+    off_t remainingLength = file->length - chunkOffset;
+    return remainingLength < (off_t)file->chunkLength ? (size_t)remainingLength : file->chunkLength;
+}
+
+FICTableFileEntryMetadata * FICTableFileEntryMetadataForEntry(void *entryBytes, size_t entryLength) {
+    return (FICTableFileEntryMetadata *)((uint8_t *)entryBytes + entryLength - sizeof(FICTableFileEntryMetadata));
+}
+
+#pragma mark - Mapping Table File Data
+
+void * FICTableFileMap(int fileDescriptor, off_t offset, size_t length) {
+    void *bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, fileDescriptor, offset);
+    return bytes != MAP_FAILED ? bytes : NULL;
+}
+
+void * FICTableFileReserveAddressSpace(size_t length) {
+    // Reserved address space can't be accessed until file data is mapped over it
+    void *bytes = mmap(NULL, _FICTableFilePageAlign(length), PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    return bytes != MAP_FAILED ? bytes : NULL;
+}
+
+bool FICTableFileMapIntoReservedAddressSpace(int fileDescriptor, void *reservedBytes, size_t mappedLength, size_t length) {
+    if (length <= mappedLength) {
+        return true;
+    }
+
+    uint8_t *bytes = (uint8_t *)reservedBytes + mappedLength;
+    size_t additionalLength = length - mappedLength;
+    if (mmap(bytes, additionalLength, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED | MAP_FIXED, fileDescriptor, (off_t)mappedLength) == MAP_FAILED) {
+        // A failed fixed mapping can leave a hole in the reserved address space, which something else could be mapped into
+        int mappingError = errno;
+        mmap(bytes, additionalLength, PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+        errno = mappingError;
+        return false;
+    }
+
+    return true;
+}
+
+void FICTableFileUnmap(void *bytes, size_t length) {
+    if (bytes != NULL) {
+        munmap(bytes, _FICTableFilePageAlign(length));
+    }
+}
+
+#pragma mark - Reading and Writing Entries
+
+bool FICTableFileFlush(void *bytes, size_t length, bool synchronously) {
+    // msync() only takes page-aligned addresses
+    size_t pageSize = FICTableFilePageSize();
+    uint8_t *pageAlignedBytes = (uint8_t *)((uintptr_t)bytes / pageSize * pageSize);
+    size_t flushedLength = length + (size_t)((uint8_t *)bytes - pageAlignedBytes);
+
+    return msync(pageAlignedBytes, flushedLength, synchronously ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+void FICTableFilePreheat(void *bytes, size_t length) {
+    // Ask for all of the data up front, so it's read in one go rather than a page per fault
+    madvise(bytes, length, MADV_WILLNEED);
+
+    // Read a byte off of each page to force the kernel to page in the data
+    size_t pageSize = FICTableFilePageSize();
+    for (size_t i = 0; i < length; i += pageSize) {
+        *((volatile uint8_t *)bytes + i);
+    }
+}
+
+void FICTableFilePrefetch(const FICTableFile *file, size_t index, size_t count) {
+    off_t offset = (off_t)(index * file->entryLength);
+    size_t length = count * file->entryLength;
+
+#if defined(F_RDADVISE)
+    struct radvisory advisory;
+    advisory.ra_offset = offset;
+    advisory.ra_count = length < (size_t)INT_MAX ? (int)length : INT_MAX;
+    fcntl(file->fileDescriptor, F_RDADVISE, &advisory);
+#else
+    posix_fadvise(file->fileDescriptor, offset, (off_t)length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+// Entries are page-aligned, so their offsets and lengths are multiples of the file system block size, as hole punching requires
+bool FICTableFilePunchHole(const FICTableFile *file, size_t index) {
+    off_t offset = (off_t)(index * file->entryLength);
+
+#if defined(F_PUNCHHOLE)
+    fpunchhole_t punchHole = { 0 };
+    punchHole.fp_offset = offset;
+    punchHole.fp_length = (off_t)file->entryLength;
+    return fcntl(file->fileDescriptor, F_PUNCHHOLE, &punchHole) == 0;
+#elif defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(file->fileDescriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, (off_t)file->entryLength) == 0;
+#else
+    (void)offset;
+    errno = ENOTSUP;
+    return false;
+#endif
+}
@@ -0,0 +1,157 @@
+//
+//  FICTableFile.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICTableFile_h
+#define FICTableFile_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ The metadata stored at the end of each entry, after its image data.
+
+ @discussion Whenever this struct is changed in any way, `+[FICImageTableEntry metadataVersion]` must be changed too.
+ */
+typedef struct {
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    uint64_t generation;
+    uint32_t imageChecksum;                 // CRC-32C of the image data, which detects image data that was torn or damaged on disk
+} FICTableFileEntryMetadata;
+
+/**
+ `FICTableFile` is the file an image table stores its entries in, laid out as an array of fixed-size entries.
+
+ @discussion Each entry is the image data followed by a `<FICTableFileEntryMetadata>`, padded to a whole number of pages so that every entry starts on a page boundary. Entries are
+ mapped into memory in chunks of about 2 MB, and the file grows and shrinks a whole chunk at a time, so every chunk but the last is always completely backed by the file.
+
+ Chunks can also be mapped one after the other into a single range of address space reserved up front for the whole file, so that the entire file is mapped at one address that
+ never moves as it grows.
+
+ A table file is not thread-safe; callers are expected to keep its length from changing while its entries are mapped or its length is read.
+ */
+typedef struct {
+    int fileDescriptor;
+    size_t imageLength;
+    size_t entryLength;                     // Page-aligned
+    size_t entriesPerChunk;
+    size_t chunkLength;
+    off_t length;
+    size_t entryCount;
+    size_t chunkCount;
+} FICTableFile;
+
+/**
+ Returns the size of a virtual memory page.
+ */
+size_t FICTableFilePageSize(void);
+
+/**
+ Initializes a closed table file whose entries each hold `imageLength` bytes of image data.
+ */
+void FICTableFileInit(FICTableFile *file, size_t imageLength);
+
+/**
+ Opens the table file at `path`, creating it if it doesn't exist yet. The entries it holds are the ones that fit in its current length.
+
+ @return `false` if the file could not be opened.
+ */
+bool FICTableFileOpen(FICTableFile *file, const char *path);
+
+/**
+ Closes the table file. Mappings of it stay valid until they're unmapped.
+ */
+void FICTableFileClose(FICTableFile *file);
+
+/**
+ Returns the smallest entry count that is a whole number of chunks and holds at least `entryCount` entries.
+ */
+size_t FICTableFileChunkAlignedEntryCount(const FICTableFile *file, size_t entryCount);
+
+/**
+ Truncates or extends the table file to hold exactly `entryCount` entries. Entries added past the old end of the file read as zeros until they're written.
+
+ @return `false` if the file could not be resized, in which case it keeps its old length.
+ */
+bool FICTableFileSetEntryCount(FICTableFile *file, size_t entryCount);
+
+/**
+ Returns the length of the chunk at `chunkIndex`, which is shorter than `chunkLength` only if the file ends partway through it.
+ */
+size_t FICTableFileChunkLength(const FICTableFile *file, size_t chunkIndex);
+
+/**
+ Returns the metadata stored at the end of an entry.
+ */
+FICTableFileEntryMetadata * FICTableFileEntryMetadataForEntry(void *entryBytes, size_t entryLength);
+
+/**
+ Maps `length` bytes of a table file, starting at `offset`, for reading and writing.
+
+ @return The mapping, or `NULL` if the file data could not be mapped.
+ */
+void * FICTableFileMap(int fileDescriptor, off_t offset, size_t length);
+
+/**
+ Reserves `length` bytes of address space, rounded up to whole pages, that can't be accessed until table file data is mapped into it.
+
+ @return The reserved address space, or `NULL` if it could not be reserved.
+ */
+void * FICTableFileReserveAddressSpace(size_t length);
+
+/**
+ Maps the table file data between `mappedLength` and `length` into reserved address space that already holds the file data before `mappedLength`.
+
+ @return `false` if the file data could not be mapped, in which case the address space past `mappedLength` stays reserved.
+
+ @discussion File data that is already mapped stays where it is, so pointers into it remain valid as the file grows.
+ */
+bool FICTableFileMapIntoReservedAddressSpace(int fileDescriptor, void *reservedBytes, size_t mappedLength, size_t length);
+
+/**
+ Unmaps a mapping or reserved address space.
+ */
+void FICTableFileUnmap(void *bytes, size_t length);
+
+/**
+ Writes mapped table file data back to disk. The start of the range doesn't have to be page-aligned.
+
+ @param synchronously Whether to wait for the data to be written, or only to start writing it.
+
+ @return `false` if the data could not be written, with `errno` set.
+ */
+bool FICTableFileFlush(void *bytes, size_t length, bool synchronously);
+
+/**
+ Pages mapped table file data in right away, asking for all of it from disk at once so it's read with one request instead of one page fault at a time.
+ */
+void FICTableFilePreheat(void *bytes, size_t length);
+
+/**
+ Advises the kernel that `count` entries starting at `index` are about to be read, so it can start reading them ahead of time. Failures are ignored.
+ */
+void FICTableFilePrefetch(const FICTableFile *file, size_t index, size_t count);
+
+/**
+ Releases the disk blocks of the entry at `index` without changing the length of the file. The entry reads as zeros afterward.
+
+ @return `false` if the file system can't punch holes, with `errno` set.
+ */
+bool FICTableFilePunchHole(const FICTableFile *file, size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,335 @@
+//
+//  FICTrace.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICTrace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+#define FICTraceEventWordCount (sizeof(FICTraceEvent) / sizeof(uint64_t))
+
+_Static_assert(sizeof(FICTraceEvent) % sizeof(uint64_t) == 0, "Trace events are copied a word at a time");
+
+// A slot's sequence is 2 * ticket + 1 while the span with that ticket is being written, and 2 * ticket + 2 once it's complete. Empty slots are 0.
+typedef struct {
+    _Atomic uint64_t sequence;
+    _Atomic uint64_t words[FICTraceEventWordCount];
+} FICTraceSlot;
+
+// Slots are padded to whole cache lines, so threads recording spans at once never share one
+#define FICTraceCacheLineLength 64
+#define FICTraceSlotLength ((sizeof(FICTraceSlot) + FICTraceCacheLineLength - 1) / FICTraceCacheLineLength * FICTraceCacheLineLength)
+
+typedef struct {
+    _Atomic bool enabled;
+    _Atomic uint64_t nextTicket;
+    _Atomic uint64_t firstTicket;                   // Spans before this one were discarded when the trace was last started
+    _Atomic(uint8_t *) slots;
+} FICTraceState;
+
+// Longest a span gets in the JSON document: its fixed fields, and a format name whose every byte is escaped as \u00XX
+#define FICTraceMaximumJSONEventLength (320 + FICTraceFormatNameLength * 6)
+
+static inline FICTraceSlot * _FICTraceSlot(uint8_t *slots, size_t capacity, uint64_t ticket) {
+    return (FICTraceSlot *)(slots + (size_t)(ticket & (capacity - 1)) * FICTraceSlotLength);
+}
+
+static uint64_t _FICTraceCurrentThreadID(void) {
+#ifdef __APPLE__
+    uint64_t threadID = 0;
+    pthread_threadid_np(NULL, &threadID);
+    return threadID;
+#else
+    return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+#pragma mark - Trace Lifecycle
+
+bool FICTraceInit(FICTrace *trace, size_t capacity) {
+    memset(trace, 0, sizeof(FICTrace));
+
+    FICTraceState *state = malloc(sizeof(FICTraceState));
+    if (state == NULL) {
+        return false;
+    }
+
+    atomic_init(&state->enabled, false);
+    atomic_init(&state->nextTicket, 0);
+    atomic_init(&state->firstTicket, 0);
+    atomic_init(&state->slots, NULL);
+
+    size_t roundedCapacity = 1;
+    while (roundedCapacity < capacity) {
+        roundedCapacity <<= 1;
+    }
+
+    trace->capacity = roundedCapacity;
+    trace->state = state;
+
+    return true;
+}
+
+void FICTraceDestroy(FICTrace *trace) {
+    FICTraceState *state = trace->state;
+    if (state != NULL) {
+        free(atomic_load_explicit(&state->slots, memory_order_relaxed));
+        free(state);
+    }
+
+    memset(trace, 0, sizeof(FICTrace));
+}
+
+bool FICTraceStart(FICTrace *trace) {
+    FICTraceState *state = trace->state;
+    if (state == NULL) {
+        return false;
+    }
+
+    if (atomic_load_explicit(&state->slots, memory_order_relaxed) == NULL) {
+        void *slots = NULL;
+        if (posix_memalign(&slots, FICTraceCacheLineLength, trace->capacity * FICTraceSlotLength) != 0) {
+            return false;
+        }
+
+        for (size_t i = 0; i < trace->capacity; i++) {
+            FICTraceSlot *slot = (FICTraceSlot *)((uint8_t *)slots + i * FICTraceSlotLength);
+            atomic_init(&slot->sequence, 0);
+            for (size_t j = 0; j < FICTraceEventWordCount; j++) {
+                atomic_init(&slot->words[j], 0);
+            }
+        }
+
+        atomic_store_explicit(&state->slots, (uint8_t *)slots, memory_order_release);
+    }
+
+    // Spans still being recorded from before are dropped as they finish, since their tickets come before the first one
+    atomic_store_explicit(&state->firstTicket, atomic_load_explicit(&state->nextTicket, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&state->enabled, true, memory_order_release);
+
+    return true;
+}
+
+void FICTraceStop(FICTrace *trace) {
+    FICTraceState *state = trace->state;
+    if (state != NULL) {
+        atomic_store_explicit(&state->enabled, false, memory_order_relaxed);
+    }
+}
+
+bool FICTraceIsEnabled(const FICTrace *trace) {
+    FICTraceState *state = trace->state;
+    return state != NULL && atomic_load_explicit(&state->enabled, memory_order_relaxed);
+}
+
+#pragma mark - Recording Spans
+
+void FICTraceRecord(FICTrace *trace, FICTraceStage stage, uint64_t startNanoseconds, uint64_t endNanoseconds, const uint8_t *entityUUIDBytes, const char *formatName) {
+    FICTraceState *state = trace->state;
+    if (state == NULL || atomic_load_explicit(&state->enabled, memory_order_acquire) == false) {
+        return;
+    }
+
+    FICTraceEvent event;
+    memset(&event, 0, sizeof(FICTraceEvent));
+    event.startNanoseconds = startNanoseconds;
+    event.durationNanoseconds = endNanoseconds > startNanoseconds ? endNanoseconds - startNanoseconds : 0;
+    event.threadID = _FICTraceCurrentThreadID();
+    event.stage = (uint32_t)stage;
+
+    if (entityUUIDBytes != NULL) {
+        event.hasEntityUUID = 1;
+        memcpy(event.entityUUIDBytes, entityUUIDBytes, sizeof(event.entityUUIDBytes));
+    }
+
+    if (formatName != NULL) {
+        // Names that don't fit are cut off between characters, so the JSON document stays valid UTF-8
+        size_t formatNameLength = strlen(formatName);
+        if (formatNameLength > FICTraceFormatNameLength) {
+            formatNameLength = FICTraceFormatNameLength;
+            while (formatNameLength > 0 && ((uint8_t)formatName[formatNameLength] & 0xC0) == 0x80) {
+                formatNameLength--;
+            }
+        }
+        memcpy(event.formatName, formatName, formatNameLength);
+    }
+
+    uint8_t *slots = atomic_load_explicit(&state->slots, memory_order_acquire);
+    uint64_t ticket = atomic_fetch_add_explicit(&state->nextTicket, 1, memory_order_relaxed);
+    FICTraceSlot *slot = _FICTraceSlot(slots, trace->capacity, ticket);
+
+    // Another thread is still writing a span from a lap ago, or has already written one from a later lap
+    uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    if ((sequence & 1) != 0 || sequence > 2 * ticket || atomic_compare_exchange_strong_explicit(&slot->sequence, &sequence, 2 * ticket + 1, memory_order_relaxed, memory_order_relaxed) == false) {
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    uint64_t words[FICTraceEventWordCount];
+    memcpy(words, &event, sizeof(FICTraceEvent));
+    for (size_t i = 0; i < FICTraceEventWordCount; i++) {
+        atomic_store_explicit(&slot->words[i], words[i], memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&slot->sequence, 2 * ticket + 2, memory_order_release);
+}
+
+#pragma mark - Reading Spans
+
+size_t FICTraceCopyEvents(const FICTrace *trace, FICTraceEvent *events, size_t maximumCount) {
+    FICTraceState *state = trace->state;
+    uint8_t *slots = state != NULL ? atomic_load_explicit(&state->slots, memory_order_acquire) : NULL;
+    if (slots == NULL || maximumCount == 0) {
+        return 0;
+    }
+
+    uint64_t nextTicket = atomic_load_explicit(&state->nextTicket, memory_order_relaxed);
+    uint64_t firstTicket = atomic_load_explicit(&state->firstTicket, memory_order_relaxed);
+    uint64_t ticketCount = maximumCount < trace->capacity ? maximumCount : trace->capacity;
+    if (nextTicket - firstTicket > ticketCount) {
+        firstTicket = nextTicket - ticketCount;
+    }
+
+    size_t count = 0;
+    for (uint64_t ticket = firstTicket; ticket < nextTicket && count < maximumCount; ticket++) {
+        FICTraceSlot *slot = _FICTraceSlot(slots, trace->capacity, ticket);
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (sequence != 2 * ticket + 2) {
+            continue;
+        }
+
+        uint64_t words[FICTraceEventWordCount];
+        for (size_t i = 0; i < FICTraceEventWordCount; i++) {
+            words[i] = atomic_load_explicit(&slot->words[i], memory_order_relaxed);
+        }
+
+        // The span is only kept if nothing started overwriting it while it was copied
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        memcpy(&events[count], words, sizeof(FICTraceEvent));
+        count++;
+    }
+
+    return count;
+}
+
+const char * FICTraceStageName(FICTraceStage stage) {
+    switch (stage) {
+        case FICTraceStageLookup:
+            return "lookup";
+        case FICTraceStageQueueWait:
+            return "queue wait";
+        case FICTraceStageSourceImageFetch:
+            return "source image fetch";
+        case FICTraceStageRestore:
+            return "restore";
+        case FICTraceStageScale:
+            return "downscale";
+        case FICTraceStageConvert:
+            return "convert";
+        case FICTraceStageDraw:
+            return "draw";
+        case FICTraceStageFlush:
+            return "flush";
+        case FICTraceStageMainQueueWait:
+            return "main queue wait";
+        case FICTraceStageCompletion:
+            return "completion";
+        default:
+            return "unknown";
+    }
+}
+
+#pragma mark - Exporting Spans
+
+static size_t _FICTraceWriteJSONString(char *buffer, const char *string, size_t maximumLength) {
+    static const char hexDigits[] = "0123456789abcdef";
+
+    size_t length = 0;
+    buffer[length++] = '"';
+    for (size_t i = 0; i < maximumLength && string[i] != '\0'; i++) {
+        uint8_t character = (uint8_t)string[i];
+        if (character == '"' || character == '\\') {
+            buffer[length++] = '\\';
+            buffer[length++] = (char)character;
+        } else if (character < 0x20) {
+            memcpy(buffer + length, "\\u00", 4);
+            length += 4;
+            buffer[length++] = hexDigits[character >> 4];
+            buffer[length++] = hexDigits[character & 0xF];
+        } else {
+            buffer[length++] = (char)character;
+        }
+    }
+    buffer[length++] = '"';
+
+    return length;
+}
+
+char * FICTraceCreateChromeJSON(const FICTrace *trace, size_t *length) {
+    size_t maximumCount = trace->capacity;
+    FICTraceEvent *events = maximumCount > 0 ? malloc(maximumCount * sizeof(FICTraceEvent)) : NULL;
+    size_t count = events != NULL ? FICTraceCopyEvents(trace, events, maximumCount) : 0;
+
+    static const char header[] = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    static const char footer[] = "\n]}\n";
+    char *document = malloc(sizeof(header) + count * FICTraceMaximumJSONEventLength + sizeof(footer));
+    if (document == NULL) {
+        free(events);
+        return NULL;
+    }
+
+    size_t documentLength = 0;
+    memcpy(document, header, sizeof(header) - 1);
+    documentLength += sizeof(header) - 1;
+
+    int processID = (int)getpid();
+    for (size_t i = 0; i < count; i++) {
+        const FICTraceEvent *event = &events[i];
+        documentLength += (size_t)sprintf(document + documentLength, "%s\n{\"name\":\"%s\",\"cat\":\"FastImageCache\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                                          i > 0 ? "," : "", FICTraceStageName((FICTraceStage)event->stage), processID, (unsigned long long)event->threadID,
+                                          (double)event->startNanoseconds / 1000.0, (double)event->durationNanoseconds / 1000.0);
+
+        bool needsSeparator = false;
+        if (event->hasEntityUUID) {
+            const uint8_t *bytes = event->entityUUIDBytes;
+            documentLength += (size_t)sprintf(document + documentLength, "\"entity\":\"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X\"",
+                                              bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7],
+                                              bytes[8], bytes[9], bytes[10], bytes[11], bytes[12], bytes[13], bytes[14], bytes[15]);
+            needsSeparator = true;
+        }
+
+        if (event->formatName[0] != '\0') {
+            documentLength += (size_t)sprintf(document + documentLength, "%s\"format\":", needsSeparator ? "," : "");
+            documentLength += _FICTraceWriteJSONString(document + documentLength, event->formatName, FICTraceFormatNameLength);
+        }
+
+        memcpy(document + documentLength, "}}", 2);
+        documentLength += 2;
+    }
+
+    memcpy(document + documentLength, footer, sizeof(footer));
+    documentLength += sizeof(footer) - 1;
+
+    free(events);
+
+    if (length != NULL) {
+        *length = documentLength;
+    }
+
+    return document;
+}
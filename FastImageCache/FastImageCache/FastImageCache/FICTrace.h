@@ -0,0 +1,143 @@
+//
+//  FICTrace.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICTrace_h
+#define FICTrace_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longer format names are cut off in recorded spans
+#define FICTraceFormatNameLength 48
+
+/**
+ The stages of retrieving and storing an image that are traced.
+
+ - `FICTraceStageLookup`: Looking up an entry and creating its image.
+ - `FICTraceStageQueueWait`: Waiting on a dispatch queue, or for a processing job to start.
+ - `FICTraceStageSourceImageFetch`: Waiting for a source image, from the moment it's requested until it's delivered.
+ - `FICTraceStageRestore`: Restoring an entry from cold storage.
+ - `FICTraceStageScale`: Downscaling an entry from a larger format.
+ - `FICTraceStageConvert`: Converting an entry from its primary format.
+ - `FICTraceStageDraw`: Running an entity's drawing block.
+ - `FICTraceStageFlush`: Writing entries to disk.
+ - `FICTraceStageMainQueueWait`: Waiting for the main queue to call completion blocks.
+ - `FICTraceStageCompletion`: Running completion blocks.
+ */
+typedef enum {
+    FICTraceStageLookup,
+    FICTraceStageQueueWait,
+    FICTraceStageSourceImageFetch,
+    FICTraceStageRestore,
+    FICTraceStageScale,
+    FICTraceStageConvert,
+    FICTraceStageDraw,
+    FICTraceStageFlush,
+    FICTraceStageMainQueueWait,
+    FICTraceStageCompletion,
+    FICTraceStageCount,
+} FICTraceStage;
+
+/**
+ One recorded span.
+ */
+typedef struct {
+    uint64_t startNanoseconds;
+    uint64_t durationNanoseconds;
+    uint64_t threadID;
+    uint32_t stage;
+    uint32_t hasEntityUUID;                 // Spans covering several entities, like batch lookups, have no entity
+    uint8_t entityUUIDBytes[16];
+    char formatName[FICTraceFormatNameLength];  // Not terminated if it fills the whole array
+} FICTraceEvent;
+
+/**
+ `FICTrace` records spans in a fixed-size ring buffer, keeping only the most recent ones.
+
+ @discussion Recording never takes a lock. Each span claims the next slot with an atomic increment and is copied in under a sequence number, so spans can be read while others are
+ being recorded without ever seeing half of one. A span whose slot is still being written by a thread that wrapped around the whole buffer is dropped rather than waited for.
+
+ Starting and stopping a trace must not happen on more than one thread at once, but recording and reading may happen on any number of threads at any time.
+ */
+typedef struct {
+    size_t capacity;                        // A power of two
+    void *state;
+} FICTrace;
+
+/**
+ Initializes a trace that keeps up to `capacity` spans, rounded up to a power of two. The spans themselves aren't allocated until the trace is first started.
+
+ @return `false` if memory for the trace could not be allocated.
+ */
+bool FICTraceInit(FICTrace *trace, size_t capacity);
+
+/**
+ Frees the memory owned by the trace. Nothing may record spans in it anymore.
+ */
+void FICTraceDestroy(FICTrace *trace);
+
+/**
+ Discards the spans recorded so far and starts recording new ones.
+
+ @return `false` if memory for the spans could not be allocated, in which case the trace stays stopped.
+ */
+bool FICTraceStart(FICTrace *trace);
+
+/**
+ Stops recording spans. The spans recorded so far can still be read.
+ */
+void FICTraceStop(FICTrace *trace);
+
+/**
+ Returns whether or not the trace is recording spans.
+ */
+bool FICTraceIsEnabled(const FICTrace *trace);
+
+/**
+ Records a span on the calling thread. Does nothing if the trace isn't recording spans.
+
+ @param entityUUIDBytes The entity the span belongs to, or `NULL`.
+
+ @param formatName The name of the format the span belongs to, or `NULL`.
+ */
+void FICTraceRecord(FICTrace *trace, FICTraceStage stage, uint64_t startNanoseconds, uint64_t endNanoseconds, const uint8_t *entityUUIDBytes, const char *formatName);
+
+/**
+ Copies up to `maximumCount` of the most recent spans into `events`, oldest first.
+
+ @return The number of spans copied.
+ */
+size_t FICTraceCopyEvents(const FICTrace *trace, FICTraceEvent *events, size_t maximumCount);
+
+/**
+ Returns the name a stage is shown with, such as "draw".
+ */
+const char * FICTraceStageName(FICTraceStage stage);
+
+/**
+ Writes the recorded spans as a JSON document in the Chrome trace event format, which trace viewers like chrome://tracing and Perfetto open directly.
+
+ @param length Receives the length of the document, not counting its terminating null character.
+
+ @return A null-terminated document to be freed with `free()`, or `NULL` if memory for it could not be allocated.
+
+ @discussion Every span is a complete event on the thread that recorded it, named after its stage, with its entity and format as arguments. Times are microseconds since the
+ monotonic clock of `FICStatisticsNanoseconds()` started.
+ */
+char * FICTraceCreateChromeJSON(const FICTrace *trace, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
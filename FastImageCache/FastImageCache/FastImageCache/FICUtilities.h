@@ -13,5 +13,6 @@ size_t FICByteAlignForCoreAnimation(size_t bytesPerRow);
 
 NSString * _Nullable FICStringWithUUIDBytes(CFUUIDBytes UUIDBytes);
 CFUUIDBytes FICUUIDBytesWithString(NSString * _Nonnull string);
+BOOL FICUUIDBytesEqual(CFUUIDBytes UUIDBytes, CFUUIDBytes otherUUIDBytes);
 CFUUIDBytes FICUUIDBytesFromMD5HashOfString(NSString * _Nonnull MD5Hash); // Useful for computing an entity's UUID from a URL, for example
 
@@ -28,30 +28,134 @@ inline size_t FICByteAlignForCoreAnimation(size_t bytesPerRow) {
 
 #pragma mark - Strings and UUIDs
 
+// Canonical UUID strings are 36 characters long: 32 hex digits in groups of 8-4-4-4-12, separated by hyphens
+#define FICUUIDStringLength 36
+
+static const size_t FICUUIDStringHyphenOffsets[4] = { 8, 13, 18, 23 };
+
+static const uint64_t FICHexOnes = 0x0101010101010101ull;
+
+static inline uint64_t _FICLoadLittleEndian64(const uint8_t *bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static inline void _FICStoreLittleEndian64(uint64_t word, uint8_t *bytes) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(bytes, &word, sizeof(uint64_t));
+}
+
+// Converts 8 ASCII hex digits to 4 bytes, handling all eight characters at once in a single 64-bit word. Returns NO if any character isn't a hex digit.
+static inline BOOL _FICParseHexDigits(const uint8_t *characters, uint8_t *bytes) {
+    const uint64_t highBits = FICHexOnes * 0x80;
+    uint64_t word = _FICLoadLittleEndian64(characters);
+    if ((word & highBits) != 0) {
+        return NO;
+    }
+    
+    // Each byte gets its high bit set if it's in range. None of the additions can carry into the next byte, since every byte is below 0x80.
+    uint64_t digitMask = (word + FICHexOnes * (0x80 - '0')) & ~(word + FICHexOnes * (0x7F - '9')) & highBits;
+    uint64_t lowercaseWord = word | (FICHexOnes * 0x20);
+    uint64_t letterMask = (lowercaseWord + FICHexOnes * (0x80 - 'a')) & ~(lowercaseWord + FICHexOnes * (0x7F - 'f')) & highBits;
+    if ((digitMask | letterMask) != highBits) {
+        return NO;
+    }
+    
+    // The low nibble of '0'-'9' is the digit's value, and the low nibble of 'a'-'f' and 'A'-'F' is 9 less than the letter's value
+    uint64_t nibbles = (word & (FICHexOnes * 0x0F)) + (letterMask >> 7) * 9;
+    uint64_t pairs = (nibbles << 4) | (nibbles >> 8);
+    
+    bytes[0] = (uint8_t)pairs;
+    bytes[1] = (uint8_t)(pairs >> 16);
+    bytes[2] = (uint8_t)(pairs >> 32);
+    bytes[3] = (uint8_t)(pairs >> 48);
+    
+    return YES;
+}
+
+// Converts 4 bytes to 8 uppercase ASCII hex digits, the inverse of _FICParseHexDigits
+static inline void _FICFormatHexDigits(const uint8_t *bytes, uint8_t *characters) {
+    uint64_t word = (uint64_t)bytes[0] | ((uint64_t)bytes[1] << 16) | ((uint64_t)bytes[2] << 32) | ((uint64_t)bytes[3] << 48);
+    uint64_t nibbles = ((word >> 4) & (FICHexOnes * 0x0F)) | ((word & (FICHexOnes * 0x0F)) << 8);
+    uint64_t letters = ((nibbles + FICHexOnes * 6) >> 4) & FICHexOnes;
+    
+    _FICStoreLittleEndian64(nibbles + FICHexOnes * '0' + letters * ('A' - '9' - 1), characters);
+}
+
 NSString * FICStringWithUUIDBytes(CFUUIDBytes UUIDBytes) {
-    NSString *UUIDString = nil;
-    CFUUIDRef UUIDRef = CFUUIDCreateFromUUIDBytes(kCFAllocatorDefault, UUIDBytes);
+    const uint8_t *bytes = (const uint8_t *)&UUIDBytes;
+    uint8_t digits[32];
+    for (size_t i = 0; i < 4; i++) {
+        _FICFormatHexDigits(bytes + i * 4, digits + i * 8);
+    }
     
-    if (UUIDRef != NULL) {
-        UUIDString = (__bridge_transfer NSString *)CFUUIDCreateString(kCFAllocatorDefault, UUIDRef);
-        CFRelease(UUIDRef);
+    uint8_t characters[FICUUIDStringLength];
+    size_t digitOffset = 0;
+    for (size_t i = 0, hyphenIndex = 0; i < FICUUIDStringLength; i++) {
+        if (hyphenIndex < 4 && i == FICUUIDStringHyphenOffsets[hyphenIndex]) {
+            characters[i] = '-';
+            hyphenIndex++;
+        } else {
+            characters[i] = digits[digitOffset++];
+        }
     }
     
-    return UUIDString;
+    return (__bridge_transfer NSString *)CFStringCreateWithBytes(kCFAllocatorDefault, characters, FICUUIDStringLength, kCFStringEncodingASCII, false);
 }
 
 CFUUIDBytes FICUUIDBytesWithString(NSString *string) {
     CFUUIDBytes UUIDBytes;
-    CFUUIDRef UUIDRef = CFUUIDCreateFromString(kCFAllocatorDefault, (CFStringRef)string);
+    memset(&UUIDBytes, 0, sizeof(UUIDBytes));
+    
+    // Canonical strings are parsed on the stack without creating a CFUUIDRef
+    CFStringRef stringRef = (__bridge CFStringRef)string;
+    uint8_t characters[FICUUIDStringLength];
+    BOOL parsed = NO;
+    
+    if (stringRef != NULL && CFStringGetLength(stringRef) == FICUUIDStringLength &&
+        CFStringGetBytes(stringRef, CFRangeMake(0, FICUUIDStringLength), kCFStringEncodingASCII, 0, false, characters, FICUUIDStringLength, NULL) == FICUUIDStringLength) {
+        uint8_t digits[32];
+        size_t digitCount = 0;
+        parsed = YES;
+        for (size_t i = 0, hyphenIndex = 0; i < FICUUIDStringLength && parsed; i++) {
+            if (hyphenIndex < 4 && i == FICUUIDStringHyphenOffsets[hyphenIndex]) {
+                parsed = characters[i] == '-';
+                hyphenIndex++;
+            } else {
+                digits[digitCount++] = characters[i];
+            }
+        }
+        
+        uint8_t *bytes = (uint8_t *)&UUIDBytes;
+        for (size_t i = 0; i < 4 && parsed; i++) {
+            parsed = _FICParseHexDigits(digits + i * 8, bytes + i * 4);
+        }
+    }
     
-    if (UUIDRef != NULL) {
-        UUIDBytes = CFUUIDGetUUIDBytes(UUIDRef);
-        CFRelease(UUIDRef);
+    if (parsed == NO) {
+        // Fall back to Core Foundation for any other form it accepts, such as UUIDs wrapped in braces
+        memset(&UUIDBytes, 0, sizeof(UUIDBytes));
+        CFUUIDRef UUIDRef = stringRef != NULL ? CFUUIDCreateFromString(kCFAllocatorDefault, stringRef) : NULL;
+        
+        if (UUIDRef != NULL) {
+            UUIDBytes = CFUUIDGetUUIDBytes(UUIDRef);
+            CFRelease(UUIDRef);
+        }
     }
     
     return UUIDBytes;
 }
 
+BOOL FICUUIDBytesEqual(CFUUIDBytes UUIDBytes, CFUUIDBytes otherUUIDBytes) {
+    return memcmp(&UUIDBytes, &otherUUIDBytes, sizeof(CFUUIDBytes)) == 0;
+}
+
 CFUUIDBytes FICUUIDBytesFromMD5HashOfString(NSString *MD5Hash) {
     const char *UTF8String = [MD5Hash UTF8String];
     CFUUIDBytes UUIDBytes;
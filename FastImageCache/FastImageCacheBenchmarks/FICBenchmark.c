@@ -0,0 +1,686 @@
+//
+//  FICBenchmark.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICBenchmarkTable.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+typedef enum {
+    FICBenchmarkWorkloadUniform,
+    FICBenchmarkWorkloadZipfian,
+    FICBenchmarkWorkloadScan,
+    FICBenchmarkWorkloadMixed,
+} FICBenchmarkWorkload;
+
+static const char *const FICBenchmarkWorkloadNames[] = { "uniform", "zipfian", "scan", "mixed" };
+
+typedef struct {
+    char directoryPath[1024];
+    size_t imageSize;
+    size_t entryCount;
+    size_t keyCount;
+    size_t operationCount;
+    size_t threadCounts[16];
+    size_t threadCountCount;
+    bool workloads[4];
+    char benchmarks[512];
+    double zipfExponent;
+    double readRatio;
+    FICEvictionPolicyKind evictionPolicyKind;
+    size_t maximumMappedChunkCount;
+    size_t repeatCount;
+    bool synchronousWrites;
+    bool reservedMapping;
+} FICBenchmarkOptions;
+
+struct FICBenchmarkRun;
+
+// Performs operation `operation` of a thread, returning whether it was a hit for benchmarks that have them
+typedef bool (*FICBenchmarkOperation)(struct FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes);
+
+typedef struct {
+    struct FICBenchmarkRun *run;
+    size_t threadIndex;
+    uint64_t *latencies;
+    size_t hitCount;
+    uint64_t randomState;
+    void *imageBytes;
+} FICBenchmarkThread;
+
+typedef struct FICBenchmarkRun {
+    const FICBenchmarkOptions *options;
+    FICBenchmarkTable *table;
+    FICBenchmarkOperation operation;
+    FICBenchmarkWorkload workload;
+    size_t threadCount;
+    size_t operationCount;                  // Per thread
+    size_t keyOffset;                       // Keys at or past this one have never been stored in the table
+    const double *zipfianDistribution;
+    FICBenchmarkThread *threads;
+
+    pthread_mutex_t startLock;
+    pthread_cond_t startCondition;
+    bool started;
+} FICBenchmarkRun;
+
+static uint64_t _FICBenchmarkNanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+// xorshift64*, so every thread draws from a generator of its own
+static uint64_t _FICBenchmarkRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static double _FICBenchmarkRandomDouble(uint64_t *state) {
+    return (double)(_FICBenchmarkRandom(state) >> 11) / (double)(1ull << 53);
+}
+
+static void _FICBenchmarkUUIDBytes(uint64_t key, uint8_t entityUUIDBytes[16], uint8_t sourceImageUUIDBytes[16]) {
+    uint64_t tag = 0xa5a5a5a5a5a5a5a5ull;
+    memcpy(entityUUIDBytes, &key, sizeof(key));
+    memcpy(entityUUIDBytes + 8, &tag, sizeof(tag));
+    if (sourceImageUUIDBytes != NULL) {
+        uint64_t sourceKey = ~key;
+        memcpy(sourceImageUUIDBytes, &sourceKey, sizeof(sourceKey));
+        memcpy(sourceImageUUIDBytes + 8, &tag, sizeof(tag));
+    }
+}
+
+// The cumulative distribution of key ranks under Zipf's law, which is searched for each key drawn
+static double * _FICBenchmarkZipfianDistribution(size_t keyCount, double exponent) {
+    double *distribution = malloc(keyCount * sizeof(double));
+    if (distribution == NULL) {
+        return NULL;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < keyCount; i++) {
+        sum += 1.0 / pow((double)(i + 1), exponent);
+        distribution[i] = sum;
+    }
+    for (size_t i = 0; i < keyCount; i++) {
+        distribution[i] /= sum;
+    }
+
+    return distribution;
+}
+
+static uint64_t _FICBenchmarkWorkloadKey(FICBenchmarkRun *run, FICBenchmarkThread *thread, size_t operation) {
+    size_t keyCount = run->options->keyCount;
+
+    switch (run->workload) {
+        case FICBenchmarkWorkloadUniform:
+            return _FICBenchmarkRandom(&thread->randomState) % keyCount;
+        case FICBenchmarkWorkloadScan:
+            // Each thread scans the whole key space from its own starting point
+            return (thread->threadIndex * keyCount / run->threadCount + operation) % keyCount;
+        case FICBenchmarkWorkloadZipfian:
+        case FICBenchmarkWorkloadMixed: {
+            double u = _FICBenchmarkRandomDouble(&thread->randomState);
+            size_t low = 0;
+            size_t high = keyCount - 1;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (run->zipfianDistribution[middle] < u) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            return low;
+        }
+    }
+
+    return 0;
+}
+
+#pragma mark - Operations
+
+// Looks an image up and stores it on a miss, the way the image cache does
+static bool _FICBenchmarkRetrieveOrStore(FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes) {
+    FICBenchmarkThread *thread = &run->threads[threadIndex];
+    uint64_t key = _FICBenchmarkWorkloadKey(run, thread, operation);
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    _FICBenchmarkUUIDBytes(key, entityUUIDBytes, sourceImageUUIDBytes);
+
+    if (run->workload == FICBenchmarkWorkloadMixed && _FICBenchmarkRandomDouble(&thread->randomState) >= run->options->readRatio) {
+        FICBenchmarkTableSetEntry(run->table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes);
+        return false;
+    }
+
+    bool hit = FICBenchmarkTableGetEntry(run->table, entityUUIDBytes, imageBytes);
+    if (hit == false) {
+        FICBenchmarkTableSetEntry(run->table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes);
+    }
+
+    return hit;
+}
+
+// Stores keys no other thread stores
+static bool _FICBenchmarkSet(FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes) {
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    _FICBenchmarkUUIDBytes(run->keyOffset + threadIndex * run->operationCount + operation, entityUUIDBytes, sourceImageUUIDBytes);
+    return FICBenchmarkTableSetEntry(run->table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes);
+}
+
+// Retrieves keys that were stored before the run
+static bool _FICBenchmarkGet(FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes) {
+    (void)operation;
+    uint8_t entityUUIDBytes[16];
+    _FICBenchmarkUUIDBytes(_FICBenchmarkRandom(&run->threads[threadIndex].randomState) % run->keyOffset, entityUUIDBytes, NULL);
+    return FICBenchmarkTableGetEntry(run->table, entityUUIDBytes, imageBytes);
+}
+
+static bool _FICBenchmarkExists(FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes) {
+    (void)operation;
+    (void)imageBytes;
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    _FICBenchmarkUUIDBytes(_FICBenchmarkRandom(&run->threads[threadIndex].randomState) % run->keyOffset, entityUUIDBytes, sourceImageUUIDBytes);
+    return FICBenchmarkTableEntryExists(run->table, entityUUIDBytes, sourceImageUUIDBytes);
+}
+
+// Deletes the keys stored before the run, each thread its own share
+static bool _FICBenchmarkDelete(FICBenchmarkRun *run, size_t threadIndex, size_t operation, void *imageBytes) {
+    (void)imageBytes;
+    uint8_t entityUUIDBytes[16];
+    _FICBenchmarkUUIDBytes(threadIndex * run->operationCount + operation, entityUUIDBytes, NULL);
+    FICBenchmarkTableDeleteEntry(run->table, entityUUIDBytes);
+    return true;
+}
+
+#pragma mark - Running Benchmarks
+
+static void * _FICBenchmarkThreadMain(void *context) {
+    FICBenchmarkThread *thread = context;
+    FICBenchmarkRun *run = thread->run;
+
+    pthread_mutex_lock(&run->startLock);
+    while (run->started == false) {
+        pthread_cond_wait(&run->startCondition, &run->startLock);
+    }
+    pthread_mutex_unlock(&run->startLock);
+
+    for (size_t i = 0; i < run->operationCount; i++) {
+        uint64_t start = _FICBenchmarkNanoseconds();
+        bool hit = run->operation(run, thread->threadIndex, i, thread->imageBytes);
+        thread->latencies[i] = _FICBenchmarkNanoseconds() - start;
+        thread->hitCount += hit ? 1 : 0;
+    }
+
+    return NULL;
+}
+
+static int _FICBenchmarkCompareLatencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t _FICBenchmarkPercentile(const uint64_t *sortedLatencies, size_t count, double percentile) {
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t rank = (size_t)ceil(percentile * (double)count);
+    return sortedLatencies[rank > 0 ? rank - 1 : 0];
+}
+
+static void _FICBenchmarkReport(const char *benchmark, const char *workload, size_t threadCount, uint64_t *latencies, size_t count, double seconds, size_t hitCount,
+                                const FICBenchmarkTableStatistics *statistics, const FICBenchmarkOptions *options) {
+    qsort(latencies, count, sizeof(uint64_t), _FICBenchmarkCompareLatencies);
+
+    printf("{\"benchmark\":\"%s\",\"workload\":\"%s\",\"threads\":%zu,\"operations\":%zu,\"seconds\":%.6f,\"operations_per_second\":%.1f,"
+           "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"hit_ratio\":%.4f,"
+           "\"evictions\":%llu,\"chunk_mappings\":%llu,\"chunk_unmappings\":%llu,\"journal_writes\":%llu,"
+           "\"image_size\":%zu,\"entries\":%zu,\"keys\":%zu,\"eviction_policy\":\"%s\",\"synchronous_writes\":%s,\"reserved_mapping\":%s}\n",
+           benchmark, workload, threadCount, count, seconds, seconds > 0 ? (double)count / seconds : 0,
+           (unsigned long long)_FICBenchmarkPercentile(latencies, count, 0.50), (unsigned long long)_FICBenchmarkPercentile(latencies, count, 0.99),
+           (unsigned long long)_FICBenchmarkPercentile(latencies, count, 0.999), (unsigned long long)(count > 0 ? latencies[count - 1] : 0),
+           count > 0 ? (double)hitCount / (double)count : 0,
+           (unsigned long long)statistics->evictionCount, (unsigned long long)statistics->mappingCount, (unsigned long long)statistics->unmappingCount,
+           (unsigned long long)statistics->journalWriteCount, options->imageSize, options->entryCount, options->keyCount,
+           options->evictionPolicyKind == FICEvictionPolicyKindTinyLFU ? "tinylfu" : "lru", options->synchronousWrites ? "true" : "false",
+           options->reservedMapping ? "true" : "false");
+    fflush(stdout);
+}
+
+static FICBenchmarkTableConfiguration _FICBenchmarkConfiguration(const FICBenchmarkOptions *options, size_t maximumMappedChunkCount) {
+    FICBenchmarkTableConfiguration configuration = {
+        .directoryPath = options->directoryPath,
+        .name = "FICBenchmark",
+        .imageLength = options->imageSize * options->imageSize * 4,
+        .maximumCount = options->entryCount,
+        .evictionPolicyKind = options->evictionPolicyKind,
+        .maximumMappedChunkCount = maximumMappedChunkCount,
+        .synchronousWrites = options->synchronousWrites,
+        .reservedMapping = options->reservedMapping,
+    };
+
+    return configuration;
+}
+
+// Opens a fresh table, filled to its maximum count with the first keys if `filled` is true, and written out with a checkpoint
+static bool _FICBenchmarkOpenTable(FICBenchmarkTable *table, const FICBenchmarkOptions *options, size_t maximumMappedChunkCount, bool filled) {
+    FICBenchmarkTableConfiguration configuration = _FICBenchmarkConfiguration(options, maximumMappedChunkCount);
+    FICBenchmarkTableRemoveFiles(options->directoryPath, configuration.name);
+    if (FICBenchmarkTableOpen(table, &configuration) == false) {
+        fprintf(stderr, "fic-benchmark: couldn't open a table in %s\n", options->directoryPath);
+        return false;
+    }
+
+    void *imageBytes = calloc(1, configuration.imageLength);
+    // The maximum count of a table is rounded up to fill its last chunk
+    size_t entryCount = filled ? table->engine.maximumCount : 0;
+    for (size_t key = 0; key < entryCount && imageBytes != NULL; key++) {
+        uint8_t entityUUIDBytes[16];
+        uint8_t sourceImageUUIDBytes[16];
+        _FICBenchmarkUUIDBytes(key, entityUUIDBytes, sourceImageUUIDBytes);
+        memset(imageBytes, (int)(key & 0xff), configuration.imageLength);
+        FICBenchmarkTableSetEntry(table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes);
+    }
+    free(imageBytes);
+
+    return FICBenchmarkTableSaveMetadata(table);
+}
+
+// Runs `operationCount` operations on each of `threadCount` threads against the table, and reports them
+static void _FICBenchmarkRun(const char *benchmark, FICBenchmarkRun *run, size_t threadCount, size_t operationCount) {
+    const FICBenchmarkOptions *options = run->options;
+    size_t imageLength = options->imageSize * options->imageSize * 4;
+    FICBenchmarkTableStatistics initialStatistics = FICBenchmarkTableGetStatistics(run->table);
+
+    run->threadCount = threadCount;
+    run->operationCount = operationCount;
+    run->threads = calloc(threadCount, sizeof(FICBenchmarkThread));
+    pthread_t *threadIdentifiers = calloc(threadCount, sizeof(pthread_t));
+    uint64_t *latencies = malloc(threadCount * operationCount * sizeof(uint64_t) + 1);
+    if (run->threads == NULL || threadIdentifiers == NULL || latencies == NULL) {
+        fprintf(stderr, "fic-benchmark: out of memory\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&run->startLock, NULL);
+    pthread_cond_init(&run->startCondition, NULL);
+    run->started = false;
+
+    for (size_t i = 0; i < threadCount; i++) {
+        FICBenchmarkThread *thread = &run->threads[i];
+        thread->run = run;
+        thread->threadIndex = i;
+        thread->latencies = latencies + i * operationCount;
+        thread->randomState = 0x9e3779b97f4a7c15ull * (i + 1);
+        thread->imageBytes = malloc(imageLength);
+        memset(thread->imageBytes, (int)i, imageLength);
+        pthread_create(&threadIdentifiers[i], NULL, _FICBenchmarkThreadMain, thread);
+    }
+
+    uint64_t start = _FICBenchmarkNanoseconds();
+    pthread_mutex_lock(&run->startLock);
+    run->started = true;
+    pthread_cond_broadcast(&run->startCondition);
+    pthread_mutex_unlock(&run->startLock);
+
+    size_t hitCount = 0;
+    for (size_t i = 0; i < threadCount; i++) {
+        pthread_join(threadIdentifiers[i], NULL);
+        hitCount += run->threads[i].hitCount;
+        free(run->threads[i].imageBytes);
+    }
+    double seconds = (double)(_FICBenchmarkNanoseconds() - start) / 1e9;
+
+    FICBenchmarkTableStatistics statistics = FICBenchmarkTableGetStatistics(run->table);
+    statistics.evictionCount -= initialStatistics.evictionCount;
+    statistics.mappingCount -= initialStatistics.mappingCount;
+    statistics.unmappingCount -= initialStatistics.unmappingCount;
+    statistics.journalWriteCount -= initialStatistics.journalWriteCount;
+
+    _FICBenchmarkReport(benchmark, run->operation == _FICBenchmarkRetrieveOrStore ? FICBenchmarkWorkloadNames[run->workload] : "uniform", threadCount, latencies,
+                        threadCount * operationCount, seconds, hitCount, &statistics, options);
+
+    pthread_mutex_destroy(&run->startLock);
+    pthread_cond_destroy(&run->startCondition);
+    free(latencies);
+    free(threadIdentifiers);
+    free(run->threads);
+    run->threads = NULL;
+}
+
+static void _FICBenchmarkTableOperation(const FICBenchmarkOptions *options, const char *benchmark, FICBenchmarkOperation operation, size_t threadCount) {
+    size_t entryCount = options->entryCount;
+    size_t operationCount = options->operationCount;
+    bool filled = true;
+    size_t maximumMappedChunkCount = options->maximumMappedChunkCount;
+
+    if (strcmp(benchmark, "set") == 0) {
+        // Stores into an empty table, so nothing is evicted
+        filled = false;
+        operationCount = entryCount / threadCount;
+    } else if (strcmp(benchmark, "evict") == 0) {
+        // Stores new keys into a full table, so every store evicts an entry
+        operationCount = entryCount / threadCount;
+    } else if (strcmp(benchmark, "delete") == 0) {
+        operationCount = entryCount / threadCount;
+    } else if (strcmp(benchmark, "chunk-map") == 0) {
+        // No chunk stays mapped once nothing uses it, so most retrievals map and unmap one
+        maximumMappedChunkCount = 0;
+    }
+
+    FICBenchmarkTable table;
+    if (_FICBenchmarkOpenTable(&table, options, maximumMappedChunkCount, filled) == false) {
+        return;
+    }
+
+    FICBenchmarkRun run = {
+        .options = options,
+        .table = &table,
+        .operation = operation,
+        .workload = FICBenchmarkWorkloadUniform,
+        .keyOffset = FICBenchmarkTableEntryCount(&table),
+    };
+    if (operationCount > 0) {
+        _FICBenchmarkRun(benchmark, &run, threadCount, operationCount);
+    }
+
+    FICBenchmarkTableClose(&table);
+}
+
+static void _FICBenchmarkWorkload(const FICBenchmarkOptions *options, FICBenchmarkWorkload workload, const double *zipfianDistribution, size_t threadCount) {
+    FICBenchmarkTable table;
+    if (_FICBenchmarkOpenTable(&table, options, options->maximumMappedChunkCount, false) == false) {
+        return;
+    }
+
+    FICBenchmarkRun run = {
+        .options = options,
+        .table = &table,
+        .operation = _FICBenchmarkRetrieveOrStore,
+        .workload = workload,
+        .zipfianDistribution = zipfianDistribution,
+    };
+    _FICBenchmarkRun("workload", &run, threadCount, options->operationCount);
+
+    FICBenchmarkTableClose(&table);
+}
+
+// Times opening a table whose journal holds a checkpoint of a full table followed by a record for every entry
+static void _FICBenchmarkOpen(const FICBenchmarkOptions *options) {
+    FICBenchmarkTable table;
+    if (_FICBenchmarkOpenTable(&table, options, options->maximumMappedChunkCount, true) == false) {
+        return;
+    }
+
+    size_t entryCount = FICBenchmarkTableEntryCount(&table);
+    for (size_t key = 0; key < entryCount; key++) {
+        uint8_t entityUUIDBytes[16];
+        _FICBenchmarkUUIDBytes(key, entityUUIDBytes, NULL);
+        FICBenchmarkTableGetEntry(&table, entityUUIDBytes, NULL);
+    }
+    FICBenchmarkTableClose(&table);
+
+    FICBenchmarkTableConfiguration configuration = _FICBenchmarkConfiguration(options, options->maximumMappedChunkCount);
+    uint64_t *latencies = malloc(options->repeatCount * sizeof(uint64_t));
+    size_t hitCount = 0;
+    uint64_t start = _FICBenchmarkNanoseconds();
+    for (size_t i = 0; i < options->repeatCount; i++) {
+        uint64_t openStart = _FICBenchmarkNanoseconds();
+        bool opened = FICBenchmarkTableOpen(&table, &configuration);
+        latencies[i] = _FICBenchmarkNanoseconds() - openStart;
+
+        // Closing flushes nothing, since the table was only opened, so it doesn't change the journal the next open replays
+        if (opened) {
+            hitCount += FICBenchmarkTableEntryCount(&table) == entryCount ? 1 : 0;
+            FICBenchmarkTableClose(&table);
+        }
+    }
+    double seconds = (double)(_FICBenchmarkNanoseconds() - start) / 1e9;
+
+    FICBenchmarkTableStatistics statistics = { 0 };
+    _FICBenchmarkReport("open", "uniform", 1, latencies, options->repeatCount, seconds, hitCount, &statistics, options);
+    free(latencies);
+}
+
+static void _FICBenchmarkSaveMetadata(const FICBenchmarkOptions *options) {
+    FICBenchmarkTable table;
+    if (_FICBenchmarkOpenTable(&table, options, options->maximumMappedChunkCount, true) == false) {
+        return;
+    }
+
+    uint64_t *latencies = malloc(options->repeatCount * sizeof(uint64_t));
+    size_t hitCount = 0;
+    uint64_t start = _FICBenchmarkNanoseconds();
+    for (size_t i = 0; i < options->repeatCount; i++) {
+        uint64_t saveStart = _FICBenchmarkNanoseconds();
+        hitCount += FICBenchmarkTableSaveMetadata(&table) ? 1 : 0;
+        latencies[i] = _FICBenchmarkNanoseconds() - saveStart;
+    }
+    double seconds = (double)(_FICBenchmarkNanoseconds() - start) / 1e9;
+
+    FICBenchmarkTableStatistics statistics = FICBenchmarkTableGetStatistics(&table);
+    _FICBenchmarkReport("save-metadata", "uniform", 1, latencies, options->repeatCount, seconds, hitCount, &statistics, options);
+    free(latencies);
+
+    FICBenchmarkTableClose(&table);
+}
+
+#pragma mark - Parsing Options
+
+static void _FICBenchmarkPrintUsage(void) {
+    fprintf(stderr,
+            "usage: fic-benchmark [options]\n"
+            "\n"
+            "Runs the image table storage engine against synthetic workloads and prints one JSON object per result.\n"
+            "\n"
+            "  --directory PATH        Where table files are created (default: a new temporary directory)\n"
+            "  --benchmarks LIST       Any of set,get,exists,delete,evict,open,save-metadata,chunk-map,workload (default: all)\n"
+            "  --workloads LIST        Any of uniform,zipfian,scan,mixed (default: all)\n"
+            "  --threads LIST          Thread counts to run with (default: 1,2,4)\n"
+            "  --operations N          Operations per thread (default: 20000)\n"
+            "  --entries N             Maximum entry count of the table (default: 2000)\n"
+            "  --keys N                Distinct entities of the workloads (default: 4 times the entry count)\n"
+            "  --image-size N          Width and height of the 32-bit images, in pixels (default: 64)\n"
+            "  --zipf-exponent X       Skew of the zipfian and mixed workloads (default: 0.99)\n"
+            "  --read-ratio X          Fraction of mixed operations that retrieve before storing (default: 0.9)\n"
+            "  --eviction-policy NAME  lru or tinylfu (default: lru)\n"
+            "  --mapped-chunks N       Unused chunks kept mapped (default: 16)\n"
+            "  --repeat N              Repetitions of open and save-metadata (default: 20)\n"
+            "  --synchronous           Sync every stored entry to disk before returning\n"
+            "  --reserved-mapping      Map the whole table file into address space reserved up front instead of in chunks\n"
+            "  --quick                 Small sizes, for checking that everything runs\n");
+}
+
+static bool _FICBenchmarkListContains(const char *list, const char *name) {
+    size_t nameLength = strlen(name);
+    for (const char *item = list; item != NULL && *item != '\0'; ) {
+        const char *end = strchr(item, ',');
+        size_t itemLength = end != NULL ? (size_t)(end - item) : strlen(item);
+        if (itemLength == nameLength && strncmp(item, name, nameLength) == 0) {
+            return true;
+        }
+        item = end != NULL ? end + 1 : NULL;
+    }
+
+    return false;
+}
+
+static bool _FICBenchmarkParseOptions(int argc, char **argv, FICBenchmarkOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->imageSize = 64;
+    options->entryCount = 2000;
+    options->operationCount = 20000;
+    options->threadCounts[0] = 1;
+    options->threadCounts[1] = 2;
+    options->threadCounts[2] = 4;
+    options->threadCountCount = 3;
+    options->zipfExponent = 0.99;
+    options->readRatio = 0.9;
+    options->evictionPolicyKind = FICEvictionPolicyKindLRU;
+    options->maximumMappedChunkCount = 16;
+    options->repeatCount = 20;
+    strcpy(options->benchmarks, "set,get,exists,delete,evict,open,save-metadata,chunk-map,workload");
+    const char *workloads = "uniform,zipfian,scan,mixed";
+
+    for (int i = 1; i < argc; i++) {
+        const char *argument = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool takesValue = true;
+
+        if (strcmp(argument, "--quick") == 0) {
+            options->imageSize = 16;
+            options->entryCount = 256;
+            options->operationCount = 2000;
+            options->repeatCount = 3;
+            takesValue = false;
+        } else if (strcmp(argument, "--synchronous") == 0) {
+            options->synchronousWrites = true;
+            takesValue = false;
+        } else if (strcmp(argument, "--reserved-mapping") == 0) {
+            options->reservedMapping = true;
+            takesValue = false;
+        } else if (strcmp(argument, "--help") == 0 || value == NULL) {
+            return false;
+        } else if (strcmp(argument, "--directory") == 0) {
+            snprintf(options->directoryPath, sizeof(options->directoryPath), "%s", value);
+        } else if (strcmp(argument, "--benchmarks") == 0) {
+            snprintf(options->benchmarks, sizeof(options->benchmarks), "%s", value);
+        } else if (strcmp(argument, "--workloads") == 0) {
+            workloads = value;
+        } else if (strcmp(argument, "--threads") == 0) {
+            options->threadCountCount = 0;
+            for (const char *item = value; item != NULL && options->threadCountCount < 16; ) {
+                size_t threadCount = strtoul(item, NULL, 10);
+                if (threadCount > 0) {
+                    options->threadCounts[options->threadCountCount++] = threadCount;
+                }
+                const char *end = strchr(item, ',');
+                item = end != NULL ? end + 1 : NULL;
+            }
+        } else if (strcmp(argument, "--operations") == 0) {
+            options->operationCount = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--entries") == 0) {
+            options->entryCount = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--keys") == 0) {
+            options->keyCount = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--image-size") == 0) {
+            options->imageSize = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--zipf-exponent") == 0) {
+            options->zipfExponent = strtod(value, NULL);
+        } else if (strcmp(argument, "--read-ratio") == 0) {
+            options->readRatio = strtod(value, NULL);
+        } else if (strcmp(argument, "--eviction-policy") == 0) {
+            if (strcmp(value, "tinylfu") == 0) {
+                options->evictionPolicyKind = FICEvictionPolicyKindTinyLFU;
+            } else if (strcmp(value, "lru") != 0) {
+                return false;
+            }
+        } else if (strcmp(argument, "--mapped-chunks") == 0) {
+            options->maximumMappedChunkCount = strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--repeat") == 0) {
+            options->repeatCount = strtoul(value, NULL, 10);
+        } else {
+            return false;
+        }
+
+        i += takesValue ? 1 : 0;
+    }
+
+    for (size_t i = 0; i < sizeof(FICBenchmarkWorkloadNames) / sizeof(FICBenchmarkWorkloadNames[0]); i++) {
+        options->workloads[i] = _FICBenchmarkListContains(workloads, FICBenchmarkWorkloadNames[i]);
+    }
+    if (options->keyCount == 0) {
+        options->keyCount = options->entryCount * 4;
+    }
+
+    return options->imageSize > 0 && options->entryCount > 0 && options->threadCountCount > 0 && options->repeatCount > 0;
+}
+
+#pragma mark - Main
+
+int main(int argc, char **argv) {
+    FICBenchmarkOptions options;
+    if (_FICBenchmarkParseOptions(argc, argv, &options) == false) {
+        _FICBenchmarkPrintUsage();
+        return 2;
+    }
+
+    bool removesDirectory = options.directoryPath[0] == '\0';
+    if (removesDirectory) {
+        const char *temporaryDirectoryPath = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+        snprintf(options.directoryPath, sizeof(options.directoryPath), "%s/fic-benchmark.XXXXXX", temporaryDirectoryPath);
+        if (mkdtemp(options.directoryPath) == NULL) {
+            fprintf(stderr, "fic-benchmark: couldn't create a directory in %s\n", temporaryDirectoryPath);
+            return 1;
+        }
+    }
+
+    const struct {
+        const char *name;
+        FICBenchmarkOperation operation;
+    } tableOperations[] = {
+        { "set", _FICBenchmarkSet },
+        { "get", _FICBenchmarkGet },
+        { "exists", _FICBenchmarkExists },
+        { "delete", _FICBenchmarkDelete },
+        { "evict", _FICBenchmarkSet },
+        { "chunk-map", _FICBenchmarkGet },
+    };
+
+    for (size_t t = 0; t < options.threadCountCount; t++) {
+        size_t threadCount = options.threadCounts[t];
+        for (size_t i = 0; i < sizeof(tableOperations) / sizeof(tableOperations[0]); i++) {
+            if (_FICBenchmarkListContains(options.benchmarks, tableOperations[i].name)) {
+                _FICBenchmarkTableOperation(&options, tableOperations[i].name, tableOperations[i].operation, threadCount);
+            }
+        }
+    }
+
+    if (_FICBenchmarkListContains(options.benchmarks, "open")) {
+        _FICBenchmarkOpen(&options);
+    }
+    if (_FICBenchmarkListContains(options.benchmarks, "save-metadata")) {
+        _FICBenchmarkSaveMetadata(&options);
+    }
+
+    if (_FICBenchmarkListContains(options.benchmarks, "workload")) {
+        double *zipfianDistribution = _FICBenchmarkZipfianDistribution(options.keyCount, options.zipfExponent);
+        for (size_t t = 0; t < options.threadCountCount; t++) {
+            for (size_t w = 0; w < sizeof(options.workloads) / sizeof(options.workloads[0]); w++) {
+                bool needsDistribution = w == FICBenchmarkWorkloadZipfian || w == FICBenchmarkWorkloadMixed;
+                if (options.workloads[w] && (needsDistribution == false || zipfianDistribution != NULL)) {
+                    _FICBenchmarkWorkload(&options, (FICBenchmarkWorkload)w, zipfianDistribution, options.threadCounts[t]);
+                }
+            }
+        }
+        free(zipfianDistribution);
+    }
+
+    FICBenchmarkTableRemoveFiles(options.directoryPath, "FICBenchmark");
+    if (removesDirectory) {
+        rmdir(options.directoryPath);
+    }
+
+    return 0;
+}
@@ -0,0 +1,452 @@
+//
+//  FICBenchmarkTable.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICBenchmarkTable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+// Journal records are appended to the file once this many have built up
+static const size_t FICBenchmarkTableJournalBatchCount = 256;
+
+static char * _FICBenchmarkTablePath(const char *directoryPath, const char *name, const char *extension) {
+    size_t length = strlen(directoryPath) + strlen(name) + strlen(extension) + 3;
+    char *path = malloc(length);
+    if (path != NULL) {
+        snprintf(path, length, "%s/%s.%s", directoryPath, name, extension);
+    }
+
+    return path;
+}
+
+// Stands in for the serialized image format, so metadata written for a different layout is discarded
+static size_t _FICBenchmarkTableFormat(const FICBenchmarkTable *table, char *format, size_t length) {
+    int formatLength = snprintf(format, length, "{\"imageLength\":%zu,\"maximumCount\":%zu}", table->engine.file.imageLength, table->engine.maximumCount);
+    return formatLength > 0 ? (size_t)formatLength : 0;
+}
+
+#pragma mark - Engine Delegate
+
+static bool _FICBenchmarkTableMetadataFormatMatches(void *context, const void *formatBytes, size_t formatLength) {
+    char format[128];
+    size_t expectedFormatLength = _FICBenchmarkTableFormat(context, format, sizeof(format));
+    return formatLength == expectedFormatLength && memcmp(formatBytes, format, formatLength) == 0;
+}
+
+// Mirrors -[FICImageTable _entryCountDidChange:]. Called with the engine lock held for writing, once the table file has been resized.
+static bool _FICBenchmarkTableEntryCountDidChange(void *context, size_t oldEntryCount) {
+    (void)oldEntryCount;
+    FICBenchmarkTable *table = context;
+    if (table->reservedBytes == NULL) {
+        return true;
+    }
+
+    // The file only grows past the reserved address space when no entry can be evicted, and what's past it is mapped in chunks
+    size_t fileLength = (size_t)table->engine.file.length;
+    if (fileLength > table->reservedLength) {
+        fileLength = table->reservedLength;
+    }
+
+    // Entries past the mapped file data couldn't be used, so the engine puts the file back to its old length
+    if (fileLength > table->reservedMappedLength) {
+        if (FICTableFileMapIntoReservedAddressSpace(table->engine.file.fileDescriptor, table->reservedBytes, table->reservedMappedLength, fileLength) == false) {
+            return false;
+        }
+
+        FICStatisticsAdd(&table->engine.statistics, FICTableEngineCounterChunkMapping, 1);
+    }
+
+    table->reservedMappedLength = fileLength;
+
+    return true;
+}
+
+#pragma mark - Journaling
+
+// Mirrors -[FICImageTable _flushJournal], except that records are flushed in batches on the calling thread instead of on a metadata queue
+static void _FICBenchmarkTableFlushJournal(FICBenchmarkTable *table, bool force) {
+    FICTableEngine *engine = &table->engine;
+    if (force == false && FICTableEnginePendingJournalRecordCount(engine) < FICBenchmarkTableJournalBatchCount) {
+        return;
+    }
+
+    FICTableEngineFlushJournal(engine);
+
+    if (FICTableEngineCheckpointIsDue(engine) && FICTableEngineScheduleCheckpoint(engine)) {
+        FICBenchmarkTableSaveMetadata(table);
+    }
+}
+
+static void _FICBenchmarkTableUnmapMetadataIfUnused(FICBenchmarkTable *table) {
+    FICTableEngine *engine = &table->engine;
+    bool borrowsStorage = engine->index.borrowsStorage || engine->allocator.borrowsStorage || engine->policy.list.borrowsStorage || engine->policy.sketch.borrowsStorage;
+    if (table->metadataMapping != NULL && borrowsStorage == false) {
+        FICMetadataJournalUnmapFile(table->metadataMapping, table->metadataMappingLength);
+        table->metadataMapping = NULL;
+        table->metadataMappingLength = 0;
+    }
+}
+
+#pragma mark - Working with Chunks
+
+static bool _FICBenchmarkTableSlotIsReserved(FICBenchmarkTable *table, uint32_t slot) {
+    return table->reservedBytes != NULL && ((size_t)slot + 1) * table->engine.file.entryLength <= table->reservedLength;
+}
+
+// The caller must hold the chunk lock
+static void _FICBenchmarkTableUnmapUnusedChunks(FICBenchmarkTable *table) {
+    FICTableFile *file = &table->engine.file;
+
+    while (true) {
+        size_t unusedChunkCount = 0;
+        FICBenchmarkTableChunk *oldestChunk = NULL;
+        for (size_t i = 0; i < table->chunkCapacity; i++) {
+            FICBenchmarkTableChunk *chunk = &table->chunks[i];
+            if (chunk->bytes != NULL && chunk->useCount == 0) {
+                unusedChunkCount++;
+                if (oldestChunk == NULL || chunk->lastUse < oldestChunk->lastUse) {
+                    oldestChunk = chunk;
+                }
+            }
+        }
+
+        if (unusedChunkCount <= table->maximumMappedChunkCount) {
+            break;
+        }
+
+        FICTableFileUnmap(oldestChunk->bytes, file->chunkLength);
+        oldestChunk->bytes = NULL;
+        table->mappedChunkCount--;
+        FICStatisticsAdd(&table->engine.statistics, FICTableEngineCounterChunkUnmapping, 1);
+    }
+}
+
+// Returns the mapped bytes of the entry, keeping its chunk mapped until the entry is released
+static uint8_t * _FICBenchmarkTableUseEntry(FICBenchmarkTable *table, uint32_t slot) {
+    FICTableFile *file = &table->engine.file;
+    if (_FICBenchmarkTableSlotIsReserved(table, slot)) {
+        // The reserved mapping never moves, so there's nothing to keep track of
+        return table->reservedBytes + (size_t)slot * file->entryLength;
+    }
+
+    size_t chunkIndex = slot / file->entriesPerChunk;
+    uint8_t *entryBytes = NULL;
+
+    pthread_mutex_lock(&table->chunkLock);
+
+    if (chunkIndex >= table->chunkCapacity) {
+        size_t chunkCapacity = table->chunkCapacity > 0 ? table->chunkCapacity : 16;
+        while (chunkCapacity <= chunkIndex) {
+            chunkCapacity *= 2;
+        }
+
+        FICBenchmarkTableChunk *chunks = realloc(table->chunks, chunkCapacity * sizeof(FICBenchmarkTableChunk));
+        if (chunks != NULL) {
+            memset(chunks + table->chunkCapacity, 0, (chunkCapacity - table->chunkCapacity) * sizeof(FICBenchmarkTableChunk));
+            table->chunks = chunks;
+            table->chunkCapacity = chunkCapacity;
+        }
+    }
+
+    if (chunkIndex < table->chunkCapacity) {
+        FICBenchmarkTableChunk *chunk = &table->chunks[chunkIndex];
+        if (chunk->bytes == NULL) {
+            void *bytes = FICTableFileMap(file->fileDescriptor, (off_t)(chunkIndex * file->chunkLength), file->chunkLength);
+            if (bytes != NULL) {
+                chunk->bytes = bytes;
+                table->mappedChunkCount++;
+                FICStatisticsAdd(&table->engine.statistics, FICTableEngineCounterChunkMapping, 1);
+            }
+        }
+
+        if (chunk->bytes != NULL) {
+            chunk->useCount++;
+            chunk->lastUse = ++table->chunkUseClock;
+            entryBytes = chunk->bytes + (slot % file->entriesPerChunk) * file->entryLength;
+        }
+    }
+
+    pthread_mutex_unlock(&table->chunkLock);
+
+    return entryBytes;
+}
+
+static void _FICBenchmarkTableReleaseEntry(FICBenchmarkTable *table, uint32_t slot) {
+    if (_FICBenchmarkTableSlotIsReserved(table, slot)) {
+        return;
+    }
+
+    pthread_mutex_lock(&table->chunkLock);
+
+    FICBenchmarkTableChunk *chunk = &table->chunks[slot / table->engine.file.entriesPerChunk];
+    chunk->useCount--;
+    chunk->lastUse = ++table->chunkUseClock;
+    if (chunk->useCount == 0) {
+        _FICBenchmarkTableUnmapUnusedChunks(table);
+    }
+
+    pthread_mutex_unlock(&table->chunkLock);
+}
+
+// Mirrors -[FICImageTable _reserveAddressSpace]. If the address space can't be reserved, the table file is mapped in chunks instead.
+static void _FICBenchmarkTableReserveAddressSpace(FICBenchmarkTable *table) {
+    FICTableFile *file = &table->engine.file;
+
+    // The table file only grows past the chunk that holds the last entry it can have when every entry is in use
+    size_t reservedLength = FICTableFileChunkAlignedEntryCount(file, table->engine.maximumCount) * file->entryLength;
+    if (reservedLength < (size_t)file->length) {
+        reservedLength = (size_t)file->length;
+    }
+
+    uint8_t *reservedBytes = FICTableFileReserveAddressSpace(reservedLength);
+    if (reservedBytes == NULL) {
+        return;
+    }
+
+    if (file->length > 0 && FICTableFileMapIntoReservedAddressSpace(file->fileDescriptor, reservedBytes, 0, (size_t)file->length) == false) {
+        FICTableFileUnmap(reservedBytes, reservedLength);
+        return;
+    }
+
+    table->reservedBytes = reservedBytes;
+    table->reservedLength = reservedLength;
+    table->reservedMappedLength = (size_t)file->length;
+    if (file->length > 0) {
+        FICStatisticsAdd(&table->engine.statistics, FICTableEngineCounterChunkMapping, 1);
+    }
+}
+
+#pragma mark - Opening and Closing Tables
+
+bool FICBenchmarkTableOpen(FICBenchmarkTable *table, const FICBenchmarkTableConfiguration *configuration) {
+    memset(table, 0, sizeof(*table));
+    table->maximumMappedChunkCount = configuration->maximumMappedChunkCount;
+    table->synchronousWrites = configuration->synchronousWrites;
+    pthread_mutex_init(&table->chunkLock, NULL);
+
+    char *metadataPath = _FICBenchmarkTablePath(configuration->directoryPath, configuration->name, "metadata");
+    FICTableEngineConfiguration engineConfiguration = {
+        .imageLength = configuration->imageLength,
+        .maximumCount = configuration->maximumCount,
+        .evictionPolicyKind = configuration->evictionPolicyKind,
+        .metadataPath = metadataPath,
+        .delegate = {
+            .metadataFormatMatches = _FICBenchmarkTableMetadataFormatMatches,
+            .entryCountDidChange = _FICBenchmarkTableEntryCountDidChange,
+        },
+        .context = table,
+    };
+
+    FICTableEngine *engine = &table->engine;
+    FICTableEngineInit(engine, &engineConfiguration);
+    bool hasMetadataPath = metadataPath != NULL;
+    free(metadataPath);
+
+    table->filePath = _FICBenchmarkTablePath(configuration->directoryPath, configuration->name, "imageTable");
+    if (table->filePath == NULL || hasMetadataPath == false) {
+        FICBenchmarkTableClose(table);
+        return false;
+    }
+
+    // Mirrors -[FICImageTable _loadMetadata]: the checkpoint is adopted in place from a private mapping of the journal, and only the records after it are replayed. Metadata is loaded
+    // before the table file is opened, so a table whose metadata doesn't match can start over with an empty file.
+    size_t validLength = 0;
+    table->metadataMapping = FICMetadataJournalMapFile(&engine->journal, &table->metadataMappingLength);
+    bool metadataWasLoaded = table->metadataMapping != NULL && FICTableEngineLoadMetadata(engine, table->metadataMapping, table->metadataMappingLength, &validLength);
+
+    bool journalIsOpen = false;
+    if (metadataWasLoaded) {
+        journalIsOpen = FICMetadataJournalOpen(&engine->journal, validLength);
+    } else {
+        if (table->metadataMapping != NULL) {
+            unlink(table->filePath);
+        }
+
+        FICTableEngineConfigureEvictionPolicy(engine);
+        journalIsOpen = FICBenchmarkTableSaveMetadata(table);
+    }
+    _FICBenchmarkTableUnmapMetadataIfUnused(table);
+
+    if (journalIsOpen == false || FICTableEngineOpenFile(engine, table->filePath) == false) {
+        FICBenchmarkTableClose(table);
+        return false;
+    }
+
+    if (configuration->reservedMapping) {
+        _FICBenchmarkTableReserveAddressSpace(table);
+    }
+
+    FICTableEngineRemoveUncommittedEntries(engine);
+    FICTableEngineRemoveEntriesBeyondEntryCount(engine);
+
+    return true;
+}
+
+void FICBenchmarkTableClose(FICBenchmarkTable *table) {
+    FICTableFile *file = &table->engine.file;
+
+    if (file->fileDescriptor >= 0) {
+        _FICBenchmarkTableFlushJournal(table, true);
+    }
+
+    for (size_t i = 0; i < table->chunkCapacity; i++) {
+        if (table->chunks[i].bytes != NULL) {
+            FICTableFileUnmap(table->chunks[i].bytes, file->chunkLength);
+        }
+    }
+    free(table->chunks);
+
+    if (table->reservedBytes != NULL) {
+        FICTableFileUnmap(table->reservedBytes, table->reservedLength);
+    }
+
+    FICTableEngineDestroy(&table->engine);
+    FICMetadataJournalUnmapFile(table->metadataMapping, table->metadataMappingLength);
+    free(table->filePath);
+    pthread_mutex_destroy(&table->chunkLock);
+
+    memset(table, 0, sizeof(*table));
+    table->engine.file.fileDescriptor = -1;
+}
+
+void FICBenchmarkTableRemoveFiles(const char *directoryPath, const char *name) {
+    const char *extensions[] = { "imageTable", "metadata" };
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        char *path = _FICBenchmarkTablePath(directoryPath, name, extensions[i]);
+        if (path != NULL) {
+            unlink(path);
+            free(path);
+        }
+    }
+}
+
+#pragma mark - Storing, Retrieving, and Deleting Entries
+
+bool FICBenchmarkTableSetEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], const void *imageBytes) {
+    FICTableEngine *engine = &table->engine;
+    uint32_t slot = FICEntryIndexNoSlot;
+
+    FICTableEngineLock(engine, true);
+    pthread_rwlock_t *entryLock = FICTableEngineLockSlotForStoring(engine, entityUUIDBytes, &slot);
+    if (entryLock != NULL) {
+        FICTableEngineSetEntry(engine, slot, entityUUIDBytes, sourceImageUUIDBytes, NULL);
+    }
+
+    // Readers of this entry wait on its entry lock until the image data has been written
+    FICTableEngineUnlock(engine);
+
+    if (entryLock == NULL) {
+        return false;
+    }
+
+    uint8_t *entryBytes = _FICBenchmarkTableUseEntry(table, slot);
+    if (entryBytes != NULL) {
+        memcpy(entryBytes, imageBytes, engine->file.imageLength);
+
+        FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry(entryBytes, engine->file.entryLength);
+        memcpy(metadata->entityUUIDBytes, entityUUIDBytes, sizeof(metadata->entityUUIDBytes));
+        memcpy(metadata->sourceImageUUIDBytes, sourceImageUUIDBytes, sizeof(metadata->sourceImageUUIDBytes));
+        FICTableEngineSealEntry(engine, slot, entryBytes);
+        FICStatisticsAdd(&engine->statistics, FICTableEngineCounterStoredEntry, 1);
+
+        FICTableEngineWriteEntry(engine, slot, entityUUIDBytes, sourceImageUUIDBytes, entryBytes, table->synchronousWrites);
+
+        _FICBenchmarkTableReleaseEntry(table, slot);
+    } else {
+        FICTableEngineDeleteEntry(engine, entityUUIDBytes, slot);
+    }
+
+    pthread_rwlock_unlock(entryLock);
+
+    _FICBenchmarkTableFlushJournal(table, false);
+
+    return entryBytes != NULL;
+}
+
+bool FICBenchmarkTableGetEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], void *imageBytes) {
+    FICTableEngine *engine = &table->engine;
+    uint32_t slot = FICEntryIndexNoSlot;
+
+    FICTableEngineLock(engine, false);
+    pthread_rwlock_t *entryLock = FICTableEngineLockSlotForReading(engine, entityUUIDBytes, &slot);
+    FICTableEngineUnlock(engine);
+
+    if (entryLock == NULL) {
+        FICStatisticsAdd(&engine->statistics, FICTableEngineCounterMiss, 1);
+        return false;
+    }
+
+    FICTableEngineEntryWasRetrieved(engine, slot, entityUUIDBytes, false);
+    FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeTouch, slot, entityUUIDBytes, NULL);
+
+    bool entryIsCorrect = false;
+    uint8_t *entryBytes = _FICBenchmarkTableUseEntry(table, slot);
+    if (entryBytes != NULL) {
+        const FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry(entryBytes, engine->file.entryLength);
+        entryIsCorrect = memcmp(metadata->entityUUIDBytes, entityUUIDBytes, sizeof(metadata->entityUUIDBytes)) == 0;
+        if (entryIsCorrect && imageBytes != NULL) {
+            memcpy(imageBytes, entryBytes, engine->file.imageLength);
+        }
+
+        _FICBenchmarkTableReleaseEntry(table, slot);
+    }
+
+    pthread_rwlock_unlock(entryLock);
+
+    FICStatisticsAdd(&engine->statistics, entryIsCorrect ? FICTableEngineCounterHit : FICTableEngineCounterMiss, 1);
+    _FICBenchmarkTableFlushJournal(table, false);
+
+    return entryIsCorrect;
+}
+
+bool FICBenchmarkTableEntryExists(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]) {
+    return FICTableEngineEntryExists(&table->engine, entityUUIDBytes, sourceImageUUIDBytes);
+}
+
+void FICBenchmarkTableDeleteEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16]) {
+    FICTableEngineDeleteEntry(&table->engine, entityUUIDBytes, FICEntryIndexNoSlot);
+
+    _FICBenchmarkTableFlushJournal(table, false);
+}
+
+#pragma mark - Working with Metadata
+
+bool FICBenchmarkTableSaveMetadata(FICBenchmarkTable *table) {
+    char format[128];
+    size_t formatLength = _FICBenchmarkTableFormat(table, format, sizeof(format));
+
+    return FICTableEngineWriteCheckpoint(&table->engine, format, formatLength);
+}
+
+#pragma mark - Inspecting Tables
+
+size_t FICBenchmarkTableEntryCount(FICBenchmarkTable *table) {
+    return FICTableEngineEntryCount(&table->engine);
+}
+
+FICBenchmarkTableStatistics FICBenchmarkTableGetStatistics(FICBenchmarkTable *table) {
+    const FICStatistics *engineStatistics = &table->engine.statistics;
+
+    FICStatisticsHistogram journalWrites;
+    FICStatisticsHistogram checkpoints;
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramJournalWrite, &journalWrites);
+    FICStatisticsGetHistogram(engineStatistics, FICTableEngineHistogramCheckpoint, &checkpoints);
+
+    FICBenchmarkTableStatistics statistics = {
+        .evictionCount = FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterEvictedEntry),
+        .mappingCount = FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterChunkMapping),
+        .unmappingCount = FICStatisticsCounterValue(engineStatistics, FICTableEngineCounterChunkUnmapping),
+        .journalWriteCount = journalWrites.count + checkpoints.count,
+    };
+
+    return statistics;
+}
@@ -0,0 +1,156 @@
+//
+//  FICBenchmarkTable.h
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#ifndef FICBenchmarkTable_h
+#define FICBenchmarkTable_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FICTableEngine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ One mapped chunk of the table file.
+ */
+typedef struct {
+    uint8_t *bytes;
+    size_t useCount;                        // Entries currently being read or written through the mapping
+    uint64_t lastUse;                       // Mappings kept past their last use are unmapped least recently used first
+} FICBenchmarkTableChunk;
+
+/**
+ Counters kept by a table since it was opened.
+ */
+typedef struct {
+    uint64_t evictionCount;
+    uint64_t mappingCount;
+    uint64_t unmappingCount;
+    uint64_t journalWriteCount;
+} FICBenchmarkTableStatistics;
+
+/**
+ `FICBenchmarkTable` is an image table built on the same `<FICTableEngine>` as `FICImageTable`, so its hot paths can be measured on any POSIX system.
+
+ @discussion The engine does everything with entries that `FICImageTable` does: picking slots and evicting entries, the entry lock protocol, journaling and replaying changes, dropping
+ uncommitted entries, and checksumming and committing image data. What the table adds is mapping chunks of the table file, the way `FICImageTable` does: chunks of about 2 MB stay
+ mapped until more than `maximumMappedChunkCount` of them are unused. With `reservedMapping`, the whole file is instead mapped into address space reserved for it up front, like
+ `FICImageFormatMappingModeReserved`, and new file data is mapped in place as the file grows. If the file grows past the reserved address space because no entry could be
+ evicted, the entries past it are mapped in chunks.
+
+ What it leaves out is what depends on Apple frameworks: images aren't created from the mapped data, and there is no cold storage, pinning, or deferred durability. Journal records
+ are appended in batches on the calling thread instead of on a metadata queue.
+
+ Tables are thread-safe.
+ */
+typedef struct {
+    FICTableEngine engine;
+    char *filePath;
+    bool synchronousWrites;
+
+    pthread_mutex_t chunkLock;
+    FICBenchmarkTableChunk *chunks;
+    size_t chunkCapacity;
+    size_t mappedChunkCount;
+    size_t maximumMappedChunkCount;
+    uint64_t chunkUseClock;
+
+    uint8_t *reservedBytes;                 // The table file up to `reservedLength`, if it's mapped into reserved address space instead of in chunks
+    size_t reservedLength;
+    size_t reservedMappedLength;
+
+    void *metadataMapping;
+    size_t metadataMappingLength;
+} FICBenchmarkTable;
+
+/**
+ Describes the table to open.
+ */
+typedef struct {
+    const char *directoryPath;
+    const char *name;
+    size_t imageLength;                     // Bytes of image data per entry
+    size_t maximumCount;
+    FICEvictionPolicyKind evictionPolicyKind;
+    size_t maximumMappedChunkCount;         // Unused chunks kept mapped
+    bool synchronousWrites;                 // Whether each stored entry is synced to disk before it's returned, like synchronous durability, instead of asynchronous durability
+    bool reservedMapping;                   // Whether the whole table file is mapped into address space reserved up front, instead of in chunks
+} FICBenchmarkTableConfiguration;
+
+/**
+ Opens the table described by `configuration`, creating its files if they don't exist yet and loading its metadata if they do.
+
+ @return `false` if the table file or its metadata couldn't be opened, in which case the table doesn't need to be closed.
+ */
+bool FICBenchmarkTableOpen(FICBenchmarkTable *table, const FICBenchmarkTableConfiguration *configuration);
+
+/**
+ Flushes pending journal records, unmaps the table file and frees everything owned by the table.
+ */
+void FICBenchmarkTableClose(FICBenchmarkTable *table);
+
+/**
+ Stores an entry, evicting another one if the table is full.
+
+ @param imageBytes `imageLength` bytes copied into the entry, the way a drawing block draws into the mapped file.
+
+ @return `false` if there was no room for the entry.
+ */
+bool FICBenchmarkTableSetEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16], const void *imageBytes);
+
+/**
+ Looks up an entry, records the access, and checks that its mapped metadata belongs to the entity.
+
+ @param imageBytes If not `NULL`, receives a copy of the entry's image data, which touches every page of it like drawing the image would.
+
+ @return `false` if the entity has no entry.
+ */
+bool FICBenchmarkTableGetEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], void *imageBytes);
+
+/**
+ Returns whether or not the entity has an entry drawn from the source image, without touching the table file.
+ */
+bool FICBenchmarkTableEntryExists(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16], const uint8_t sourceImageUUIDBytes[16]);
+
+/**
+ Deletes the entity's entry, if it has one.
+ */
+void FICBenchmarkTableDeleteEntry(FICBenchmarkTable *table, const uint8_t entityUUIDBytes[16]);
+
+/**
+ Writes a checkpoint of the table's metadata, replacing its journal.
+
+ @return `false` if the checkpoint couldn't be written.
+ */
+bool FICBenchmarkTableSaveMetadata(FICBenchmarkTable *table);
+
+/**
+ Returns the number of entries stored in the table.
+ */
+size_t FICBenchmarkTableEntryCount(FICBenchmarkTable *table);
+
+/**
+ Returns a copy of the table's counters.
+ */
+FICBenchmarkTableStatistics FICBenchmarkTableGetStatistics(FICBenchmarkTable *table);
+
+/**
+ Deletes the files of the table named `name` in `directoryPath`.
+ */
+void FICBenchmarkTableRemoveFiles(const char *directoryPath, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
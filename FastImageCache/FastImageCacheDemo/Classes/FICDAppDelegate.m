@@ -30,7 +30,7 @@
     NSInteger squareImageFormatMaximumCount = 400;
     FICImageFormatDevices squareImageFormatDevices = FICImageFormatDevicePhone | FICImageFormatDevicePad;
     
-    // ...32-bit BGR
+    // ...32-bit BGRA, which the other square image formats are converted from
     FICImageFormat *squareImageFormat32BitBGRA = [FICImageFormat formatWithName:FICDPhotoSquareImage32BitBGRAFormatName family:FICDPhotoImageFormatFamily imageSize:FICDPhotoSquareImageSize style:FICImageFormatStyle32BitBGRA
         maximumCount:squareImageFormatMaximumCount devices:squareImageFormatDevices protectionMode:FICImageFormatProtectionModeNone];
     
@@ -40,18 +40,24 @@
     FICImageFormat *squareImageFormat32BitBGR = [FICImageFormat formatWithName:FICDPhotoSquareImage32BitBGRFormatName family:FICDPhotoImageFormatFamily imageSize:FICDPhotoSquareImageSize style:FICImageFormatStyle32BitBGR
         maximumCount:squareImageFormatMaximumCount devices:squareImageFormatDevices protectionMode:FICImageFormatProtectionModeNone];
     
+    [squareImageFormat32BitBGR setPrimaryFormatName:FICDPhotoSquareImage32BitBGRAFormatName];
+    
     [mutableImageFormats addObject:squareImageFormat32BitBGR];
     
     // ...16-bit BGR
     FICImageFormat *squareImageFormat16BitBGR = [FICImageFormat formatWithName:FICDPhotoSquareImage16BitBGRFormatName family:FICDPhotoImageFormatFamily imageSize:FICDPhotoSquareImageSize style:FICImageFormatStyle16BitBGR
         maximumCount:squareImageFormatMaximumCount devices:squareImageFormatDevices protectionMode:FICImageFormatProtectionModeNone];
     
+    [squareImageFormat16BitBGR setPrimaryFormatName:FICDPhotoSquareImage32BitBGRAFormatName];
+    
     [mutableImageFormats addObject:squareImageFormat16BitBGR];
     
     // ...8-bit Grayscale
     FICImageFormat *squareImageFormat8BitGrayscale = [FICImageFormat formatWithName:FICDPhotoSquareImage8BitGrayscaleFormatName family:FICDPhotoImageFormatFamily imageSize:FICDPhotoSquareImageSize style:FICImageFormatStyle8BitGrayscale
         maximumCount:squareImageFormatMaximumCount devices:squareImageFormatDevices protectionMode:FICImageFormatProtectionModeNone];
     
+    [squareImageFormat8BitGrayscale setPrimaryFormatName:FICDPhotoSquareImage32BitBGRAFormatName];
+    
     [mutableImageFormats addObject:squareImageFormat8BitGrayscale];
     
     if ([UIViewController instancesRespondToSelector:@selector(preferredStatusBarStyle)]) {
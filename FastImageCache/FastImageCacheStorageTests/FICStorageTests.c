@@ -0,0 +1,1234 @@
+//
+//  FICStorageTests.c
+//  FastImageCache
+//
+//  Copyright (c) 2013 Path, Inc.
+//  See LICENSE for full license agreement.
+//
+
+#include "FICBenchmarkTable.h"
+#include "FICChecksum.h"
+#include "FICColdStore.h"
+#include "FICCompression.h"
+#include "FICMetadataJournal.h"
+#include "FICTableEngine.h"
+#include "FICTableFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma mark Internal Definitions
+
+static size_t FICStorageTestFailureCount = 0;
+
+#define FICStorageTestAssert(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: %s: assertion failed: %s\n", __FILE__, __LINE__, __func__, #condition); \
+        FICStorageTestFailureCount++; \
+        return; \
+    } \
+} while (0)
+
+static char FICStorageTestDirectoryPath[1024];
+
+static void _FICStorageTestPath(char *path, size_t length, const char *name) {
+    snprintf(path, length, "%s/%s", FICStorageTestDirectoryPath, name);
+}
+
+static void _FICStorageTestUUIDBytes(uint8_t UUIDBytes[16], uint32_t key) {
+    memset(UUIDBytes, 0, 16);
+    memcpy(UUIDBytes, &key, sizeof(key));
+    UUIDBytes[15] = 0xA5;
+}
+
+#pragma mark - Table Files
+
+static void _FICStorageTestTableFileGeometry(void) {
+    FICTableFile file;
+    FICTableFileInit(&file, 1000);
+
+    FICStorageTestAssert(file.entryLength % FICTableFilePageSize() == 0);
+    FICStorageTestAssert(file.entryLength >= 1000 + sizeof(FICTableFileEntryMetadata));
+    FICStorageTestAssert(file.entriesPerChunk >= 4);
+    FICStorageTestAssert(file.chunkLength == file.entryLength * file.entriesPerChunk);
+    FICStorageTestAssert(FICTableFileChunkAlignedEntryCount(&file, 0) == 0);
+    FICStorageTestAssert(FICTableFileChunkAlignedEntryCount(&file, 1) == file.entriesPerChunk);
+    FICStorageTestAssert(FICTableFileChunkAlignedEntryCount(&file, file.entriesPerChunk + 1) == file.entriesPerChunk * 2);
+
+    // Images too large to fit several to a 2 MB chunk still get four
+    FICTableFileInit(&file, 4 * 1024 * 1024);
+    FICStorageTestAssert(file.entriesPerChunk == 4);
+}
+
+static void _FICStorageTestTableFileEntriesSurviveReopening(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "entries.imageTable");
+
+    FICTableFile file;
+    FICTableFileInit(&file, 4096);
+    FICStorageTestAssert(FICTableFileOpen(&file, path));
+    FICStorageTestAssert(file.entryCount == 0 && file.chunkCount == 0);
+
+    FICStorageTestAssert(FICTableFileSetEntryCount(&file, file.entriesPerChunk + 1));
+    FICStorageTestAssert(file.chunkCount == 2);
+    FICStorageTestAssert(FICTableFileChunkLength(&file, 0) == file.chunkLength);
+    FICStorageTestAssert(FICTableFileChunkLength(&file, 1) == file.entryLength);
+    FICStorageTestAssert(FICTableFileChunkLength(&file, 2) == 0);
+
+    uint8_t *chunkBytes = FICTableFileMap(file.fileDescriptor, (off_t)file.chunkLength, FICTableFileChunkLength(&file, 1));
+    FICStorageTestAssert(chunkBytes != NULL);
+    memset(chunkBytes, 0x5A, file.imageLength);
+    FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry(chunkBytes, file.entryLength);
+    _FICStorageTestUUIDBytes(metadata->entityUUIDBytes, 7);
+    metadata->generation = 42;
+    FICStorageTestAssert(FICTableFileFlush(chunkBytes + 1, file.entryLength - 1, true));
+    FICTableFileUnmap(chunkBytes, file.entryLength);
+    FICTableFileClose(&file);
+
+    FICTableFileInit(&file, 4096);
+    FICStorageTestAssert(FICTableFileOpen(&file, path));
+    FICStorageTestAssert(file.entryCount == file.entriesPerChunk + 1);
+
+    chunkBytes = FICTableFileMap(file.fileDescriptor, (off_t)file.chunkLength, FICTableFileChunkLength(&file, 1));
+    FICStorageTestAssert(chunkBytes != NULL);
+    FICTableFilePreheat(chunkBytes, file.entryLength);
+    metadata = FICTableFileEntryMetadataForEntry(chunkBytes, file.entryLength);
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 7);
+    FICStorageTestAssert(memcmp(metadata->entityUUIDBytes, entityUUIDBytes, sizeof(entityUUIDBytes)) == 0);
+    FICStorageTestAssert(metadata->generation == 42);
+    FICStorageTestAssert(chunkBytes[0] == 0x5A && chunkBytes[file.imageLength - 1] == 0x5A);
+    FICTableFileUnmap(chunkBytes, file.entryLength);
+
+    FICStorageTestAssert(FICTableFileSetEntryCount(&file, 0));
+    FICStorageTestAssert(file.length == 0 && file.chunkCount == 0);
+    FICTableFileClose(&file);
+    unlink(path);
+}
+
+static void _FICStorageTestTableFileReservedAddressSpaceGrowsInPlace(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "reserved.imageTable");
+
+    FICTableFile file;
+    FICTableFileInit(&file, 4096);
+    FICStorageTestAssert(FICTableFileOpen(&file, path));
+
+    size_t reservedLength = file.chunkLength * 4;
+    uint8_t *reservedBytes = FICTableFileReserveAddressSpace(reservedLength);
+    FICStorageTestAssert(reservedBytes != NULL);
+
+    FICStorageTestAssert(FICTableFileSetEntryCount(&file, file.entriesPerChunk));
+    FICStorageTestAssert(FICTableFileMapIntoReservedAddressSpace(file.fileDescriptor, reservedBytes, 0, (size_t)file.length));
+    reservedBytes[0] = 0x11;
+
+    // Data that's already mapped stays at the same address as more of the file is mapped after it
+    size_t mappedLength = (size_t)file.length;
+    FICStorageTestAssert(FICTableFileSetEntryCount(&file, file.entriesPerChunk * 3));
+    FICStorageTestAssert(FICTableFileMapIntoReservedAddressSpace(file.fileDescriptor, reservedBytes, mappedLength, (size_t)file.length));
+    reservedBytes[file.chunkLength * 2] = 0x22;
+    FICStorageTestAssert(reservedBytes[0] == 0x11);
+
+    FICTableFileUnmap(reservedBytes, reservedLength);
+    FICTableFileClose(&file);
+    unlink(path);
+}
+
+static void _FICStorageTestTableFilePunchHole(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "holes.imageTable");
+
+    FICTableFile file;
+    FICTableFileInit(&file, 4096);
+    FICStorageTestAssert(FICTableFileOpen(&file, path));
+    FICStorageTestAssert(FICTableFileSetEntryCount(&file, file.entriesPerChunk));
+
+    uint8_t *chunkBytes = FICTableFileMap(file.fileDescriptor, 0, file.chunkLength);
+    FICStorageTestAssert(chunkBytes != NULL);
+    memset(chunkBytes, 0xFF, file.entryLength * 2);
+    FICStorageTestAssert(FICTableFileFlush(chunkBytes, file.entryLength * 2, true));
+
+    if (FICTableFilePunchHole(&file, 1)) {
+        FICStorageTestAssert(chunkBytes[file.entryLength] == 0 && chunkBytes[file.entryLength * 2 - 1] == 0);
+        FICStorageTestAssert(chunkBytes[0] == 0xFF);
+        FICStorageTestAssert(file.length == (off_t)file.chunkLength);
+    } else {
+        // Not every file system can punch holes, in which case the entry is left as it was
+        FICStorageTestAssert(errno == ENOTSUP || errno == EOPNOTSUPP);
+        FICStorageTestAssert(chunkBytes[file.entryLength] == 0xFF);
+    }
+
+    FICTableFileUnmap(chunkBytes, file.chunkLength);
+    FICTableFileClose(&file);
+    unlink(path);
+}
+
+#pragma mark - Metadata Journals
+
+static const char *FICStorageTestJournalFormat = "journal-format";
+
+typedef struct {
+    FICMetadataJournalRecord records[16];
+    size_t count;
+} FICStorageTestJournalRecords;
+
+static void _FICStorageTestJournalRecordWasReplayed(const FICMetadataJournalRecord *record, void *context) {
+    FICStorageTestJournalRecords *replayedRecords = context;
+    if (replayedRecords->count < sizeof(replayedRecords->records) / sizeof(replayedRecords->records[0])) {
+        replayedRecords->records[replayedRecords->count] = *record;
+    }
+    replayedRecords->count++;
+}
+
+static FICMetadataJournalRecord _FICStorageTestJournalRecord(FICMetadataJournalRecordType type, uint32_t key, uint32_t index) {
+    FICMetadataJournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = (uint8_t)type;
+    record.index = index;
+    _FICStorageTestUUIDBytes(record.entityUUIDBytes, key);
+    if (type == FICMetadataJournalRecordTypeSet) {
+        _FICStorageTestUUIDBytes(record.sourceImageUUIDBytes, key + 100);
+    }
+
+    return record;
+}
+
+// Replays the journal file at `path`, returning the number of leading bytes that are valid
+static size_t _FICStorageTestReplayJournal(const char *path, FICStorageTestJournalRecords *replayedRecords) {
+    memset(replayedRecords, 0, sizeof(*replayedRecords));
+
+    FICMetadataJournal journal;
+    FICMetadataJournalInit(&journal, path);
+    size_t length = 0;
+    void *mapping = FICMetadataJournalMapFile(&journal, &length);
+    FICMetadataJournalDestroy(&journal);
+    if (mapping == NULL) {
+        return 0;
+    }
+
+    const void *formatBytes = NULL;
+    const void *snapshotBytes = NULL;
+    size_t formatLength = 0;
+    size_t snapshotLength = 0;
+    size_t validLength = FICMetadataJournalReplay(mapping, length, &formatBytes, &formatLength, &snapshotBytes, &snapshotLength, _FICStorageTestJournalRecordWasReplayed, replayedRecords);
+    if (formatLength != strlen(FICStorageTestJournalFormat) || memcmp(formatBytes, FICStorageTestJournalFormat, formatLength) != 0) {
+        validLength = 0;
+    }
+
+    FICMetadataJournalUnmapFile(mapping, length);
+
+    return validLength;
+}
+
+static off_t _FICStorageTestFileLength(const char *path) {
+    struct stat fileStatus;
+    return stat(path, &fileStatus) == 0 ? fileStatus.st_size : -1;
+}
+
+static void _FICStorageTestMetadataJournalReplaysRecords(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "replay.metadata");
+
+    FICMetadataJournal journal;
+    FICMetadataJournalInit(&journal, path);
+    uint8_t snapshot[64];
+    memset(snapshot, 0x5A, sizeof(snapshot));
+    FICStorageTestAssert(FICMetadataJournalWriteCheckpoint(&journal, FICStorageTestJournalFormat, strlen(FICStorageTestJournalFormat), snapshot, sizeof(snapshot)));
+
+    FICMetadataJournalRecord records[] = {
+        _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeSet, 1, 0),
+        _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeCommit, 1, 0),
+        _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeSet, 2, 1),
+        _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeTouch, 1, 0),
+        _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeDelete, 2, 0),
+    };
+    records[2].flags = FICMetadataJournalRecordFlagCommitted;
+    size_t recordCount = sizeof(records) / sizeof(records[0]);
+
+    // Records appended in separate writes are replayed as one sequence
+    FICStorageTestAssert(FICMetadataJournalAppendRecords(&journal, records, 2));
+    FICStorageTestAssert(FICMetadataJournalAppendRecords(&journal, records + 2, recordCount - 2));
+    FICMetadataJournalDestroy(&journal);
+
+    FICStorageTestJournalRecords replayedRecords;
+    size_t validLength = _FICStorageTestReplayJournal(path, &replayedRecords);
+    FICStorageTestAssert(validLength > 0 && (off_t)validLength == _FICStorageTestFileLength(path));
+    FICStorageTestAssert(replayedRecords.count == recordCount);
+    for (size_t i = 0; i < recordCount; i++) {
+        const FICMetadataJournalRecord *record = &replayedRecords.records[i];
+        FICStorageTestAssert(record->type == records[i].type && record->flags == records[i].flags && record->index == records[i].index);
+        FICStorageTestAssert(memcmp(record->entityUUIDBytes, records[i].entityUUIDBytes, 16) == 0);
+        if (record->type == FICMetadataJournalRecordTypeSet) {
+            FICStorageTestAssert(memcmp(record->sourceImageUUIDBytes, records[i].sourceImageUUIDBytes, 16) == 0);
+        }
+    }
+
+    // A new checkpoint replaces the records
+    FICMetadataJournalInit(&journal, path);
+    FICStorageTestAssert(FICMetadataJournalWriteCheckpoint(&journal, FICStorageTestJournalFormat, strlen(FICStorageTestJournalFormat), snapshot, sizeof(snapshot)));
+    FICMetadataJournalDestroy(&journal);
+    FICStorageTestAssert(_FICStorageTestReplayJournal(path, &replayedRecords) > 0);
+    FICStorageTestAssert(replayedRecords.count == 0);
+
+    unlink(path);
+}
+
+static void _FICStorageTestMetadataJournalTruncatesDamagedTail(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "damage.metadata");
+
+    FICMetadataJournal journal;
+    FICMetadataJournalInit(&journal, path);
+    FICStorageTestAssert(FICMetadataJournalWriteCheckpoint(&journal, FICStorageTestJournalFormat, strlen(FICStorageTestJournalFormat), NULL, 0));
+    off_t checkpointLength = _FICStorageTestFileLength(path);
+
+    FICMetadataJournalRecord records[3];
+    for (uint32_t key = 0; key < 3; key++) {
+        records[key] = _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeSet, key, key);
+        records[key].flags = FICMetadataJournalRecordFlagCommitted;
+    }
+    FICStorageTestAssert(FICMetadataJournalAppendRecords(&journal, records, 3));
+    off_t recordLength = (_FICStorageTestFileLength(path) - checkpointLength) / 3;
+    FICStorageTestAssert(recordLength > 0);
+
+    // A record torn by a crash only made it to disk partway
+    FICMetadataJournalRecord tornRecord = _FICStorageTestJournalRecord(FICMetadataJournalRecordTypeSet, 3, 3);
+    FICStorageTestAssert(FICMetadataJournalAppendRecords(&journal, &tornRecord, 1));
+    FICMetadataJournalDestroy(&journal);
+    FICStorageTestAssert(truncate(path, checkpointLength + recordLength * 3 + recordLength / 2) == 0);
+
+    FICStorageTestJournalRecords replayedRecords;
+    size_t validLength = _FICStorageTestReplayJournal(path, &replayedRecords);
+    FICStorageTestAssert((off_t)validLength == checkpointLength + recordLength * 3);
+    FICStorageTestAssert(replayedRecords.count == 3);
+
+    // A record with a bad checksum ends the replay, so the records after it are discarded too
+    int fileDescriptor = open(path, O_RDWR);
+    FICStorageTestAssert(fileDescriptor >= 0);
+    uint8_t damage = 0xEE;
+    FICStorageTestAssert(pwrite(fileDescriptor, &damage, 1, checkpointLength + recordLength + 8) == 1);
+    close(fileDescriptor);
+
+    validLength = _FICStorageTestReplayJournal(path, &replayedRecords);
+    FICStorageTestAssert((off_t)validLength == checkpointLength + recordLength);
+    FICStorageTestAssert(replayedRecords.count == 1);
+    FICStorageTestAssert(replayedRecords.records[0].index == 0);
+
+    // Opening the journal drops the damaged tail, so new records follow the last valid one
+    FICMetadataJournalInit(&journal, path);
+    FICStorageTestAssert(FICMetadataJournalOpen(&journal, validLength));
+    FICStorageTestAssert(_FICStorageTestFileLength(path) == (off_t)validLength);
+    FICStorageTestAssert(FICMetadataJournalAppendRecords(&journal, &records[2], 1));
+    FICMetadataJournalDestroy(&journal);
+
+    validLength = _FICStorageTestReplayJournal(path, &replayedRecords);
+    FICStorageTestAssert((off_t)validLength == checkpointLength + recordLength * 2);
+    FICStorageTestAssert(replayedRecords.count == 2);
+    FICStorageTestAssert(replayedRecords.records[1].index == 2);
+
+    unlink(path);
+}
+
+#pragma mark - Table Engines
+
+static const char FICStorageTestEngineFormat[] = "{\"test\":1}";
+
+static bool _FICStorageTestEngineFormatMatches(void *context, const void *formatBytes, size_t formatLength) {
+    (void)context;
+    return formatLength == strlen(FICStorageTestEngineFormat) && memcmp(formatBytes, FICStorageTestEngineFormat, formatLength) == 0;
+}
+
+// An engine opened the way FICImageTable opens its own: metadata is loaded from a private mapping of the journal, which is kept until the engine is closed because the checkpoint is
+// adopted in place
+typedef struct {
+    FICTableEngine engine;
+    void *metadataMapping;
+    size_t metadataMappingLength;
+} FICStorageTestEngine;
+
+static bool _FICStorageTestOpenEngine(FICStorageTestEngine *testEngine, const char *name, size_t maximumCount) {
+    char metadataPath[1100];
+    char filePath[1100];
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "%s.metadata", name);
+    _FICStorageTestPath(metadataPath, sizeof(metadataPath), fileName);
+    snprintf(fileName, sizeof(fileName), "%s.imageTable", name);
+    _FICStorageTestPath(filePath, sizeof(filePath), fileName);
+
+    FICTableEngineConfiguration configuration = {
+        .imageLength = 4096,
+        .maximumCount = maximumCount,
+        .evictionPolicyKind = FICEvictionPolicyKindLRU,
+        .metadataPath = metadataPath,
+        .delegate = { .metadataFormatMatches = _FICStorageTestEngineFormatMatches },
+    };
+
+    memset(testEngine, 0, sizeof(*testEngine));
+    FICTableEngine *engine = &testEngine->engine;
+    FICTableEngineInit(engine, &configuration);
+
+    size_t validLength = 0;
+    testEngine->metadataMapping = FICMetadataJournalMapFile(&engine->journal, &testEngine->metadataMappingLength);
+    bool metadataWasLoaded = testEngine->metadataMapping != NULL && FICTableEngineLoadMetadata(engine, testEngine->metadataMapping, testEngine->metadataMappingLength, &validLength);
+
+    bool journalIsOpen = false;
+    if (metadataWasLoaded) {
+        journalIsOpen = FICMetadataJournalOpen(&engine->journal, validLength);
+    } else {
+        FICTableEngineConfigureEvictionPolicy(engine);
+        journalIsOpen = FICTableEngineWriteCheckpoint(engine, FICStorageTestEngineFormat, strlen(FICStorageTestEngineFormat));
+    }
+
+    if (journalIsOpen == false || FICTableEngineOpenFile(engine, filePath) == false) {
+        return false;
+    }
+
+    FICTableEngineRemoveUncommittedEntries(engine);
+    FICTableEngineRemoveEntriesBeyondEntryCount(engine);
+
+    return true;
+}
+
+static void _FICStorageTestCloseEngine(FICStorageTestEngine *testEngine) {
+    FICTableEngineDestroy(&testEngine->engine);
+    FICMetadataJournalUnmapFile(testEngine->metadataMapping, testEngine->metadataMappingLength);
+}
+
+static void _FICStorageTestRemoveEngineFiles(const char *name) {
+    FICBenchmarkTableRemoveFiles(FICStorageTestDirectoryPath, name);
+}
+
+// Stores an entry the way -[FICImageTable setEntryForEntityUUID:...] does, filling its image data with `key`. Entries that aren't written to disk stay uncommitted.
+static uint32_t _FICStorageTestEngineStoreEntry(FICTableEngine *engine, uint32_t key, uint32_t sourceKey, bool writesEntry) {
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, sourceKey);
+
+    uint32_t slot = FICEntryIndexNoSlot;
+    FICTableEngineLock(engine, true);
+    pthread_rwlock_t *entryLock = FICTableEngineLockSlotForStoring(engine, entityUUIDBytes, &slot);
+    if (entryLock != NULL) {
+        FICTableEngineSetEntry(engine, slot, entityUUIDBytes, sourceImageUUIDBytes, NULL);
+    }
+    FICTableEngineUnlock(engine);
+
+    if (entryLock == NULL) {
+        return FICEntryIndexNoSlot;
+    }
+
+    FICTableFile *file = &engine->file;
+    uint8_t *entryBytes = FICTableFileMap(file->fileDescriptor, (off_t)(slot * file->entryLength), file->entryLength);
+    if (entryBytes != NULL) {
+        memset(entryBytes, (int)key, file->imageLength);
+        FICTableFileEntryMetadata *metadata = FICTableFileEntryMetadataForEntry(entryBytes, file->entryLength);
+        memcpy(metadata->entityUUIDBytes, entityUUIDBytes, sizeof(entityUUIDBytes));
+        memcpy(metadata->sourceImageUUIDBytes, sourceImageUUIDBytes, sizeof(sourceImageUUIDBytes));
+        FICTableEngineSealEntry(engine, slot, entryBytes);
+
+        if (writesEntry) {
+            FICTableEngineWriteEntry(engine, slot, entityUUIDBytes, sourceImageUUIDBytes, entryBytes, true);
+        }
+
+        FICTableFileUnmap(entryBytes, file->entryLength);
+    }
+
+    pthread_rwlock_unlock(entryLock);
+
+    return entryBytes != NULL ? slot : FICEntryIndexNoSlot;
+}
+
+// Returns whether the entity has an entry drawn from the source image whose image data checks out and was filled with `key`
+static bool _FICStorageTestEngineEntryIsIntact(FICTableEngine *engine, uint32_t key, uint32_t sourceKey) {
+    uint8_t entityUUIDBytes[16];
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, sourceKey);
+
+    if (FICTableEngineEntryExists(engine, entityUUIDBytes, sourceImageUUIDBytes) == false) {
+        return false;
+    }
+
+    uint32_t slot = FICEntryIndexNoSlot;
+    FICTableEngineLock(engine, false);
+    pthread_rwlock_t *entryLock = FICTableEngineLockSlotForReading(engine, entityUUIDBytes, &slot);
+    FICTableEngineUnlock(engine);
+
+    if (entryLock == NULL) {
+        return false;
+    }
+
+    FICTableFile *file = &engine->file;
+    uint8_t *entryBytes = FICTableFileMap(file->fileDescriptor, (off_t)(slot * file->entryLength), file->entryLength);
+    bool entryIsIntact = entryBytes != NULL && FICTableEngineVerifyEntry(engine, slot, entryBytes) && entryBytes[0] == (uint8_t)key && entryBytes[file->imageLength - 1] == (uint8_t)key;
+    if (entryBytes != NULL) {
+        FICTableFileUnmap(entryBytes, file->entryLength);
+    }
+
+    pthread_rwlock_unlock(entryLock);
+
+    return entryIsIntact;
+}
+
+static void _FICStorageTestTableEngineEvictsLeastRecentlyUsedEntry(void) {
+    FICStorageTestEngine testEngine;
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-eviction", 1));
+    FICTableEngine *engine = &testEngine.engine;
+
+    // The maximum count grows to fill the first chunk
+    size_t maximumCount = engine->maximumCount;
+    FICStorageTestAssert(maximumCount == engine->file.entriesPerChunk);
+
+    uint8_t firstEntityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(firstEntityUUIDBytes, 0);
+    for (uint32_t key = 0; key < maximumCount; key++) {
+        FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, key, 0, true) == key);
+    }
+
+    // Using the first entry leaves the second one least recently used
+    FICTableEngineEntryWasRetrieved(engine, 0, firstEntityUUIDBytes, false);
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, (uint32_t)maximumCount, 0, true) == 1);
+
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == maximumCount);
+    FICStorageTestAssert(engine->file.entryCount == maximumCount);
+    FICStorageTestAssert(FICStatisticsCounterValue(&engine->statistics, FICTableEngineCounterEvictedEntry) == 1);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 0, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 1, 0) == false);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, (uint32_t)maximumCount, 0));
+
+    // Pinned entries are never evicted, even when they're least recently used
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 2);
+    FICTableEngineEntryWasRetrieved(engine, 2, entityUUIDBytes, true);
+    for (uint32_t slot = 3; slot < maximumCount; slot++) {
+        _FICStorageTestUUIDBytes(entityUUIDBytes, slot);
+        FICTableEngineEntryWasRetrieved(engine, slot, entityUUIDBytes, false);
+    }
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, (uint32_t)maximumCount + 1, 0, true) != 2);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 2, 0));
+
+    _FICStorageTestCloseEngine(&testEngine);
+    _FICStorageTestRemoveEngineFiles("engine-eviction");
+}
+
+static void _FICStorageTestTableEngineReplaysJournal(void) {
+    FICStorageTestEngine testEngine;
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-replay", 64));
+    FICTableEngine *engine = &testEngine.engine;
+
+    for (uint32_t key = 0; key < 4; key++) {
+        FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, key, 0, true) == key);
+    }
+
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 1);
+    FICStorageTestAssert(FICTableEngineDeleteEntry(engine, entityUUIDBytes, FICEntryIndexNoSlot));
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 2, 7, true) == 2);
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 4, 0, true) == 1);
+
+    // Accesses are journaled as touches. Entry 0 is touched last, so after replaying it's the most recently used entry.
+    uint32_t touchedKeys[] = { 3, 0 };
+    for (size_t i = 0; i < sizeof(touchedKeys) / sizeof(touchedKeys[0]); i++) {
+        _FICStorageTestUUIDBytes(entityUUIDBytes, touchedKeys[i]);
+        FICTableEngineEntryWasRetrieved(engine, touchedKeys[i], entityUUIDBytes, false);
+        FICTableEngineJournalRecord(engine, FICMetadataJournalRecordTypeTouch, touchedKeys[i], entityUUIDBytes, NULL);
+    }
+
+    // Without a checkpoint, reopening the table only has the journal records to go on
+    FICStorageTestAssert(FICTableEngineFlushJournal(engine));
+    _FICStorageTestCloseEngine(&testEngine);
+
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-replay", 64));
+    engine = &testEngine.engine;
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == 4);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 0, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 1, 0) == false);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 2, 0) == false);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 2, 7));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 3, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 4, 0));
+
+    // The entries stored last were touched less recently than entries 3 and 0, in the order they were stored
+    FICTableEngineLock(engine, true);
+    uint32_t evictedSlot = FICEntryIndexNoSlot;
+    FICStorageTestAssert(FICTableEngineEvictEntry(engine, &evictedSlot));
+    FICStorageTestAssert(evictedSlot == 2);
+    FICStorageTestAssert(FICTableEngineEvictEntry(engine, &evictedSlot));
+    FICStorageTestAssert(evictedSlot == 1);
+    FICStorageTestAssert(FICTableEngineEvictEntry(engine, &evictedSlot));
+    FICStorageTestAssert(evictedSlot == 3);
+    FICTableEngineUnlock(engine);
+
+    _FICStorageTestCloseEngine(&testEngine);
+    _FICStorageTestRemoveEngineFiles("engine-replay");
+}
+
+static void _FICStorageTestTableEngineDropsUncommittedEntries(void) {
+    FICStorageTestEngine testEngine;
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-uncommitted", 64));
+    FICTableEngine *engine = &testEngine.engine;
+
+    // Entry 1 is stored, but its image data never makes it to disk, as if the app were killed while drawing it
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 0, 0, true) == 0);
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 1, 0, false) == 1);
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == 2);
+    FICStorageTestAssert(FICTableEngineFlushJournal(engine));
+    _FICStorageTestCloseEngine(&testEngine);
+
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-uncommitted", 64));
+    engine = &testEngine.engine;
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == 1);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 0, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 1, 0) == false);
+
+    // A checkpoint carries entries that still aren't committed, so they're dropped after it too
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 2, 0, false) != FICEntryIndexNoSlot);
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 3, 0, true) != FICEntryIndexNoSlot);
+    FICStorageTestAssert(FICTableEngineWriteCheckpoint(engine, FICStorageTestEngineFormat, strlen(FICStorageTestEngineFormat)));
+    _FICStorageTestCloseEngine(&testEngine);
+
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-uncommitted", 64));
+    engine = &testEngine.engine;
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == 2);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 0, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 2, 0) == false);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 3, 0));
+
+    _FICStorageTestCloseEngine(&testEngine);
+    _FICStorageTestRemoveEngineFiles("engine-uncommitted");
+}
+
+static void _FICStorageTestTableEngineCompactsTableFile(void) {
+    FICStorageTestEngine testEngine;
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-compaction", 4096));
+    FICTableEngine *engine = &testEngine.engine;
+    FICTableFile *file = &engine->file;
+
+    size_t entriesPerChunk = file->entriesPerChunk;
+    for (uint32_t key = 0; key <= entriesPerChunk; key++) {
+        FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, key, 0, true) == key);
+    }
+    FICStorageTestAssert(file->entryCount == entriesPerChunk * 2);
+    FICStorageTestAssert(FICTableEngineCompactableLength(engine) == 0);
+
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 5);
+    FICStorageTestAssert(FICTableEngineDeleteEntry(engine, entityUUIDBytes, 5));
+    FICStorageTestAssert(FICTableEngineCompactableLength(engine) == file->chunkLength);
+
+    // The entry in the second chunk moves into the slot freed in the first one
+    uint32_t slot = FICEntryIndexNoSlot;
+    uint32_t newSlot = FICEntryIndexNoSlot;
+    FICStorageTestAssert(FICTableEngineLockEntryToMove(engine, &slot, &newSlot));
+    FICStorageTestAssert(slot == entriesPerChunk && newSlot == 5);
+
+    uint8_t *bytes = FICTableFileMap(file->fileDescriptor, 0, (size_t)file->length);
+    FICStorageTestAssert(bytes != NULL);
+    FICTableEngineMoveEntry(engine, slot, newSlot, bytes + slot * file->entryLength, bytes + newSlot * file->entryLength);
+    FICTableEngineUnlock(engine);
+    _FICStorageTestUUIDBytes(entityUUIDBytes, (uint32_t)entriesPerChunk);
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, 0);
+    FICStorageTestAssert(FICTableEngineWriteEntry(engine, newSlot, entityUUIDBytes, sourceImageUUIDBytes, bytes + newSlot * file->entryLength, true));
+    FICTableEngineUnlockEntriesToMove(engine, slot, newSlot);
+    FICTableFileUnmap(bytes, entriesPerChunk * 2 * file->entryLength);
+    FICStorageTestAssert(FICTableEngineLockEntryToMove(engine, &slot, &newSlot) == false);
+
+    size_t entryCount = 0;
+    FICStorageTestAssert(FICTableEngineLockForTruncation(engine, &entryCount));
+    FICStorageTestAssert(entryCount == entriesPerChunk);
+    FICTableEngineTruncate(engine, entryCount);
+    FICTableEngineUnlock(engine);
+    FICTableEngineUnlockAllEntries(engine);
+
+    FICStorageTestAssert(file->entryCount == entriesPerChunk);
+    FICStorageTestAssert(engine->truncatedLength == file->chunkLength);
+    FICStorageTestAssert(FICTableEngineCompactableLength(engine) == 0);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, (uint32_t)entriesPerChunk, 0));
+
+    // The move is journaled, so it survives reopening the table
+    FICStorageTestAssert(FICTableEngineFlushJournal(engine));
+    _FICStorageTestCloseEngine(&testEngine);
+
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-compaction", 4096));
+    engine = &testEngine.engine;
+    FICStorageTestAssert(FICTableEngineEntryCount(engine) == entriesPerChunk);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, (uint32_t)entriesPerChunk, 0));
+
+    _FICStorageTestCloseEngine(&testEngine);
+    _FICStorageTestRemoveEngineFiles("engine-compaction");
+}
+
+static void _FICStorageTestTableEnginePunchesIdleSlots(void) {
+    FICStorageTestEngine testEngine;
+    FICStorageTestAssert(_FICStorageTestOpenEngine(&testEngine, "engine-idle-holes", 4096));
+    FICTableEngine *engine = &testEngine.engine;
+    FICTableFile *file = &engine->file;
+
+    for (uint32_t key = 0; key < 8; key++) {
+        FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, key, 0, true) == key);
+    }
+
+    uint8_t entityUUIDBytes[16];
+    for (uint32_t key = 2; key <= 4; key += 2) {
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        FICStorageTestAssert(FICTableEngineDeleteEntry(engine, entityUUIDBytes, key));
+    }
+
+    // The free slots between entries are only found to be free the first time
+    size_t punchedLength = FICTableEnginePunchHoles(engine, SIZE_MAX, UINT64_MAX);
+    if (engine->holePunchingEnabled == false) {
+        // Not every file system can punch holes
+        FICStorageTestAssert(punchedLength == 0);
+        _FICStorageTestCloseEngine(&testEngine);
+        _FICStorageTestRemoveEngineFiles("engine-idle-holes");
+        return;
+    }
+
+    FICStorageTestAssert(FICSlotAllocatorIsOccupied(&engine->idleSlots, 2) && FICSlotAllocatorIsOccupied(&engine->idleSlots, 4));
+
+    // Until they've stayed free long enough, they're left alone
+    FICStorageTestAssert(FICTableEnginePunchHoles(engine, SIZE_MAX, UINT64_MAX) == 0);
+
+    // Storing an entry reuses the lowest free slot, which isn't idle anymore, so only the other one is released
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 8, 0, true) == 2);
+    FICStorageTestAssert(FICTableEnginePunchHoles(engine, SIZE_MAX, 0) == file->entryLength);
+    FICStorageTestAssert(FICSlotAllocatorIsOccupied(&engine->punchedSlots, 4));
+    FICStorageTestAssert(engine->punchedLength == punchedLength + file->entryLength);
+
+    // A hole isn't punched twice, but it's reused like any other free slot
+    FICStorageTestAssert(FICTableEnginePunchHoles(engine, SIZE_MAX, 0) == 0);
+    FICStorageTestAssert(_FICStorageTestEngineStoreEntry(engine, 9, 0, true) == 4);
+    FICStorageTestAssert(FICSlotAllocatorIsOccupied(&engine->punchedSlots, 4) == false);
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 8, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 9, 0));
+    FICStorageTestAssert(_FICStorageTestEngineEntryIsIntact(engine, 3, 0));
+
+    _FICStorageTestCloseEngine(&testEngine);
+    _FICStorageTestRemoveEngineFiles("engine-idle-holes");
+}
+
+#pragma mark - Compression
+
+// Fills a buffer with pseudorandom bytes, which don't compress
+static void _FICStorageTestRandomBytes(uint8_t *bytes, size_t length, uint32_t seed) {
+    uint32_t state = seed;
+    for (size_t i = 0; i < length; i++) {
+        state = state * 1664525u + 1013904223u;
+        bytes[i] = (uint8_t)(state >> 24);
+    }
+}
+
+static bool _FICStorageTestCompressionRoundTrips(const uint8_t *bytes, size_t length, size_t *compressedLength) {
+    size_t capacity = FICCompressionBound(length);
+    uint8_t *compressedBytes = malloc(capacity);
+    uint8_t *decompressedBytes = malloc(length > 0 ? length : 1);
+    bool roundTrips = false;
+    if (compressedBytes != NULL && decompressedBytes != NULL) {
+        *compressedLength = FICCompress(bytes, length, compressedBytes, capacity);
+        roundTrips = *compressedLength > 0 && FICDecompress(compressedBytes, *compressedLength, decompressedBytes, length) && memcmp(decompressedBytes, bytes, length) == 0;
+    }
+
+    free(compressedBytes);
+    free(decompressedBytes);
+
+    return roundTrips;
+}
+
+static void _FICStorageTestCompressionRoundTrip(void) {
+    static uint8_t bytes[256 * 1024];
+    size_t length = sizeof(bytes);
+    size_t compressedLength = 0;
+
+    // Lengths around the 12 bytes below which nothing is matched, and around the 15 and 255 byte steps of the length encoding
+    size_t shortLengths[] = { 0, 1, 4, 5, 12, 13, 15, 16, 19, 270, 271, 4096 };
+    _FICStorageTestRandomBytes(bytes, length, 1);
+    for (size_t i = 0; i < sizeof(shortLengths) / sizeof(shortLengths[0]); i++) {
+        FICStorageTestAssert(_FICStorageTestCompressionRoundTrips(bytes, shortLengths[i], &compressedLength));
+        FICStorageTestAssert(compressedLength <= FICCompressionBound(shortLengths[i]));
+    }
+
+    // Incompressible data stays within the bound
+    FICStorageTestAssert(_FICStorageTestCompressionRoundTrips(bytes, length, &compressedLength));
+    FICStorageTestAssert(compressedLength <= FICCompressionBound(length));
+
+    // A flat image, like transparent corners, shrinks to a sliver of its length
+    memset(bytes, 0, length);
+    FICStorageTestAssert(_FICStorageTestCompressionRoundTrips(bytes, length, &compressedLength));
+    FICStorageTestAssert(compressedLength <= length / 100);
+
+    // Rows that repeat further apart than the 64 KB window can reach, and short overlapping repeats
+    for (size_t i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)((i % 70000) * 7 + (i % 3));
+    }
+    FICStorageTestAssert(_FICStorageTestCompressionRoundTrips(bytes, length, &compressedLength));
+    FICStorageTestAssert(compressedLength < length);
+}
+
+static void _FICStorageTestCompressionRejectsCorruptInput(void) {
+    uint8_t bytes[4096];
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i / 64);
+    }
+
+    uint8_t compressedBytes[4096 + 4096 / 255 + 16];
+    size_t compressedLength = FICCompress(bytes, sizeof(bytes), compressedBytes, sizeof(compressedBytes));
+    FICStorageTestAssert(compressedLength > 0 && compressedLength < sizeof(bytes));
+
+    // Too small a destination for the compressed data
+    uint8_t smallBuffer[16];
+    FICStorageTestAssert(FICCompress(bytes, sizeof(bytes), smallBuffer, sizeof(smallBuffer)) == 0);
+
+    // Data has to decompress to exactly the expected length
+    uint8_t decompressedBytes[sizeof(bytes) + 1];
+    FICStorageTestAssert(FICDecompress(compressedBytes, compressedLength, decompressedBytes, sizeof(bytes)));
+    FICStorageTestAssert(FICDecompress(compressedBytes, compressedLength, decompressedBytes, sizeof(bytes) - 1) == false);
+    FICStorageTestAssert(FICDecompress(compressedBytes, compressedLength, decompressedBytes, sizeof(bytes) + 1) == false);
+
+    // Truncated data
+    for (size_t length = 0; length < compressedLength; length++) {
+        FICStorageTestAssert(FICDecompress(compressedBytes, length, decompressedBytes, sizeof(bytes)) == false);
+    }
+
+    // A match that reaches back before the start of the output, and one with an offset of 0
+    uint8_t matchBeforeStart[] = { 0x10, 'A', 0x02, 0x00, 0x00 };
+    FICStorageTestAssert(FICDecompress(matchBeforeStart, sizeof(matchBeforeStart), decompressedBytes, 5) == false);
+    uint8_t zeroOffset[] = { 0x10, 'A', 0x00, 0x00, 0x00 };
+    FICStorageTestAssert(FICDecompress(zeroOffset, sizeof(zeroOffset), decompressedBytes, 5) == false);
+
+    // A literal length that runs past the end of the input
+    uint8_t longLiterals[] = { 0xF0, 0xFF, 0xFF, 'A' };
+    FICStorageTestAssert(FICDecompress(longLiterals, sizeof(longLiterals), decompressedBytes, sizeof(bytes)) == false);
+
+    // Damaged bytes anywhere never read or write out of bounds, which running under a sanitizer checks
+    for (size_t i = 0; i < compressedLength; i++) {
+        uint8_t damagedBytes[sizeof(compressedBytes)];
+        memcpy(damagedBytes, compressedBytes, compressedLength);
+        damagedBytes[i] ^= 0x5A;
+        FICDecompress(damagedBytes, compressedLength, decompressedBytes, sizeof(bytes));
+    }
+}
+
+#pragma mark - Checksums
+
+static void _FICStorageTestChecksumMatchesKnownValues(void) {
+    FICChecksumImplementation implementations[] = { FICChecksumImplementationTable, FICChecksumImplementationHardware };
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        FICStorageTestAssert(FICChecksumCRC32CWithImplementation(implementations[i], 0, "123456789", 9) == 0xe3069283u);
+        FICStorageTestAssert(FICChecksumCRC32CWithImplementation(implementations[i], 0, "", 0) == 0);
+    }
+
+    FICStorageTestAssert(FICChecksumCRC32C(0, "123456789", 9) == 0xe3069283u);
+    FICStorageTestAssert(FICChecksumImplementationIsAvailable(FICChecksumImplementationTable));
+}
+
+static void _FICStorageTestChecksumImplementationsAgree(void) {
+    if (FICChecksumImplementationIsAvailable(FICChecksumImplementationHardware) == false) {
+        // The CPU doesn't have CRC instructions, so there's nothing to compare the tables with
+        printf("fic-storage-tests: skipping hardware checksums, which this CPU doesn't support\n");
+        return;
+    }
+
+    // Buffers start at every offset within a word and end at every length around it, so each implementation's word and byte loops are all covered
+    static uint8_t bytes[4096 + 16];
+    for (uint32_t seed = 1; seed <= 8; seed++) {
+        _FICStorageTestRandomBytes(bytes, sizeof(bytes), seed);
+
+        for (size_t offset = 0; offset < 16; offset++) {
+            for (size_t length = 0; length <= 4096; length = length < 64 ? length + 1 : length * 2 + 3) {
+                uint32_t tableChecksum = FICChecksumCRC32CWithImplementation(FICChecksumImplementationTable, seed, bytes + offset, length);
+                uint32_t hardwareChecksum = FICChecksumCRC32CWithImplementation(FICChecksumImplementationHardware, seed, bytes + offset, length);
+                FICStorageTestAssert(tableChecksum == hardwareChecksum);
+            }
+        }
+    }
+
+    // Checksumming in pieces gives the same result with both
+    uint32_t checksum = FICChecksumCRC32CWithImplementation(FICChecksumImplementationTable, 0, bytes, 4096);
+    uint32_t firstChecksum = FICChecksumCRC32CWithImplementation(FICChecksumImplementationHardware, 0, bytes, 1001);
+    FICStorageTestAssert(FICChecksumCRC32CWithImplementation(FICChecksumImplementationTable, firstChecksum, bytes + 1001, 4096 - 1001) == checksum);
+    FICStorageTestAssert(FICChecksumCRC32C(0, bytes, 4096) == checksum);
+}
+
+#pragma mark - Cold Stores
+
+static const uint32_t FICStorageTestColdStoreImageLength = 4096;
+
+static void _FICStorageTestOpenColdStore(FICColdStore *store, const char *path, size_t capacity, uint32_t formatChecksum) {
+    FICColdStoreInit(store, path, capacity, FICStorageTestColdStoreImageLength, formatChecksum);
+    FICColdStoreOpen(store);
+}
+
+static bool _FICStorageTestColdStoreAppend(FICColdStore *store, uint32_t key, size_t payloadLength) {
+    uint8_t entityUUIDBytes[16];
+    uint8_t payload[1024];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+    memset(payload, (int)key, payloadLength);
+    return FICColdStoreAppend(store, entityUUIDBytes, entityUUIDBytes, payload, payloadLength);
+}
+
+// Returns whether the store has the record appended for `key`, intact
+static bool _FICStorageTestColdStoreHasRecord(FICColdStore *store, uint32_t key, size_t payloadLength) {
+    uint8_t entityUUIDBytes[16];
+    uint8_t payload[1024];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+    if (FICColdStorePayloadLength(store, entityUUIDBytes, entityUUIDBytes) != payloadLength || FICColdStoreRead(store, entityUUIDBytes, payload, payloadLength) == false) {
+        return false;
+    }
+
+    for (size_t i = 0; i < payloadLength; i++) {
+        if (payload[i] != (uint8_t)key) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the offset of the record appended for `key` in the log file
+static uint64_t _FICStorageTestColdStoreRecordOffset(const FICColdStore *store, uint32_t key) {
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+    const FICEntryIndexEntry *entry = FICEntryIndexFind(&store->index, entityUUIDBytes);
+    return entry != NULL ? store->records[entry->slot].offset : 0;
+}
+
+static void _FICStorageTestColdStorePersistsRecords(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "persists.coldStore");
+
+    FICColdStore store;
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 1);
+    FICStorageTestAssert(store.fileDescriptor >= 0);
+    for (uint32_t key = 1; key <= 3; key++) {
+        FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, key, 100 * key));
+    }
+
+    // Appending again for an entity replaces its record
+    FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, 2, 50));
+    FICStorageTestAssert(FICColdStoreCount(&store) == 3);
+
+    uint8_t entityUUIDBytes[16];
+    uint8_t otherSourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 1);
+    _FICStorageTestUUIDBytes(otherSourceImageUUIDBytes, 9);
+    FICStorageTestAssert(FICColdStorePayloadLength(&store, entityUUIDBytes, otherSourceImageUUIDBytes) == 0);
+    FICColdStoreDestroy(&store);
+
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 1);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 3);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 1, 100));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 2, 50));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 3, 300));
+
+    // Removed records don't come back when the log is scanned again
+    FICColdStoreRemove(&store, entityUUIDBytes);
+    FICColdStoreDestroy(&store);
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 1);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 2);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 1, 100) == false);
+    FICColdStoreDestroy(&store);
+
+    // A log written for a different image format is discarded
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 2);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 0);
+    FICColdStoreDestroy(&store);
+
+    unlink(path);
+}
+
+static void _FICStorageTestColdStoreWrapsAround(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "wraps.coldStore");
+
+    // Records of 200 bytes take 264 bytes of log each, so three fit after the header and the fourth wraps around to overwrite the first
+    size_t capacity = 1024;
+    FICColdStore store;
+    _FICStorageTestOpenColdStore(&store, path, capacity, 1);
+    for (uint32_t key = 1; key <= 10; key++) {
+        FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, key, 200));
+        FICStorageTestAssert(FICColdStoreCount(&store) <= 3);
+
+        struct stat fileStatus;
+        FICStorageTestAssert(fstat(store.fileDescriptor, &fileStatus) == 0 && (size_t)fileStatus.st_size <= capacity);
+    }
+
+    // The newest records survive, oldest first
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 7, 200) == false);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 8, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 9, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 10, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreRecordOffset(&store, 10) < _FICStorageTestColdStoreRecordOffset(&store, 9));
+
+    // A record larger than the whole store is refused
+    FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, 11, 1000) == false);
+    FICColdStoreDestroy(&store);
+
+    // Scanning a wrapped log puts its records back in the order they were written, so the next append overwrites the oldest
+    _FICStorageTestOpenColdStore(&store, path, capacity, 1);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 3);
+    FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, 12, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 8, 200) == false);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 9, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 10, 200));
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 12, 200));
+    FICColdStoreDestroy(&store);
+
+    unlink(path);
+}
+
+static void _FICStorageTestColdStoreChecksumsRecords(void) {
+    char path[1100];
+    _FICStorageTestPath(path, sizeof(path), "checksums.coldStore");
+
+    FICColdStore store;
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 1);
+    for (uint32_t key = 1; key <= 3; key++) {
+        FICStorageTestAssert(_FICStorageTestColdStoreAppend(&store, key, 200));
+    }
+
+    // Damaged data is caught when it's read, and the record is dropped
+    uint8_t damage = 0xEE;
+    uint64_t offset = _FICStorageTestColdStoreRecordOffset(&store, 1);
+    FICStorageTestAssert(pwrite(store.fileDescriptor, &damage, 1, (off_t)offset + 64 + 10) == 1);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 1, 200) == false);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 2);
+
+    // A damaged record header is skipped when the log is scanned, without losing the records after it
+    offset = _FICStorageTestColdStoreRecordOffset(&store, 2);
+    FICStorageTestAssert(pwrite(store.fileDescriptor, &damage, 1, (off_t)offset + 20) == 1);
+    FICColdStoreDestroy(&store);
+
+    _FICStorageTestOpenColdStore(&store, path, 64 * 1024, 1);
+    FICStorageTestAssert(FICColdStoreCount(&store) == 1);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 2, 200) == false);
+    FICStorageTestAssert(_FICStorageTestColdStoreHasRecord(&store, 3, 200));
+    FICColdStoreDestroy(&store);
+
+    unlink(path);
+}
+
+#pragma mark - Tables
+
+static void _FICStorageTestTableEvictsAndPersistsEntries(void) {
+    FICBenchmarkTableConfiguration configuration = {
+        .directoryPath = FICStorageTestDirectoryPath,
+        .name = "persistence",
+        .imageLength = 4096,
+        .maximumCount = 1,
+        .evictionPolicyKind = FICEvictionPolicyKindLRU,
+        .maximumMappedChunkCount = 1,
+        .synchronousWrites = false,
+    };
+
+    FICBenchmarkTable table;
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+
+    // The maximum count grows to fill a chunk
+    size_t maximumCount = table.engine.maximumCount;
+    FICStorageTestAssert(maximumCount == table.engine.file.entriesPerChunk);
+
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, 0xFFFF);
+    uint8_t *imageBytes = malloc(configuration.imageLength);
+    FICStorageTestAssert(imageBytes != NULL);
+
+    for (uint32_t key = 0; key < maximumCount + 2; key++) {
+        uint8_t entityUUIDBytes[16];
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        memset(imageBytes, (int)key, configuration.imageLength);
+        FICStorageTestAssert(FICBenchmarkTableSetEntry(&table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes));
+
+        // Key 2 is kept recently used, so it's never the one evicted
+        uint8_t recentEntityUUIDBytes[16];
+        _FICStorageTestUUIDBytes(recentEntityUUIDBytes, 2);
+        FICBenchmarkTableGetEntry(&table, recentEntityUUIDBytes, NULL);
+    }
+
+    uint8_t entityUUIDBytes[16];
+    FICStorageTestAssert(FICBenchmarkTableEntryCount(&table) == maximumCount);
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 0);
+    FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, NULL) == false);
+    FICStorageTestAssert(FICBenchmarkTableGetStatistics(&table).evictionCount == 2);
+
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 3);
+    FICBenchmarkTableDeleteEntry(&table, entityUUIDBytes);
+    FICStorageTestAssert(FICBenchmarkTableSaveMetadata(&table));
+    FICBenchmarkTableClose(&table);
+
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+    FICStorageTestAssert(FICBenchmarkTableEntryCount(&table) == maximumCount - 1);
+    FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, NULL) == false);
+
+    _FICStorageTestUUIDBytes(entityUUIDBytes, 2);
+    FICStorageTestAssert(FICBenchmarkTableEntryExists(&table, entityUUIDBytes, sourceImageUUIDBytes));
+    FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, imageBytes));
+    FICStorageTestAssert(imageBytes[0] == 2 && imageBytes[configuration.imageLength - 1] == 2);
+
+    free(imageBytes);
+    FICBenchmarkTableClose(&table);
+    FICBenchmarkTableRemoveFiles(configuration.directoryPath, configuration.name);
+}
+
+static void _FICStorageTestTableMapsReservedAddressSpace(void) {
+    FICBenchmarkTableConfiguration configuration = {
+        .directoryPath = FICStorageTestDirectoryPath,
+        .name = "reserved",
+        .imageLength = 4096,
+        .maximumCount = 600,
+        .evictionPolicyKind = FICEvictionPolicyKindLRU,
+        .maximumMappedChunkCount = 0,
+        .synchronousWrites = false,
+        .reservedMapping = true,
+    };
+
+    FICBenchmarkTable table;
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+    FICStorageTestAssert(table.reservedBytes != NULL);
+    size_t chunkCount = table.reservedLength / table.engine.file.chunkLength;
+    FICStorageTestAssert(chunkCount > 1);
+
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, 0xFFFF);
+    static uint8_t imageBytes[4096];
+    size_t entryCount = table.engine.maximumCount;
+    for (uint32_t key = 0; key < entryCount; key++) {
+        uint8_t entityUUIDBytes[16];
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        memset(imageBytes, (int)(key & 0xff), sizeof(imageBytes));
+        FICStorageTestAssert(FICBenchmarkTableSetEntry(&table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes));
+    }
+
+    // The file is mapped in place as it grows a chunk at a time, and nothing is unmapped even though no unused chunks are kept mapped
+    FICBenchmarkTableStatistics statistics = FICBenchmarkTableGetStatistics(&table);
+    FICStorageTestAssert(statistics.mappingCount == chunkCount);
+    FICStorageTestAssert(statistics.unmappingCount == 0);
+    FICBenchmarkTableClose(&table);
+
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+    FICStorageTestAssert(table.reservedMappedLength == (size_t)table.engine.file.length);
+    for (uint32_t key = 0; key < entryCount; key++) {
+        uint8_t entityUUIDBytes[16];
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, imageBytes));
+        FICStorageTestAssert(imageBytes[0] == (key & 0xff) && imageBytes[sizeof(imageBytes) - 1] == (key & 0xff));
+    }
+
+    statistics = FICBenchmarkTableGetStatistics(&table);
+    FICStorageTestAssert(statistics.mappingCount == 1);
+    FICStorageTestAssert(statistics.unmappingCount == 0);
+
+    FICBenchmarkTableClose(&table);
+    FICBenchmarkTableRemoveFiles(configuration.directoryPath, configuration.name);
+}
+
+static void _FICStorageTestReservedTableGrowsPastReservationWhenEntriesArePinned(void) {
+    FICBenchmarkTableConfiguration configuration = {
+        .directoryPath = FICStorageTestDirectoryPath,
+        .name = "reserved-pinned",
+        .imageLength = 4096,
+        .maximumCount = 64,
+        .evictionPolicyKind = FICEvictionPolicyKindLRU,
+        .maximumMappedChunkCount = 0,
+        .synchronousWrites = false,
+        .reservedMapping = true,
+    };
+
+    FICBenchmarkTable table;
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+    FICStorageTestAssert(table.reservedBytes != NULL);
+    size_t reservedEntryCount = table.reservedLength / table.engine.file.entryLength;
+
+    // Every entry the reservation has room for is in use, so none of them can be evicted
+    uint8_t sourceImageUUIDBytes[16];
+    _FICStorageTestUUIDBytes(sourceImageUUIDBytes, 0xFFFF);
+    static uint8_t imageBytes[4096];
+    for (uint32_t key = 0; key < reservedEntryCount; key++) {
+        uint8_t entityUUIDBytes[16];
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        memset(imageBytes, (int)(key & 0xff), sizeof(imageBytes));
+        FICStorageTestAssert(FICBenchmarkTableSetEntry(&table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes));
+
+        uint32_t slot = FICTableEngineSlotOfEntry(&table.engine, entityUUIDBytes);
+        FICTableEngineEntryWasRetrieved(&table.engine, slot, entityUUIDBytes, true);
+    }
+
+    // The entry is still stored, like it is in the chunked mode, with the file data past the reservation mapped in chunks
+    uint32_t overflowKey = (uint32_t)reservedEntryCount;
+    uint8_t entityUUIDBytes[16];
+    _FICStorageTestUUIDBytes(entityUUIDBytes, overflowKey);
+    memset(imageBytes, (int)(overflowKey & 0xff), sizeof(imageBytes));
+    FICStorageTestAssert(FICBenchmarkTableSetEntry(&table, entityUUIDBytes, sourceImageUUIDBytes, imageBytes));
+    FICStorageTestAssert(FICBenchmarkTableEntryCount(&table) == reservedEntryCount + 1);
+    FICStorageTestAssert((size_t)table.engine.file.length > table.reservedLength);
+    FICStorageTestAssert(table.reservedMappedLength == table.reservedLength);
+
+    for (uint32_t key = 0; key <= overflowKey; key++) {
+        _FICStorageTestUUIDBytes(entityUUIDBytes, key);
+        FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, imageBytes));
+        FICStorageTestAssert(imageBytes[0] == (key & 0xff) && imageBytes[sizeof(imageBytes) - 1] == (key & 0xff));
+    }
+
+    // The chunk past the reservation is unmapped again once it isn't used
+    FICBenchmarkTableStatistics statistics = FICBenchmarkTableGetStatistics(&table);
+    FICStorageTestAssert(statistics.unmappingCount == statistics.mappingCount - reservedEntryCount / table.engine.file.entriesPerChunk);
+    FICBenchmarkTableClose(&table);
+
+    // Reopening reserves room for the whole file
+    FICStorageTestAssert(FICBenchmarkTableOpen(&table, &configuration));
+    FICStorageTestAssert(table.reservedLength == (size_t)table.engine.file.length);
+    _FICStorageTestUUIDBytes(entityUUIDBytes, overflowKey);
+    FICStorageTestAssert(FICBenchmarkTableGetEntry(&table, entityUUIDBytes, imageBytes));
+    FICStorageTestAssert(imageBytes[0] == (overflowKey & 0xff));
+
+    FICBenchmarkTableClose(&table);
+    FICBenchmarkTableRemoveFiles(configuration.directoryPath, configuration.name);
+}
+
+#pragma mark - Running Tests
+
+int main(void) {
+    const char *temporaryDirectoryPath = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(FICStorageTestDirectoryPath, sizeof(FICStorageTestDirectoryPath), "%s/fic-storage-tests.XXXXXX", temporaryDirectoryPath);
+    if (mkdtemp(FICStorageTestDirectoryPath) == NULL) {
+        fprintf(stderr, "fic-storage-tests: couldn't create a directory in %s\n", temporaryDirectoryPath);
+        return 1;
+    }
+
+    _FICStorageTestTableFileGeometry();
+    _FICStorageTestTableFileEntriesSurviveReopening();
+    _FICStorageTestTableFileReservedAddressSpaceGrowsInPlace();
+    _FICStorageTestTableFilePunchHole();
+    _FICStorageTestMetadataJournalReplaysRecords();
+    _FICStorageTestMetadataJournalTruncatesDamagedTail();
+    _FICStorageTestTableEngineEvictsLeastRecentlyUsedEntry();
+    _FICStorageTestTableEngineReplaysJournal();
+    _FICStorageTestTableEngineDropsUncommittedEntries();
+    _FICStorageTestTableEngineCompactsTableFile();
+    _FICStorageTestTableEnginePunchesIdleSlots();
+    _FICStorageTestCompressionRoundTrip();
+    _FICStorageTestCompressionRejectsCorruptInput();
+    _FICStorageTestChecksumMatchesKnownValues();
+    _FICStorageTestChecksumImplementationsAgree();
+    _FICStorageTestColdStorePersistsRecords();
+    _FICStorageTestColdStoreWrapsAround();
+    _FICStorageTestColdStoreChecksumsRecords();
+    _FICStorageTestTableEvictsAndPersistsEntries();
+    _FICStorageTestTableMapsReservedAddressSpace();
+    _FICStorageTestReservedTableGrowsPastReservationWhenEntriesArePinned();
+
+    rmdir(FICStorageTestDirectoryPath);
+
+    if (FICStorageTestFailureCount > 0) {
+        fprintf(stderr, "fic-storage-tests: %zu failed\n", FICStorageTestFailureCount);
+        return 1;
+    }
+
+    printf("fic-storage-tests: all passed\n");
+    return 0;
+}
@@ -8,6 +8,152 @@
 
 #import <UIKit/UIKit.h>
 #import <XCTest/XCTest.h>
+#import <objc/runtime.h>
+
+#import "../FastImageCache/FastImageCache/FICSlotAllocator.h"
+#import "../FastImageCache/FastImageCache/FICRecencyList.h"
+#import "../FastImageCache/FastImageCache/FICEvictionPolicy.h"
+#import "../FastImageCache/FastImageCache/FICEntryIndex.h"
+#import "../FastImageCache/FastImageCache/FICCompression.h"
+#import "../FastImageCache/FastImageCache/FICPixelConversion.h"
+#import "../FastImageCache/FastImageCache/FICPixelScaling.h"
+#import "../FastImageCache/FastImageCache/FICChecksum.h"
+#import "../FastImageCache/FastImageCache/FICMetadataJournal.h"
+#import "../FastImageCache/FastImageCache/FICMetadataSnapshot.h"
+#import "../FastImageCache/FastImageCache/FICUtilities.h"
+#import "../FastImageCache/FastImageCache/FICImageCache.h"
+#import "../FastImageCache/FastImageCache/FICImageFormat.h"
+#import "../FastImageCache/FastImageCache/FICImageTable.h"
+#import "../FastImageCache/FastImageCache/FICImageTableChunk.h"
+#import "../FastImageCache/FastImageCache/FICImageTableDiskBudget.h"
+#import "../FastImageCache/FastImageCache/FICImageCacheTrace.h"
+
+#pragma mark - Private Interfaces
+
+@interface FICImageTable (FICTesting)
+
++ (dispatch_queue_t)_metadataQueue;
+- (void)_prefetchEntriesInRange:(NSRange)range;
+- (NSInteger)_maximumCount;
+
+@end
+
+@interface FICImageCache (FICTesting)
+
++ (dispatch_queue_t)_prefetchQueue;
+
+@end
+
+#pragma mark - Test Entities
+
+@interface FICTestEntity : NSObject <FICEntity>
+
+@property (nonatomic, copy) NSString *fic_UUID;
+@property (nonatomic, copy) NSString *fic_sourceImageUUID;
+
+@end
+
+@implementation FICTestEntity
+
+- (NSURL *)fic_sourceImageURLWithFormatName:(NSString *)formatName {
+    return [NSURL URLWithString:[NSString stringWithFormat:@"test://%@", _fic_sourceImageUUID]];
+}
+
+- (FICEntityImageDrawingBlock)fic_drawingBlockForImage:(UIImage *)image withFormatName:(NSString *)formatName {
+    return ^(CGContextRef context, CGSize contextSize) {
+        UIGraphicsPushContext(context);
+        [image drawInRect:CGRectMake(0, 0, contextSize.width, contextSize.height)];
+        UIGraphicsPopContext();
+    };
+}
+
+@end
+
+// Doesn't finish drawing its image until it's told to, which keeps the processing worker busy
+@interface FICTestBlockingEntity : FICTestEntity
+
+@property (nonatomic, strong) dispatch_semaphore_t drawingSemaphore;
+
+@end
+
+@implementation FICTestBlockingEntity
+
+- (FICEntityImageDrawingBlock)fic_drawingBlockForImage:(UIImage *)image withFormatName:(NSString *)formatName {
+    dispatch_semaphore_t drawingSemaphore = _drawingSemaphore;
+    FICEntityImageDrawingBlock drawingBlock = [super fic_drawingBlockForImage:image withFormatName:formatName];
+    return ^(CGContextRef context, CGSize contextSize) {
+        dispatch_semaphore_wait(drawingSemaphore, DISPATCH_TIME_FOREVER);
+        drawingBlock(context, contextSize);
+    };
+}
+
+@end
+
+#pragma mark - Test Delegates
+
+// Holds on to source image requests instead of completing them
+@interface FICTestImageCacheDelegate : NSObject <FICImageCacheDelegate>
+
+@property (nonatomic, strong, readonly) NSMutableArray *requestedEntities;
+@property (nonatomic, strong, readonly) NSMutableArray *canceledEntities;
+
+@end
+
+@implementation FICTestImageCacheDelegate
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _requestedEntities = [[NSMutableArray alloc] init];
+        _canceledEntities = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)imageCache:(FICImageCache *)imageCache wantsSourceImageForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName completionBlock:(FICImageRequestCompletionBlock)completionBlock {
+    [_requestedEntities addObject:entity];
+}
+
+- (void)imageCache:(FICImageCache *)imageCache cancelImageLoadingForEntity:(id <FICEntity>)entity withFormatName:(NSString *)formatName {
+    [_canceledEntities addObject:entity];
+}
+
+@end
+
+#pragma mark - Test Image Tables
+
+static const void *FICTestPrefetchedRangesKey = &FICTestPrefetchedRangesKey;
+
+// Records the ranges of entries it's asked to prefetch. It has no instance variables of its own, so an image table created by an image cache can be turned into one by setting its class.
+@interface FICTestPrefetchRecordingImageTable : FICImageTable
+
+@property (nonatomic, strong, readonly) NSMutableArray *prefetchedRanges;
+
+@end
+
+@implementation FICTestPrefetchRecordingImageTable
+
+- (NSMutableArray *)prefetchedRanges {
+    @synchronized (self) {
+        NSMutableArray *prefetchedRanges = objc_getAssociatedObject(self, FICTestPrefetchedRangesKey);
+        if (prefetchedRanges == nil) {
+            prefetchedRanges = [NSMutableArray array];
+            objc_setAssociatedObject(self, FICTestPrefetchedRangesKey, prefetchedRanges, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        return prefetchedRanges;
+    }
+}
+
+- (void)_prefetchEntriesInRange:(NSRange)range {
+    @synchronized (self) {
+        [[self prefetchedRanges] addObject:[NSValue valueWithRange:range]];
+    }
+    [super _prefetchEntriesInRange:range];
+}
+
+@end
+
+#pragma mark
 
 @interface FastImageCacheTests : XCTestCase
 
@@ -37,4 +183,1525 @@
     }];
 }
 
+#pragma mark - Slot Allocation
+
+// Simulates a full table where every insert evicts a random entry and reuses the lowest free slot. The time per
+// iteration should stay flat as the table grows.
+- (void)_measureSlotAllocationWithSlotCount:(size_t)slotCount {
+    FICSlotAllocator allocator;
+    FICSlotAllocatorInit(&allocator);
+    FICSlotAllocatorSetSlotCount(&allocator, slotCount);
+    for (size_t slot = 0; slot < slotCount; slot++) {
+        FICSlotAllocatorMarkOccupied(&allocator, slot);
+    }
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100000; i++) {
+            FICSlotAllocatorMarkFree(&allocator, arc4random_uniform((uint32_t)slotCount));
+            size_t slot = FICSlotAllocatorFirstFreeSlot(&allocator);
+            XCTAssertLessThan(slot, slotCount);
+            FICSlotAllocatorMarkOccupied(&allocator, slot);
+        }
+    }];
+    
+    FICSlotAllocatorDestroy(&allocator);
+}
+
+- (void)testSlotAllocationPerformance1K {
+    [self _measureSlotAllocationWithSlotCount:1000];
+}
+
+- (void)testSlotAllocationPerformance10K {
+    [self _measureSlotAllocationWithSlotCount:10000];
+}
+
+- (void)testSlotAllocationPerformance100K {
+    [self _measureSlotAllocationWithSlotCount:100000];
+}
+
+#pragma mark - Recency Tracking
+
+// Simulates cache hits that pin and later release entries, interleaved with evictions of the least recently used entry.
+- (void)_measureRecencyListWithSlotCount:(uint32_t)slotCount {
+    FICRecencyList list;
+    FICRecencyListInit(&list);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        FICRecencyListTouch(&list, slot);
+    }
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100000; i++) {
+            uint32_t slot = arc4random_uniform(slotCount);
+            FICRecencyListTouch(&list, slot);
+            FICRecencyListPin(&list, slot);
+            
+            uint32_t victim = FICRecencyListLeastRecentSlot(&list);
+            FICRecencyListRemove(&list, victim);
+            FICRecencyListTouch(&list, victim);
+            
+            FICRecencyListUnpin(&list, slot);
+        }
+    }];
+    
+    FICRecencyListDestroy(&list);
+}
+
+- (void)testRecencyListPerformance1K {
+    [self _measureRecencyListWithSlotCount:1000];
+}
+
+- (void)testRecencyListPerformance100K {
+    [self _measureRecencyListWithSlotCount:100000];
+}
+
+#pragma mark - UUID Keys
+
+- (void)testUUIDStringRoundTrip {
+    for (NSUInteger i = 0; i < 1000; i++) {
+        NSUUID *UUID = [NSUUID UUID];
+        CFUUIDBytes UUIDBytes;
+        [UUID getUUIDBytes:(uint8_t *)&UUIDBytes];
+        
+        XCTAssertEqualObjects(FICStringWithUUIDBytes(UUIDBytes), [UUID UUIDString]);
+        XCTAssertTrue(FICUUIDBytesEqual(FICUUIDBytesWithString([UUID UUIDString]), UUIDBytes));
+        XCTAssertTrue(FICUUIDBytesEqual(FICUUIDBytesWithString([[UUID UUIDString] lowercaseString]), UUIDBytes));
+    }
+    
+    XCTAssertFalse(FICUUIDBytesEqual(FICUUIDBytesWithString(@"0000000G-0000-0000-0000-000000000000"), FICUUIDBytesWithString(@"00000000-0000-0000-0000-000000000000")));
+}
+
+// Simulates cache hits against a full index: each lookup parses the entity UUID string and finds its entry.
+- (void)_measureEntryIndexLookupWithEntryCount:(uint32_t)entryCount {
+    FICEntryIndex index;
+    FICEntryIndexInit(&index);
+    
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (uint32_t slot = 0; slot < entryCount; slot++) {
+        NSString *entityUUID = [[NSUUID UUID] UUIDString];
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString(entityUUID);
+        FICEntryIndexSet(&index, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&entityUUIDBytes, slot);
+        [entityUUIDs addObject:entityUUID];
+    }
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100000; i++) {
+            CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString([entityUUIDs objectAtIndex:arc4random_uniform(entryCount)]);
+            XCTAssertTrue(FICEntryIndexFind(&index, (const uint8_t *)&entityUUIDBytes) != NULL);
+        }
+    }];
+    
+    FICEntryIndexDestroy(&index);
+}
+
+- (void)testEntryIndexLookupPerformance1K {
+    [self _measureEntryIndexLookupWithEntryCount:1000];
+}
+
+- (void)testEntryIndexLookupPerformance100K {
+    [self _measureEntryIndexLookupWithEntryCount:100000];
+}
+
+#pragma mark - Concurrent Retrieval
+
+// Simulates cache hits on several threads at once. Every thread retrieves the same number of images, so the time per run should stay roughly flat as threads are added, up to the number of cores.
+- (void)_measureConcurrentImageRetrievalWithThreadCount:(size_t)threadCount mappingMode:(FICImageFormatMappingMode)mappingMode {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICConcurrentRetrievalTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICConcurrentRetrievalTestsFormat" family:@"FICConcurrentRetrievalTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:256 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setMappingMode:mappingMode];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    NSUInteger entryCount = 256;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 1, 0, 0, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    NSUInteger *missCounts = calloc(threadCount, sizeof(NSUInteger));
+    
+    [self measureBlock:^{
+        dispatch_apply(threadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t thread) {
+            for (NSUInteger i = 0; i < 10000; i++) {
+                @autoreleasepool {
+                    uint32_t entryIndex = arc4random_uniform((uint32_t)entryCount);
+                    UIImage *image = [imageTable newImageForEntityUUID:entityUUIDs[entryIndex] sourceImageUUID:sourceImageUUIDs[entryIndex] preheatData:NO];
+                    if (image == nil) {
+                        missCounts[thread]++;
+                    }
+                }
+            }
+        });
+    }];
+    
+    for (size_t thread = 0; thread < threadCount; thread++) {
+        XCTAssertEqual(missCounts[thread], (NSUInteger)0);
+    }
+    free(missCounts);
+    
+    [imageTable reset];
+}
+
+- (void)testConcurrentImageRetrievalPerformance1Thread {
+    [self _measureConcurrentImageRetrievalWithThreadCount:1 mappingMode:FICImageFormatMappingModeChunked];
+}
+
+- (void)testConcurrentImageRetrievalPerformance2Threads {
+    [self _measureConcurrentImageRetrievalWithThreadCount:2 mappingMode:FICImageFormatMappingModeChunked];
+}
+
+- (void)testConcurrentImageRetrievalPerformance4Threads {
+    [self _measureConcurrentImageRetrievalWithThreadCount:4 mappingMode:FICImageFormatMappingModeChunked];
+}
+
+- (void)testConcurrentImageRetrievalPerformance8Threads {
+    [self _measureConcurrentImageRetrievalWithThreadCount:8 mappingMode:FICImageFormatMappingModeChunked];
+}
+
+- (void)testConcurrentImageRetrievalPerformance4ThreadsReservedMapping {
+    [self _measureConcurrentImageRetrievalWithThreadCount:4 mappingMode:FICImageFormatMappingModeReserved];
+}
+
+#pragma mark - Image Processing
+
+// Simulates a burst of freshly downloaded photos being drawn into a format. Comparing the serial run with the parallel one shows the throughput gained by processing on every core.
+- (void)_measureImageProcessingWithMaximumConcurrentProcessingCount:(NSUInteger)maximumConcurrentProcessingCount {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICImageProcessingTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICImageProcessingTestsFormat" family:@"FICImageProcessingTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGR
+                                                    maximumCount:200 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageCache setFormats:@[imageFormat]];
+    [imageCache setMaximumConcurrentProcessingCount:maximumConcurrentProcessingCount];
+    
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(1024, 768), YES, 1);
+    [[UIColor orangeColor] setFill];
+    UIRectFill(CGRectMake(0, 0, 1024, 768));
+    UIImage *sourceImage = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    
+    NSUInteger imageCount = 200;
+    
+    [self measureBlock:^{
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Every image was processed"];
+        __block NSUInteger remainingImageCount = imageCount;
+        
+        for (NSUInteger i = 0; i < imageCount; i++) {
+            FICTestEntity *entity = [[FICTestEntity alloc] init];
+            [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+            [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+            
+            [imageCache setImage:sourceImage forEntity:entity withFormatName:[imageFormat name] completionBlock:^(id <FICEntity> entity, NSString *formatName, UIImage *image) {
+                // Completion blocks are called on the main queue
+                XCTAssertNotNil(image);
+                remainingImageCount--;
+                if (remainingImageCount == 0) {
+                    [expectation fulfill];
+                }
+            }];
+        }
+        
+        [self waitForExpectationsWithTimeout:60 handler:nil];
+    }];
+    
+    [imageCache reset];
+}
+
+- (void)testImageProcessingPerformanceSerial {
+    [self _measureImageProcessingWithMaximumConcurrentProcessingCount:1];
+}
+
+- (void)testImageProcessingPerformanceParallel {
+    [self _measureImageProcessingWithMaximumConcurrentProcessingCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+}
+
+// Images queued before a reset should be deleted by it, even while they're drawn in parallel, and images queued after it should survive it
+- (void)testResetIsOrderedWithImageProcessing {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICImageProcessingTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICResetTestsFormat" family:@"FICImageProcessingTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGR
+                                                    maximumCount:50 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageCache setFormats:@[imageFormat]];
+    [imageCache setMaximumConcurrentProcessingCount:4];
+    
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(256, 256), YES, 1);
+    [[UIColor orangeColor] setFill];
+    UIRectFill(CGRectMake(0, 0, 256, 256));
+    UIImage *sourceImage = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    
+    NSMutableArray *entities = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 21; i++) {
+        FICTestEntity *entity = [[FICTestEntity alloc] init];
+        [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+        [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+        [entities addObject:entity];
+    }
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every image was processed"];
+    __block NSUInteger remainingImageCount = [entities count];
+    FICImageCacheCompletionBlock completionBlock = ^(id <FICEntity> entity, NSString *formatName, UIImage *image) {
+        remainingImageCount--;
+        if (remainingImageCount == 0) {
+            [expectation fulfill];
+        }
+    };
+    
+    FICTestEntity *lastEntity = [entities lastObject];
+    for (FICTestEntity *entity in entities) {
+        if (entity == lastEntity) {
+            [imageCache reset];
+        }
+    
+        [imageCache setImage:sourceImage forEntity:entity withFormatName:[imageFormat name] completionBlock:completionBlock];
+    }
+    
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    
+    for (FICTestEntity *entity in entities) {
+        XCTAssertEqual([imageCache imageExistsForEntity:entity withFormatName:[imageFormat name]], (BOOL)(entity == lastEntity));
+    }
+    
+    [imageCache reset];
+}
+
+// Simulates a cell that shows an entity's thumbnail scrolling into view while the entity's large image is also waiting to be drawn. Only the thumbnail moves ahead.
+- (void)testReprioritizingImageProcessingOnlyAffectsTheGivenFormat {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICProcessingPriorityTests"];
+    FICImageFormat *smallImageFormat = [FICImageFormat formatWithName:@"FICProcessingPriorityTestsSmallFormat" family:@"FICProcessingPriorityTestsSmall" imageSize:CGSizeMake(16, 16)
+                                                                 style:FICImageFormatStyle32BitBGR maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad
+                                                        protectionMode:FICImageFormatProtectionModeNone];
+    FICImageFormat *largeImageFormat = [FICImageFormat formatWithName:@"FICProcessingPriorityTestsLargeFormat" family:@"FICProcessingPriorityTestsLarge" imageSize:CGSizeMake(64, 64)
+                                                                 style:FICImageFormatStyle32BitBGR maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad
+                                                        protectionMode:FICImageFormatProtectionModeNone];
+    [imageCache setFormats:@[smallImageFormat, largeImageFormat]];
+    [imageCache setMaximumConcurrentProcessingCount:1];
+    
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(64, 64), YES, 1);
+    [[UIColor orangeColor] setFill];
+    UIRectFill(CGRectMake(0, 0, 64, 64));
+    UIImage *sourceImage = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    
+    FICTestBlockingEntity *blockingEntity = [[FICTestBlockingEntity alloc] init];
+    [blockingEntity setFic_UUID:[[NSUUID UUID] UUIDString]];
+    [blockingEntity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+    [blockingEntity setDrawingSemaphore:dispatch_semaphore_create(0)];
+    
+    FICTestEntity *otherEntity = [[FICTestEntity alloc] init];
+    [otherEntity setFic_UUID:[[NSUUID UUID] UUIDString]];
+    [otherEntity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+    
+    FICTestEntity *entity = [[FICTestEntity alloc] init];
+    [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+    [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Every image was processed"];
+    NSMutableArray *processedImages = [NSMutableArray array];
+    FICImageCacheCompletionBlock completionBlock = ^(id <FICEntity> completedEntity, NSString *formatName, UIImage *image) {
+        if (completedEntity != blockingEntity) {
+            [processedImages addObject:@[completedEntity, formatName]];
+        }
+        if ([processedImages count] == 3) {
+            [expectation fulfill];
+        }
+    };
+    
+    // The blocking entity keeps the only worker busy while the other images wait in the order they were added
+    [imageCache setImage:sourceImage forEntity:blockingEntity withFormatName:[smallImageFormat name] completionBlock:completionBlock];
+    [imageCache setImage:sourceImage forEntity:otherEntity withFormatName:[smallImageFormat name] completionBlock:completionBlock];
+    [imageCache setImage:sourceImage forEntity:entity withFormatName:[largeImageFormat name] completionBlock:completionBlock];
+    [imageCache setImage:sourceImage forEntity:entity withFormatName:[smallImageFormat name] completionBlock:completionBlock];
+    
+    [imageCache setPriority:FICImageCachePriorityHigh forImageRetrievalForEntity:entity withFormatName:[smallImageFormat name]];
+    dispatch_semaphore_signal([blockingEntity drawingSemaphore]);
+    
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    
+    XCTAssertEqualObjects(processedImages, (@[@[entity, [smallImageFormat name]], @[otherEntity, [smallImageFormat name]], @[entity, [largeImageFormat name]]]));
+    
+    [imageCache reset];
+}
+
+#pragma mark - Durability
+
+// Measures how long it takes to store entries with each durability mode. Deferred writes should be much faster than synchronous ones, since they're written back in batches later.
+- (void)_measureEntryWritingWithDurability:(FICImageFormatDurability)durability {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICDurabilityTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICDurabilityTestsFormat" family:@"FICDurabilityTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:500 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setDurability:durability];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 500; i++) {
+            @autoreleasepool {
+                [imageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+                    CGContextSetRGBFillColor(context, 0, 0, 1, 1);
+                    CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+                }];
+            }
+        }
+    }];
+    
+    [imageTable reset];
+}
+
+- (void)testEntryWritingPerformanceSynchronous {
+    [self _measureEntryWritingWithDurability:FICImageFormatDurabilitySynchronous];
+}
+
+- (void)testEntryWritingPerformanceDeferred {
+    [self _measureEntryWritingWithDurability:FICImageFormatDurabilityDeferred];
+}
+
+// Simulates the app stopping after an image was stored but before its data was written. The entry's set record is in the journal, but without a commit it's dropped on the next launch.
+- (void)testUncommittedEntriesAreDroppedWhenReopening {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICDurabilityTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICUncommittedEntryTestsFormat" family:@"FICDurabilityTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setDurability:FICImageFormatDurabilityDeferred];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    NSString *entityUUID = [[NSUUID UUID] UUIDString];
+    NSString *sourceImageUUID = [[NSUUID UUID] UUIDString];
+    [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 1, 0, 0, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    }];
+    XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]);
+    
+    // The set record is written to the journal right away, while the commit has to wait for the deferred flush a second later
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    FICImageTable *reopenedImageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    XCTAssertNotNil(reopenedImageTable);
+    XCTAssertFalse([reopenedImageTable entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]);
+    
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    [imageTable reset];
+}
+
+#pragma mark - Chunk Mapping
+
+// Simulates scrolling back and forth over the same images. Once every chunk has been mapped, retrieving images again shouldn't map or unmap anything.
+- (void)testRepeatedImageRetrievalDoesNotRemapChunks {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICChunkMappingTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICChunkMappingTestsFormat" family:@"FICChunkMappingTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:500 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    NSUInteger entryCount = 500;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 0, 1, 0, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    NSUInteger mappingCount = 0;
+    NSUInteger unmappingCount = 0;
+    for (NSUInteger pass = 0; pass < 3; pass++) {
+        if (pass == 1) {
+            mappingCount = [FICImageTableChunk mappingCount];
+            unmappingCount = [FICImageTableChunk unmappingCount];
+        }
+        
+        for (NSUInteger i = 0; i < entryCount; i++) {
+            @autoreleasepool {
+                NSUInteger entryIndex = pass % 2 == 0 ? i : entryCount - 1 - i;
+                UIImage *image = [imageTable newImageForEntityUUID:entityUUIDs[entryIndex] sourceImageUUID:sourceImageUUIDs[entryIndex] preheatData:NO];
+                XCTAssertNotNil(image);
+            }
+        }
+    }
+    
+    XCTAssertEqual([FICImageTableChunk mappingCount], mappingCount);
+    XCTAssertEqual([FICImageTableChunk unmappingCount], unmappingCount);
+    
+    [imageTable reset];
+}
+
+// Simulates every image of a reserved-mode table being on screen when another one is stored. Nothing can be evicted, so the table file grows past the reserved address space, the
+// same way it grows in the chunked mode, and the entries past it are mapped in chunks.
+- (void)testReservedMappingStoresEntriesPastTheReservationWhenEveryEntryIsInUse {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICReservedMappingTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICReservedMappingTestsFormat" family:@"FICReservedMappingTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:100 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setMappingMode:FICImageFormatMappingModeReserved];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    // Holding on to each image keeps its entry pinned
+    NSUInteger entryCount = (NSUInteger)[imageTable _maximumCount] + 1;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *images = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        @autoreleasepool {
+            [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+            [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+            [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+                CGContextSetRGBFillColor(context, 0, 1, 0, 1);
+                CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+            }];
+            
+            UIImage *image = [imageTable newImageForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] preheatData:NO];
+            XCTAssertNotNil(image);
+            if (image != nil) {
+                [images addObject:image];
+            }
+        }
+    }
+    
+    XCTAssertEqual([images count], entryCount);
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i]]);
+    }
+    
+    // Once the images are gone, storing another entry evicts one instead of growing the file again
+    [images removeAllObjects];
+    NSString *entityUUID = [[NSUUID UUID] UUIDString];
+    NSString *sourceImageUUID = [[NSUUID UUID] UUIDString];
+    [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 0, 1, 0, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    }];
+    XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID]);
+    XCTAssertEqual([imageTable statistics].evictedEntryCount, (NSUInteger)1);
+    
+    [imageTable reset];
+}
+
+#pragma mark - Batched Retrieval
+
+// Simulates a screenful of cache hits, retrieved either in one batch or one entity at a time. Misses must come back as NSNull in their requested positions.
+- (void)_measureImageRetrievalWithBatchCount:(NSUInteger)batchCount batched:(BOOL)batched {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICBatchedRetrievalTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICBatchedRetrievalTestsFormat" family:@"FICBatchedRetrievalTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:batchCount devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:batchCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:batchCount];
+    for (NSUInteger i = 0; i < batchCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        
+        // Every fourth entity is left out of the table
+        if (i % 4 != 3) {
+            [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+                CGContextSetRGBFillColor(context, 0, 0, 1, 1);
+                CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+            }];
+        }
+    }
+    
+    NSArray *images = [imageTable newImagesForEntityUUIDs:entityUUIDs sourceImageUUIDs:sourceImageUUIDs preheatData:NO];
+    XCTAssertEqual([images count], batchCount);
+    for (NSUInteger i = 0; i < batchCount; i++) {
+        if (i % 4 != 3) {
+            XCTAssertTrue([images[i] isKindOfClass:[UIImage class]]);
+        } else {
+            XCTAssertEqualObjects(images[i], [NSNull null]);
+        }
+    }
+    
+    [self measureBlock:^{
+        for (NSUInteger pass = 0; pass < 1000; pass++) {
+            @autoreleasepool {
+                if (batched) {
+                    [imageTable newImagesForEntityUUIDs:entityUUIDs sourceImageUUIDs:sourceImageUUIDs preheatData:NO];
+                } else {
+                    for (NSUInteger i = 0; i < batchCount; i++) {
+                        [imageTable newImageForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] preheatData:NO];
+                    }
+                }
+            }
+        }
+    }];
+    
+    [imageTable reset];
+}
+
+- (void)testImageRetrievalPerformanceBatched {
+    [self _measureImageRetrievalWithBatchCount:40 batched:YES];
+}
+
+- (void)testImageRetrievalPerformanceUnbatched {
+    [self _measureImageRetrievalWithBatchCount:40 batched:NO];
+}
+
+// Simulates a screen of cells that missed the cache while speculative requests for rows further down are still waiting. The batch's source images go ahead of them together.
+- (void)testBatchedRetrievalRequestsMissingSourceImagesWithItsPriority {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICBatchedRetrievalPriorityTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICBatchedRetrievalPriorityTestsFormat" family:@"FICBatchedRetrievalPriorityTests" imageSize:CGSizeMake(16, 16)
+                                                            style:FICImageFormatStyle32BitBGRA maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad
+                                                   protectionMode:FICImageFormatProtectionModeNone];
+    [imageCache setFormats:@[imageFormat]];
+    FICTestImageCacheDelegate *delegate = [[FICTestImageCacheDelegate alloc] init];
+    [imageCache setDelegate:delegate];
+    [imageCache setMaximumConcurrentSourceImageRequestCount:1];
+    
+    NSMutableArray *entities = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 4; i++) {
+        FICTestEntity *entity = [[FICTestEntity alloc] init];
+        [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+        [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+        [entities addObject:entity];
+    }
+    
+    NSString *formatName = [imageFormat name];
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[0] withFormatName:formatName priority:FICImageCachePriorityNormal deadline:nil completionBlock:nil];
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[1] withFormatName:formatName priority:FICImageCachePriorityNormal deadline:nil completionBlock:nil];
+    
+    // The misses are requested in the same main queue block that calls the batch completion block, so they've been requested once it's called
+    XCTestExpectation *expectation = [self expectationWithDescription:@"The batch was looked up"];
+    [imageCache asynchronouslyRetrieveImagesForEntities:@[entities[2], entities[3]] withFormatName:formatName priority:FICImageCachePriorityHigh deadline:nil batchCompletionBlock:^(NSArray *foundEntities, NSString *batchFormatName, NSArray *images) {
+        XCTAssertEqual([foundEntities count], (NSUInteger)0);
+        [expectation fulfill];
+    } completionBlock:nil];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    for (NSUInteger i = 0; i < 3; i++) {
+        [imageCache cancelImageRetrievalForEntity:[[delegate requestedEntities] lastObject] withFormatName:formatName];
+    }
+    
+    XCTAssertEqualObjects([delegate requestedEntities], (@[entities[0], entities[2], entities[3], entities[1]]));
+    
+    [imageCache reset];
+}
+
+#pragma mark - Prefetching
+
+- (void)testPrefetchingMergesNeighboringEntriesAndSkipsMissingOnes {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICPrefetchTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICPrefetchTestsFormat" family:@"FICPrefetchTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:64 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICTestPrefetchRecordingImageTable *imageTable = [[FICTestPrefetchRecordingImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    [imageTable reset];
+    
+    // Entries go in the first free slot, so entry i is in slot i
+    NSUInteger entryCount = 8;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 0, 0, 1, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    [imageTable deleteEntryForEntityUUID:entityUUIDs[6]];
+    
+    // Entries are asked for out of order, along with a deleted entry, one drawn from a different source image, and one that was never stored
+    NSArray *prefetchedEntityUUIDs = @[entityUUIDs[5], entityUUIDs[0], entityUUIDs[2], entityUUIDs[1], entityUUIDs[7], entityUUIDs[6], entityUUIDs[3], [[NSUUID UUID] UUIDString]];
+    NSArray *prefetchedSourceImageUUIDs = @[sourceImageUUIDs[5], sourceImageUUIDs[0], sourceImageUUIDs[2], sourceImageUUIDs[1], sourceImageUUIDs[7], sourceImageUUIDs[6],
+                                            [[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString]];
+    [imageTable prefetchEntriesForEntityUUIDs:prefetchedEntityUUIDs sourceImageUUIDs:prefetchedSourceImageUUIDs];
+    
+    NSArray *expectedRanges = @[[NSValue valueWithRange:NSMakeRange(0, 3)], [NSValue valueWithRange:NSMakeRange(5, 1)], [NSValue valueWithRange:NSMakeRange(7, 1)]];
+    XCTAssertEqualObjects([imageTable prefetchedRanges], expectedRanges);
+    
+    // Nothing is prefetched when no entry matches
+    [[imageTable prefetchedRanges] removeAllObjects];
+    [imageTable prefetchEntriesForEntityUUIDs:@[entityUUIDs[3], entityUUIDs[6]] sourceImageUUIDs:@[[[NSUUID UUID] UUIDString], sourceImageUUIDs[6]]];
+    XCTAssertEqual([[imageTable prefetchedRanges] count], (NSUInteger)0);
+    
+    [imageTable reset];
+}
+
+- (void)testNewerPrefetchListsCancelEarlierBatches {
+    NSString *formatName = @"FICPrefetchGenerationTestsFormat";
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICPrefetchGenerationTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:formatName family:@"FICPrefetchGenerationTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:256 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageCache setFormats:@[imageFormat]];
+    
+    FICTestPrefetchRecordingImageTable *imageTable = [[imageCache valueForKey:@"_imageTables"] objectForKey:formatName];
+    object_setClass(imageTable, [FICTestPrefetchRecordingImageTable class]);
+    [imageTable reset];
+    
+    // Enough entities for several batches
+    NSUInteger entityCount = 100;
+    NSMutableArray *entities = [NSMutableArray arrayWithCapacity:entityCount];
+    for (NSUInteger i = 0; i < entityCount; i++) {
+        FICTestEntity *entity = [[FICTestEntity alloc] init];
+        [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+        [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+        [entities addObject:entity];
+        [imageTable setEntryForEntityUUID:[entity fic_UUID] sourceImageUUID:[entity fic_sourceImageUUID] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 0, 1, 0, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    // The prefetch queue is held up while the lists are made, so none of the first list's batches can start before the second list replaces it
+    dispatch_queue_t prefetchQueue = [FICImageCache _prefetchQueue];
+    dispatch_suspend(prefetchQueue);
+    [imageCache prefetchImagesForEntities:entities withFormatName:formatName];
+    [imageCache prefetchImagesForEntities:@[entities[10], entities[11]] withFormatName:formatName];
+    dispatch_resume(prefetchQueue);
+    dispatch_sync(prefetchQueue, ^{});
+    
+    XCTAssertEqualObjects([imageTable prefetchedRanges], (@[[NSValue valueWithRange:NSMakeRange(10, 2)]]));
+    
+    // An empty list stops prefetching altogether
+    [[imageTable prefetchedRanges] removeAllObjects];
+    dispatch_suspend(prefetchQueue);
+    [imageCache prefetchImagesForEntities:entities withFormatName:formatName];
+    [imageCache prefetchImagesForEntities:@[] withFormatName:formatName];
+    dispatch_resume(prefetchQueue);
+    dispatch_sync(prefetchQueue, ^{});
+    
+    XCTAssertEqual([[imageTable prefetchedRanges] count], (NSUInteger)0);
+    
+    [imageTable reset];
+}
+
+#pragma mark - Source Image Requests
+
+- (void)testSourceImageRequestsAreBoundedAndCoalesced {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICSourceImageRequestTests"];
+    FICTestImageCacheDelegate *delegate = [[FICTestImageCacheDelegate alloc] init];
+    [imageCache setDelegate:delegate];
+    [imageCache setMaximumConcurrentSourceImageRequestCount:2];
+    
+    NSMutableArray *entities = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 4; i++) {
+        FICTestEntity *entity = [[FICTestEntity alloc] init];
+        [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+        [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+        [entities addObject:entity];
+        
+        [imageCache asynchronouslyRetrieveImageForEntity:entity withFormatName:@"FICSourceImageRequestTestsFormat" completionBlock:nil];
+    }
+    
+    // A second entity with the same source image joins the first entity's request
+    FICTestEntity *duplicateEntity = [[FICTestEntity alloc] init];
+    [duplicateEntity setFic_UUID:[[NSUUID UUID] UUIDString]];
+    [duplicateEntity setFic_sourceImageUUID:[entities[0] fic_sourceImageUUID]];
+    [imageCache asynchronouslyRetrieveImageForEntity:duplicateEntity withFormatName:@"FICSourceImageRequestTestsFormat" completionBlock:nil];
+    
+    XCTAssertEqualObjects([delegate requestedEntities], (@[entities[0], entities[1]]));
+    XCTAssertEqual([imageCache coalescedSourceImageRequestCount], (NSUInteger)1);
+    
+    // Canceling a waiting request takes it out of line without bothering the delegate
+    [imageCache cancelImageRetrievalForEntity:entities[2] withFormatName:@"FICSourceImageRequestTestsFormat"];
+    XCTAssertEqual([[delegate canceledEntities] count], (NSUInteger)0);
+    
+    // Canceling an outstanding request frees its slot for the next one in line
+    [imageCache cancelImageRetrievalForEntity:entities[1] withFormatName:@"FICSourceImageRequestTestsFormat"];
+    XCTAssertEqualObjects([delegate canceledEntities], (@[entities[1]]));
+    XCTAssertEqualObjects([delegate requestedEntities], (@[entities[0], entities[1], entities[3]]));
+    XCTAssertEqual([imageCache sourceImageRequestCount], (NSUInteger)3);
+}
+
+- (void)testSourceImageRequestsAreServedByPriority {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICSourceImageRequestTests"];
+    FICTestImageCacheDelegate *delegate = [[FICTestImageCacheDelegate alloc] init];
+    [imageCache setDelegate:delegate];
+    [imageCache setMaximumConcurrentSourceImageRequestCount:1];
+    
+    NSMutableArray *entities = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 4; i++) {
+        FICTestEntity *entity = [[FICTestEntity alloc] init];
+        [entity setFic_UUID:[[NSUUID UUID] UUIDString]];
+        [entity setFic_sourceImageUUID:[[NSUUID UUID] UUIDString]];
+        [entities addObject:entity];
+    }
+    
+    NSString *formatName = @"FICSourceImageRequestTestsFormat";
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[0] withFormatName:formatName priority:FICImageCachePriorityLow deadline:nil completionBlock:nil];
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[1] withFormatName:formatName priority:FICImageCachePriorityLow deadline:nil completionBlock:nil];
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[2] withFormatName:formatName priority:FICImageCachePriorityNormal deadline:nil completionBlock:nil];
+    [imageCache asynchronouslyRetrieveImageForEntity:entities[3] withFormatName:formatName priority:FICImageCachePriorityNormal deadline:[NSDate dateWithTimeIntervalSinceNow:1] completionBlock:nil];
+    
+    // The second speculative request scrolls into view
+    [imageCache setPriority:FICImageCachePriorityHigh forImageRetrievalForEntity:entities[1] withFormatName:formatName];
+    
+    for (NSUInteger i = 0; i < 3; i++) {
+        [imageCache cancelImageRetrievalForEntity:[[delegate requestedEntities] lastObject] withFormatName:formatName];
+    }
+    
+    XCTAssertEqualObjects([delegate requestedEntities], (@[entities[0], entities[1], entities[3], entities[2]]));
+}
+
+#pragma mark - Cold Storage
+
+- (void)testCompressionRoundTrip {
+    // Flat data like transparent corners, followed by noise that doesn't compress at all
+    size_t length = 256 * 1024;
+    uint8_t *bytes = calloc(length, 1);
+    arc4random_buf(bytes + length / 2, length / 2);
+    
+    size_t compressedCapacity = FICCompressionBound(length);
+    uint8_t *compressedBytes = malloc(compressedCapacity);
+    size_t compressedLength = FICCompress(bytes, length, compressedBytes, compressedCapacity);
+    XCTAssertGreaterThan(compressedLength, (size_t)0);
+    XCTAssertLessThan(compressedLength, length * 3 / 4);
+    
+    uint8_t *decompressedBytes = malloc(length);
+    XCTAssertTrue(FICDecompress(compressedBytes, compressedLength, decompressedBytes, length));
+    XCTAssertEqual(memcmp(bytes, decompressedBytes, length), 0);
+    
+    // Damaged data is rejected instead of being decompressed out of bounds
+    XCTAssertFalse(FICDecompress(compressedBytes, compressedLength / 2, decompressedBytes, length));
+    XCTAssertFalse(FICDecompress(compressedBytes, compressedLength, decompressedBytes, length - 1));
+    
+    free(bytes);
+    free(compressedBytes);
+    free(decompressedBytes);
+}
+
+// Fills a table far past its maximum count, then brings back an entry evicted early on. It should come back from cold storage with the image data it was drawn with.
+- (void)testEvictedEntriesAreRestoredFromColdStorage {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICColdStorageTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICColdStorageTestsFormat" family:@"FICColdStorageTests" imageSize:CGSizeMake(128, 128) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:4 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setColdStorageMaximumLength:4 * 1024 * 1024];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    FICEntityImageDrawingBlock imageDrawingBlock = ^(CGContextRef context, CGSize contextSize) {
+        CGContextClearRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        CGContextSetRGBFillColor(context, 1, 0.5, 0, 1);
+        CGContextFillEllipseInRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    };
+    
+    NSUInteger entryCount = 64;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:imageDrawingBlock];
+    }
+    
+    XCTAssertFalse([imageTable entryExistsForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0]]);
+    XCTAssertTrue([imageTable coldEntryExistsForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0]]);
+    XCTAssertFalse([imageTable coldEntryExistsForEntityUUID:entityUUIDs[0] sourceImageUUID:[[NSUUID UUID] UUIDString]]);
+    
+    XCTAssertTrue([imageTable restoreEntryForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0]]);
+    UIImage *restoredImage = [imageTable newImageForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0] preheatData:NO];
+    UIImage *drawnImage = [imageTable newImageForEntityUUID:entityUUIDs[entryCount - 1] sourceImageUUID:sourceImageUUIDs[entryCount - 1] preheatData:NO];
+    XCTAssertNotNil(restoredImage);
+    XCTAssertNotNil(drawnImage);
+    
+    NSData *restoredData = CFBridgingRelease(CGDataProviderCopyData(CGImageGetDataProvider([restoredImage CGImage])));
+    NSData *drawnData = CFBridgingRelease(CGDataProviderCopyData(CGImageGetDataProvider([drawnImage CGImage])));
+    XCTAssertEqualObjects(restoredData, drawnData);
+    
+    [imageTable reset];
+    XCTAssertFalse([imageTable coldEntryExistsForEntityUUID:entityUUIDs[1] sourceImageUUID:sourceImageUUIDs[1]]);
+}
+
+#pragma mark - Pixel Conversion
+
+// Rows of 17 pixels go through both the vectorized loop and the per-pixel tail. Every pixel should composite over white the same way.
+- (void)testPixelConversionCompositesOverWhite {
+    size_t width = 17;
+    uint8_t pixels[17 * 4];
+    for (size_t x = 0; x < width; x++) {
+        // Half-transparent pure red, premultiplied
+        uint8_t pixel[4] = { 0, 0, 128, 128 };
+        memcpy(pixels + x * 4, pixel, sizeof(pixel));
+    }
+    
+    uint8_t convertedPixels[17 * 4];
+    FICPixelConvertBGRAToBGR(pixels, sizeof(pixels), convertedPixels, sizeof(convertedPixels), width, 1);
+    for (size_t x = 0; x < width; x++) {
+        XCTAssertEqual(convertedPixels[x * 4 + 0], 127);
+        XCTAssertEqual(convertedPixels[x * 4 + 1], 127);
+        XCTAssertEqual(convertedPixels[x * 4 + 2], 255);
+        XCTAssertEqual(convertedPixels[x * 4 + 3], 255);
+    }
+    
+    uint16_t convertedPixels555[17];
+    FICPixelConvertBGRAToBGR555(pixels, sizeof(pixels), convertedPixels555, sizeof(convertedPixels555), width, 1);
+    for (size_t x = 0; x < width; x++) {
+        XCTAssertEqual(convertedPixels555[x], (31 << 10) | (15 << 5) | 15);
+    }
+    
+    uint8_t convertedPixelsGrayscale[17];
+    FICPixelConvertBGRAToGrayscale(pixels, sizeof(pixels), convertedPixelsGrayscale, sizeof(convertedPixelsGrayscale), width, 1);
+    for (size_t x = 0; x < width; x++) {
+        XCTAssertEqual(convertedPixelsGrayscale[x], (77 * 255 + 150 * 127 + 29 * 127 + 128) >> 8);
+    }
+}
+
+// Converts the square photos of the demo app, 75x75 points at 2x, with the row lengths the image tables use
+- (void)_measurePixelConversion:(void (*)(const void *, size_t, void *, size_t, size_t, size_t))convert bytesPerPixel:(size_t)bytesPerPixel {
+    size_t width = 150;
+    size_t height = 150;
+    size_t sourceRowLength = FICByteAlignForCoreAnimation(width * 4);
+    size_t destinationRowLength = FICByteAlignForCoreAnimation(width * bytesPerPixel);
+    uint8_t *source = malloc(sourceRowLength * height);
+    uint8_t *destination = malloc(destinationRowLength * height);
+    arc4random_buf(source, sourceRowLength * height);
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 1000; i++) {
+            convert(source, sourceRowLength, destination, destinationRowLength, width, height);
+        }
+    }];
+    
+    free(source);
+    free(destination);
+}
+
+- (void)testPixelConversionPerformanceBGR {
+    [self _measurePixelConversion:FICPixelConvertBGRAToBGR bytesPerPixel:4];
+}
+
+- (void)testPixelConversionPerformanceBGR555 {
+    [self _measurePixelConversion:FICPixelConvertBGRAToBGR555 bytesPerPixel:2];
+}
+
+- (void)testPixelConversionPerformanceGrayscale {
+    [self _measurePixelConversion:FICPixelConvertBGRAToGrayscale bytesPerPixel:1];
+}
+
+#pragma mark - Pixel Scaling
+
+- (void)testDownscalingAveragesCoveredPixels {
+    // Each source row counts up from 0, so each 4x4 block of a 16x4 image averages to its middle
+    uint8_t pixels[4][16];
+    for (size_t y = 0; y < 4; y++) {
+        for (size_t x = 0; x < 16; x++) {
+            pixels[y][x] = (uint8_t)(x * 16 + y * 4);
+        }
+    }
+    
+    uint8_t scaledPixels[4];
+    XCTAssertTrue(FICPixelDownscale(pixels, 16, 16, 4, scaledPixels, 4, 4, 1, 1));
+    for (size_t x = 0; x < 4; x++) {
+        XCTAssertEqual(scaledPixels[x], (uint8_t)((x * 4 + 1.5) * 16 + 1.5 * 4 + 0.5));
+    }
+    
+    // A uniform image stays uniform at any scale
+    uint8_t uniformPixels[9 * 9 * 4];
+    memset(uniformPixels, 200, sizeof(uniformPixels));
+    uint8_t scaledUniformPixels[4 * 4 * 4];
+    XCTAssertTrue(FICPixelDownscale(uniformPixels, 9 * 4, 9, 9, scaledUniformPixels, 4 * 4, 4, 4, 4));
+    for (size_t i = 0; i < sizeof(scaledUniformPixels); i++) {
+        XCTAssertEqual(scaledUniformPixels[i], 200);
+    }
+    
+    XCTAssertFalse(FICPixelDownscale(pixels, 16, 16, 4, scaledPixels, 4, 4, 8, 1));
+}
+
+// A thumbnail format that misses should be filled from the full-size entry of the same family, without its drawing block
+- (void)testMissingEntriesAreDownscaledFromLargerFormats {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICPixelScalingTests"];
+    FICImageFormat *largeImageFormat = [FICImageFormat formatWithName:@"FICPixelScalingTestsLargeFormat" family:@"FICPixelScalingTests" imageSize:CGSizeMake(300, 300) style:FICImageFormatStyle32BitBGRA
+                                                         maximumCount:4 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageFormat *smallImageFormat = [FICImageFormat formatWithName:@"FICPixelScalingTestsSmallFormat" family:@"FICPixelScalingTests" imageSize:CGSizeMake(75, 75) style:FICImageFormatStyle32BitBGRA
+                                                         maximumCount:4 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [smallImageFormat setDownscalesFromFamily:YES];
+    FICImageTable *largeImageTable = [[FICImageTable alloc] initWithFormat:largeImageFormat imageCache:imageCache];
+    FICImageTable *smallImageTable = [[FICImageTable alloc] initWithFormat:smallImageFormat imageCache:imageCache];
+    XCTAssertTrue([smallImageTable canScaleEntriesFromImageTable:largeImageTable]);
+    XCTAssertFalse([largeImageTable canScaleEntriesFromImageTable:smallImageTable]);
+    
+    FICEntityImageDrawingBlock imageDrawingBlock = ^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 0, 0.5, 1, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    };
+    
+    NSString *entityUUID = [[NSUUID UUID] UUIDString];
+    NSString *sourceImageUUID = [[NSUUID UUID] UUIDString];
+    XCTAssertFalse([smallImageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID scalingEntryFromImageTable:largeImageTable]);
+    
+    [largeImageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:imageDrawingBlock];
+    XCTAssertTrue([smallImageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID scalingEntryFromImageTable:largeImageTable]);
+    UIImage *scaledImage = [smallImageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:NO];
+    
+    NSString *drawnEntityUUID = [[NSUUID UUID] UUIDString];
+    [smallImageTable setEntryForEntityUUID:drawnEntityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:imageDrawingBlock];
+    UIImage *drawnImage = [smallImageTable newImageForEntityUUID:drawnEntityUUID sourceImageUUID:sourceImageUUID preheatData:NO];
+    XCTAssertNotNil(scaledImage);
+    XCTAssertNotNil(drawnImage);
+    
+    NSData *scaledData = CFBridgingRelease(CGDataProviderCopyData(CGImageGetDataProvider([scaledImage CGImage])));
+    NSData *drawnData = CFBridgingRelease(CGDataProviderCopyData(CGImageGetDataProvider([drawnImage CGImage])));
+    XCTAssertEqualObjects(scaledData, drawnData);
+    
+    [largeImageTable reset];
+    [smallImageTable reset];
+}
+
+// Downscales a 300x300 point full-size photo at 2x to the demo app's 75x75 point thumbnails
+- (void)testDownscalingPerformance {
+    size_t sourceWidth = 600;
+    size_t destinationWidth = 150;
+    size_t sourceRowLength = FICByteAlignForCoreAnimation(sourceWidth * 4);
+    size_t destinationRowLength = FICByteAlignForCoreAnimation(destinationWidth * 4);
+    uint8_t *source = malloc(sourceRowLength * sourceWidth);
+    uint8_t *destination = malloc(destinationRowLength * destinationWidth);
+    arc4random_buf(source, sourceRowLength * sourceWidth);
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100; i++) {
+            FICPixelDownscale(source, sourceRowLength, sourceWidth, sourceWidth, destination, destinationRowLength, destinationWidth, destinationWidth, 4);
+        }
+    }];
+    
+    free(source);
+    free(destination);
+}
+
+#pragma mark - Checksums
+
+- (void)testChecksumMatchesKnownValues {
+    XCTAssertEqual(FICChecksumCRC32C(0, "123456789", 9), 0xe3069283u);
+    XCTAssertEqual(FICChecksumCRC32C(0, "", 0), 0u);
+    
+    // Checksumming data in pieces gives the same result as checksumming it all at once, however it's split up
+    uint8_t bytes[1031];
+    for (NSUInteger i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 31 + 7);
+    }
+    uint32_t checksum = FICChecksumCRC32C(0, bytes, sizeof(bytes));
+    for (size_t split = 0; split < 17; split++) {
+        XCTAssertEqual(FICChecksumCRC32C(FICChecksumCRC32C(0, bytes, split), bytes + split, sizeof(bytes) - split), checksum);
+    }
+}
+
+- (void)testScrubbingDiscardsDamagedEntries {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICChecksumTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICChecksumTestsFormat" family:@"FICChecksumTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:100 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    NSArray *entityUUIDs = @[[[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString]];
+    NSArray *sourceImageUUIDs = @[[[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString]];
+    for (NSUInteger i = 0; i < [entityUUIDs count]; i++) {
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 0, 0.5, 1, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    // Intact entries pass, and a scrub stops at the end of the image table
+    size_t scrubbedLength = [imageTable scrubEntriesUpToLength:SIZE_MAX];
+    XCTAssertGreaterThan(scrubbedLength, (size_t)0);
+    XCTAssertEqual([imageTable scrubEntriesUpToLength:SIZE_MAX], scrubbedLength);
+    XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0]]);
+    
+    // The first entry is stored at the start of the table file. Damage one of its pixels behind the image table's back.
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForUpdatingAtPath:[imageTable tableFilePath]];
+    [fileHandle seekToFileOffset:100];
+    [fileHandle writeData:[NSData dataWithBytes:"\x5a" length:1]];
+    [fileHandle synchronizeFile];
+    [fileHandle closeFile];
+    
+    [imageTable scrubEntriesUpToLength:SIZE_MAX];
+    XCTAssertFalse([imageTable entryExistsForEntityUUID:entityUUIDs[0] sourceImageUUID:sourceImageUUIDs[0]]);
+    XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUIDs[1] sourceImageUUID:sourceImageUUIDs[1]]);
+    
+    [imageTable reset];
+}
+
+#pragma mark - Opening Image Tables
+
+// Fills the structures an image table keeps its metadata in with entries in slots 0 through entryCount - 1, from least to most recently used
+static void FICTestsFillMetadata(FICEntryIndex *index, FICSlotAllocator *allocator, FICEvictionPolicy *policy, uint32_t entryCount, NSMutableData *entityUUIDBytesData) {
+    for (uint32_t slot = 0; slot < entryCount; slot++) {
+        CFUUIDBytes entityUUIDBytes = FICUUIDBytesWithString([[NSUUID UUID] UUIDString]);
+        FICEntryIndexSet(index, (const uint8_t *)&entityUUIDBytes, (const uint8_t *)&entityUUIDBytes, slot);
+        FICSlotAllocatorMarkOccupied(allocator, slot);
+        FICEvictionPolicyTouch(policy, slot, (const uint8_t *)&entityUUIDBytes);
+        [entityUUIDBytesData appendBytes:&entityUUIDBytes length:sizeof(entityUUIDBytes)];
+    }
+}
+
+- (void)testMetadataSnapshotRoundTrip {
+    FICEntryIndex index;
+    FICSlotAllocator allocator;
+    FICEvictionPolicy policy;
+    FICEntryIndexInit(&index);
+    FICSlotAllocatorInit(&allocator);
+    FICEvictionPolicyInit(&policy);
+    
+    uint32_t entryCount = 1000;
+    NSMutableData *entityUUIDBytesData = [NSMutableData data];
+    FICTestsFillMetadata(&index, &allocator, &policy, entryCount, entityUUIDBytesData);
+    FICRecencyListPin(&policy.list, 10);
+    
+    uint32_t uncommittedSlot = 20;
+    NSMutableData *snapshotData = [NSMutableData dataWithLength:FICMetadataSnapshotLength(&index, &allocator, &policy, 1)];
+    FICMetadataSnapshotWrite([snapshotData mutableBytes], &index, &allocator, &policy, &uncommittedSlot, 1);
+    
+    FICEntryIndex adoptedIndex;
+    FICSlotAllocator adoptedAllocator;
+    FICEvictionPolicy adoptedPolicy;
+    FICEntryIndexInit(&adoptedIndex);
+    FICSlotAllocatorInit(&adoptedAllocator);
+    FICEvictionPolicyInit(&adoptedPolicy);
+    
+    const uint32_t *uncommittedSlots = NULL;
+    size_t uncommittedSlotCount = 0;
+    XCTAssertTrue(FICMetadataSnapshotAdopt([snapshotData mutableBytes], [snapshotData length], &adoptedIndex, &adoptedAllocator, &adoptedPolicy, &uncommittedSlots, &uncommittedSlotCount));
+    XCTAssertEqual(uncommittedSlotCount, (size_t)1);
+    XCTAssertEqual(uncommittedSlots[0], uncommittedSlot);
+    
+    const CFUUIDBytes *entityUUIDBytes = [entityUUIDBytesData bytes];
+    for (uint32_t slot = 0; slot < entryCount; slot++) {
+        const FICEntryIndexEntry *entry = FICEntryIndexFind(&adoptedIndex, (const uint8_t *)&entityUUIDBytes[slot]);
+        XCTAssertTrue(entry != NULL && entry->slot == slot);
+        XCTAssertTrue(FICSlotAllocatorIsOccupied(&adoptedAllocator, slot));
+    }
+    
+    // The pinned slot was saved as the most recently used one, so the least recently used slot is unchanged
+    uint32_t slots[2];
+    XCTAssertEqual(FICRecencyListGetSlots(&adoptedPolicy.list, slots, 2), (size_t)2);
+    XCTAssertEqual(slots[0], (uint32_t)10);
+    XCTAssertEqual(FICRecencyListLeastRecentSlot(&adoptedPolicy.list), (uint32_t)0);
+    
+    // Growing past the snapshot copies it, and the copy keeps every entry
+    CFUUIDBytes newEntityUUIDBytes = FICUUIDBytesWithString([[NSUUID UUID] UUIDString]);
+    XCTAssertTrue(FICEntryIndexSet(&adoptedIndex, (const uint8_t *)&newEntityUUIDBytes, (const uint8_t *)&newEntityUUIDBytes, entryCount * 4));
+    XCTAssertFalse(adoptedIndex.borrowsStorage);
+    XCTAssertTrue(FICEntryIndexFind(&adoptedIndex, (const uint8_t *)&entityUUIDBytes[entryCount - 1]) != NULL);
+    
+    // A damaged header is rejected rather than trusted
+    ((uint8_t *)[snapshotData mutableBytes])[8] ^= 1;
+    FICEntryIndex rejectedIndex;
+    FICEntryIndexInit(&rejectedIndex);
+    XCTAssertFalse(FICMetadataSnapshotAdopt([snapshotData mutableBytes], [snapshotData length], &rejectedIndex, &adoptedAllocator, &adoptedPolicy, &uncommittedSlots, &uncommittedSlotCount));
+    
+    FICEntryIndexDestroy(&index);
+    FICSlotAllocatorDestroy(&allocator);
+    FICEvictionPolicyDestroy(&policy);
+    FICEntryIndexDestroy(&adoptedIndex);
+    FICSlotAllocatorDestroy(&adoptedAllocator);
+    FICEvictionPolicyDestroy(&adoptedPolicy);
+}
+
+// Simulates launching the app with a full image table on disk. The time to open it should stay flat as the number of entries grows.
+- (void)_measureImageTableOpeningWithEntryCount:(uint32_t)entryCount {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICStartupTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICStartupTestsFormat" family:@"FICStartupTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:entryCount devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    // Let the new table write its empty journal before it's replaced
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    FICEntryIndex index;
+    FICSlotAllocator allocator;
+    FICEvictionPolicy policy;
+    FICEntryIndexInit(&index);
+    FICSlotAllocatorInit(&allocator);
+    FICEvictionPolicyInit(&policy);
+    FICTestsFillMetadata(&index, &allocator, &policy, entryCount, [NSMutableData data]);
+    
+    NSMutableData *snapshotData = [NSMutableData dataWithLength:FICMetadataSnapshotLength(&index, &allocator, &policy, 0)];
+    FICMetadataSnapshotWrite([snapshotData mutableBytes], &index, &allocator, &policy, NULL, 0);
+    NSData *formatData = [NSJSONSerialization dataWithJSONObject:[imageFormat dictionaryRepresentation] options:kNilOptions error:NULL];
+    
+    FICMetadataJournal journal;
+    FICMetadataJournalInit(&journal, [[imageTable metadataFilePath] fileSystemRepresentation]);
+    XCTAssertTrue(FICMetadataJournalWriteCheckpoint(&journal, [formatData bytes], [formatData length], [snapshotData bytes], [snapshotData length]));
+    FICMetadataJournalDestroy(&journal);
+    
+    // A 16x16 entry fits in a single page. The table file is sparse, so it takes no space on disk.
+    XCTAssertEqual(truncate([[imageTable tableFilePath] fileSystemRepresentation], (off_t)entryCount * [FICImageTable pageSize]), 0);
+    
+    [self measureBlock:^{
+        @autoreleasepool {
+            FICImageTable *openedImageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+            XCTAssertNotNil(openedImageTable);
+        }
+    }];
+    
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    FICEntryIndexDestroy(&index);
+    FICSlotAllocatorDestroy(&allocator);
+    FICEvictionPolicyDestroy(&policy);
+    
+    [imageTable reset];
+}
+
+- (void)testImageTableOpeningPerformance1K {
+    [self _measureImageTableOpeningWithEntryCount:1000];
+}
+
+- (void)testImageTableOpeningPerformance10K {
+    [self _measureImageTableOpeningWithEntryCount:10000];
+}
+
+- (void)testImageTableOpeningPerformance100K {
+    [self _measureImageTableOpeningWithEntryCount:100000];
+}
+
+// Simulates upgrading from a version that stored metadata as JSON or a .plist. The entries it lists should be found on the first launch, and the metadata should be replaced with a journal.
+- (void)_testLegacyMetadataMigrationWithPropertyList:(BOOL)propertyList {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICLegacyMetadataTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICLegacyMetadataTestsFormat" family:@"FICLegacyMetadataTests" imageSize:CGSizeMake(16, 16) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    [imageFormat setDurability:FICImageFormatDurabilitySynchronous];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    
+    // A new table stores its first entries in slots 0 and 1
+    NSArray *entityUUIDs = @[[[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString]];
+    NSArray *sourceImageUUIDs = @[[[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString]];
+    for (NSUInteger i = 0; i < [entityUUIDs count]; i++) {
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, 0, 0, 1, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    NSDictionary *metadataDictionary = @{
+        @"format": [imageFormat dictionaryRepresentation],
+        @"indexMap": @{ entityUUIDs[0]: @0, entityUUIDs[1]: @1 },
+        @"contextMap": @{ entityUUIDs[0]: sourceImageUUIDs[0], entityUUIDs[1]: sourceImageUUIDs[1] },
+        @"mruArray": @[entityUUIDs[1], entityUUIDs[0]],
+    };
+    NSData *metadataData = nil;
+    if (propertyList) {
+        metadataData = [NSPropertyListSerialization dataWithPropertyList:metadataDictionary format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+    } else {
+        metadataData = [NSJSONSerialization dataWithJSONObject:metadataDictionary options:kNilOptions error:NULL];
+    }
+    XCTAssertTrue([metadataData writeToFile:[imageTable metadataFilePath] atomically:YES]);
+    
+    FICImageTable *migratedImageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    for (NSUInteger i = 0; i < [entityUUIDs count]; i++) {
+        XCTAssertTrue([migratedImageTable entryExistsForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i]]);
+    }
+    
+    dispatch_sync([FICImageTable _metadataQueue], ^{});
+    
+    NSData *migratedMetadataData = [NSData dataWithContentsOfFile:[imageTable metadataFilePath]];
+    XCTAssertTrue(FICMetadataJournalIsJournalData([migratedMetadataData bytes], [migratedMetadataData length]));
+    
+    [imageTable reset];
+}
+
+- (void)testLegacyJSONMetadataIsMigrated {
+    [self _testLegacyMetadataMigrationWithPropertyList:NO];
+}
+
+- (void)testLegacyPropertyListMetadataIsMigrated {
+    [self _testLegacyMetadataMigrationWithPropertyList:YES];
+}
+
+#pragma mark - Compaction
+
+- (void)testCompactionMovesEntriesAndShrinksTableFile {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICCompactionTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICCompactionTestsFormat" family:@"FICCompactionTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:1000 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    
+    // Enough entries to fill several chunks of the table file, only the last few of which are kept
+    NSUInteger entryCount = 400;
+    NSUInteger keptEntryCount = 5;
+    NSMutableArray *entityUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    NSMutableArray *sourceImageUUIDs = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [entityUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [sourceImageUUIDs addObject:[[NSUUID UUID] UUIDString]];
+        [imageTable setEntryForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] imageDrawingBlock:^(CGContextRef context, CGSize contextSize) {
+            CGContextSetRGBFillColor(context, (CGFloat)i / entryCount, 0.5, 1, 1);
+            CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+        }];
+    }
+    
+    for (NSUInteger i = 0; i < entryCount - keptEntryCount; i++) {
+        [imageTable deleteEntryForEntityUUID:entityUUIDs[i]];
+    }
+    
+    unsigned long long fileLength = [[fileManager attributesOfItemAtPath:[imageTable tableFilePath] error:NULL] fileSize];
+    XCTAssertGreaterThan([imageTable compactableLength], 0ULL);
+    
+    // The last entry backs a live image, so nothing can be moved past it
+    @autoreleasepool {
+        UIImage *image = [imageTable newImageForEntityUUID:entityUUIDs[entryCount - 1] sourceImageUUID:sourceImageUUIDs[entryCount - 1] preheatData:NO];
+        XCTAssertNotNil(image);
+        [imageTable compactEntriesUpToLength:SIZE_MAX];
+        XCTAssertEqual([imageTable compactedEntryCount], (NSUInteger)0);
+        XCTAssertEqual([imageTable truncatedLength], 0ULL);
+    }
+    
+    [imageTable compactEntriesUpToLength:SIZE_MAX];
+    XCTAssertEqual([imageTable compactedEntryCount], keptEntryCount);
+    XCTAssertEqual([imageTable compactableLength], 0ULL);
+    
+    unsigned long long compactedFileLength = [[fileManager attributesOfItemAtPath:[imageTable tableFilePath] error:NULL] fileSize];
+    XCTAssertLessThan(compactedFileLength, fileLength);
+    XCTAssertEqual([imageTable truncatedLength], fileLength - compactedFileLength);
+    
+    // Moved entries keep their image data and checksums, so they survive a scrub
+    [imageTable scrubEntriesUpToLength:SIZE_MAX];
+    for (NSUInteger i = entryCount - keptEntryCount; i < entryCount; i++) {
+        XCTAssertTrue([imageTable entryExistsForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i]]);
+        XCTAssertNotNil([imageTable newImageForEntityUUID:entityUUIDs[i] sourceImageUUID:sourceImageUUIDs[i] preheatData:NO]);
+    }
+    
+    // Nothing is left to do once the table is compact
+    XCTAssertEqual([imageTable compactEntriesUpToLength:SIZE_MAX], (size_t)0);
+    
+    [imageTable reset];
+}
+
+#pragma mark - Eviction Policies
+
+// Replays a trace of entity keys against a table of `capacity` entries, the way an image table would, and returns the fraction of accesses that were hits
+static double FICTestsHitRatio(FICEvictionPolicyKind kind, const uint32_t *keys, NSUInteger keyCount, uint32_t capacity) {
+    FICEvictionPolicy policy;
+    FICEntryIndex index;
+    FICEvictionPolicyInit(&policy);
+    FICEntryIndexInit(&index);
+    FICEvictionPolicyConfigure(&policy, kind, capacity);
+    
+    uint32_t usedCount = 0;
+    NSUInteger hitCount = 0;
+    for (NSUInteger i = 0; i < keyCount; i++) {
+        uint8_t entityUUIDBytes[16] = {0};
+        memcpy(entityUUIDBytes, &keys[i], sizeof(uint32_t));
+        
+        const FICEntryIndexEntry *entry = FICEntryIndexFind(&index, entityUUIDBytes);
+        if (entry != NULL) {
+            hitCount++;
+            FICEvictionPolicyTouch(&policy, entry->slot, entityUUIDBytes);
+            continue;
+        }
+        
+        uint32_t slot = usedCount < capacity ? usedCount++ : FICEvictionPolicyChooseVictim(&policy, &index);
+        const FICEntryIndexEntry *evictedEntry = FICEntryIndexFindSlot(&index, slot);
+        if (evictedEntry != NULL) {
+            uint8_t evictedEntityUUIDBytes[16];
+            memcpy(evictedEntityUUIDBytes, evictedEntry->entityUUIDBytes, sizeof(evictedEntityUUIDBytes));
+            FICEntryIndexRemove(&index, evictedEntityUUIDBytes);
+            FICEvictionPolicyRemove(&policy, slot);
+        }
+        
+        FICEntryIndexSet(&index, entityUUIDBytes, entityUUIDBytes, slot);
+        FICEvictionPolicyTouch(&policy, slot, entityUUIDBytes);
+    }
+    
+    FICEvictionPolicyDestroy(&policy);
+    FICEntryIndexDestroy(&index);
+    
+    return (double)hitCount / keyCount;
+}
+
+// Keys drawn from a Zipfian distribution, so a few entities are used far more often than the rest, like the avatars of frequent contacts
+static NSMutableData * FICTestsZipfianKeys(NSUInteger keyCount, uint32_t distinctKeyCount, double exponent) {
+    NSMutableData *cumulativeWeightData = [NSMutableData dataWithLength:distinctKeyCount * sizeof(double)];
+    double *cumulativeWeights = [cumulativeWeightData mutableBytes];
+    double totalWeight = 0;
+    for (uint32_t key = 0; key < distinctKeyCount; key++) {
+        totalWeight += 1 / pow(key + 1, exponent);
+        cumulativeWeights[key] = totalWeight;
+    }
+    
+    // A fixed seed keeps the trace, and so the hit ratios, the same on every run
+    unsigned short seed[3] = {1, 2, 3};
+    NSMutableData *keyData = [NSMutableData dataWithLength:keyCount * sizeof(uint32_t)];
+    uint32_t *keys = [keyData mutableBytes];
+    for (NSUInteger i = 0; i < keyCount; i++) {
+        double weight = erand48(seed) * totalWeight;
+        uint32_t low = 0, high = distinctKeyCount - 1;
+        while (low < high) {
+            uint32_t middle = (low + high) / 2;
+            if (cumulativeWeights[middle] < weight) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        keys[i] = low;
+    }
+    
+    return keyData;
+}
+
+- (void)testTinyLFUHitRatioComparedToLRU {
+    NSUInteger keyCount = 200000;
+    uint32_t capacity = 500;
+    NSMutableData *zipfianKeyData = FICTestsZipfianKeys(keyCount, 10000, 0.9);
+    
+    // Every fourth stretch of the trace scrolls through entities that are never seen again, like a long feed
+    NSMutableData *scanKeyData = [zipfianKeyData mutableCopy];
+    uint32_t *scanKeys = [scanKeyData mutableBytes];
+    uint32_t nextScanKey = 1000000;
+    for (NSUInteger i = 0; i < keyCount; i++) {
+        if ((i / 1000) % 4 == 3) {
+            scanKeys[i] = nextScanKey++;
+        }
+    }
+    
+    double zipfianLRU = FICTestsHitRatio(FICEvictionPolicyKindLRU, [zipfianKeyData bytes], keyCount, capacity);
+    double zipfianTinyLFU = FICTestsHitRatio(FICEvictionPolicyKindTinyLFU, [zipfianKeyData bytes], keyCount, capacity);
+    double scanLRU = FICTestsHitRatio(FICEvictionPolicyKindLRU, scanKeys, keyCount, capacity);
+    double scanTinyLFU = FICTestsHitRatio(FICEvictionPolicyKindTinyLFU, scanKeys, keyCount, capacity);
+    NSLog(@"Hit ratios, Zipfian: LRU %.3f, TinyLFU %.3f; with scans: LRU %.3f, TinyLFU %.3f", zipfianLRU, zipfianTinyLFU, scanLRU, scanTinyLFU);
+    
+    XCTAssertGreaterThan(zipfianTinyLFU, zipfianLRU);
+    XCTAssertGreaterThan(scanTinyLFU, scanLRU);
+}
+
+#pragma mark - Disk Budgets
+
+- (void)testDiskBudgetEvictsCheapestEntriesAcrossImageTables {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICDiskBudgetTests"];
+    FICImageFormat *cheapImageFormat = [FICImageFormat formatWithName:@"FICDiskBudgetTestsCheapFormat" family:@"FICDiskBudgetTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                         maximumCount:1000 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageFormat *costlyImageFormat = [cheapImageFormat copy];
+    [costlyImageFormat setName:@"FICDiskBudgetTestsCostlyFormat"];
+    [costlyImageFormat setRecreationCost:4];
+    FICImageTable *cheapImageTable = [[FICImageTable alloc] initWithFormat:cheapImageFormat imageCache:imageCache];
+    FICImageTable *costlyImageTable = [[FICImageTable alloc] initWithFormat:costlyImageFormat imageCache:imageCache];
+    [cheapImageTable reset];
+    [costlyImageTable reset];
+    
+    FICImageTableDiskBudget *diskBudget = [[FICImageTableDiskBudget alloc] init];
+    [cheapImageTable setDiskBudget:diskBudget];
+    [costlyImageTable setDiskBudget:diskBudget];
+    
+    FICEntityImageDrawingBlock drawingBlock = ^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 1, 0.5, 0, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    };
+    
+    [cheapImageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    size_t entryLength = [cheapImageTable usedLength];
+    [diskBudget setMaximumLength:10 * entryLength];
+    
+    // Both formats have entries of the same length, so the cheap format's entries go first, even the ones that were just stored
+    for (NSUInteger i = 0; i < 10; i++) {
+        [costlyImageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    }
+    for (NSUInteger i = 0; i < 2; i++) {
+        [cheapImageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    }
+    XCTAssertEqual([costlyImageTable usedLength], 10 * entryLength);
+    XCTAssertEqual([cheapImageTable usedLength], (size_t)0);
+    XCTAssertEqual([diskBudget evictedEntryCount], (NSUInteger)3);
+    
+    // Costly entries that are never accessed again lose out to cheap entries that keep being stored
+    NSString *lastEntityUUID = nil;
+    NSString *lastSourceImageUUID = nil;
+    for (NSUInteger i = 0; i < 20; i++) {
+        lastEntityUUID = [[NSUUID UUID] UUIDString];
+        lastSourceImageUUID = [[NSUUID UUID] UUIDString];
+        [cheapImageTable setEntryForEntityUUID:lastEntityUUID sourceImageUUID:lastSourceImageUUID imageDrawingBlock:drawingBlock];
+        XCTAssertLessThanOrEqual([diskBudget length], [diskBudget maximumLength]);
+    }
+    XCTAssertGreaterThan([cheapImageTable usedLength], (size_t)0);
+    XCTAssertLessThan([costlyImageTable usedLength], 10 * entryLength);
+    XCTAssertTrue([cheapImageTable entryExistsForEntityUUID:lastEntityUUID sourceImageUUID:lastSourceImageUUID]);
+    
+    [cheapImageTable reset];
+    [costlyImageTable reset];
+}
+
+#pragma mark - Image Table Statistics
+
+- (void)testImageTableStatisticsCountHitsMissesAndWrites {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICStatisticsTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICStatisticsTestsFormat" family:@"FICStatisticsTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:2 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    [imageTable reset];
+    
+    FICEntityImageDrawingBlock drawingBlock = ^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 0, 0.5, 1, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    };
+    
+    NSString *entityUUID = [[NSUUID UUID] UUIDString];
+    NSString *sourceImageUUID = [[NSUUID UUID] UUIDString];
+    [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID imageDrawingBlock:drawingBlock];
+    XCTAssertNotNil([imageTable newImageForEntityUUID:entityUUID sourceImageUUID:sourceImageUUID preheatData:NO]);
+    XCTAssertNil([imageTable newImageForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:sourceImageUUID preheatData:NO]);
+    
+    // The table rounds its maximum count up to whole chunks of about 2 MB, so storing 4 MB of entries is sure to evict some
+    NSUInteger entryCount = 4 * 1024 * 1024 / (64 * 64 * 4);
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        [imageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    }
+    
+    FICImageTableStatistics statistics = [imageTable statistics];
+    XCTAssertEqual(statistics.hitCount, (NSUInteger)1);
+    XCTAssertEqual(statistics.missCount, (NSUInteger)1);
+    XCTAssertEqual(statistics.storedEntryCount, entryCount + 1);
+    XCTAssertGreaterThan(statistics.evictedEntryCount, (NSUInteger)0);
+    XCTAssertGreaterThan(statistics.chunkMappingCount, (NSUInteger)0);
+    XCTAssertGreaterThanOrEqual(statistics.writtenLength, (unsigned long long)(entryCount + 1) * 64 * 64 * 4);
+    XCTAssertGreaterThan(statistics.lockCount, (NSUInteger)0);
+    XCTAssertEqual(statistics.flushDurations.count, (uint64_t)(entryCount + 1));
+    XCTAssertLessThanOrEqual(FICStatisticsHistogramPercentile(&statistics.flushDurations, 0.5), statistics.flushDurations.maximumNanoseconds);
+    
+    [imageTable reset];
+}
+
+#pragma mark - Tracing
+
+- (void)testTraceExportsSpansAsChromeTraceEvents {
+    FICImageCache *imageCache = [[FICImageCache alloc] initWithNameSpace:@"FICTraceTests"];
+    FICImageFormat *imageFormat = [FICImageFormat formatWithName:@"FICTraceTestsFormat" family:@"FICTraceTests" imageSize:CGSizeMake(64, 64) style:FICImageFormatStyle32BitBGRA
+                                                    maximumCount:10 devices:FICImageFormatDevicePhone | FICImageFormatDevicePad protectionMode:FICImageFormatProtectionModeNone];
+    FICImageTable *imageTable = [[FICImageTable alloc] initWithFormat:imageFormat imageCache:imageCache];
+    [imageTable reset];
+    
+    FICImageCacheTrace *trace = [[FICImageCacheTrace alloc] initWithMaximumSpanCount:4];
+    [imageTable setTrace:trace];
+    
+    NSString *entityUUID = [[NSUUID UUID] UUIDString];
+    FICEntityImageDrawingBlock drawingBlock = ^(CGContextRef context, CGSize contextSize) {
+        CGContextSetRGBFillColor(context, 1, 1, 0, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, contextSize.width, contextSize.height));
+    };
+    
+    // Nothing is recorded until the trace is enabled
+    [imageTable setEntryForEntityUUID:[[NSUUID UUID] UUIDString] sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    [trace setEnabled:YES];
+    uint64_t startTime = [trace spanStartTime];
+    XCTAssertGreaterThan(startTime, (uint64_t)0);
+    [trace recordSpanForStage:FICTraceStageDraw startTime:startTime entityUUID:entityUUID formatName:[imageFormat name]];
+    [imageTable setEntryForEntityUUID:entityUUID sourceImageUUID:[[NSUUID UUID] UUIDString] imageDrawingBlock:drawingBlock];
+    [trace setEnabled:NO];
+    [trace recordSpanForStage:FICTraceStageLookup startTime:startTime entityUUID:entityUUID formatName:[imageFormat name]];
+    
+    NSDictionary *document = [NSJSONSerialization JSONObjectWithData:[trace chromeTraceData] options:0 error:NULL];
+    NSArray *events = [document objectForKey:@"traceEvents"];
+    XCTAssertEqual([events count], (NSUInteger)2);
+    XCTAssertEqualObjects([[events firstObject] objectForKey:@"name"], @"draw");
+    XCTAssertEqualObjects([[events lastObject] objectForKey:@"name"], @"flush");
+    for (NSDictionary *event in events) {
+        XCTAssertEqualObjects([event objectForKey:@"ph"], @"X");
+        XCTAssertEqualObjects([[event objectForKey:@"args"] objectForKey:@"entity"], entityUUID);
+        XCTAssertEqualObjects([[event objectForKey:@"args"] objectForKey:@"format"], [imageFormat name]);
+    }
+    
+    // Only the most recent spans are kept
+    [trace setEnabled:YES];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [trace recordSpanForStage:FICTraceStageCompletion startTime:[trace spanStartTime] entityUUID:nil formatName:nil];
+    }
+    document = [NSJSONSerialization JSONObjectWithData:[trace chromeTraceData] options:0 error:NULL];
+    XCTAssertEqual([[document objectForKey:@"traceEvents"] count], [trace maximumSpanCount]);
+    
+    [imageTable reset];
+}
+
 @end
+
+
+